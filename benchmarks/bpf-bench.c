@@ -0,0 +1,408 @@
+/* Benchmark of the libbpf packet filter over recorded traffic
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
+
+/* Run a few representative filters over every frame of a pcap file,
+   once with the switch-based interpreter libbpf used to have and once
+   with the compiled form of libbpf/bpf_prog.c, check that both give
+   the same verdicts and report the time spent per packet.
+
+   This needs nothing from the Hurd but GNU Mach's <device/bpf.h>, so
+   it also runs on GNU/Linux:
+
+     gcc -O2 -I../libbpf -I$GNUMACH/include -o bpf-bench \
+	 bpf-bench.c ../libbpf/bpf_prog.c
+     ./bpf-bench capture.pcap [ROUNDS]  */
+
+#include <error.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bpf_prog.h"
+
+/* What GNU Mach hands to filters: the frame is split after the
+   Ethernet header, and loads may reach up to NET_RCV_MAX bytes.  */
+#define ETHER_HLEN	14
+#define BUFLEN		4095
+
+struct filter
+{
+  const char *name;
+  struct bpf_insn *insns;
+  int len;
+};
+
+/* The filter installed by pfinet and lwip.  */
+static struct bpf_insn ether_insns[] =
+{
+  {0, 0, 0, 0},
+  {BPF_LD|BPF_H|BPF_ABS, 0, 0, 12},
+  {BPF_JMP|BPF_JEQ|BPF_K, 2, 0, 0x0806},
+  {BPF_JMP|BPF_JEQ|BPF_K, 1, 0, 0x0800},
+  {BPF_JMP|BPF_JEQ|BPF_K, 0, 1, 0x86DD},
+  {BPF_RET|BPF_K, 0, 0, 1500},
+  {BPF_RET|BPF_K, 0, 0, 0},
+};
+
+/* tcp dst port 22, as generated by tcpdump.  */
+static struct bpf_insn ssh_insns[] =
+{
+  {0, 0, 0, 0},
+  {BPF_LD|BPF_H|BPF_ABS, 0, 0, 12},
+  {BPF_JMP|BPF_JEQ|BPF_K, 0, 8, 0x0800},
+  {BPF_LD|BPF_B|BPF_ABS, 0, 0, 23},
+  {BPF_JMP|BPF_JEQ|BPF_K, 0, 6, 6},
+  {BPF_LD|BPF_H|BPF_ABS, 0, 0, 20},
+  {BPF_JMP|BPF_JSET|BPF_K, 4, 0, 0x1fff},
+  {BPF_LDX|BPF_MSH|BPF_B, 0, 0, 14},
+  {BPF_LD|BPF_H|BPF_IND, 0, 0, 16},
+  {BPF_JMP|BPF_JEQ|BPF_K, 0, 1, 22},
+  {BPF_RET|BPF_K, 0, 0, 1500},
+  {BPF_RET|BPF_K, 0, 0, 0},
+};
+
+/* UDP sessions hashed on their destination port.  */
+static struct bpf_insn udp_match_insns[] =
+{
+  {0, 0, 0, 0},
+  {BPF_LD|BPF_H|BPF_ABS, 0, 0, 12},
+  {BPF_JMP|BPF_JEQ|BPF_K, 0, 7, 0x0800},
+  {BPF_LD|BPF_B|BPF_ABS, 0, 0, 23},
+  {BPF_JMP|BPF_JEQ|BPF_K, 0, 5, 17},
+  {BPF_LDX|BPF_MSH|BPF_B, 0, 0, 14},
+  {BPF_LD|BPF_H|BPF_IND, 0, 0, 16},
+  {BPF_ST, 0, 0, 0},
+  {BPF_RET|BPF_MATCH_IMM, 1, 0, 1500},
+  {BPF_MISC|BPF_KEY, 0, 0, 0},
+  {BPF_RET|BPF_K, 0, 0, 0},
+};
+
+#define FILTER(n, i) { n, i, sizeof (i) / sizeof (i[0]) }
+
+static struct filter filters[] =
+{
+  FILTER ("ether", ether_insns),
+  FILTER ("tcp dst port 22", ssh_insns),
+  FILTER ("udp match", udp_match_insns),
+};
+
+/* The interpreter bpf_do_filter used before filters were compiled,
+   reduced to the interface of bpf_prog_run.  It is kept out of line,
+   like bpf_prog_run, so that both are timed under the same
+   conditions.  */
+static int __attribute__ ((noinline))
+interpret (bpf_insn_t pc, bpf_insn_t pc_end, char *p, unsigned int wirelen,
+	   char *header, unsigned int hlen, unsigned int buflen,
+	   unsigned int *mem, int *n_keys)
+{
+  unsigned long A = 0, X = 0;
+  int k;
+  char *data;
+
+  for (++pc; pc < pc_end; ++pc)
+    switch (pc->code)
+      {
+      default:
+	abort ();
+      case BPF_RET|BPF_K:
+	return ((u_int)pc->k <= wirelen) ? pc->k : wirelen;
+      case BPF_RET|BPF_A:
+	return ((u_int)A <= wirelen) ? A : wirelen;
+      case BPF_RET|BPF_MATCH_IMM:
+	*n_keys = pc->jt;
+	return ((u_int)pc->k <= wirelen) ? pc->k : wirelen;
+      case BPF_LD|BPF_W|BPF_ABS:
+	k = pc->k;
+      load_word:
+	if ((u_int)k + sizeof (long) <= hlen)
+	  data = header;
+	else if ((u_int)k + sizeof (long) <= buflen)
+	  {
+	    k -= hlen;
+	    data = p;
+	  }
+	else
+	  return 0;
+	A = ntohl (*(long *)(data + k));
+	continue;
+      case BPF_LD|BPF_H|BPF_ABS:
+	k = pc->k;
+      load_half:
+	if ((u_int)k + sizeof (short) <= hlen)
+	  data = header;
+	else if ((u_int)k + sizeof (short) <= buflen)
+	  {
+	    k -= hlen;
+	    data = p;
+	  }
+	else
+	  return 0;
+	A = EXTRACT_SHORT (&data[k]);
+	continue;
+      case BPF_LD|BPF_B|BPF_ABS:
+	k = pc->k;
+      load_byte:
+	if ((u_int)k < hlen)
+	  data = header;
+	else if ((u_int)k < buflen)
+	  {
+	    data = p;
+	    k -= hlen;
+	  }
+	else
+	  return 0;
+	A = data[k];
+	continue;
+      case BPF_LD|BPF_W|BPF_LEN: A = wirelen; continue;
+      case BPF_LDX|BPF_W|BPF_LEN: X = wirelen; continue;
+      case BPF_LD|BPF_W|BPF_IND: k = X + pc->k; goto load_word;
+      case BPF_LD|BPF_H|BPF_IND: k = X + pc->k; goto load_half;
+      case BPF_LD|BPF_B|BPF_IND: k = X + pc->k; goto load_byte;
+      case BPF_LDX|BPF_MSH|BPF_B:
+	k = pc->k;
+	if ((u_int)k < hlen)
+	  data = header;
+	else if ((u_int)k < buflen)
+	  {
+	    data = p;
+	    k -= hlen;
+	  }
+	else
+	  return 0;
+	X = (data[k] & 0xf) << 2;
+	continue;
+      case BPF_LD|BPF_IMM: A = pc->k; continue;
+      case BPF_LDX|BPF_IMM: X = pc->k; continue;
+      case BPF_LD|BPF_MEM: A = mem[pc->k]; continue;
+      case BPF_LDX|BPF_MEM: X = mem[pc->k]; continue;
+      case BPF_ST: mem[pc->k] = A; continue;
+      case BPF_STX: mem[pc->k] = X; continue;
+      case BPF_JMP|BPF_JA: pc += pc->k; continue;
+      case BPF_JMP|BPF_JGT|BPF_K: pc += (A > pc->k) ? pc->jt : pc->jf; continue;
+      case BPF_JMP|BPF_JGE|BPF_K: pc += (A >= pc->k) ? pc->jt : pc->jf; continue;
+      case BPF_JMP|BPF_JEQ|BPF_K: pc += (A == pc->k) ? pc->jt : pc->jf; continue;
+      case BPF_JMP|BPF_JSET|BPF_K: pc += (A & pc->k) ? pc->jt : pc->jf; continue;
+      case BPF_JMP|BPF_JGT|BPF_X: pc += (A > X) ? pc->jt : pc->jf; continue;
+      case BPF_JMP|BPF_JGE|BPF_X: pc += (A >= X) ? pc->jt : pc->jf; continue;
+      case BPF_JMP|BPF_JEQ|BPF_X: pc += (A == X) ? pc->jt : pc->jf; continue;
+      case BPF_JMP|BPF_JSET|BPF_X: pc += (A & X) ? pc->jt : pc->jf; continue;
+      case BPF_ALU|BPF_ADD|BPF_X: A += X; continue;
+      case BPF_ALU|BPF_SUB|BPF_X: A -= X; continue;
+      case BPF_ALU|BPF_MUL|BPF_X: A *= X; continue;
+      case BPF_ALU|BPF_DIV|BPF_X:
+	if (X == 0)
+	  return 0;
+	A /= X;
+	continue;
+      case BPF_ALU|BPF_AND|BPF_X: A &= X; continue;
+      case BPF_ALU|BPF_OR|BPF_X: A |= X; continue;
+      case BPF_ALU|BPF_LSH|BPF_X: A <<= X; continue;
+      case BPF_ALU|BPF_RSH|BPF_X: A >>= X; continue;
+      case BPF_ALU|BPF_ADD|BPF_K: A += pc->k; continue;
+      case BPF_ALU|BPF_SUB|BPF_K: A -= pc->k; continue;
+      case BPF_ALU|BPF_MUL|BPF_K: A *= pc->k; continue;
+      case BPF_ALU|BPF_DIV|BPF_K: A /= pc->k; continue;
+      case BPF_ALU|BPF_AND|BPF_K: A &= pc->k; continue;
+      case BPF_ALU|BPF_OR|BPF_K: A |= pc->k; continue;
+      case BPF_ALU|BPF_LSH|BPF_K: A <<= pc->k; continue;
+      case BPF_ALU|BPF_RSH|BPF_K: A >>= pc->k; continue;
+      case BPF_ALU|BPF_NEG: A = -A; continue;
+      case BPF_MISC|BPF_TAX: X = A; continue;
+      case BPF_MISC|BPF_TXA: A = X; continue;
+      }
+
+  return 0;
+}
+
+/* The frames of the capture, stored back to back in one buffer with
+   BUFLEN bytes of slack at the end, so that filters reading past the
+   end of a frame stay inside the buffer as they would in Mach's
+   receive buffers.  */
+static char *frames;
+static size_t *frame_off;
+static unsigned int *frame_len;
+static size_t nframes;
+
+static void
+load_pcap (const char *file)
+{
+  struct
+  {
+    uint32_t magic;
+    uint16_t major, minor;
+    int32_t zone;
+    uint32_t sigfigs, snaplen, linktype;
+  } fh;
+  struct
+  {
+    uint32_t sec, usec, caplen, len;
+  } ph;
+  size_t size = 0, alloced = 0, max = 0;
+  FILE *f;
+  int swap;
+
+  f = fopen (file, "r");
+  if (! f)
+    error (1, errno, "%s", file);
+  if (fread (&fh, sizeof fh, 1, f) != 1)
+    error (1, 0, "%s: Not a pcap file", file);
+  if (fh.magic == 0xa1b2c3d4 || fh.magic == 0xa1b23c4d)
+    swap = 0;
+  else if (fh.magic == 0xd4c3b2a1 || fh.magic == 0x4d3cb2a1)
+    swap = 1;
+  else
+    error (1, 0, "%s: Not a pcap file", file);
+  if ((swap ? __builtin_bswap32 (fh.linktype) : fh.linktype) != 1)
+    error (1, 0, "%s: Not an Ethernet capture", file);
+
+  while (fread (&ph, sizeof ph, 1, f) == 1)
+    {
+      uint32_t len = swap ? __builtin_bswap32 (ph.caplen) : ph.caplen;
+
+      if (size + len + BUFLEN > alloced)
+	{
+	  alloced = 2 * (size + len + BUFLEN);
+	  frames = realloc (frames, alloced);
+	  if (! frames)
+	    error (1, errno, "realloc");
+	}
+      if (nframes == max)
+	{
+	  max = max ? 2 * max : 1024;
+	  frame_off = realloc (frame_off, max * sizeof *frame_off);
+	  frame_len = realloc (frame_len, max * sizeof *frame_len);
+	  if (! frame_off || ! frame_len)
+	    error (1, errno, "realloc");
+	}
+      if (fread (frames + size, 1, len, f) != len)
+	break;
+
+      if (len >= ETHER_HLEN)
+	{
+	  frame_off[nframes] = size;
+	  frame_len[nframes] = len;
+	  nframes++;
+	  size += len;
+	}
+    }
+  fclose (f);
+
+  if (nframes == 0)
+    error (1, 0, "%s: No Ethernet frames", file);
+  memset (frames + size, 0, BUFLEN);
+}
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main (int argc, char **argv)
+{
+  int rounds = 20;
+  int i;
+
+  if (argc < 2 || argc > 3)
+    {
+      fprintf (stderr, "Usage: %s PCAP-FILE [ROUNDS]\n", argv[0]);
+      exit (1);
+    }
+  if (argc == 3)
+    rounds = atoi (argv[2]);
+  load_pcap (argv[1]);
+
+  printf ("%zu frames, %d rounds\n", nframes, rounds);
+
+  for (i = 0; i < sizeof filters / sizeof filters[0]; i++)
+    {
+      struct filter *flt = &filters[i];
+      int bytes = flt->len * sizeof (struct bpf_insn);
+      struct bpf_cinsn prog[BPF_PROG_LEN (bytes)];
+      unsigned int mem[BPF_MEMWORDS];
+      unsigned long accepted = 0, sum_interp = 0, sum_prog = 0;
+      double t0, t1, t2;
+      size_t n;
+      int r;
+
+      if (! bpf_compile (flt->insns, bytes, prog))
+	error (1, 0, "%s: Filter does not compile", flt->name);
+
+      /* Both forms must agree on every frame.  */
+      for (n = 0; n < nframes; n++)
+	{
+	  char *h = frames + frame_off[n];
+	  unsigned int wirelen = frame_len[n] - ETHER_HLEN;
+	  int keys1 = 0, keys2 = 0, ret1, ret2;
+	  unsigned int mem2[BPF_MEMWORDS];
+
+	  ret1 = interpret (flt->insns, flt->insns + flt->len, h + ETHER_HLEN,
+			    wirelen, h, ETHER_HLEN, BUFLEN, mem, &keys1);
+	  ret2 = bpf_prog_run (prog, h + ETHER_HLEN, wirelen, h, ETHER_HLEN,
+			       BUFLEN, mem2, &keys2);
+	  if (ret1 != ret2 || keys1 != keys2
+	      || memcmp (mem, mem2, keys1 * sizeof mem[0]))
+	    error (1, 0, "%s: Frame %zu: interpreter returned %d/%d, "
+		   "compiled filter %d/%d", flt->name, n,
+		   ret1, keys1, ret2, keys2);
+	  accepted += ret1 != 0;
+	}
+
+      t0 = now ();
+      for (r = 0; r < rounds; r++)
+	for (n = 0; n < nframes; n++)
+	  {
+	    char *h = frames + frame_off[n];
+	    int keys = 0;
+	    sum_interp += interpret (flt->insns, flt->insns + flt->len,
+				     h + ETHER_HLEN,
+				     frame_len[n] - ETHER_HLEN, h, ETHER_HLEN,
+				     BUFLEN, mem, &keys);
+	  }
+      t1 = now ();
+      for (r = 0; r < rounds; r++)
+	for (n = 0; n < nframes; n++)
+	  {
+	    char *h = frames + frame_off[n];
+	    int keys = 0;
+	    sum_prog += bpf_prog_run (prog, h + ETHER_HLEN,
+				      frame_len[n] - ETHER_HLEN, h, ETHER_HLEN,
+				      BUFLEN, mem, &keys);
+	  }
+      t2 = now ();
+
+      if (sum_interp != sum_prog)
+	error (1, 0, "%s: Results differ between runs", flt->name);
+
+      printf ("%-16s accepted %6lu  interpreted %7.2f ns/pkt  "
+	      "compiled %7.2f ns/pkt  (%.2fx)\n",
+	      flt->name, accepted,
+	      (t1 - t0) * 1e9 / ((double) rounds * nframes),
+	      (t2 - t1) * 1e9 / ((double) rounds * nframes),
+	      (t1 - t0) / (t2 - t1));
+    }
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+/* Benchmark of the page checksum of the default pager
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
+
+/* Checksum a set of pages with the word XOR mach-defpager used to
+   have, and with the portable and the SSE4.2 versions of the CRC32C of
+   mach-defpager/checksum.c; check that both CRC32C versions agree,
+   including on unaligned and odd-sized buffers, and report the time
+   spent per page.
+
+   checksum.c does not depend on Mach, so this runs on GNU/Linux:
+
+     gcc -O2 -I../mach-defpager -o crc32c-bench \
+	 crc32c-bench.c ../mach-defpager/checksum.c -lpthread
+     ./crc32c-bench [PAGES] [ROUNDS]  */
+
+#include <error.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "checksum.h"
+
+#define PAGE_SIZE	4096
+
+/* What compute_checksum used to do.  */
+static uint32_t
+xor_words (const void *buf, size_t len)
+{
+  const int *p = buf;
+  int checksum = -1;
+  size_t count = len / sizeof (int);
+
+  while (count-- > 0)
+    checksum ^= *p++;
+  return checksum;
+}
+
+/* The checksum of "123456789" is the usual check value.  */
+static void
+check (void)
+{
+  static const char check_string[] = "123456789";
+  unsigned char buf[3 * PAGE_SIZE];
+  size_t i, off, len;
+
+  if (crc32c (0, check_string, 9) != 0xe3069283
+      || crc32c_sw (0, check_string, 9) != 0xe3069283)
+    error (1, 0, "Wrong CRC32C of \"123456789\"");
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = random ();
+  for (off = 0; off < 16; off++)
+    for (len = 0; len + off <= sizeof buf; len += len < 64 ? 1 : 61)
+      {
+	uint32_t hw = crc32c (0, buf + off, len);
+	uint32_t sw = crc32c_sw (0, buf + off, len);
+	uint32_t split = crc32c (crc32c (0, buf + off, len / 3),
+				 buf + off + len / 3, len - len / 3);
+
+	if (hw != sw || split != sw)
+	  error (1, 0, "Checksums differ at offset %zu, length %zu: "
+		 "%08x, portable %08x, split %08x", off, len, hw, sw, split);
+      }
+}
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+run (const char *name, uint32_t (*fn) (const void *, size_t),
+     const unsigned char *pages, size_t npages, int rounds)
+{
+  volatile uint32_t sink = 0;
+  double t0, t1;
+  size_t n;
+  int r;
+
+  t0 = now ();
+  for (r = 0; r < rounds; r++)
+    for (n = 0; n < npages; n++)
+      sink ^= fn (pages + n * PAGE_SIZE, PAGE_SIZE);
+  t1 = now ();
+
+  printf ("%-20s %8.1f ns/page  %6.2f GB/s\n", name,
+	  (t1 - t0) * 1e9 / ((double) rounds * npages),
+	  (double) rounds * npages * PAGE_SIZE / (t1 - t0) / 1e9);
+}
+
+static uint32_t
+crc_default (const void *buf, size_t len)
+{
+  return crc32c (0, buf, len);
+}
+
+static uint32_t
+crc_portable (const void *buf, size_t len)
+{
+  return crc32c_sw (0, buf, len);
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t npages = 256, i;
+  int rounds = 200;
+  unsigned char *pages;
+
+  if (argc > 3)
+    {
+      fprintf (stderr, "Usage: %s [PAGES] [ROUNDS]\n", argv[0]);
+      exit (1);
+    }
+  if (argc > 1)
+    npages = atoi (argv[1]);
+  if (argc > 2)
+    rounds = atoi (argv[2]);
+
+  pages = aligned_alloc (PAGE_SIZE, npages * PAGE_SIZE);
+  if (pages == NULL)
+    error (1, 0, "Cannot allocate %zu pages", npages);
+  for (i = 0; i < npages * PAGE_SIZE; i++)
+    pages[i] = random ();
+
+  check ();
+
+  printf ("%zu pages, %d rounds, crc32 instruction %s\n", npages, rounds,
+	  crc32c_hw_available () ? "used" : "not available");
+  run ("xor", xor_words, pages, npages, rounds);
+  run ("crc32c portable", crc_portable, pages, npages, rounds);
+  if (crc32c_hw_available ())
+    run ("crc32c sse4.2", crc_default, pages, npages, rounds);
+
+  free (pages);
+  return 0;
+}
@@ -27,6 +27,7 @@
 #include <argp.h>
 #include <string.h>
 #include <assert-backtrace.h>
+#include <time.h>
 #include <error.h>
 
 #include <pthread.h>
@@ -62,8 +63,17 @@ struct changes
   uint32_t bell_audible;
   uint32_t bell_visible;
 
-  off_t start;
-  off_t end;
+  /* The regions of the matrix changed since the last flush, as ranges
+     of cells, which wrap around the end of the matrix if START is
+     greater than END.  Close regions are merged, so that a flush
+     writes few entries to the change ringbuffer.  */
+#define DISPLAY_DAMAGE_REGIONS 8
+  struct
+  {
+    off_t start;
+    off_t end;
+  } damage[DISPLAY_DAMAGE_REGIONS];
+  int ndamage;
 
 #define DISPLAY_CHANGE_CURSOR_POS	0x0001
 #define DISPLAY_CHANGE_CURSOR_STATUS	0x0002
@@ -194,6 +204,14 @@ struct display
   struct modreq *filemod_reqs_pending;
   /* The notify port.  */
   struct notify *notify_port;
+
+  /* When the last file change notification was sent.  */
+  struct timespec last_notice;
+  /* Set if a notification is due at the end of the current frame; the
+     display is then in the DEFERRED_DISPLAYS list through
+     NEXT_DEFERRED.  */
+  int notice_deferred;
+  struct display *next_deferred;
 };
 
 
@@ -201,6 +219,16 @@ struct display
 static struct port_bucket *notify_bucket;
 static struct port_class *notify_class;
 
+/* Readers are sent at most one file change notification per frame.
+   Changes made within a frame of the last notification are announced
+   at the end of the frame by service_deferred_notices.  */
+#define DISPLAY_FRAME_NSEC (1000000000 / 60)
+
+/* The displays with a notification due, and their lock.  */
+static pthread_mutex_t deferred_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t deferred_cond = PTHREAD_COND_INITIALIZER;
+static struct display *deferred_displays;
+
 #define msgh_request_port	msgh_remote_port
 #define msgh_reply_port		msgh_local_port
 
@@ -536,9 +564,10 @@ display_notice_changes (display_t display, mach_port_t notify)
   return 0;
 }
 
-/* Requires DISPLAY to be locked.  */
+/* Send a file change notification to the readers of DISPLAY.
+   Requires DISPLAY to be locked.  */
 static void
-display_notice_filechange (display_t display)
+display_send_filechange (display_t display)
 {
   error_t err;
   struct modreq *req = display->filemod_reqs_pending;
@@ -587,6 +616,82 @@ display_notice_filechange (display_t display)
     }
 }
 
+/* Notify the readers of DISPLAY of a change, now or at the end of the
+   frame.  Requires DISPLAY to be locked.  */
+static void
+display_notice_filechange (display_t display)
+{
+  struct timespec now;
+  long long elapsed;
+
+  if (display->notice_deferred)
+    return;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - display->last_notice.tv_sec) * 1000000000LL
+    + now.tv_nsec - display->last_notice.tv_nsec;
+  if (elapsed >= 0 && elapsed < DISPLAY_FRAME_NSEC)
+    {
+      /* The reference keeps DISPLAY around until the notification is
+	 sent, see display_destroy_complete.  */
+      ports_port_ref (display->notify_port);
+      pthread_mutex_lock (&deferred_lock);
+      display->notice_deferred = 1;
+      display->next_deferred = deferred_displays;
+      deferred_displays = display;
+      pthread_cond_signal (&deferred_cond);
+      pthread_mutex_unlock (&deferred_lock);
+      return;
+    }
+
+  display->last_notice = now;
+  display_send_filechange (display);
+}
+
+/* A top-level function for the thread that sends the notifications
+   deferred to the end of a frame by display_notice_filechange.  */
+static void *
+service_deferred_notices (void *arg)
+{
+  const struct timespec frame = { 0, DISPLAY_FRAME_NSEC };
+
+  for (;;)
+    {
+      struct display *display, *next;
+
+      pthread_mutex_lock (&deferred_lock);
+      while (!deferred_displays)
+	pthread_cond_wait (&deferred_cond, &deferred_lock);
+      pthread_mutex_unlock (&deferred_lock);
+
+      nanosleep (&frame, NULL);
+
+      pthread_mutex_lock (&deferred_lock);
+      display = deferred_displays;
+      deferred_displays = NULL;
+      pthread_mutex_unlock (&deferred_lock);
+
+      for (; display; display = next)
+	{
+	  struct notify *notify_port = display->notify_port;
+
+	  pthread_mutex_lock (&display->lock);
+	  next = display->next_deferred;
+	  display->notice_deferred = 0;
+	  /* Both lists are empty once the display is destroyed.  */
+	  if (display->filemod_reqs || display->filemod_reqs_pending)
+	    {
+	      clock_gettime (CLOCK_MONOTONIC, &display->last_notice);
+	      display_send_filechange (display);
+	    }
+	  pthread_mutex_unlock (&display->lock);
+	  ports_port_deref (notify_port);
+	}
+    }
+
+  return NULL;
+}
+
 static void
 display_flush_filechange (display_t display, unsigned int type)
 {
@@ -599,12 +704,18 @@ display_flush_filechange (display_t display, unsigned int type)
   if (type & DISPLAY_CHANGE_MATRIX
       && display->changes.which & DISPLAY_CHANGE_MATRIX)
     {
+      int i;
+
       notify = 1;
-      next->matrix.start = display->changes.start;
-      next->matrix.end = display->changes.end;
-      user->changes.written++;
-      next = &user->changes._buffer[user->changes.written
-				    % _CONS_CHANGES_LENGTH];
+      for (i = 0; i < display->changes.ndamage; i++)
+	{
+	  next->matrix.start = display->changes.damage[i].start;
+	  next->matrix.end = display->changes.damage[i].end;
+	  user->changes.written++;
+	  next = &user->changes._buffer[user->changes.written
+					% _CONS_CHANGES_LENGTH];
+	}
+      display->changes.ndamage = 0;
       display->changes.which &= ~DISPLAY_CHANGE_MATRIX;
     }
 
@@ -688,87 +799,117 @@ display_flush_filechange (display_t display, unsigned int type)
     display_notice_filechange (display);
 }
 
-/* Record a change in the matrix ringbuffer.  */
-static void
-display_record_filechange (display_t display, off_t start, off_t end)
+/* Return the number of cells from START to END in a matrix of SIZE
+   cells, wrapping around its end if START is greater than END.  A
+   region ending just before its start is the whole matrix.  */
+static off_t
+region_length (off_t size, off_t start, off_t end)
 {
-  if (!(display->changes.which & DISPLAY_CHANGE_MATRIX))
+  off_t len = end - start + 1;
+
+  return len <= 0 ? len + size : len;
+}
+
+/* Set *START and *END to the smallest region of a matrix of SIZE cells
+   covering both the region from *START to *END and the one from
+   OLD_START to OLD_END.  Return the number of cells it covers which
+   are in neither.  */
+static off_t
+region_union (off_t size, off_t old_start, off_t old_end,
+	      off_t *start, off_t *end)
+{
+  off_t old_len = region_length (size, old_start, old_end);
+  off_t len = region_length (size, *start, *end);
+  off_t s, e, union_start, union_len;
+
+  /* Rotate the matrix so that the old region starts at 0, to reduce
+     the number of cases.  */
+  s = *start - old_start;
+  if (s < 0)
+    s += size;
+  e = s + len - 1;
+
+  if (e >= size)
     {
-      display->changes.start = start;
-      display->changes.end = end;
-      display->changes.which |= DISPLAY_CHANGE_MATRIX;
+      /* The new region wraps around, so it covers the start of the old
+	 one.  */
+      union_start = s;
+      union_len = size - s + (e - size + 1 > old_len
+			      ? e - size + 1 : old_len);
     }
   else
     {
-      off_t size = display->user->screen.width * display->user->screen.lines;
-      off_t rotate = display->changes.start;
-      off_t old_end = display->changes.end;
-      int disjunct = 0;
-
-      /* First rotate the buffer to reduce the number of cases.  */
-      old_end -= rotate;
-      if (old_end < 0)
-	old_end += size;
-      start -= rotate;
-      if (start < 0)
-	start += size;
-      end -= rotate;
-      if (end < 0)
-	end += size;
-
-      /* Now the old region starts at 0 and ends at OLD_END.  Try to
-	 merge in the new region if it overlaps or touches the old
-	 one.  */
-      if (start <= end)
-	{
-	  if (start <= old_end + 1)
-	    {
-	      start = 0;
-	      if (old_end > end)
-		end = old_end;
-	    }
-	  else
-	    {
-	      if (end == size - 1)
-		end = old_end;
-	      else
-		disjunct = 1;
-	    }
-	}
-      else
+      /* Extend the old region forward to the end of the new one, or
+	 backward, around the end of the matrix, to its start.  */
+      off_t forward = e + 1 > old_len ? e + 1 : old_len;
+      off_t backward = size - s + old_len;
+
+      union_start = forward <= backward ? 0 : s;
+      union_len = forward <= backward ? forward : backward;
+    }
+  if (union_len > size)
+    union_len = size;
+
+  /* Now reverse the rotation.  */
+  union_start += old_start;
+  if (union_start >= size)
+    union_start -= size;
+  *start = union_start;
+  *end = union_start + union_len - 1;
+  if (*end >= size)
+    *end -= size;
+
+  return union_len > old_len + len ? union_len - old_len - len : 0;
+}
+
+/* Record a change in the matrix ringbuffer.  */
+static void
+display_record_filechange (display_t display, off_t start, off_t end)
+{
+  struct changes *changes = &display->changes;
+  off_t size = display->user->screen.width * display->user->screen.lines;
+
+  changes->which |= DISPLAY_CHANGE_MATRIX;
+
+  for (;;)
+    {
+      int i, best = -1;
+      off_t best_waste = 0, best_start = 0, best_end = 0;
+
+      for (i = 0; i < changes->ndamage; i++)
 	{
-	  if (start <= old_end + 1)
-	    {
-	      start = 0;
-	      end = size - 1;
-	    }
-	  else
+	  off_t s = start, e = end;
+	  off_t waste = region_union (size, changes->damage[i].start,
+				      changes->damage[i].end, &s, &e);
+
+	  if (best < 0 || waste < best_waste)
 	    {
-	      if (old_end > end)
-		end = old_end;
+	      best = i;
+	      best_waste = waste;
+	      best_start = s;
+	      best_end = e;
 	    }
 	}
-      /* Now reverse the rotation.  */
-      start += rotate;
-      if (start >= size)
-	start -= size;
-      end += rotate;
-      if (end >= size)
-	end -= size;
-
-      if (disjunct)
+
+      if (best < 0
+	  || (best_waste > 0 && changes->ndamage < DISPLAY_DAMAGE_REGIONS))
 	{
-	  /* The regions are disjunct, so we have to flush the old
-	     changes.  */
-	  display_flush_filechange (display, DISPLAY_CHANGE_MATRIX);
-	  display->changes.which |= DISPLAY_CHANGE_MATRIX;
+	  /* Keep the region apart.  */
+	  changes->damage[changes->ndamage].start = start;
+	  changes->damage[changes->ndamage].end = end;
+	  changes->ndamage++;
+	  return;
 	}
-      display->changes.start = start;
-      display->changes.end = end;
+
+      /* Merge the region with the closest one, or with one it overlaps
+	 or touches, and try to merge the union with the others.  */
+      start = best_start;
+      end = best_end;
+      changes->damage[best] = changes->damage[--changes->ndamage];
     }
 }
 	    
-
+
 static void
 conchar_memset (conchar_t *conchar, wchar_t chr, conchar_attr_t attr,
 		size_t size)
@@ -839,6 +980,62 @@ user_destroy (display_t display)
 }
 
 
+/* Move COUNT cells from SRC to DST in the matrix of USER, of SIZE
+   cells, where both wrap around its end.  */
+static void
+matrix_move (struct cons_display *user, off_t size, off_t dst, off_t src,
+	     off_t count)
+{
+  /* Copy the chunks between the ends of the matrix in the order which
+     does not overwrite cells before they are moved.  */
+  if (dst < src)
+    while (count)
+      {
+	off_t d = dst % size, s = src % size;
+	off_t chunk = count;
+
+	if (chunk > size - d)
+	  chunk = size - d;
+	if (chunk > size - s)
+	  chunk = size - s;
+	memmove (user->_matrix + d, user->_matrix + s,
+		 chunk * sizeof (conchar_t));
+	dst += chunk;
+	src += chunk;
+	count -= chunk;
+      }
+  else
+    while (count)
+      {
+	off_t d = (dst + count - 1) % size, s = (src + count - 1) % size;
+	off_t chunk = count;
+
+	if (chunk > d + 1)
+	  chunk = d + 1;
+	if (chunk > s + 1)
+	  chunk = s + 1;
+	memmove (user->_matrix + d - chunk + 1, user->_matrix + s - chunk + 1,
+		 chunk * sizeof (conchar_t));
+	count -= chunk;
+      }
+}
+
+/* Fill COUNT cells from START in the matrix of USER, of SIZE cells,
+   with CHR and ATTR, wrapping around its end.  */
+static void
+matrix_fill (struct cons_display *user, off_t size, off_t start,
+	     off_t count, wchar_t chr, conchar_attr_t attr)
+{
+  start %= size;
+  if (start + count > size)
+    {
+      conchar_memset (user->_matrix + start, chr, attr, size - start);
+      count -= size - start;
+      start = 0;
+    }
+  conchar_memset (user->_matrix + start, chr, attr, count);
+}
+
 static void
 screen_fill (display_t display, size_t col1, size_t row1, size_t col2,
 	     size_t row2, wchar_t chr, conchar_attr_t attr)
@@ -888,20 +1085,9 @@ screen_shift_left (display_t display, size_t col1, size_t row1, size_t col2,
 
   if (start + shift <= end)
     {
-      /* Use a loop to copy the data.  Using wmemmove and wmemset on
-	 the chunks is tiresome, as there are many cases.  */
-      off_t src = start + shift;
-      off_t dst = start;
-
-      while (src <= end)
-	user->_matrix[dst++ % size] = user->_matrix[src++ % size];
-      while (dst <= end)
-	{
-	  user->_matrix[dst % size].chr = chr;
-	  user->_matrix[dst++ % size].attr = attr;
-	}
-
-      display_record_filechange (display, start, end);
+      matrix_move (user, size, start, start + shift, end - start - shift + 1);
+      matrix_fill (user, size, end - shift + 1, shift, chr, attr);
+      display_record_filechange (display, start % size, end % size);
     }
   else
     screen_fill (display, col1, row1, col2, row2, chr, attr);
@@ -927,20 +1113,9 @@ screen_shift_right (display_t display, size_t col1, size_t row1, size_t col2,
 
   if (start + shift <= end)
     {
-      /* Use a loop to copy the data.  Using wmemmove and wmemset on
-	 the chunks is tiresome, as there are many cases.  */
-      off_t src = end - shift;
-      off_t dst = end;
-
-      while (src >= start)
-	user->_matrix[dst-- % size] = user->_matrix[src-- % size];
-      while (dst >= start)
-	{
-	  user->_matrix[dst % size].chr = chr;
-	  user->_matrix[dst-- % size].attr = attr;
-	}
-
-      display_record_filechange (display, start, end);
+      matrix_move (user, size, start + shift, start, end - start - shift + 1);
+      matrix_fill (user, size, start, shift, chr, attr);
+      display_record_filechange (display, start % size, end % size);
     }
   else
     screen_fill (display, col1, row1, col2, row2, chr, attr);
@@ -1778,6 +1953,62 @@ display_output_one (display_t display, wchar_t chr)
     }
 }
 
+/* Return non-zero if CHR is printed in one column by display_output_one
+   without further ado.  */
+static inline int
+plain_char_p (wchar_t chr)
+{
+  if (chr < 0x7f)
+    return chr >= L' ';
+  return chr >= 0xa0 && wcwidth (chr) == 1;
+}
+
+/* Output the run of plain characters at the start of the LEN at CHRS,
+   as display_output_one would, but a line at a time.  Return the length
+   of the run, which is zero if CHRS does not start with one.  Display
+   must be locked.  */
+static size_t
+display_output_run (display_t display, const wchar_t *chrs, size_t len)
+{
+  struct cons_display *user = display->user;
+  size_t done = 0;
+
+  if (display->output.parse.state != STATE_NORMAL || display->insert_mode)
+    return 0;
+
+  while (done < len && plain_char_p (chrs[done]))
+    {
+      conchar_t *cell;
+      size_t n, i;
+      off_t idx;
+
+      if (user->cursor.col >= user->screen.width)
+	{
+	  user->cursor.col = 0;
+	  linefeed (display);
+	}
+
+      idx = ((user->screen.cur_line + user->cursor.row) % user->screen.lines)
+	* user->screen.width + user->cursor.col;
+      cell = user->_matrix + idx;
+      for (n = 0; done + n < len
+	     && n < user->screen.width - user->cursor.col
+	     && plain_char_p (chrs[done + n]); n++)
+	{
+	  wchar_t chr = chrs[done + n];
+
+	  cell[n].chr = display->attr.altchar ? altchar_to_ucs4 (chr) : chr;
+	  cell[n].attr = display->attr.current;
+	}
+
+      user->cursor.col += n;
+      display_record_filechange (display, idx, idx + n - 1);
+      done += n;
+    }
+
+  return done;
+}
+
 /* Output LENGTH bytes starting from BUFFER in the system encoding.
    Set BUFFER and LENGTH to the new values.  The exact semantics are
    just as in the iconv interface.  */
@@ -1804,14 +2035,22 @@ display_output_some (display_t display, char **buffer, size_t *length)
       char *outptr = (char *) outbuf;
       size_t outsize = CONV_OUTBUF_SIZE * sizeof (wchar_t);
       error_t saved_err;
-      int i;
+      size_t i, n;
 
       nconv = iconv (display->output.cd, buffer, length, &outptr, &outsize);
       saved_err = errno;
 
       /* First process all successfully converted characters.  */
-      for (i = 0; i < CONV_OUTBUF_SIZE - outsize / sizeof (wchar_t); i++)
-	display_output_one (display, outbuf[i]);
+      n = CONV_OUTBUF_SIZE - outsize / sizeof (wchar_t);
+      for (i = 0; i < n; )
+	{
+	  size_t run = display_output_run (display, outbuf + i, n - i);
+
+	  if (run)
+	    i += run;
+	  else
+	    display_output_one (display, outbuf[i++]);
+	}
 
       if (nconv == (size_t) -1)
 	{
@@ -1866,6 +2105,15 @@ display_init (void)
       errno = err;
       perror ("pthread_create");
     }
+
+  err = pthread_create (&thread, NULL, service_deferred_notices, NULL);
+  if (!err)
+    pthread_detach (thread);
+  else
+    {
+      errno = err;
+      perror ("pthread_create");
+    }
 }
 
 
@@ -0,0 +1,262 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+/* This file implements the address table of the switch mode.  In that
+ * mode, the multiplexer learns behind which interface every Ethernet
+ * address lives from the source of the frames it forwards, and sends
+ * unicast frames only to that interface.  */
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <hurd/ihash.h>
+#include <maptime.h>
+
+#include <pthread.h>
+
+#include "vdev.h"
+#include "netfs_impl.h"
+#include "util.h"
+
+/* Nonzero if the multiplexer works as a learning switch.  */
+int bridge_mode;
+
+/* Number of seconds after which a learned address is forgotten.  */
+int bridge_aging_time = 300;
+
+#define MAC_HASH_SIZE 1024
+#define MAC_MAX 8192
+
+struct mac_entry
+{
+  struct mac_entry *next;
+  unsigned char addr[ETH_ALEN];
+  /* The interface behind which ADDR lives, or NULL for the underlying
+     network.  */
+  struct vether_device *vdev;
+  /* Time at which ADDR was last seen, or 0 for the addresses of the
+     virtual interfaces themselves, which never age.  */
+  time_t seen;
+};
+
+static struct mac_entry *mac_table[MAC_HASH_SIZE];
+static int mac_count;
+
+/* Forwarding holds this lock for reading while it delivers a frame to
+ * the interface it found in the table, so that an interface cannot be
+ * destroyed under its feet.  */
+static pthread_rwlock_t mac_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static time_t
+bridge_now (void)
+{
+  struct timeval tv;
+
+  if (multiplexer_maptime == NULL)
+    return time (NULL);
+  maptime_read (multiplexer_maptime, &tv);
+  return tv.tv_sec;
+}
+
+static inline struct mac_entry **
+mac_bucket (const unsigned char *addr)
+{
+  return &mac_table[hurd_ihash_hash32 (addr, ETH_ALEN, 0) % MAC_HASH_SIZE];
+}
+
+/* Find ADDR in the table.  MAC_LOCK must be held.  */
+static struct mac_entry *
+mac_find (const unsigned char *addr)
+{
+  struct mac_entry *e;
+
+  for (e = *mac_bucket (addr); e; e = e->next)
+    if (memcmp (e->addr, addr, ETH_ALEN) == 0)
+      return e;
+  return NULL;
+}
+
+static int
+expired (struct mac_entry *e, time_t now)
+{
+  time_t seen = __atomic_load_n (&e->seen, __ATOMIC_RELAXED);
+  return seen != 0 && now - seen > bridge_aging_time;
+}
+
+/* Remove the expired entries of the bucket of ADDR.  MAC_LOCK must be
+   held for writing.  */
+static void
+mac_expire (const unsigned char *addr, time_t now)
+{
+  struct mac_entry **pe, *e;
+
+  for (pe = mac_bucket (addr); (e = *pe); )
+    if (expired (e, now))
+      {
+	*pe = e->next;
+	free (e);
+	mac_count--;
+      }
+    else
+      pe = &e->next;
+}
+
+/* Record that ADDR was seen as the source of a frame coming from VDEV,
+ * or from the underlying network if VDEV is NULL.  */
+void
+bridge_learn (const char *addr, struct vether_device *vdev)
+{
+  const unsigned char *a = (const unsigned char *) addr;
+  struct mac_entry *e;
+  time_t now;
+
+  /* Group addresses are never valid sources.  */
+  if (a[0] & 1)
+    return;
+
+  now = bridge_now ();
+
+  /* The common case: the address is known and has not moved.  */
+  pthread_rwlock_rdlock (&mac_lock);
+  e = mac_find (a);
+  if (e && e->vdev == vdev)
+    {
+      if (__atomic_load_n (&e->seen, __ATOMIC_RELAXED) != 0)
+	__atomic_store_n (&e->seen, now, __ATOMIC_RELAXED);
+      pthread_rwlock_unlock (&mac_lock);
+      return;
+    }
+  pthread_rwlock_unlock (&mac_lock);
+
+  pthread_rwlock_wrlock (&mac_lock);
+  mac_expire (a, now);
+  e = mac_find (a);
+  if (e)
+    {
+      /* Nobody else can take over the address of a virtual
+	 interface.  */
+      if (e->seen != 0)
+	{
+	  e->vdev = vdev;
+	  e->seen = now;
+	}
+    }
+  else if (mac_count < MAC_MAX)
+    {
+      e = malloc (sizeof *e);
+      if (e)
+	{
+	  memcpy (e->addr, a, ETH_ALEN);
+	  e->vdev = vdev;
+	  e->seen = now;
+	  e->next = *mac_bucket (a);
+	  *mac_bucket (a) = e;
+	  mac_count++;
+	}
+    }
+  pthread_rwlock_unlock (&mac_lock);
+}
+
+/* Make ADDR the address of VDEV, replacing OLD_ADDR if it is not NULL.
+ * Such entries never age.  */
+void
+bridge_set_address (struct vether_device *vdev, const char *addr,
+		    const char *old_addr)
+{
+  struct mac_entry *e, **pe;
+
+  pthread_rwlock_wrlock (&mac_lock);
+  if (old_addr)
+    for (pe = mac_bucket ((const unsigned char *) old_addr); (e = *pe);
+	 pe = &e->next)
+      if (e->vdev == vdev && e->seen == 0
+	  && memcmp (e->addr, old_addr, ETH_ALEN) == 0)
+	{
+	  *pe = e->next;
+	  free (e);
+	  mac_count--;
+	  break;
+	}
+
+  e = mac_find ((const unsigned char *) addr);
+  if (e == NULL)
+    {
+      e = malloc (sizeof *e);
+      if (e)
+	{
+	  memcpy (e->addr, addr, ETH_ALEN);
+	  e->next = *mac_bucket (e->addr);
+	  *mac_bucket (e->addr) = e;
+	  mac_count++;
+	}
+    }
+  if (e)
+    {
+      e->vdev = vdev;
+      e->seen = 0;
+    }
+  pthread_rwlock_unlock (&mac_lock);
+}
+
+/* Forget all addresses living behind VDEV.  This waits for the
+ * deliveries started by bridge_forward to finish.  */
+void
+bridge_forget (struct vether_device *vdev)
+{
+  struct mac_entry **pe, *e;
+  int i;
+
+  pthread_rwlock_wrlock (&mac_lock);
+  for (i = 0; i < MAC_HASH_SIZE; i++)
+    for (pe = &mac_table[i]; (e = *pe); )
+      if (e->vdev == vdev)
+	{
+	  *pe = e->next;
+	  free (e);
+	  mac_count--;
+	}
+      else
+	pe = &e->next;
+  pthread_rwlock_unlock (&mac_lock);
+}
+
+/* Look up the destination ADDR of a frame.  If it is a known unicast
+ * address, call FUNC with the interface behind it (NULL for the
+ * underlying network) and return 1.  Otherwise return 0; the frame
+ * then has to be flooded.  */
+int
+bridge_forward (const char *addr, void (*func) (struct vether_device *))
+{
+  const unsigned char *a = (const unsigned char *) addr;
+  struct mac_entry *e;
+
+  if (a[0] & 1)
+    return 0;
+
+  pthread_rwlock_rdlock (&mac_lock);
+  e = mac_find (a);
+  if (e == NULL || expired (e, bridge_now ()))
+    {
+      pthread_rwlock_unlock (&mac_lock);
+      return 0;
+    }
+  func (e->vdev);
+  pthread_rwlock_unlock (&mac_lock);
+  return 1;
+}
@@ -51,7 +51,9 @@ dev_getstat(struct vether_device *ifp, dev_flavor_t flavor,
 		case NET_FLAGS:
 			if (*count != 1)
 				return D_INVALID_SIZE;
+			pthread_mutex_lock(&ifp->lock);
 			status[0] = ifp->if_flags;
+			pthread_mutex_unlock(&ifp->lock);
 			break;
 		case NET_STATUS:
 			{
@@ -65,7 +67,9 @@ dev_getstat(struct vether_device *ifp, dev_flavor_t flavor,
 				ns->header_format = ifp->if_header_format;
 				ns->header_size = ifp->if_header_size;
 				ns->address_size = ifp->if_address_size;
+				pthread_mutex_lock(&ifp->lock);
 				ns->flags = ifp->if_flags;
+				pthread_mutex_unlock(&ifp->lock);
 				ns->mapped_size = 0;
 
 				*count = NET_STATUS_COUNT;
@@ -85,7 +89,9 @@ dev_getstat(struct vether_device *ifp, dev_flavor_t flavor,
 					return (D_INVALID_OPERATION);
 				}
 
+				pthread_mutex_lock(&ifp->lock);
 				memcpy(status, ifp->if_address, addr_byte_count);
+				pthread_mutex_unlock(&ifp->lock);
 				if (addr_byte_count < addr_int_count * sizeof(int))
 					memset((char *)status + addr_byte_count, 0,
 							(addr_int_count * sizeof(int)
@@ -109,9 +115,18 @@ dev_getstat(struct vether_device *ifp, dev_flavor_t flavor,
 static
 int wants_all_multi_p (struct vether_device *v)
 {
-  return !! (v->if_flags & IFF_ALLMULTI);
+  int ret;
+
+  pthread_mutex_lock (&v->lock);
+  ret = !! (v->if_flags & IFF_ALLMULTI);
+  pthread_mutex_unlock (&v->lock);
+  return ret;
 }
 
+/* Serializes the changes of the flags of all devices, so that each one
+   is computed from the flags the previous one left.  */
+static pthread_mutex_t flags_lock = PTHREAD_MUTEX_INITIALIZER;
+
 io_return_t
 vdev_setstat (struct vether_device *ifp, dev_flavor_t flavor,
 	      dev_status_t status, size_t count)
@@ -147,27 +162,24 @@ vdev_setstat (struct vether_device *ifp, dev_flavor_t flavor,
     flags = status[0];
 
   change_flags:
+    pthread_mutex_lock (&flags_lock);
+
     /* What needs to change?  */
+    pthread_mutex_lock (&ifp->lock);
     delta = flags ^ ifp->if_flags;
+    pthread_mutex_unlock (&ifp->lock);
 
     /* Only allow specific flag changes.  */
     if ((delta
 	 /* AIUI IFF_RUNNING shouldn't be toggle-able, but we let this slip.  */
 	 & ~(IFF_UP | IFF_RUNNING | IFF_DEBUG | IFF_PROMISC | IFF_ALLMULTI))
 	!= 0)
-      return D_INVALID_OPERATION;
-
-
-    if (! err && (delta & IFF_PROMISC))
       {
-	/* The ethernet device is always in promiscuous mode, and we
-	   forward all packets.  If this flag is cleared for a virtual
-	   device, we should filter traffic based on observed MAC
-	   addresses from this interface.  */
-	/* XXX: Implement this.  */
+	pthread_mutex_unlock (&flags_lock);
+	return D_INVALID_OPERATION;
       }
 
-    if (! err && (delta & IFF_ALLMULTI))
+    if (delta & IFF_ALLMULTI)
       {
 	/* We activate IFF_ALLMULTI if at least one virtual device
 	   wants it, and deactivate it otherwise.  */
@@ -179,7 +191,20 @@ vdev_setstat (struct vether_device *ifp, dev_flavor_t flavor,
       }
 
     if (! err)
-      ifp->if_flags = flags;
+      {
+	pthread_mutex_lock (&ifp->lock);
+	if (delta & IFF_PROMISC)
+	  /* The ethernet device is always in promiscuous mode.  Without
+	     --switch we forward all packets to every virtual device.  In
+	     switch mode, unicast packets go only to the device behind
+	     which their destination was observed, and to the devices
+	     with this flag set.  */
+	  __atomic_add_fetch (&vdev_promisc_count,
+			      (flags & IFF_PROMISC) ? 1 : -1, __ATOMIC_RELAXED);
+	ifp->if_flags = flags;
+	pthread_mutex_unlock (&ifp->lock);
+      }
+    pthread_mutex_unlock (&flags_lock);
     break;
 
   case NET_ADDRESS:
@@ -187,6 +212,7 @@ vdev_setstat (struct vether_device *ifp, dev_flavor_t flavor,
       int addr_byte_count;
       int addr_int_count;
       int i;
+      char old_address[ETH_ALEN];
 
       addr_byte_count = ifp->if_address_size;
       addr_int_count = (addr_byte_count + (sizeof(int)-1)) / sizeof(int);
@@ -194,7 +220,14 @@ vdev_setstat (struct vether_device *ifp, dev_flavor_t flavor,
       if (count != addr_int_count)
 	return D_INVALID_SIZE;
 
+      pthread_mutex_lock (&ifp->lock);
+      memcpy (old_address, ifp->if_address, addr_byte_count);
       memcpy(ifp->if_address, status, addr_byte_count);
+      pthread_mutex_unlock (&ifp->lock);
+      /* Forwarding takes the address table lock before the device
+	 lock, so this must be done without the latter.  */
+      if (bridge_mode)
+	bridge_set_address (ifp, (char *) status, old_address);
       for (i = 0; i < addr_int_count; i++) {
 	int word;
 
@@ -99,17 +99,21 @@ ds_device_write (struct vether_device *vdev, mach_port_t reply_port,
 		 int *bytes_written)
 {
   kern_return_t ret = 0;
+  short flags;
   if (vdev == NULL)
     return D_NO_SUCH_DEVICE;
 
-  if ((vdev->if_flags & IFF_UP) == 0)
+  pthread_mutex_lock (&vdev->lock);
+  flags = vdev->if_flags;
+  pthread_mutex_unlock (&vdev->lock);
+  if ((flags & IFF_UP) == 0)
     return D_DEVICE_DOWN;
 
-  /* The packet is forwarded to all virtual interfaces and
-   * the interface which the multiplexer connects to. */
-  broadcast_pack (data, datalen, vdev);
+  /* The packet is forwarded to the other virtual interfaces and, unless
+   * its destination is known to be one of them, to the interface
+   * which the multiplexer connects to. */
   *bytes_written = datalen;
-  if(ether_port != MACH_PORT_NULL)
+  if (forward_pack (data, datalen, vdev) && ether_port != MACH_PORT_NULL)
     ret = device_write (ether_port, mode , recnum ,
 			data, datalen, bytes_written);
   /* The data in device_write() is transmifered out of line,
@@ -195,8 +199,10 @@ ds_device_set_filter (struct vether_device *vdev, mach_port_t receive_port,
     goto out;
   if (tmp != MACH_PORT_NULL)
     mach_port_deallocate (mach_task_self (), tmp);
+  pthread_mutex_lock (&vdev->lock);
   err = net_set_filter (&vdev->port_list, receive_port,
 			priority, filter, filterlen);
+  pthread_mutex_unlock (&vdev->lock);
 out:
   return err;
 }
@@ -59,6 +59,12 @@ static const struct argp_option options[] =
 {
     {"interface", 'i', "DEVICE", 0,
       "Network interface to use", 2},
+    {"switch", 's', 0, 0,
+      "Send unicast packets only to the interface behind which their "
+      "destination was seen, instead of to all interfaces", 2},
+    {"aging-time", 'a', "SECONDS", 0,
+      "In switch mode, forget addresses not seen for SECONDS "
+      "(default 300)", 2},
     {0}
 };
 
@@ -110,6 +116,18 @@ parse_opt (int opt, char *arg, struct argp_state *state)
     case 'i':
       device_file = arg;
       break;
+    case 's':
+      bridge_mode = 1;
+      break;
+    case 'a':
+      {
+	char *end;
+	long secs = strtol (arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || secs <= 0)
+	  argp_error (state, "%s: Invalid aging time", arg);
+	bridge_aging_time = secs;
+	break;
+      }
     case ARGP_KEY_ERROR:
     case ARGP_KEY_SUCCESS:
     case ARGP_KEY_INIT:
@@ -210,6 +228,11 @@ netfs_append_args (char **argz, size_t *argz_len)
          err = argz_add (argz, argz_len, buf); } } while (0)
   if (device_file)
     ADD_OPT ("--interface=%s", device_file);
+  if (bridge_mode)
+    {
+      ADD_OPT ("--switch");
+      ADD_OPT ("--aging-time=%d", bridge_aging_time);
+    }
 #undef ADD_OPT
   return err;
 }
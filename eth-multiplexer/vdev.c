@@ -43,9 +43,12 @@ static struct vether_device *dev_head;
 static int dev_num;
 
 /* This lock is only used to protected the virtual device list.
- * TODO every device structure should has its own lock to protect itself. */
+ * Every device structure has its own lock to protect itself. */
 static pthread_mutex_t dev_list_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Number of virtual devices in promiscuous mode.  */
+int vdev_promisc_count;
+
 mach_msg_type_t header_type =
 {
   MACH_MSG_TYPE_BYTE,
@@ -114,10 +117,12 @@ remove_dead_port_from_dev (mach_port_t dead_port)
   pthread_mutex_lock (&dev_list_lock);
   for (vdev = dev_head; vdev; vdev = vdev->next)
     {
+      pthread_mutex_lock (&vdev->lock);
       remove_dead_filter (&vdev->port_list,
 			  &vdev->port_list.if_rcv_port_list, dead_port);
       remove_dead_filter (&vdev->port_list,
 			  &vdev->port_list.if_snd_port_list, dead_port);
+      pthread_mutex_unlock (&vdev->lock);
     }
   pthread_mutex_unlock (&dev_list_lock);
   return 0;
@@ -139,6 +144,7 @@ add_vdev (char *name, size_t size)
 
   vdev->dev_port = ports_get_right (vdev);
   ports_port_deref (vdev);
+  pthread_mutex_init (&vdev->lock, NULL);
   strncpy (vdev->name, name, IFNAMSIZ-1);
   vdev->name[IFNAMSIZ-1] = '\0';
   vdev->if_header_size = ETH_HLEN;
@@ -158,9 +164,12 @@ add_vdev (char *name, size_t size)
   hash = hurd_ihash_hash32 (ether_address, ETH_ALEN, 0);
   hash = hurd_ihash_hash32 (name, strlen (name), hash);
   memcpy (&vdev->if_address[2], &hash, 4);
+  if (bridge_mode)
+    bridge_set_address (vdev, vdev->if_address, NULL);
 
   queue_init (&vdev->port_list.if_rcv_port_list);
   queue_init (&vdev->port_list.if_snd_port_list);
+  vdev->port_list.rcv_dispatch = NULL;
 
   pthread_mutex_lock (&dev_list_lock);
   vdev->next = dev_head;
@@ -181,6 +190,9 @@ destroy_vdev (void *port)
   struct vether_device *vdev = (struct vether_device *)port;
 
   debug ("device %s is going to be destroyed\n", vdev->name);
+  /* Nothing may be forwarded to it any more.  */
+  bridge_forget (vdev);
+
   /* Delete it from the virtual device list */
   pthread_mutex_lock (&dev_list_lock);
   *vdev->pprev = vdev->next;
@@ -191,15 +203,70 @@ destroy_vdev (void *port)
 
   /* TODO Delete all filters in the interface,
    * there shouldn't be any filters left */
+  pthread_mutex_lock (&vdev->lock);
+  if (vdev->if_flags & IFF_PROMISC)
+    __atomic_sub_fetch (&vdev_promisc_count, 1, __ATOMIC_RELAXED);
   destroy_filters (&vdev->port_list);
+  pthread_mutex_unlock (&vdev->lock);
+  pthread_mutex_destroy (&vdev->lock);
 }
 
-static int deliver_msg (struct net_rcv_msg *msg, struct vether_device *vdev);
+static int deliver_msg (struct net_rcv_msg *msg, struct vether_device *vdev,
+			short flags);
+
+/* Forward MSG, which comes from FROM_VDEV, or from the underlying
+ * network if FROM_VDEV is NULL, to the virtual interfaces.
+ * Return nonzero if it must also be sent to the underlying network. */
+static int
+forward (struct net_rcv_msg *msg, struct vether_device *from_vdev)
+{
+  struct ethhdr *header = (struct ethhdr *) msg->header;
+  struct vether_device *to = NULL;
+
+  int internal_deliver_msg (struct vether_device *vdev)
+    {
+      /* Skip the interface the packet is from.  */
+      if (from_vdev == vdev)
+	return 0;
+      /* Skip interfaces that are down.  */
+      return deliver_msg (msg, vdev, IFF_UP);
+    }
+
+  void deliver_known (struct vether_device *vdev)
+    {
+      to = vdev;
+      if (vdev)
+	internal_deliver_msg (vdev);
+    }
 
-/* Broadcast the packet to all virtual interfaces
- * except the one the packet is from */
+  int deliver_promisc (struct vether_device *vdev)
+    {
+      if (vdev == to || from_vdev == vdev)
+	return 0;
+      return deliver_msg (msg, vdev, IFF_UP | IFF_PROMISC);
+    }
+
+  if (bridge_mode)
+    {
+      bridge_learn ((char *) header->h_source, from_vdev);
+      if (bridge_forward ((char *) header->h_dest, deliver_known))
+	{
+	  /* Promiscuous interfaces still see everything.  */
+	  if (__atomic_load_n (&vdev_promisc_count, __ATOMIC_RELAXED) > 0)
+	    foreach_dev_do (deliver_promisc);
+	  return from_vdev != NULL && to == NULL;
+	}
+    }
+
+  /* Unknown destinations and group addresses are flooded.  */
+  foreach_dev_do (internal_deliver_msg);
+  return from_vdev != NULL;
+}
+
+/* Forward the packet sent by FROM_VDEV to the other virtual interfaces.
+ * Return nonzero if it must also be sent to the underlying network. */
 int
-broadcast_pack (char *data, int datalen, struct vether_device *from_vdev)
+forward_pack (char *data, int datalen, struct vether_device *from_vdev)
 {
   struct net_rcv_msg msg;
   int pack_size;
@@ -221,61 +288,36 @@ broadcast_pack (char *data, int datalen, struct vether_device *from_vdev)
   packet->length = pack_size + sizeof (struct packet_header);
   msg.packet_type.msgt_number = packet->length;
 
-  int internal_deliver_pack (struct vether_device *vdev)
-    {
-      /* Skip current interface.  */
-      if (from_vdev == vdev)
-	return 0;
-      /* Skip interfaces that are down.  */
-      if ((vdev->if_flags & IFF_UP) == 0)
-        return 0;
-      return deliver_msg (&msg, vdev);
-    }
-
-  return foreach_dev_do (internal_deliver_pack);
+  return forward (&msg, from_vdev);
 }
 
-/* Broadcast the message to all virtual interfaces. */
+/* Forward the message from the underlying network to the virtual
+ * interfaces. */
 int
-broadcast_msg (struct net_rcv_msg *msg)
+forward_msg (struct net_rcv_msg *msg)
 {
-  int rval = 0;
   mach_msg_header_t header;
 
-  int internal_deliver_msg (struct vether_device *vdev)
-    {
-      /* Skip interfaces that are down.  */
-      if ((vdev->if_flags & IFF_UP) == 0)
-        return 0;
-      return deliver_msg (msg, vdev);
-    }
-
   /* Save the message header because deliver_msg will change it. */
   header = msg->msg_hdr;
-  rval = foreach_dev_do (internal_deliver_msg);
+  forward (msg, NULL);
   msg->msg_hdr = header;
-  return rval;
+  return 0;
 }
 
 /*
  * Deliver the message to all right pfinet servers that
- * connects to the virtual network interface.
+ * connects to the virtual network interface, if it has
+ * all of FLAGS set.
  */
 static int
-deliver_msg(struct net_rcv_msg *msg, struct vether_device *vdev)
+deliver_msg(struct net_rcv_msg *msg, struct vether_device *vdev, short flags)
 {
   mach_msg_return_t err;
-  queue_head_t *if_port_list;
-  net_rcv_port_t infp, nextfp;
+  net_rcv_port_t *fps;
+  int i, n;
 
-  msg->msg_hdr.msgh_bits = MACH_MSGH_BITS (MACH_MSG_TYPE_COPY_SEND, 0);
-  /* remember message sizes must be rounded up */
-  msg->msg_hdr.msgh_local_port = MACH_PORT_NULL;
-  msg->msg_hdr.msgh_kind = MACH_MSGH_KIND_NORMAL;
-  msg->msg_hdr.msgh_id = NET_RCV_MSG_ID;
-
-  if_port_list = &vdev->port_list.if_rcv_port_list;
-  FILTER_ITERATE (if_port_list, infp, nextfp, &infp->input)
+  void deliver_to (net_rcv_port_t infp)
     {
       mach_port_t dest;
       net_hash_entry_t entp, *hash_headp;
@@ -308,8 +350,37 @@ deliver_msg(struct net_rcv_msg *msg, struct vether_device *vdev)
 	  debug ("after delivering the packet\n");
 	}
     }
-  FILTER_ITERATE_END
 
-    return 0;
+  msg->msg_hdr.msgh_bits = MACH_MSGH_BITS (MACH_MSG_TYPE_COPY_SEND, 0);
+  /* remember message sizes must be rounded up */
+  msg->msg_hdr.msgh_local_port = MACH_PORT_NULL;
+  msg->msg_hdr.msgh_kind = MACH_MSGH_KIND_NORMAL;
+  msg->msg_hdr.msgh_id = NET_RCV_MSG_ID;
+
+  /* The flags, the filters and their index change under this lock.  */
+  pthread_mutex_lock (&vdev->lock);
+  if ((vdev->if_flags & flags) != flags)
+    {
+      pthread_mutex_unlock (&vdev->lock);
+      return 0;
+    }
+  /* Only run the filters that may accept this frame.  */
+  n = net_dispatch (&vdev->port_list,
+		    msg->packet + sizeof (struct packet_header),
+		    msg->header, sizeof (struct ethhdr), &fps);
+  if (n < 0)
+    {
+      /* There is no index; try them all.  */
+      net_rcv_port_t infp, nextfp;
+      FILTER_ITERATE (&vdev->port_list.if_rcv_port_list, infp, nextfp,
+		      &infp->input)
+	deliver_to (infp);
+      FILTER_ITERATE_END
+    }
+  for (i = 0; i < n; i++)
+    deliver_to (fps[i]);
+  pthread_mutex_unlock (&vdev->lock);
+
+  return 0;
 }
 
@@ -22,6 +22,7 @@
 #define VDEV_H
 
 #include <net/if.h>
+#include <pthread.h>
 
 #include <hurd.h>
 #include <mach.h>
@@ -56,6 +57,8 @@ struct vether_device
   struct vether_device *next;
   struct vether_device **pprev;
 
+  /* Protects the filters and the if_* fields that can change.  */
+  pthread_mutex_t lock;
   if_filter_list_t port_list;
 };
 
@@ -68,11 +71,22 @@ int remove_dead_port_from_dev (mach_port_t dead_port);
 struct vether_device *add_vdev (char *name, size_t size);
 void destroy_vdev (void *port);
 boolean_t all_dev_close ();
-int broadcast_pack (char *data, int datalen, struct vether_device *from_vdev);
-int broadcast_msg (struct net_rcv_msg *msg);
+int forward_pack (char *data, int datalen, struct vether_device *from_vdev);
+int forward_msg (struct net_rcv_msg *msg);
 int get_dev_num ();
 int foreach_dev_do (dev_act_func func);
 
+extern int vdev_promisc_count;
+
+/* bridge.c */
+extern int bridge_mode;
+extern int bridge_aging_time;
+void bridge_learn (const char *addr, struct vether_device *vdev);
+void bridge_set_address (struct vether_device *vdev, const char *addr,
+			 const char *old_addr);
+void bridge_forget (struct vether_device *vdev);
+int bridge_forward (const char *addr, void (*func) (struct vether_device *));
+
 /* dev_stat.c */
 io_return_t dev_getstat (struct vether_device *, dev_flavor_t,
                          dev_status_t, natural_t *);
@@ -18,6 +18,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
+#include <stdlib.h>
 #include <string.h>
 #include <error.h>
 #include <limits.h>
@@ -53,16 +54,31 @@ cluster_t nr_of_clusters;
 /* Hold this lock while converting times using gmtime.  */
 pthread_spinlock_t epoch_to_time_lock = PTHREAD_SPINLOCK_INITIALIZER;
 
-/* Hold this lock while allocating a new cluster in the FAT.  */
-pthread_spinlock_t allocate_free_cluster_lock = PTHREAD_SPINLOCK_INITIALIZER;
+/* Hold this lock while allocating a new cluster in the FAT, or while
+   using the free cluster map.  */
+pthread_mutex_t allocate_free_cluster_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* Where to look for the next free cluster. This is meant to avoid
    searching through a nearly full file system from the beginning at
-   every request.  It would be better to use the field of the same
+   every request, and to keep the clusters of a growing file
+   contiguous.  It would be better to use the field of the same
    name in the fs_info block. 2 is the first data cluster in any
    FAT.  */
 cluster_t next_free_cluster = 2;
 
+/* A bitmap of the free clusters, with the bit of cluster N set if it is
+   free, and their number.  The map is built from the FAT the first
+   time it is needed, and is then kept up to date by
+   fat_write_next_cluster.  */
+#define BITS_PER_MAP_WORD (sizeof (unsigned long) * CHAR_BIT)
+static unsigned long *free_cluster_map;
+static cluster_t nr_of_free_clusters;
+
+/* Set if the map could not be allocated when it was last built.  Until
+   fat_get_freespace builds it again, clusters are found by reading the
+   FAT.  */
+static int free_cluster_map_failed;
+
 
 /* Read the superblock.  */
 void
@@ -204,11 +220,101 @@ fat_read_sblock (void)
 }
 
 
-/* Write NEXT_CLUSTER in the FAT at position CLUSTER.
-   You must call this from inside diskfs_catch_exception.
-   Returns 0 (always succeeds).  */
-error_t
-fat_write_next_cluster(cluster_t cluster, cluster_t next_cluster)
+static inline int
+cluster_is_free (cluster_t cluster)
+{
+  return (free_cluster_map[cluster / BITS_PER_MAP_WORD]
+	  >> (cluster % BITS_PER_MAP_WORD)) & 1;
+}
+
+/* Record in the free cluster map whether CLUSTER is FREE.  Hold
+   ALLOCATE_FREE_CLUSTER_LOCK.  */
+static void
+mark_cluster (cluster_t cluster, int free)
+{
+  unsigned long bit = 1UL << (cluster % BITS_PER_MAP_WORD);
+
+  if (free == cluster_is_free (cluster))
+    return;
+
+  free_cluster_map[cluster / BITS_PER_MAP_WORD] ^= bit;
+  if (free)
+    nr_of_free_clusters++;
+  else
+    nr_of_free_clusters--;
+}
+
+/* Return the first free cluster from START to END - 1, or END if there
+   is none.  Hold ALLOCATE_FREE_CLUSTER_LOCK, and call this from inside
+   diskfs_catch_exception.  */
+static cluster_t
+find_free_cluster (cluster_t start, cluster_t end)
+{
+  if (!free_cluster_map)
+    {
+      /* There was no memory for the map; read the FAT instead.  */
+      for (; start < end; start++)
+	{
+	  cluster_t next_cluster;
+
+	  fat_get_next_cluster (start, &next_cluster);
+	  if (next_cluster == FAT_FREE_CLUSTER)
+	    break;
+	}
+      return start;
+    }
+
+  while (start < end)
+    {
+      unsigned long word = free_cluster_map[start / BITS_PER_MAP_WORD]
+			   >> (start % BITS_PER_MAP_WORD);
+
+      if (word)
+	{
+	  start += ffsl (word) - 1;
+	  return start < end ? start : end;
+	}
+
+      start = (start / BITS_PER_MAP_WORD + 1) * BITS_PER_MAP_WORD;
+    }
+
+  return end;
+}
+
+/* Count the free clusters in the FAT into NR_OF_FREE_CLUSTERS, and
+   build FREE_CLUSTER_MAP unless memory is short.  Hold
+   ALLOCATE_FREE_CLUSTER_LOCK, and call this from inside
+   diskfs_catch_exception.  */
+static void
+scan_free_clusters (void)
+{
+  size_t words = (nr_of_clusters + 2 + BITS_PER_MAP_WORD - 1)
+		 / BITS_PER_MAP_WORD;
+  unsigned long *map = calloc (words, sizeof *map);
+  cluster_t cluster, next_cluster;
+
+  nr_of_free_clusters = 0;
+
+  /* First cluster is the 3rd entry in the FAT table.  */
+  for (cluster = 2; cluster < nr_of_clusters + 2; cluster++)
+    {
+      fat_get_next_cluster (cluster, &next_cluster);
+      if (next_cluster == FAT_FREE_CLUSTER)
+	{
+	  nr_of_free_clusters++;
+	  if (map)
+	    map[cluster / BITS_PER_MAP_WORD]
+	      |= 1UL << (cluster % BITS_PER_MAP_WORD);
+	}
+    }
+
+  free_cluster_map = map;
+  free_cluster_map_failed = !map;
+}
+
+/* Write NEXT_CLUSTER in the FAT at position CLUSTER.  */
+static void
+write_fat_entry (cluster_t cluster, cluster_t next_cluster)
 {
   loff_t fat_entry_offset;
   cluster_t data;
@@ -254,6 +360,19 @@ fat_write_next_cluster(cluster_t cluster, cluster_t next_cluster)
       fat_entry_offset = cluster * 4;
       write_dword (fat_image + fat_entry_offset, next_cluster & 0x0fffffff);
     }
+}
+
+/* Write NEXT_CLUSTER in the FAT at position CLUSTER.
+   You must call this from inside diskfs_catch_exception.
+   Returns 0 (always succeeds).  */
+error_t
+fat_write_next_cluster(cluster_t cluster, cluster_t next_cluster)
+{
+  pthread_mutex_lock (&allocate_free_cluster_lock);
+  write_fat_entry (cluster, next_cluster);
+  if (free_cluster_map)
+    mark_cluster (cluster, next_cluster == FAT_FREE_CLUSTER);
+  pthread_mutex_unlock (&allocate_free_cluster_lock);
 
   return 0;
 }
@@ -317,49 +436,71 @@ error_t
 fat_allocate_cluster (cluster_t content, cluster_t *cluster)
 {
   error_t err = 0;
-  cluster_t old_next_free_cluster;
-  int wrapped = 0;
-  cluster_t found_cluster = FAT_FREE_CLUSTER;
+  cluster_t end = nr_of_clusters + 2;
+  cluster_t found_cluster;
 
   assert_backtrace (content != FAT_FREE_CLUSTER);
 
-  pthread_spin_lock (&allocate_free_cluster_lock);
-  old_next_free_cluster = next_free_cluster;
+  pthread_mutex_lock (&allocate_free_cluster_lock);
 
-  /* Loop over all clusters, starting from next_free_cluster and
-     wrapping if reaching the end of the FAT, until we either find an
-     unallocated cluster, or we have to give up because all clusters
-     are allocated.  */
-  do
-    {
-      cluster_t next_free_content;
+  /* If memory was short when the map was last built, do without it
+     rather than scan the whole FAT again for every cluster.  */
+  if (!free_cluster_map && !free_cluster_map_failed)
+    scan_free_clusters ();
 
-      fat_get_next_cluster (next_free_cluster, &next_free_content);
-
-      if (next_free_content == FAT_FREE_CLUSTER)
-	found_cluster = next_free_cluster;
-
-      if (++next_free_cluster == nr_of_clusters + 2)
-	{
-	  next_free_cluster = 2;
-	  wrapped = 1;
-	}
+  /* Search the map from next_free_cluster on, and then wrap to the
+     beginning of the FAT.  */
+  found_cluster = find_free_cluster (next_free_cluster, end);
+  if (found_cluster == end)
+    {
+      found_cluster = find_free_cluster (2, next_free_cluster);
+      if (found_cluster == next_free_cluster)
+	found_cluster = end;
     }
-  while (found_cluster == FAT_FREE_CLUSTER
-	 && !(wrapped && next_free_cluster == old_next_free_cluster));
 
-  if (found_cluster != FAT_FREE_CLUSTER)
+  if (found_cluster != end)
     {
       *cluster = found_cluster;
-      fat_write_next_cluster(found_cluster, content);
+      write_fat_entry (found_cluster, content);
+      if (free_cluster_map)
+	mark_cluster (found_cluster, 0);
+      next_free_cluster = found_cluster + 1;
+      if (next_free_cluster == end)
+	next_free_cluster = 2;
     }
-  else 
+  else
     err = ENOSPC;
 
-  pthread_spin_unlock (&allocate_free_cluster_lock);
+  pthread_mutex_unlock (&allocate_free_cluster_lock);
   return err;
 }
 
+/* Return the index of the extent of NODE holding cluster CLUSTER of the
+   file, which must be in the chain read so far.  Hold NODE's
+   CHAIN_EXTENSION_LOCK, or its ALLOC_LOCK for writing.  */
+static size_t
+find_extent (struct disknode *dn, cluster_t cluster)
+{
+  size_t lo = 0, hi = dn->nr_extents;
+
+  assert_backtrace (cluster < dn->length_of_chain);
+
+  /* Find the last extent starting at or before CLUSTER.  */
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (dn->extents[mid].offset <= cluster)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  assert_backtrace (cluster - dn->extents[lo].offset
+		    < dn->extents[lo].length);
+  return lo;
+}
+
 /* Extend the cluster chain to maximum size or new_last_cluster,
    whatever is less. If we reach the end of the file, and CREATE is
    true, allocate new blocks until there is either no space on the
@@ -370,50 +511,65 @@ fat_extend_chain (struct node *node, cluster_t new_last_cluster, int create)
 {
   error_t err = 0;
   struct disknode *dn = node->dn;
-  struct cluster_chain *table;
-  int offs;
+  struct cluster_extent *last;
   cluster_t left, prev_cluster, cluster;
 
-  error_t allocate_new_table(struct cluster_chain **table)
+  /* Add CLUSTER at the end of the chain, growing the last extent if
+     CLUSTER follows it on disk.  */
+  error_t append_cluster (cluster_t cluster)
     {
-      struct cluster_chain *t;
-
-      t = *table;
-      *table = malloc (sizeof (struct cluster_chain));
-      if (!*table)
-	return ENOMEM;
-      (*table)->next = 0;
-      if (t)
-	dn->last = t->next = *table;
-      else
-	dn->last = dn->first = *table;
+      struct cluster_extent *e;
+
+      if (dn->nr_extents > 0)
+	{
+	  e = &dn->extents[dn->nr_extents - 1];
+	  if (e->disk_cluster + e->length == cluster)
+	    {
+	      e->length++;
+	      dn->length_of_chain++;
+	      return 0;
+	    }
+	}
+
+      if (dn->nr_extents == dn->extents_alloced)
+	{
+	  size_t n = dn->extents_alloced ? 2 * dn->extents_alloced : 4;
+
+	  e = realloc (dn->extents, n * sizeof *e);
+	  if (!e)
+	    return ENOMEM;
+	  dn->extents = e;
+	  dn->extents_alloced = n;
+	}
+
+      e = &dn->extents[dn->nr_extents++];
+      e->offset = dn->length_of_chain;
+      e->disk_cluster = cluster;
+      e->length = 1;
+      dn->length_of_chain++;
       return 0;
     }
-  
-  pthread_spin_lock (&dn->chain_extension_lock);
+
+  pthread_rwlock_wrlock (&dn->chain_extension_lock);
 
   /* If we already have what we need, or we have all clusters that are
      available without allocating new ones, go out.  */
   if (new_last_cluster < dn->length_of_chain
       || (!create && dn->chain_complete))
     {
-      pthread_spin_unlock (&dn->chain_extension_lock);
+      pthread_rwlock_unlock (&dn->chain_extension_lock);
       return 0;
     }
 
   left = new_last_cluster + 1 - dn->length_of_chain;
 
-  table = dn->last;
-  if (table)
+  if (dn->nr_extents > 0)
     {
-      offs = (dn->length_of_chain - 1) & (CLUSTERS_PER_TABLE - 1);
-      prev_cluster = table->cluster[offs];
+      last = &dn->extents[dn->nr_extents - 1];
+      prev_cluster = last->disk_cluster + last->length - 1;
     }
   else
-    {
-      offs = CLUSTERS_PER_TABLE - 1;
-      prev_cluster = FAT_FREE_CLUSTER;
-    }
+    prev_cluster = FAT_FREE_CLUSTER;
 
    while (left)
      {
@@ -444,23 +600,16 @@ fat_extend_chain (struct node *node, cluster_t new_last_cluster, int create)
 	     }
 	 }
        prev_cluster = cluster;
-       offs++;
-       if (offs == CLUSTERS_PER_TABLE)
-	 {
-	   offs = 0;
-	   err = allocate_new_table(&table);
-	   if (err)
-	     break;
-	 }
-       table->cluster[offs] = cluster;
-       dn->length_of_chain++;
+       err = append_cluster (cluster);
+       if (err)
+	 break;
        left--;
      }
 
    if (dn->length_of_chain << log2_bytes_per_cluster > node->allocsize)
      node->allocsize = dn->length_of_chain << log2_bytes_per_cluster;
 
-   pthread_spin_unlock (&dn->chain_extension_lock);
+   pthread_rwlock_unlock (&dn->chain_extension_lock);
    return err;
 }
    
@@ -472,9 +621,8 @@ fat_getcluster (struct node *node, cluster_t cluster, int create,
 		cluster_t *disk_cluster)
 {
   error_t err = 0;
-  cluster_t chains_to_go = cluster >> LOG2_CLUSTERS_PER_TABLE;
-  cluster_t offs = cluster & (CLUSTERS_PER_TABLE - 1);
-  struct cluster_chain *chain;
+  struct disknode *dn = node->dn;
+  struct cluster_extent *e;
 
   if (cluster >= node->dn->length_of_chain)
     {
@@ -487,24 +635,22 @@ fat_getcluster (struct node *node, cluster_t cluster, int create,
 	  return EINVAL;
 	}
     }
-  chain = node->dn->first;
-  while (chains_to_go--)
-    {
-      assert_backtrace (chain);
-      chain = chain->next;
-    }
-  assert_backtrace (chain);
-  *disk_cluster = chain->cluster[offs];
+
+  /* The extents may be reallocated by a concurrent fat_extend_chain.  */
+  pthread_rwlock_rdlock (&dn->chain_extension_lock);
+  e = &dn->extents[find_extent (dn, cluster)];
+  *disk_cluster = e->disk_cluster + (cluster - e->offset);
+  pthread_rwlock_unlock (&dn->chain_extension_lock);
   return 0;
 }
 
 void
 fat_truncate_node (struct node *node, cluster_t clusters_to_keep)
 {
-  struct cluster_chain *next;
-  cluster_t count;
+  struct disknode *dn = node->dn;
+  struct cluster_extent *e;
+  size_t first, i;
   cluster_t offs;
-  cluster_t pos;
 
   /* The root dir of a FAT12/16 fs is of fixed size, while the root
      dir of a FAT32 fs must never decease to exist.  */
@@ -513,77 +659,52 @@ fat_truncate_node (struct node *node, cluster_t clusters_to_keep)
 
   /* Expand the cluster chain, because we have to know the complete tail.  */
   fat_extend_chain (node, FAT_EOC, 0);
-  if (clusters_to_keep == node->dn->length_of_chain)
+  if (clusters_to_keep == dn->length_of_chain)
     return;
-  assert_backtrace (clusters_to_keep < node->dn->length_of_chain);
+  assert_backtrace (clusters_to_keep < dn->length_of_chain);
 
   /* Truncation happens here.  */
-  next = node->dn->first;
+  first = find_extent (dn, clusters_to_keep);
+  e = &dn->extents[first];
+  offs = clusters_to_keep - e->offset;
   if (clusters_to_keep == 0)
-    {
-      /* Deallocate the complete file.  */
-      node->dn->start_cluster = 0;
-      pos = count = offs = 0;
-      node->dn->last = 0;
-    }
+    /* Deallocate the complete file.  */
+    dn->start_cluster = 0;
+  else if (offs > 0)
+    fat_write_next_cluster (e->disk_cluster + offs - 1, FAT_EOC);
   else
-    {
-      count = (clusters_to_keep - 1) >> LOG2_CLUSTERS_PER_TABLE;
-      offs = (clusters_to_keep - 1) & (CLUSTERS_PER_TABLE - 1);
-      while (count-- > 0)
-	{
-	  assert_backtrace (next);
-
-	  /* This cluster is now the last cluster in the chain.  */
-	  if (count == 0)
-	    node->dn->last = next;
-
-	  next = next->next;
-	}
-      assert_backtrace (next);
-      fat_write_next_cluster (next->cluster[offs++], FAT_EOC);
-      pos = clusters_to_keep;
-    }
+    fat_write_next_cluster (e[-1].disk_cluster + e[-1].length - 1, FAT_EOC);
 
   /* Purge dangling clusters. If we die here, scandisk will have to
      clean up the remains.  */
-  while (pos < node->dn->length_of_chain)
-    {
-      if (offs == CLUSTERS_PER_TABLE)
-	{
-	  offs = 0;
-	  next = next->next;
-	  assert_backtrace (next);
-	}
-      fat_write_next_cluster(next->cluster[offs++], 0);
-      pos++;
-    }
- 
-  /* Free now unused tables.  (Could be done in one run with the above.)  */
-  next = node->dn->first;
-  if (clusters_to_keep != 0)
-    {
-      count = (clusters_to_keep - 1) >> LOG2_CLUSTERS_PER_TABLE;
-      offs = (clusters_to_keep - 1) & (CLUSTERS_PER_TABLE - 1);
-      while (count-- > 0)
-	{
-	  assert_backtrace (next);
-	  next = next->next;
-	}
-      assert_backtrace (next);
-      next = next->next;
-    }
-  while (next)
+  for (i = first; i < dn->nr_extents; i++, offs = 0)
+    for (; offs < dn->extents[i].length; offs++)
+      fat_write_next_cluster (dn->extents[i].disk_cluster + offs, 0);
+
+  /* Drop the extents of the purged clusters.  */
+  if (clusters_to_keep > e->offset)
     {
-      struct cluster_chain *next_next = next->next;
-      free (next);
-      next = next_next;
+      e->length = clusters_to_keep - e->offset;
+      dn->nr_extents = first + 1;
     }
+  else
+    dn->nr_extents = first;
 
-  if (clusters_to_keep == 0)
-    node->dn->first = 0;
-  
-  node->dn->length_of_chain = clusters_to_keep; 
+  dn->length_of_chain = clusters_to_keep;
+}
+
+/* Forget the part of the cluster chain of NODE read so far.  */
+void
+fat_drop_chain (struct node *node)
+{
+  struct disknode *dn = node->dn;
+
+  free (dn->extents);
+  dn->extents = 0;
+  dn->nr_extents = 0;
+  dn->extents_alloced = 0;
+  dn->length_of_chain = 0;
+  dn->chain_complete = 0;
 }
 
 
@@ -592,23 +713,22 @@ int
 fat_get_freespace (void)
 {
   int free_clusters = 0;
-  cluster_t curr_cluster;
-  cluster_t next_cluster;
   error_t err;
 
-  err = diskfs_catch_exception ();
-  if (!err)
+  pthread_mutex_lock (&allocate_free_cluster_lock);
+  if (free_cluster_map)
+    free_clusters = nr_of_free_clusters;
+  else
     {
-      /* First cluster is the 3rd entry in the FAT table.  */
-      for (curr_cluster = 2; curr_cluster < nr_of_clusters + 2;
-	   curr_cluster++)
+      err = diskfs_catch_exception ();
+      if (!err)
 	{
-	  fat_get_next_cluster (curr_cluster, &next_cluster);
-	  if (next_cluster == FAT_FREE_CLUSTER)
-	    free_clusters++;
+	  scan_free_clusters ();
+	  free_clusters = nr_of_free_clusters;
 	}
+      diskfs_end_catch_exception ();
     }
-  diskfs_end_catch_exception ();
+  pthread_mutex_unlock (&allocate_free_cluster_lock);
 
   return free_clusters;
 }
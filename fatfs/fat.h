@@ -307,13 +307,14 @@ extern size_t bytes_per_cluster;
 /* A cluster number.  */
 typedef unsigned long cluster_t;
 
-#define LOG2_CLUSTERS_PER_TABLE 10
-#define CLUSTERS_PER_TABLE (1 << LOG2_CLUSTERS_PER_TABLE)
-
-struct cluster_chain
+/* A run of clusters which are contiguous both in a file and on disk:
+   clusters OFFSET to OFFSET + LENGTH - 1 of the file are the disk
+   clusters DISK_CLUSTER to DISK_CLUSTER + LENGTH - 1.  */
+struct cluster_extent
 {
-  struct cluster_chain *next;
-  cluster_t cluster[CLUSTERS_PER_TABLE];
+  cluster_t offset;
+  cluster_t disk_cluster;
+  cluster_t length;
 };
 
 /* Prototyping.  */
@@ -323,6 +324,7 @@ void fat_from_epoch (unsigned char *, unsigned char *, time_t *);
 error_t fat_getcluster (struct node *, cluster_t, int, cluster_t *);
 void fat_truncate_node (struct node *, cluster_t);
 error_t fat_extend_chain (struct node *, cluster_t, int);
+void fat_drop_chain (struct node *);
 int fat_get_freespace (void);
 
 /* Unprocessed superblock.  */
@@ -52,12 +52,18 @@ struct disknode
   /* Lock to hold while fiddling with this inode's block allocation
      info.  */
   pthread_rwlock_t alloc_lock;
-  /* Lock to hold while extending this inode's block allocation info.
+  /* Lock to hold for writing while extending this inode's block
+     allocation info, and for reading while looking up a cluster in it.
      Hold only if you hold readers alloc_lock, then you don't need to
-     hold it if you hold writers alloc_lock already.  */
-  pthread_spinlock_t chain_extension_lock;
-  struct cluster_chain *first;
-  struct cluster_chain *last;
+     hold it if you hold writers alloc_lock already.  Extending the chain
+     may allocate clusters, which can block, so this is not a
+     spinlock.  */
+  pthread_rwlock_t chain_extension_lock;
+  /* The part of the cluster chain read so far, as NR_EXTENTS extents
+     sorted by offset in the file.  */
+  struct cluster_extent *extents;
+  size_t nr_extents;
+  size_t extents_alloced;
   cluster_t length_of_chain;
   int chain_complete;
 
@@ -0,0 +1,249 @@
+/* Test the default pager's access to paging files made of several runs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* This is linked with the default pager's setup.o.  The device is kept
+   in memory, and the paging file is made of runs whose lengths are not
+   multiples of the page size, so that pages and clusters straddle
+   them.  */
+
+#include <mach.h>
+#include <device/device.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mach-defpager/file_io.h"
+
+#define RECORD_SIZE	512
+#define DEVICE_RECORDS	1024
+
+/* Start and length of each run, in records.  */
+static const recnum_t runs[] = { 100, 12, 300, 20, 10, 9, 500, 40, 700, 3 };
+#define NRUNS	(sizeof runs / sizeof runs[0] / 2)
+
+static char device[DEVICE_RECORDS * RECORD_SIZE];
+static int failures;
+
+#define CHECK(cond)							\
+  do {									\
+    if (! (cond))							\
+      {									\
+	fprintf (stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+	failures++;							\
+      }									\
+  } while (0)
+
+kern_return_t S_default_pager_paging_storage (mach_port_t pager,
+					      mach_port_t device,
+					      const recnum_t *runs,
+					      mach_msg_type_number_t nrun,
+					      const char *name,
+					      boolean_t add);
+
+/* What setup.o needs from the rest of the default pager.  */
+
+mach_port_t default_pager_default_port = 1;
+static struct file_direct *paging_file;
+
+void
+create_paging_partition (const char *name, struct file_direct *fdp,
+			 int isa_file, int linux_signature)
+{
+  paging_file = fdp;
+}
+
+kern_return_t
+destroy_paging_partition (const char *name, void **pp_private)
+{
+  return KERN_INVALID_ARGUMENT;
+}
+
+/* The device.  */
+
+/* Return nonzero if the records from RECNUM for COUNT bytes are all in
+   the same run.  */
+static int
+in_one_run (recnum_t recnum, size_t count)
+{
+  size_t i;
+
+  for (i = 0; i < NRUNS; i++)
+    if (recnum >= runs[2 * i]
+	&& recnum + count / RECORD_SIZE <= runs[2 * i] + runs[2 * i + 1])
+      return 1;
+  return 0;
+}
+
+kern_return_t
+device_get_status (device_t dev, dev_flavor_t flavor,
+		   dev_status_t status, mach_msg_type_number_t *count)
+{
+  if (flavor != DEV_GET_RECORDS || *count < DEV_GET_RECORDS_COUNT)
+    return D_INVALID_OPERATION;
+  status[DEV_GET_RECORDS_DEVICE_RECORDS] = DEVICE_RECORDS;
+  status[DEV_GET_RECORDS_RECORD_SIZE] = RECORD_SIZE;
+  *count = DEV_GET_RECORDS_COUNT;
+  return 0;
+}
+
+kern_return_t
+device_write (device_t dev, dev_mode_t mode, recnum_t recnum,
+	      io_buf_ptr_t data, mach_msg_type_number_t count, int *written)
+{
+  CHECK (count > 0 && count % RECORD_SIZE == 0);
+  CHECK (in_one_run (recnum, count));
+  memcpy (device + recnum * RECORD_SIZE, data, count);
+  *written = count;
+  return 0;
+}
+
+kern_return_t
+device_read (device_t dev, dev_mode_t mode, recnum_t recnum,
+	     int wanted, io_buf_ptr_t *data, mach_msg_type_number_t *count)
+{
+  vm_address_t buf;
+
+  CHECK (wanted > 0 && wanted % RECORD_SIZE == 0);
+  CHECK (in_one_run (recnum, wanted));
+  if (vm_allocate (mach_task_self (), &buf, round_page (wanted), 1))
+    return D_NO_MEMORY;
+  memcpy ((void *) buf, device + recnum * RECORD_SIZE, wanted);
+  *data = (io_buf_ptr_t) buf;
+  *count = wanted;
+  return 0;
+}
+
+/* Return where record RECORD of the paging file is on the device.  */
+static char *
+file_record (recnum_t record)
+{
+  size_t i;
+
+  for (i = 0; record >= runs[2 * i + 1]; i++)
+    record -= runs[2 * i + 1];
+  return device + (runs[2 * i] + record) * RECORD_SIZE;
+}
+
+/* Write NPAGES pages of PATTERN at page PAGE of the paging file, as
+   default_write does.  */
+static void
+write_cluster (vm_offset_t page, int npages, char pattern)
+{
+  vm_size_t size = npages * vm_page_size, written;
+  vm_offset_t offset = page * vm_page_size;
+  char *buf = malloc (size), *addr = buf;
+  int turns = 0;
+
+  memset (buf, pattern, size);
+  while (size > 0)
+    {
+      if (++turns > npages + 1
+	  || page_write_file_direct (paging_file, offset, (vm_offset_t) addr,
+				     size, &written)
+	  || written == 0 || written > size)
+	{
+	  fprintf (stderr, "cannot write %d pages at page %lu\n",
+		   npages, (unsigned long) page);
+	  failures++;
+	  break;
+	}
+      addr += written;
+      offset += written;
+      size -= written;
+    }
+  free (buf);
+}
+
+/* Check that page PAGE of the paging file holds PATTERN, on the device
+   and as read back.  */
+static void
+check_page (vm_offset_t page, char pattern)
+{
+  recnum_t records = vm_page_size / RECORD_SIZE, i;
+  vm_address_t addr;
+  vm_size_t size;
+  size_t j;
+
+  for (i = 0; i < records; i++)
+    for (j = 0; j < RECORD_SIZE; j++)
+      if (file_record (page * records + i)[j] != pattern)
+	{
+	  fprintf (stderr, "page %lu not written\n", (unsigned long) page);
+	  failures++;
+	  return;
+	}
+
+  if (page_read_file_direct (paging_file, page * vm_page_size,
+			     vm_page_size, &addr, &size)
+      || size != vm_page_size)
+    {
+      fprintf (stderr, "cannot read page %lu\n", (unsigned long) page);
+      failures++;
+      return;
+    }
+  for (j = 0; j < size; j++)
+    if (((char *) addr)[j] != pattern)
+      {
+	fprintf (stderr, "page %lu read wrong\n", (unsigned long) page);
+	failures++;
+	break;
+      }
+  vm_deallocate (mach_task_self (), addr, size);
+}
+
+int
+main (int argc, char **argv)
+{
+  vm_offset_t npages, page;
+  int n;
+
+  if (vm_page_size % RECORD_SIZE != 0)
+    {
+      printf ("SKIP: pages are not made of whole records\n");
+      return 0;
+    }
+
+  CHECK (S_default_pager_paging_storage (default_pager_default_port, 2,
+					 runs, 2 * NRUNS, "test", 1) == 0);
+  if (! paging_file)
+    {
+      printf ("FAIL: no paging file\n");
+      return 1;
+    }
+  CHECK (paging_file->nruns == NRUNS);
+  npages = paging_file->fd_size / (vm_page_size / RECORD_SIZE);
+
+  /* Clusters of every size from every page, each over the last.  */
+  for (n = 1; n <= npages; n++)
+    for (page = 0; page + n <= npages; page++)
+      {
+	vm_offset_t i;
+
+	write_cluster (page, n, (char) (n * 16 + page));
+	for (i = page; i < page + n; i++)
+	  check_page (i, (char) (n * 16 + page));
+      }
+
+  if (failures)
+    {
+      printf ("FAIL: %d checks failed\n", failures);
+      return 1;
+    }
+  printf ("PASS\n");
+  return 0;
+}
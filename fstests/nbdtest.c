@@ -0,0 +1,408 @@
+/* Test the nbd store against a stand-in server
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* The server runs in a thread of this program and serves an export kept
+   in memory.  It answers the requests it has received in reverse order,
+   so that replies are matched to requests by handle, and it sends the
+   data of structured replies out of order and as holes.  */
+
+#include <errno.h>
+#include <error.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <byteswap.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <hurd/store.h>
+
+#if BYTE_ORDER == BIG_ENDIAN
+# define htonll(x)	(x)
+#else
+# define htonll(x)	(bswap_64 (x))
+#endif
+#define ntohll htonll
+
+#define EXPORT_SIZE	(4 * 1024 * 1024)
+#define BLOCK_SIZE	512
+
+/* How the server behaves.  */
+enum mode
+{
+  OLDSTYLE,			/* old-style handshake, simple replies */
+  NEWSTYLE,			/* fixed new-style, structured replies */
+  BAD,				/* like NEWSTYLE, but sends data for writes */
+};
+
+static enum mode mode;
+static char *export;
+
+struct request
+{
+  uint32_t magic;
+  uint32_t type;
+  uint64_t handle;
+  uint64_t from;
+  uint32_t len;
+} __attribute__ ((packed));
+
+struct chunk
+{
+  uint32_t magic;
+  uint16_t flags;
+  uint16_t type;
+  uint64_t handle;
+  uint32_t length;
+} __attribute__ ((packed));
+
+static void
+get (int fd, void *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t cc = read (fd, buf, len);
+      if (cc <= 0)
+	pthread_exit (NULL);
+      buf += cc;
+      len -= cc;
+    }
+}
+
+static void
+put (int fd, const void *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t cc = write (fd, buf, len);
+      if (cc <= 0)
+	pthread_exit (NULL);
+      buf += cc;
+      len -= cc;
+    }
+}
+
+static void
+handshake (int fd)
+{
+  uint64_t size = htonll (EXPORT_SIZE);
+
+  if (mode == OLDSTYLE)
+    {
+      uint32_t flags = htonl (0x0001 | 0x0004); /* HAS_FLAGS, SEND_FLUSH */
+      char zeros[124] = { 0 };
+
+      put (fd, "NBDMAGIC\x00\x00\x42\x02\x81\x86\x12\x53", 16);
+      put (fd, &size, sizeof size);
+      put (fd, &flags, sizeof flags);
+      put (fd, zeros, sizeof zeros);
+    }
+  else
+    {
+      uint16_t hflags = htons (0x0001 | 0x0002); /* FIXED, NO_ZEROES */
+      uint16_t tflags = htons (0x0001 | 0x0004);
+      uint32_t cflags;
+
+      put (fd, "NBDMAGICIHAVEOPT", 16);
+      put (fd, &hflags, sizeof hflags);
+      get (fd, &cflags, sizeof cflags);
+      for (;;)
+	{
+	  struct
+	  {
+	    uint64_t magic;
+	    uint32_t option, length;
+	  } __attribute__ ((packed)) opt;
+	  struct
+	  {
+	    uint64_t magic;
+	    uint32_t option, type, length;
+	  } __attribute__ ((packed)) rep;
+	  char data[256];
+
+	  get (fd, &opt, sizeof opt);
+	  if (ntohl (opt.length) > sizeof data)
+	    pthread_exit (NULL);
+	  get (fd, data, ntohl (opt.length));
+	  if (ntohl (opt.option) == 1)	/* EXPORT_NAME */
+	    break;
+
+	  rep.magic = htonll (0x0003e889045565a9ULL);
+	  rep.option = opt.option;
+	  rep.type = htonl (ntohl (opt.option) == 8 ? 1 : 0x80000001);
+	  rep.length = 0;
+	  put (fd, &rep, sizeof rep);
+	}
+      put (fd, &size, sizeof size);
+      put (fd, &tflags, sizeof tflags);
+    }
+}
+
+static void
+put_chunk (int fd, uint64_t handle, int flags, int type, uint32_t length)
+{
+  struct chunk c =
+  {
+    magic: htonl (0x668e33ef),
+    flags: htons (flags),
+    type: htons (type),
+    handle: handle,
+    length: htonl (length),
+  };
+  put (fd, &c, sizeof c);
+}
+
+/* Send the data at FROM for LEN bytes as one OFFSET_DATA chunk, or as a
+   hole if it is all zeros.  */
+static void
+put_data (int fd, uint64_t handle, int flags, uint64_t from, uint32_t len)
+{
+  uint64_t offset = htonll (from);
+  uint32_t i;
+
+  for (i = 0; i < len && export[from + i] == 0; i++)
+    ;
+  if (i == len)
+    {
+      uint32_t size = htonl (len);
+      put_chunk (fd, handle, flags, 2, sizeof offset + sizeof size);
+      put (fd, &offset, sizeof offset);
+      put (fd, &size, sizeof size);
+    }
+  else
+    {
+      put_chunk (fd, handle, flags, 1, sizeof offset + len);
+      put (fd, &offset, sizeof offset);
+      put (fd, export + from, len);
+    }
+}
+
+static void
+reply (int fd, struct request *req)
+{
+  uint32_t type = ntohl (req->type);
+  uint64_t from = ntohll (req->from);
+  uint32_t len = ntohl (req->len);
+
+  if (mode == OLDSTYLE)
+    {
+      struct
+      {
+	uint32_t magic, error;
+	uint64_t handle;
+      } __attribute__ ((packed)) rep =
+	{ htonl (0x67446698), 0, req->handle };
+
+      put (fd, &rep, sizeof rep);
+      if (type == 0)
+	put (fd, export + from, len);
+    }
+  else if (type == 0)
+    {
+      /* The second half first.  */
+      uint32_t half = len / 2;
+      if (half > 0)
+	put_data (fd, req->handle, 0, from + half, len - half);
+      put_data (fd, req->handle, 1, from, half ?: len);
+    }
+  else if (mode == BAD && type == 1)
+    {
+      uint64_t offset = htonll (from);
+      put_chunk (fd, req->handle, 1, 1, sizeof offset + 8);
+      put (fd, &offset, sizeof offset);
+      put (fd, export, 8);
+    }
+  else
+    put_chunk (fd, req->handle, 1, 0, 0);
+}
+
+#define BACKLOG 8
+
+static void *
+serve (void *arg)
+{
+  int fd = (intptr_t) arg;
+  struct request pending[BACKLOG];
+  int npending = 0;
+
+  handshake (fd);
+  for (;;)
+    {
+      struct pollfd pfd = { fd, POLLIN };
+      struct request *req;
+
+      if (npending == BACKLOG
+	  || (npending > 0 && poll (&pfd, 1, 10) == 0))
+	{
+	  /* Answer the latest request first.  */
+	  reply (fd, &pending[--npending]);
+	  continue;
+	}
+
+      req = &pending[npending];
+      get (fd, req, sizeof *req);
+      if (ntohl (req->type) == 2)	/* DISC */
+	break;
+      if (ntohll (req->from) + ntohl (req->len) > EXPORT_SIZE)
+	error (1, 0, "request beyond the end of the export");
+      if (ntohl (req->type) == 1)
+	get (fd, export + ntohll (req->from), ntohl (req->len));
+      npending++;
+    }
+
+  close (fd);
+  return NULL;
+}
+
+static void *
+listener (void *arg)
+{
+  int sock = (intptr_t) arg;
+
+  for (;;)
+    {
+      pthread_t thread;
+      int fd = accept (sock, NULL, NULL);
+      if (fd < 0)
+	error (1, errno, "accept");
+      pthread_create (&thread, NULL, serve, (void *) (intptr_t) fd);
+      pthread_detach (thread);
+    }
+  return NULL;
+}
+
+static int failures;
+
+#define CHECK(cond)							\
+  do {									\
+    if (! (cond))							\
+      {									\
+	fprintf (stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+	failures++;							\
+      }									\
+  } while (0)
+
+static void
+test_mode (const char *name, enum mode m)
+{
+  size_t len = 300 * 1024;
+  char *pattern = malloc (len), *readback = 0, *zeros;
+  size_t amount, readlen = 0;
+  struct store *store, *clone;
+  error_t err;
+  size_t i;
+
+  mode = m;
+  for (i = 0; i < len; i++)
+    pattern[i] = i * 7 + 1;
+
+  err = store_nbd_open (name, 0, &store);
+  if (err)
+    error (1, err, "%s", name);
+
+  if (mode == BAD)
+    {
+      /* The server sends data for a write; that request fails, but the
+	 connection survives it.  */
+      err = store_write (store, 0, pattern, BLOCK_SIZE, &amount);
+      CHECK (err == EIO);
+      err = store_read (store, 0, BLOCK_SIZE, (void **) &readback, &readlen);
+      CHECK (! err && readlen == BLOCK_SIZE);
+      store_free (store);
+      free (pattern);
+      return;
+    }
+
+  /* Enough for the transfer to be split, and to fill the window.  */
+  err = store_write (store, 3, pattern, len, &amount);
+  CHECK (! err && amount == len);
+  err = store_read (store, 3, len, (void **) &readback, &readlen);
+  CHECK (! err && readlen == len && ! memcmp (readback, pattern, len));
+
+  /* Never written, so sent back as holes.  */
+  zeros = calloc (1, len);
+  readlen = 0;
+  err = store_read (store, 2048, len, (void **) &readback, &readlen);
+  CHECK (! err && readlen == len && ! memcmp (readback, zeros, len));
+  free (zeros);
+
+  CHECK (! store_flush (store));
+
+  /* Deactivating a clone must leave the connection alone.  */
+  err = store_clone (store, &clone);
+  CHECK (! err);
+  if (! err)
+    {
+      CHECK (! store_set_flags (clone, STORE_INACTIVE));
+      readlen = 0;
+      err = store_read (store, 3, len, (void **) &readback, &readlen);
+      CHECK (! err && readlen == len && ! memcmp (readback, pattern, len));
+
+      /* And reactivating it gives it a connection of its own.  */
+      CHECK (! store_clear_flags (clone, STORE_INACTIVE));
+      readlen = 0;
+      err = store_read (clone, 3, len, (void **) &readback, &readlen);
+      CHECK (! err && readlen == len && ! memcmp (readback, pattern, len));
+      store_free (clone);
+    }
+
+  store_free (store);
+  memset (export, 0, EXPORT_SIZE);
+  free (pattern);
+}
+
+int
+main (int argc, char **argv)
+{
+  struct sockaddr_in sin = { .sin_family = AF_INET };
+  socklen_t sinlen = sizeof sin;
+  pthread_t thread;
+  char name[64];
+  int sock;
+
+  export = calloc (1, EXPORT_SIZE);
+  if (! export)
+    error (1, errno, "calloc");
+
+  sock = socket (PF_INET, SOCK_STREAM, 0);
+  if (sock < 0)
+    error (1, errno, "socket");
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (bind (sock, (struct sockaddr *) &sin, sizeof sin) < 0
+      || getsockname (sock, (struct sockaddr *) &sin, &sinlen) < 0
+      || listen (sock, 4) < 0)
+    error (1, errno, "cannot listen");
+  pthread_create (&thread, NULL, listener, (void *) (intptr_t) sock);
+
+  snprintf (name, sizeof name, "nbd://127.0.0.1:%d/%d",
+	    ntohs (sin.sin_port), BLOCK_SIZE);
+  test_mode (name, OLDSTYLE);
+  test_mode (name, NEWSTYLE);
+  test_mode (name, BAD);
+
+  if (failures)
+    {
+      printf ("FAIL: %d checks failed\n", failures);
+      return 1;
+    }
+  printf ("PASS\n");
+  return 0;
+}
@@ -20,183 +20,481 @@
 
 #include <unistd.h>
 #include <string.h>
-#include <sys/mman.h>
+#include <stddef.h>
 
 #include <hurd/netfs.h>
 
 #include "ccache.h"
 
-#define READ_CHUNK_SIZE   (8*1024)
-#define ALLOC_CHUNK_SIZE  (64*1024)
-
+/* File contents are fetched and cached in blocks of this size.  Blocks are
+   fetched by starting a transfer at the block (with the REST command), and
+   reading on over the same data connection as long as reads are sequential.
+   All the blocks of a filesystem are in one LRU list, and the least recently
+   used ones are dropped to keep the total under the contents-cache-size
+   parameter.  */
+#define BLOCK_SIZE	(64*1024)
+
+/* A forward seek of at most this many bytes reads on over the current data
+   connection (caching what it skips) instead of starting a new transfer.  */
+#define MAX_SKIP	(4*BLOCK_SIZE)
+
+/* The key of block INDEX in the blocks table of a ccache.  Not 0, which
+   libihash also uses as the key of removed entries.  */
+#define BLOCK_KEY(index)	((hurd_ihash_key_t) (index) + 1)
+
+/* A cached block of file contents.  */
+struct ccache_block
+{
+  struct ccache *cc;
+  size_t index;			/* Block number in the file.  */
+  size_t len;			/* Bytes of DATA; less than BLOCK_SIZE only
+				   for the last block of the file.  */
+  char *data;
+  hurd_ihash_locp_t locp;	/* Position in CC's blocks table.  */
+
+  /* Position in the filesystem's LRU list.  */
+  struct ccache_block *next, *prev;
+};
+
+/* Remove BLOCK from the LRU list of FS.  FS->ccache_lock should be held.  */
+static void
+lru_unlink (struct ftpfs *fs, struct ccache_block *block)
+{
+  if (block->next)
+    block->next->prev = block->prev;
+  else
+    fs->ccache_lru = block->prev;
+  if (block->prev)
+    block->prev->next = block->next;
+  else
+    fs->ccache_mru = block->next;
+}
+
+/* Put BLOCK at the head of the LRU list of FS.  FS->ccache_lock should be
+   held.  */
+static void
+lru_push (struct ftpfs *fs, struct ccache_block *block)
+{
+  block->prev = 0;
+  block->next = fs->ccache_mru;
+  if (fs->ccache_mru)
+    fs->ccache_mru->prev = block;
+  else
+    fs->ccache_lru = block;
+  fs->ccache_mru = block;
+}
+
+/* Drop BLOCK from the cache.  FS->ccache_lock should be held.  */
+static void
+drop_block (struct ftpfs *fs, struct ccache_block *block)
+{
+  lru_unlink (fs, block);
+  hurd_ihash_locp_remove (&block->cc->blocks, block->locp);
+  fs->ccache_size -= block->len;
+  free (block->data);
+  free (block);
+}
+
+/* Add the LEN bytes at DATA, which were malloced, to the cache as block
+   INDEX of CC, evicting old blocks if the cache is full.  DATA is freed if
+   the block cannot be added.  */
+static void
+add_block (struct ccache *cc, size_t index, char *data, size_t len)
+{
+  struct ftpfs *fs = cc->node->nn->fs;
+  struct ccache_block *block;
+
+  pthread_mutex_lock (&fs->ccache_lock);
+
+  block = hurd_ihash_find (&cc->blocks, BLOCK_KEY (index));
+  if (block)
+    /* We already have it.  */
+    free (data);
+  else
+    {
+      block = malloc (sizeof *block);
+      if (block
+	  && hurd_ihash_add (&cc->blocks, BLOCK_KEY (index), block) == 0)
+	{
+	  block->cc = cc;
+	  block->index = index;
+	  block->len = len;
+	  block->data = data;
+	  lru_push (fs, block);
+	  fs->ccache_size += len;
+
+	  while (fs->ccache_size > fs->params.contents_cache_max
+		 && fs->ccache_lru != block)
+	    drop_block (fs, fs->ccache_lru);
+	}
+      else
+	/* Not caching it only means fetching it again.  */
+	{
+	  free (block);
+	  free (data);
+	}
+    }
+
+  pthread_mutex_unlock (&fs->ccache_lock);
+}
+
+/* Return true if block INDEX of CC is cached.  */
+static int
+have_block (struct ccache *cc, size_t index)
+{
+  struct ftpfs *fs = cc->node->nn->fs;
+  int have;
+
+  pthread_mutex_lock (&fs->ccache_lock);
+  have = hurd_ihash_find (&cc->blocks, BLOCK_KEY (index)) != 0;
+  pthread_mutex_unlock (&fs->ccache_lock);
+
+  return have;
+}
+
+/* Copy what is cached of CC from OFFS on, up to END, to DATA, stopping at
+   the first block that is not cached.  Return the number of bytes copied.  */
+static size_t
+copy_cached (struct ccache *cc, off_t offs, off_t end, char *data)
+{
+  struct ftpfs *fs = cc->node->nn->fs;
+  size_t done = 0;
+
+  pthread_mutex_lock (&fs->ccache_lock);
+
+  while (offs < end)
+    {
+      struct ccache_block *block =
+	hurd_ihash_find (&cc->blocks, BLOCK_KEY (offs / BLOCK_SIZE));
+      size_t block_offs = offs % BLOCK_SIZE;
+      size_t amount;
+
+      if (! block || block->len <= block_offs)
+	break;
+
+      amount = block->len - block_offs;
+      if (amount > end - offs)
+	amount = end - offs;
+      memcpy (data + done, block->data + block_offs, amount);
+
+      if (fs->ccache_mru != block)
+	{
+	  lru_unlink (fs, block);
+	  lru_push (fs, block);
+	}
+
+      done += amount;
+      offs += amount;
+    }
+
+  pthread_mutex_unlock (&fs->ccache_lock);
+
+  return done;
+}
+
+/* Drop all the cached blocks of CC.  */
+static void
+drop_blocks (struct ccache *cc)
+{
+  struct ftpfs *fs = cc->node->nn->fs;
+
+  pthread_mutex_lock (&fs->ccache_lock);
+  HURD_IHASH_ITERATE (&cc->blocks, value)
+    drop_block (fs, value);
+  pthread_mutex_unlock (&fs->ccache_lock);
+}
+
+/* Take CC's connection back from the pool of connections, where it is
+   parked between fetches, unless it was given to someone else meanwhile.  */
+static void
+claim_data_conn (struct ccache *cc)
+{
+  if (cc->conn && ! ftpfs_unpark_ftp_conn (cc->node->nn->fs, cc->conn, cc))
+    {
+      cc->conn = 0;
+      cc->data_conn = -1;
+    }
+}
+
+/* Close CC's data connection, if it has one.  */
+static void
+close_data_conn (struct ccache *cc)
+{
+  if (cc->conn)
+    {
+      close (cc->data_conn);
+      cc->data_conn = -1;
+      ftp_conn_finish_transfer (cc->conn);
+      ftpfs_release_ftp_conn (cc->node->nn->fs, cc->conn);
+      cc->conn = 0;
+    }
+}
+
+/* Open a data connection for CC, fetching the file from POS on, or from its
+   start if the server cannot restart transfers.  */
+static error_t
+open_data_conn (struct ccache *cc, off_t pos)
+{
+  struct netnode *nn = cc->node->nn;
+  error_t err = ftpfs_get_ftp_conn (nn->fs, &cc->conn);
+
+  if (err)
+    {
+      cc->conn = 0;
+      return err;
+    }
+
+  err = EOPNOTSUPP;
+  if (pos > 0 && ! nn->fs->no_restart)
+    {
+      err = ftp_conn_start_retrieve_at (cc->conn, nn->rmt_path, pos,
+					&cc->data_conn);
+      if (err == EOPNOTSUPP)
+	/* Don't try again.  */
+	nn->fs->no_restart = 1;
+      else if (! err)
+	cc->data_conn_pos = pos;
+    }
+  if (err == EOPNOTSUPP)
+    {
+      err = ftp_conn_start_retrieve (cc->conn, nn->rmt_path, &cc->data_conn);
+      if (! err)
+	cc->data_conn_pos = 0;
+    }
+
+  if (err == ENOENT)
+    err = ESTALE;
+  if (err)
+    {
+      ftpfs_release_ftp_conn (nn->fs, cc->conn);
+      cc->conn = 0;
+    }
+
+  return err;
+}
+
+/* Read up to LEN bytes from FD into BUF, stopping only at end of file.
+   Return the number of bytes read in AMOUNT.  */
+static error_t
+read_fully (int fd, char *buf, size_t len, size_t *amount)
+{
+  size_t done = 0;
+
+  while (done < len)
+    {
+      ssize_t rd = read (fd, buf + done, len - done);
+      if (rd < 0)
+	return errno;
+      if (rd == 0)
+	break;
+      done += rd;
+    }
+
+  *amount = done;
+  return 0;
+}
+
+/* Fetch block INDEX of CC into the cache, together with the blocks its data
+   connection reads on the way there.  The caller should have set
+   CC->fetching_active, and should not hold CC->lock.  */
+static error_t
+fetch_block (struct ccache *cc, size_t index)
+{
+  error_t err = 0;
+  off_t start = (off_t) index * BLOCK_SIZE;
+  struct ftpfs *fs = cc->node->nn->fs;
+  int re_connected = 0;
+
+  claim_data_conn (cc);
+
+  if (cc->conn
+      && (cc->data_conn_pos > start
+	  || (start - cc->data_conn_pos > MAX_SKIP && ! fs->no_restart)))
+    /* The data connection is somewhere else in the file.  */
+    close_data_conn (cc);
+
+  while (! err)
+    {
+      off_t pos;
+      size_t len, amount;
+      char *data;
+
+      if (! cc->conn)
+	/* We need to setup a connection to fetch data over.  */
+	{
+	  err = open_data_conn (cc, start);
+	  if (err)
+	    break;
+	  re_connected = 1;
+	}
+
+      pos = cc->data_conn_pos;
+      if (pos > start || pos >= cc->size)
+	/* We're done.  */
+	break;
+
+      len = BLOCK_SIZE;
+      if (len > cc->size - pos)
+	len = cc->size - pos;
+
+      data = malloc (len);
+      if (! data)
+	err = ENOMEM;
+      else
+	err = read_fully (cc->data_conn, data, len, &amount);
+
+      if (! err && amount < len)
+	/* EOF.  This either means the file changed size, or our
+	   data-connection got closed; we just try to open the connection a
+	   second time, and then if that fails, assume the size changed.  */
+	{
+	  free (data);
+	  if (re_connected)
+	    err = EIO;
+	  else
+	    close_data_conn (cc);
+	}
+      else if (! err)
+	{
+	  add_block (cc, pos / BLOCK_SIZE, data, len);
+	  cc->data_conn_pos += len;
+	}
+      else
+	free (data);
+
+      if (!err && ports_self_interrupted ())
+	err = EINTR;
+    }
+
+  if (!err && cc->conn && cc->data_conn_pos >= cc->size)
+    /* We're finished reading all data, close the data connection.  */
+    close_data_conn (cc);
+
+  if (cc->conn)
+    /* Keep it for the next sequential read, unless the pool runs short.  */
+    ftpfs_park_ftp_conn (fs, cc->conn, cc, cc->data_conn);
+
+  return err;
+}
+
+/* Fetch the blocks of CC from CC->prefetch_pos to CC->prefetch_end, unless
+   some reader starts waiting for CC.  ARG is CC, whose fetching_active
+   was set for us, and whose node has an extra reference.  */
+static void *
+prefetch (void *arg)
+{
+  struct ccache *cc = arg;
+  struct node *node = cc->node;
+  error_t err = 0;
+
+  pthread_mutex_lock (&cc->lock);
+
+  while (!err && cc->prefetch_pos < cc->prefetch_end && cc->waiters == 0)
+    {
+      size_t index = cc->prefetch_pos / BLOCK_SIZE;
+
+      cc->prefetch_pos = (off_t) (index + 1) * BLOCK_SIZE;
+      if (have_block (cc, index))
+	continue;
+
+      pthread_mutex_unlock (&cc->lock);
+      err = fetch_block (cc, index);
+      pthread_mutex_lock (&cc->lock);
+    }
+
+  cc->fetching_active = 0;
+  pthread_cond_broadcast (&cc->wakeup);
+  pthread_mutex_unlock (&cc->lock);
+
+  netfs_nrele (node);
+
+  return 0;
+}
+
+/* Start fetching the READ_AHEAD bytes of CC after END in the background,
+   unless they are mostly there already.  CC->lock should be held, and no
+   thread should be fetching.  */
+static void
+start_prefetch (struct ccache *cc, off_t end)
+{
+  size_t read_ahead = cc->node->nn->fs->params.read_ahead;
+  pthread_t thread;
+
+  if (read_ahead == 0 || end >= cc->size)
+    return;
+
+  /* Only start when the read-ahead is half used up, so as not to start a
+   thread for each read.  */
+  if (have_block (cc, (end + read_ahead / 2) / BLOCK_SIZE)
+      || end + read_ahead / 2 >= cc->size)
+    return;
+
+  cc->prefetch_pos = end;
+  cc->prefetch_end = end + read_ahead;
+  if (cc->prefetch_end > cc->size)
+    cc->prefetch_end = cc->size;
+
+  cc->fetching_active = 1;
+  netfs_nref (cc->node);
+  if (pthread_create (&thread, NULL, prefetch, cc) == 0)
+    pthread_detach (thread);
+  else
+    {
+      cc->fetching_active = 0;
+      netfs_nrele (cc->node);
+    }
+}
+
 /* Read LEN bytes at OFFS in the file referred to by CC into DATA, or return
    an error.  */
 error_t
 ccache_read (struct ccache *cc, off_t offs, size_t len, void *data)
 {
   error_t err = 0;
-  size_t max = offs + len;
+  off_t end = offs + len;
+  off_t pos = offs;
+  int stalled = 0;
 
   pthread_mutex_lock (&cc->lock);
 
-  if (max > cc->size)
-    max = cc->size;
+  if (! cc->fetching_active)
+    /* The file may have changed size since we last looked (its contents
+       are then invalidated).  */
+    cc->size = cc->node->nn_stat.st_size;
+
+  if (end > cc->size)
+    end = cc->size;
 
-  while (cc->max < max && !err)
+  while (pos < end && !err)
     {
+      size_t copied = copy_cached (cc, pos, end, data + (pos - offs));
+
+      pos += copied;
+      if (copied > 0)
+	stalled = 0;
+      if (pos >= end)
+	break;
+
       if (cc->fetching_active)
 	/* Some thread is fetching data, so just let it do its thing, but get
 	   a wakeup call when it's done.  */
 	{
+	  cc->waiters++;
 	  if (pthread_hurd_cond_wait_np (&cc->wakeup, &cc->lock))
 	    err = EINTR;
+	  cc->waiters--;
 	}
+      else if (stalled++ > 1)
+	/* We fetched the block, but it is not there.  */
+	err = EIO;
       else
 	{
-	  int re_connected = 0;
-	  struct netnode *nn = cc->node->nn;
-
 	  cc->fetching_active = 1;
+	  pthread_mutex_unlock (&cc->lock);
 
-	  while (cc->max < max && !err)
-	    {
-	      pthread_mutex_unlock (&cc->lock);
-
-	      if (! cc->conn)
-		/* We need to setup a connection to fetch data over.  */
-		{
-		  err = ftpfs_get_ftp_conn (nn->fs, &cc->conn);
-		  if (! err)
-		    {
-		      err = ftp_conn_start_retrieve (cc->conn, nn->rmt_path,
-						     &cc->data_conn);
-		      if (err == ENOENT)
-			err = ESTALE;
-		      if (err)
-			{
-			  ftpfs_release_ftp_conn (nn->fs, cc->conn);
-			  cc->conn = 0;
-			}
-		      else
-			cc->data_conn_pos = 0;
-		    }
-		  re_connected = 1;
-		}
-
-	      if (! err)
-		/* Try and read some data over the connection.  */
-		{
-		  size_t new_end = cc->max + READ_CHUNK_SIZE;
-
-		  if (new_end > cc->size)
-		    new_end = cc->size;
-
-		  if (new_end > cc->alloced)
-		    /* Make some room in memory for the new part of the
-		       image.  */
-		    {
-		      size_t alloc_end = cc->alloced + ALLOC_CHUNK_SIZE;
-
-		      if (alloc_end < new_end)
-			alloc_end = new_end;
-		      else if (alloc_end > cc->size)
-			alloc_end = cc->size;
-
-		      if (cc->alloced == 0)
-			{
-			  vm_address_t addr = 0;
-			  addr = (vm_address_t) mmap (0, alloc_end, 
-						      PROT_READ|PROT_WRITE,
-						      MAP_ANON, 0, 0);
-			  err = (addr == -1) ? errno : 0;
-			  if (! err)
-			    cc->image = (char *)addr;
-			}
-		      else
-			{
-			  vm_address_t addr =
-			    (vm_address_t)cc->image + cc->alloced;
-			  /* XXX.  This can't be replaced with mmap until we
-			     have MAP_EXCL.  -tb  */
-			  err = vm_allocate (mach_task_self (),
-					     &addr, alloc_end - cc->alloced,
-					     0);
-			  if (err == EKERN_NO_SPACE)
-			    /* Gack.  We've goota move the whole splooge.  */
-			    {
-			      addr = 0;
-			      addr = (vm_address_t) mmap (0, alloc_end, 
-							  PROT_READ|PROT_WRITE,
-							  MAP_ANON, 0, 0);
-			      err = (addr == -1) ? errno : 0;
-			      if (! err)
-				/* That worked; copy what's already-fetched. */
-				{
-				  bcopy (cc->image, (void *)addr, cc->max);
-				  munmap (cc->image, cc->alloced);
-				  cc->image = (char *)addr;
-				}
-			    }
-			}
-		      if (! err)
-			cc->alloced = alloc_end;
-		    }
-
-		  if (! err)
-		    {
-		      ssize_t rd =
-			read (cc->data_conn,
-			      cc->image + cc->data_conn_pos,
-			      new_end - cc->data_conn_pos);
-		      if (rd < 0)
-			err = errno;
-		      else if (rd == 0)
-			/* EOF.  This either means the file changed size, or
-			   our data-connection got closed; we just try to
-			   open the connection a second time, and then if
-			   that fails, assume the size changed.  */
-			{
-			  if (re_connected)
-			    err = EIO; /* Something's fucked */
-			  else
-			    /* Try opening the connection again.  */
-			    {
-			      close (cc->data_conn);
-			      ftp_conn_finish_transfer (cc->conn);
-			      ftpfs_release_ftp_conn (nn->fs, cc->conn);
-			      cc->conn = 0;
-			    }
-			}
-		      else
-			{
-			  cc->data_conn_pos += rd;
-			  if (cc->data_conn_pos > cc->max)
-			    cc->max = cc->data_conn_pos;
-			}
-		    }
-
-		  if (!err && ports_self_interrupted ())
-		    err = EINTR;
-		}
-
-	      pthread_mutex_lock (&cc->lock);
-
-	      if (cc->max < max && !err)
-		/* If anyone's waiting for data, let them look (if we're done
-		   fetching, this gets delayed until below).  */
-		pthread_cond_broadcast (&cc->wakeup);
-	    }
-
-	  if (!err && cc->conn && cc->max == cc->size)
-	    /* We're finished reading all data, close the data connection.  */
-	    {
-	      close (cc->data_conn);
-	      ftp_conn_finish_transfer (cc->conn);
-	      ftpfs_release_ftp_conn (nn->fs, cc->conn);
-	      cc->conn = 0;
-	    }
-
-	  /* We're done, error or no.  */
+	  err = fetch_block (cc, pos / BLOCK_SIZE);
+
+	  pthread_mutex_lock (&cc->lock);
 	  cc->fetching_active = 0;
 
 	  /* Let others know something's going on.  */
@@ -205,13 +503,17 @@ ccache_read (struct ccache *cc, off_t offs, size_t len, void *data)
     }
 
   if (! err)
-    bcopy (cc->image + offs, data, max - offs);
+    {
+      if (offs == cc->next_read && ! cc->fetching_active)
+	start_prefetch (cc, end);
+      cc->next_read = end;
+    }
 
   pthread_mutex_unlock (&cc->lock);
 
   return err;
 }
-
+
 /* Discard any cached contents in CC.  */
 error_t
 ccache_invalidate (struct ccache *cc)
@@ -220,6 +522,7 @@ ccache_invalidate (struct ccache *cc)
 
   pthread_mutex_lock (&cc->lock);
 
+  cc->waiters++;
   while  (cc->fetching_active && !err)
     /* Some thread is fetching data, so just let it do its thing, but get
        a wakeup call when it's done.  */
@@ -227,30 +530,21 @@ ccache_invalidate (struct ccache *cc)
       if (pthread_hurd_cond_wait_np (&cc->wakeup, &cc->lock))
 	err = EINTR;
     }
+  cc->waiters--;
 
   if (! err)
     {
-      if (cc->alloced > 0)
-	{
-	  munmap (cc->image, cc->alloced);
-	  cc->image = 0;
-	  cc->alloced = 0;
-	  cc->max = 0;
-	}
-      if (cc->conn)
-	{
-	  close (cc->data_conn);
-	  ftp_conn_finish_transfer (cc->conn);
-	  ftpfs_release_ftp_conn (cc->node->nn->fs, cc->conn);
-	  cc->conn = 0;
-	}
+      drop_blocks (cc);
+      claim_data_conn (cc);
+      close_data_conn (cc);
+      cc->next_read = 0;
     }
 
   pthread_mutex_unlock (&cc->lock);
 
   return err;
 }
-
+
 /* Return a ccache object for NODE in CC.  */
 error_t
 ccache_create (struct node *node, struct ccache **cc)
@@ -261,15 +555,17 @@ ccache_create (struct node *node, struct ccache **cc)
     return ENOMEM;
 
   new->node = node;
-  new->image = 0;
   new->size = node->nn_stat.st_size;
-  new->max = 0;
-  new->alloced = 0;
+  hurd_ihash_init (&new->blocks, offsetof (struct ccache_block, locp));
   pthread_mutex_init (&new->lock, NULL);
   pthread_cond_init (&new->wakeup, NULL);
+  new->waiters = 0;
   new->fetching_active = 0;
   new->conn = 0;
   new->data_conn = -1;
+  new->data_conn_pos = 0;
+  new->next_read = 0;
+  new->prefetch_pos = new->prefetch_end = 0;
 
   *cc = new;
 
@@ -280,14 +576,9 @@ ccache_create (struct node *node, struct ccache **cc)
 void
 ccache_free (struct ccache *cc)
 {
-  if (cc->alloced > 0)
-    munmap (cc->image, cc->alloced);
-  if (cc->data_conn >= 0)
-    close (cc->data_conn);
-  if (cc->conn)
-    {
-      ftp_conn_finish_transfer (cc->conn);
-      ftpfs_release_ftp_conn (cc->node->nn->fs, cc->conn);
-    }
+  drop_blocks (cc);
+  hurd_ihash_destroy (&cc->blocks);
+  claim_data_conn (cc);
+  close_data_conn (cc);
   free (cc);
 }
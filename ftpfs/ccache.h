@@ -28,33 +28,41 @@ struct ccache
   /* The filesystem node this is a cache of.  */
   struct node *node;
 
-  /* In memory file image, alloced using vm_allocate.  */
-  char *image;
-
   /* Size of data.  */
   off_t size;
 
-  /* Upper bounds of fetched image.  */
-  off_t max;
-
-  /* Amount of IMAGE that has been allocated.  */
-  size_t alloced;
+  /* The blocks of the file that are in memory, indexed by block number.
+     This is protected by the filesystem's ccache_lock, as blocks may be
+     evicted to make room for those of other files.  */
+  struct hurd_ihash blocks;
 
   pthread_mutex_t lock;
 
   /* People can wait for a reading thread on this condition.  */
   pthread_cond_t wakeup;
 
+  /* The number of threads waiting on WAKEUP; a read-ahead stops early
+     when there are any.  */
+  int waiters;
+
   /* True if some thread is now fetching data.  Only that thread should
-     modify the DATA_CONN, DATA_CONN_POS, and MAX fields.  */
+     modify the CONN, DATA_CONN, DATA_CONN_POS, PREFETCH_POS, and
+     PREFETCH_END fields.  */
   int fetching_active;
 
-  /* Ftp connection over which data is being fetched, or 0.  */
+  /* Ftp connection over which data is being fetched, or 0.  Between
+     fetches, it is parked in the pool of connections (see conn.c).  */
   struct ftp_conn *conn;
   /* File descriptor over which data is being fetched.  */
   int data_conn;
   /* Where DATA_CONN points in the file.  */
   off_t data_conn_pos;
+
+  /* Where the last read ended, to detect sequential reads.  */
+  off_t next_read;
+
+  /* The range a background read-ahead is fetching.  */
+  off_t prefetch_pos, prefetch_end;
 };
 
 /* Read LEN bytes at OFFS in the file referred to by CC into DATA, or return
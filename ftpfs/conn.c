@@ -20,6 +20,7 @@
 
 #include <assert-backtrace.h>
 #include <stdint.h>
+#include <unistd.h>
 
 #include "ftpfs.h"
 
@@ -28,22 +29,79 @@ struct ftpfs_conn
 {
   struct ftp_conn *conn;
   struct ftpfs_conn *next;
+
+  /* If non-zero, CONN is parked by this owner, in the middle of a transfer
+     on the data connection PARKED_DATA.  */
+  void *parked_owner;
+  int parked_data;
 };
 
 /* For debugging purposes, give each connection a unique integer id.  */
 static unsigned conn_id = 0;
 
-/* Get an ftp connection to use for an operation. */
+/* Return the least recently used parked connection in FS, or 0 if there
+   is none.  FS->conn_lock should be held.  */
+static struct ftpfs_conn *
+oldest_parked_conn (struct ftpfs *fs)
+{
+  struct ftpfs_conn *fsc, *oldest = 0;
+
+  /* Connections are added to the front of FS->conns.  */
+  for (fsc = fs->conns; fsc; fsc = fsc->next)
+    if (fsc->parked_owner)
+      oldest = fsc;
+
+  return oldest;
+}
+
+/* Get an ftp connection to use for an operation.  If FS already has as
+   many connections as it may open, wait for one to be released, or take
+   one that is parked.  */
 error_t
 ftpfs_get_ftp_conn (struct ftpfs *fs, struct ftp_conn **conn)
 {
   struct ftpfs_conn *fsc;
+  int parked_data = -1;
+
+  pthread_mutex_lock (&fs->conn_lock);
+  for (;;)
+    {
+      fsc = fs->free_conns;
+      if (fsc)
+	{
+	  fs->free_conns = fsc->next;
+	  break;
+	}
+
+      if (fs->params.max_conns == 0 || fs->num_conns < fs->params.max_conns)
+	/* Make a new one.  */
+	{
+	  fs->num_conns++;
+	  break;
+	}
+
+      fsc = oldest_parked_conn (fs);
+      if (fsc)
+	/* Take it from its owner; the transfer is aborted below.  */
+	{
+	  parked_data = fsc->parked_data;
+	  fsc->parked_owner = 0;
+	  *conn = fsc->conn;
+	  pthread_mutex_unlock (&fs->conn_lock);
+
+	  close (parked_data);
+	  ftp_conn_abort (fsc->conn);
+
+	  return 0;
+	}
 
-  pthread_spin_lock (&fs->conn_lock);
-  fsc = fs->free_conns;
-  if (fsc)
-    fs->free_conns = fsc->next;
-  pthread_spin_unlock (&fs->conn_lock);
+      if (pthread_hurd_cond_wait_np (&fs->conn_free, &fs->conn_lock))
+	{
+	  pthread_mutex_unlock (&fs->conn_lock);
+	  return EINTR;
+	}
+    }
+  pthread_mutex_unlock (&fs->conn_lock);
 
   if (! fsc)
     {
@@ -51,21 +109,28 @@ ftpfs_get_ftp_conn (struct ftpfs *fs, struct ftp_conn **conn)
 
       fsc = malloc (sizeof (struct ftpfs_conn));
       if (! fsc)
-	return ENOMEM;
-
-      err = ftp_conn_create (fs->ftp_params, fs->ftp_hooks, &fsc->conn);
-
-      if (! err)
+	err = ENOMEM;
+      else
 	{
-	  /* Set connection type to binary.  */
-	  err = ftp_conn_set_type (fsc->conn, "I");
-	  if (err)
-	    ftp_conn_free (fsc->conn);
+	  err = ftp_conn_create (fs->ftp_params, fs->ftp_hooks, &fsc->conn);
+
+	  if (! err)
+	    {
+	      /* Set connection type to binary.  */
+	      err = ftp_conn_set_type (fsc->conn, "I");
+	      if (err)
+		ftp_conn_free (fsc->conn);
+	    }
 	}
 
       if (err)
 	{
 	  free (fsc);
+	  /* Let someone else try.  */
+	  pthread_mutex_lock (&fs->conn_lock);
+	  fs->num_conns--;
+	  pthread_cond_signal (&fs->conn_free);
+	  pthread_mutex_unlock (&fs->conn_lock);
 	  return err;
 	}
 
@@ -73,34 +138,94 @@ ftpfs_get_ftp_conn (struct ftpfs *fs, struct ftp_conn **conn)
       fsc->conn->hook = (void *)(uintptr_t)conn_id++;
     }
 
-  pthread_spin_lock (&fs->conn_lock);
+  fsc->parked_owner = 0;
+
+  pthread_mutex_lock (&fs->conn_lock);
   fsc->next = fs->conns;
   fs->conns = fsc;
-  pthread_spin_unlock (&fs->conn_lock);
+  pthread_mutex_unlock (&fs->conn_lock);
 
   *conn = fsc->conn;
 
   return 0;
 }
 
+/* Return the entry for CONN in FS's list of connections in use, and its
+   predecessor in *PREV.  FS->conn_lock should be held.  */
+static struct ftpfs_conn *
+find_conn (struct ftpfs *fs, struct ftp_conn *conn, struct ftpfs_conn **prev)
+{
+  struct ftpfs_conn *fsc, *pfsc;
+
+  for (pfsc = 0, fsc = fs->conns; fsc; pfsc = fsc, fsc = fsc->next)
+    if (fsc->conn == conn)
+      break;
+
+  if (prev)
+    *prev = pfsc;
+  return fsc;
+}
+
 /* Return CONN to the pool of free connections in FS.  */
 void
 ftpfs_release_ftp_conn (struct ftpfs *fs, struct ftp_conn *conn)
 {
   struct ftpfs_conn *fsc, *pfsc;
 
-  pthread_spin_lock (&fs->conn_lock);
-  for (pfsc = 0, fsc = fs->conns; fsc; pfsc = fsc, fsc = fsc->next)
-    if (fsc->conn == conn)
-      {
-	if (pfsc)
-	  pfsc->next = fsc->next;
-	else
-	  fs->conns = fsc->next;
-	fsc->next = fs->free_conns;
-	fs->free_conns = fsc;
-	break;
-      }
+  pthread_mutex_lock (&fs->conn_lock);
+  fsc = find_conn (fs, conn, &pfsc);
   assert_backtrace (fsc);
-  pthread_spin_unlock (&fs->conn_lock);
+  if (pfsc)
+    pfsc->next = fsc->next;
+  else
+    fs->conns = fsc->next;
+  fsc->parked_owner = 0;
+  fsc->next = fs->free_conns;
+  fs->free_conns = fsc;
+  pthread_cond_signal (&fs->conn_free);
+  pthread_mutex_unlock (&fs->conn_lock);
+}
+
+/* Mark CONN, which is in the middle of the transfer on the data connection
+   DATA, as unused until OWNER reclaims it with ftpfs_unpark_ftp_conn.  If
+   FS runs out of connections in the meantime, the transfer is aborted and
+   CONN is given to another user.  */
+void
+ftpfs_park_ftp_conn (struct ftpfs *fs, struct ftp_conn *conn,
+		     void *owner, int data)
+{
+  struct ftpfs_conn *fsc;
+
+  pthread_mutex_lock (&fs->conn_lock);
+  fsc = find_conn (fs, conn, 0);
+  assert_backtrace (fsc && !fsc->parked_owner);
+  fsc->parked_owner = owner;
+  fsc->parked_data = data;
+  /* A waiter may take it.  */
+  pthread_cond_signal (&fs->conn_free);
+  pthread_mutex_unlock (&fs->conn_lock);
+}
+
+/* Reclaim CONN, which OWNER parked with ftpfs_park_ftp_conn.  Return true
+   if OWNER can go on with its transfer, and false if CONN was taken away;
+   the data connection has then been closed, and CONN no longer belongs to
+   OWNER.  */
+int
+ftpfs_unpark_ftp_conn (struct ftpfs *fs, struct ftp_conn *conn, void *owner)
+{
+  struct ftpfs_conn *fsc;
+  int ours = 0;
+
+  pthread_mutex_lock (&fs->conn_lock);
+  /* CONN may have been taken and parked again by someone else, so check
+     the owner too.  */
+  fsc = find_conn (fs, conn, 0);
+  if (fsc && fsc->parked_owner == owner)
+    {
+      fsc->parked_owner = 0;
+      ours = 1;
+    }
+  pthread_mutex_unlock (&fs->conn_lock);
+
+  return ours;
 }
@@ -48,10 +48,16 @@ ftpfs_create (char *rmt_path, int fsid,
 
   new->free_conns = 0;
   new->conns = 0;
-  pthread_spin_init (&new->conn_lock, PTHREAD_PROCESS_PRIVATE);
+  new->num_conns = 0;
+  pthread_mutex_init (&new->conn_lock, NULL);
+  pthread_cond_init (&new->conn_free, NULL);
   new->node_cache_mru = new->node_cache_lru = 0;
   new->node_cache_len = 0;
   pthread_mutex_init (&new->node_cache_lock, NULL);
+  new->ccache_mru = new->ccache_lru = 0;
+  new->ccache_size = 0;
+  pthread_mutex_init (&new->ccache_lock, NULL);
+  new->no_restart = 0;
 
   new->fsid = fsid;
   new->next_inode = 2;
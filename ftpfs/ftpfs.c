@@ -106,6 +106,11 @@ cntl_debug (struct ftp_conn *conn, int type, const char *txt)
 
 #define DEFAULT_NODE_CACHE_MAX	50
 
+#define DEFAULT_CONTENTS_CACHE_MAX	16384	/* KBytes */
+#define DEFAULT_READ_AHEAD		256	/* KBytes */
+
+#define DEFAULT_MAX_CONNS	8
+
 /* Return a string corresponding to the printed rep of DEFAULT_what */
 #define ___D(what) #what
 #define __D(what) ___D(what)
@@ -120,6 +125,9 @@ cntl_debug (struct ftp_conn *conn, int type, const char *txt)
 #define OPT_NODE_CACHE_MAX      8
 #define OPT_BULK_STAT_PERIOD    9
 #define OPT_BULK_STAT_THRESHOLD 10
+#define OPT_CONTENTS_CACHE_MAX  11
+#define OPT_READ_AHEAD          12
+#define OPT_MAX_CONNS           13
 
 /* Options usable both at startup and at runtime.  */
 static const struct argp_option common_options[] =
@@ -142,6 +150,16 @@ static const struct argp_option common_options[] =
    "Number of stats within the bulk-stat-period that trigger a bulk stat"
    " (default " _D(BULK_STAT_THRESHOLD) ")"},
 
+  {"contents-cache-size", OPT_CONTENTS_CACHE_MAX, "KBYTES", 0,
+   "Amount of file contents kept in memory, for all files (default "
+   _D(CONTENTS_CACHE_MAX) ")"},
+  {"read-ahead", OPT_READ_AHEAD, "KBYTES", 0,
+   "Amount of data fetched in advance of sequential reads (default "
+   _D(READ_AHEAD) ")"},
+  {"max-connections", OPT_MAX_CONNS, "NUM", 0,
+   "Maximum number of connections opened to the server, 0 for no limit"
+   " (default " _D(MAX_CONNS) ")"},
+
   {0, 0}
 };
 
@@ -207,6 +225,12 @@ parse_common_opt (int key, char *arg, struct argp_state *state)
       params->name_timeout = atoi (arg); break;
     case OPT_STAT_TIMEOUT:
       params->stat_timeout = atoi (arg); break;
+    case OPT_CONTENTS_CACHE_MAX:
+      params->contents_cache_max = (size_t) atoi (arg) * 1024; break;
+    case OPT_READ_AHEAD:
+      params->read_ahead = (size_t) atoi (arg) * 1024; break;
+    case OPT_MAX_CONNS:
+      params->max_conns = atoi (arg); break;
     default:
       return ARGP_ERR_UNKNOWN;
     }
@@ -363,6 +387,12 @@ netfs_append_args (char **argz, size_t *argz_len)
     FOPT ("--bulk-stat-period=%ld", ftpfs->params.bulk_stat_period);
   if (ftpfs->params.bulk_stat_threshold != DEFAULT_BULK_STAT_THRESHOLD)
     FOPT ("--bulk-stat-threshold=%d", ftpfs->params.bulk_stat_threshold);
+  if (ftpfs->params.contents_cache_max != DEFAULT_CONTENTS_CACHE_MAX * 1024)
+    FOPT ("--contents-cache-size=%Zu", ftpfs->params.contents_cache_max / 1024);
+  if (ftpfs->params.read_ahead != DEFAULT_READ_AHEAD * 1024)
+    FOPT ("--read-ahead=%Zu", ftpfs->params.read_ahead / 1024);
+  if (ftpfs->params.max_conns != DEFAULT_MAX_CONNS)
+    FOPT ("--max-connections=%u", ftpfs->params.max_conns);
 
   return argz_add (argz, argz_len, ftpfs_remote_fs);
 }
@@ -384,6 +414,9 @@ main (int argc, char **argv)
   ftpfs_params.node_cache_max = DEFAULT_NODE_CACHE_MAX;
   ftpfs_params.bulk_stat_period = DEFAULT_BULK_STAT_PERIOD;
   ftpfs_params.bulk_stat_threshold = DEFAULT_BULK_STAT_THRESHOLD;
+  ftpfs_params.contents_cache_max = DEFAULT_CONTENTS_CACHE_MAX * 1024;
+  ftpfs_params.read_ahead = DEFAULT_READ_AHEAD * 1024;
+  ftpfs_params.max_conns = DEFAULT_MAX_CONNS;
 
   argp_parse (&argp, argc, argv, 0, 0, 0);
 
@@ -29,6 +29,7 @@
 
 /* Anonymous types.  */
 struct ccache;
+struct ccache_block;
 struct ftpfs_conn;
 
 /* A single entry in a directory.  */
@@ -145,6 +146,16 @@ struct ftpfs_params
 
   /* The size of the node cache.  */
   size_t node_cache_max;
+
+  /* The maximum number of bytes of file contents cached, for all files.  */
+  size_t contents_cache_max;
+
+  /* The number of bytes fetched in advance of sequential reads.  */
+  size_t read_ahead;
+
+  /* The maximum number of connections opened to the server, or 0 for no
+     limit.  */
+  unsigned max_conns;
 };
 
 /* A particular filesystem.  */
@@ -156,7 +167,9 @@ struct ftpfs
   /* A pool of ftp connections for server threads to use.  */
   struct ftpfs_conn *free_conns;
   struct ftpfs_conn *conns;
-  pthread_spinlock_t conn_lock;
+  unsigned num_conns;		/* Number of connections in both lists.  */
+  pthread_mutex_t conn_lock;
+  pthread_cond_t conn_free;	/* Signaled when a connection is freed.  */
 
   /* Parameters for making new ftp connections.  */
   struct ftp_conn_params *ftp_params;
@@ -176,6 +189,16 @@ struct ftpfs
   struct node *node_cache_mru, *node_cache_lru;
   size_t node_cache_len;	/* Number of entries in it.  */
   pthread_mutex_t node_cache_lock;
+
+  /* The blocks of file contents cached for all files, most recently used
+     first (see ccache.c).  */
+  struct ccache_block *ccache_mru, *ccache_lru;
+  size_t ccache_size;		/* Bytes of data in them.  */
+  pthread_mutex_t ccache_lock;
+
+  /* True if the server cannot restart transfers in the middle of a file,
+     so contents must always be fetched from the start.  */
+  int no_restart;
 };
 
 extern volatile struct mapped_time_value *ftpfs_maptime;
@@ -214,6 +237,20 @@ error_t ftpfs_get_ftp_conn (struct ftpfs *fs, struct ftp_conn **conn);
 /* Return CONN to the pool of free connections in FS.  */
 void ftpfs_release_ftp_conn (struct ftpfs *fs, struct ftp_conn *conn);
 
+/* Mark CONN, which is in the middle of the transfer on the data connection
+   DATA, as unused until OWNER reclaims it with ftpfs_unpark_ftp_conn.  If
+   FS runs out of connections in the meantime, the transfer is aborted and
+   CONN is given to another user.  */
+void ftpfs_park_ftp_conn (struct ftpfs *fs, struct ftp_conn *conn,
+			  void *owner, int data);
+
+/* Reclaim CONN, which OWNER parked with ftpfs_park_ftp_conn.  Return true
+   if OWNER can go on with its transfer, and false if CONN was taken away;
+   the data connection has then been closed, and CONN no longer belongs to
+   OWNER.  */
+int ftpfs_unpark_ftp_conn (struct ftpfs *fs, struct ftp_conn *conn,
+			   void *owner);
+
 /* Return in DIR a new ftpfs directory, in the filesystem FS, with node NODE
    and remote path RMT_PATH.  RMT_PATH is *not copied*, so it shouldn't ever
    change while this directory is active.  */
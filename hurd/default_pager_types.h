@@ -29,4 +29,16 @@ typedef const recnum_t *const_recnum_array_t;
 typedef vm_size_t *vm_size_array_t;
 typedef const vm_size_t *const_vm_size_array_t;
 
+/* Statistics of the compressed in-memory tier of the default pager.  */
+typedef struct default_pager_compressed_info
+{
+  vm_size_t dci_pool_limit;	/* Bytes the pool may hold.  */
+  vm_size_t dci_pool_used;	/* Bytes of compressed pages it holds.  */
+  vm_size_t dci_pages;		/* Pages it holds.  */
+  vm_size_t dci_stores;		/* Pages stored into it.  */
+  vm_size_t dci_hits;		/* Pages read back from it.  */
+  vm_size_t dci_evictions;	/* Pages moved from it to disk.  */
+  vm_size_t dci_rejects;	/* Pages which did not compress well.  */
+} default_pager_compressed_info_t;
+
 #endif
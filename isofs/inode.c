@@ -59,6 +59,8 @@ diskfs_user_make_node (struct node **npp, struct lookup_context *ctx)
   /* Format specific data for the new node.  */
   dn = diskfs_node_disknode (np);
   dn->fileinfo = 0;
+  dn->dir_index = 0;
+  dn->no_dir_index = 0;
   dn->dr = ctx->dr;
   err = calculate_file_start (ctx->dr, &dn->file_start, &ctx->rr);
   if (err)
@@ -328,6 +330,8 @@ diskfs_node_norefs (struct node *np)
   if (np->dn->translator)
     free (np->dn->translator);
 
+  drop_dir_index (np);
+
   assert_backtrace (!np->dn->fileinfo);
   free (np);
 }
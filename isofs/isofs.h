@@ -43,6 +43,10 @@ struct disknode
 
   size_t translen;
   char *translator;
+
+  /* For a directory, its index (see lookup.c), or zero.  */
+  struct dir_index *dir_index;
+  int no_dir_index;		/* The directory is too large to index.  */
 };
 
 struct user_pager_info
@@ -102,5 +106,8 @@ error_t cache_id (struct dirrect *record, struct rrip_lookup *rr, ino_t *idp);
 
 error_t calculate_file_start (struct dirrect *, off_t *, struct rrip_lookup *);
 
+/* Forget the directory index of NP, if it has one.  */
+void drop_dir_index (struct node *np);
+
 char *isodate_915 (char *, struct timespec *);
 char *isodate_84261 (char *, struct timespec *);
@@ -20,6 +20,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <dirent.h>
 #include "isofs.h"
 
@@ -63,6 +64,411 @@ isonamematch (const char *dirname, size_t dnamelen,
   return 0;
 }
 
+/* Directory indexes.  The first lookup in a directory larger than one
+   logical sector parses all its records, with their Rock Ridge fields,
+   into an index hashed on the names; later lookups and readdirs in the
+   directory use it instead of scanning and parsing the records again.
+   Indexes are kept for the most recently used directories, up to
+   DIR_INDEX_MAX_ENTRIES entries in all.
+
+   An index does not change once built.  It is built with only the
+   directory locked, and used by whoever holds a reference to it
+   without any lock; DIR_INDEX_LOCK is only held to find an index and
+   to keep count of them.  */
+
+#define DIR_INDEX_MAX_ENTRIES	(256 * 1024)
+
+struct dir_index_entry
+{
+  struct dirrect *dr;		/* Somewhere in disk_image.  */
+  struct rrip_lookup rr;	/* Its Rock Ridge fields.  */
+
+  /* The entry is hashed under its ISO 9660 name, and under its NM name
+     if it has one; the next slot in the same bucket for each.  */
+  int next[2];
+};
+
+struct dir_index
+{
+  struct node *dir;
+  struct dir_index *prev, *next;	/* In the LRU list.  */
+  int refs;			/* DIR's, while cached, and users'.  */
+
+  /* The records of the directory in order, without the RE ones.  */
+  struct dir_index_entry *entries;
+  size_t nentries;
+
+  /* Heads of the hash chains; a slot is an entry number times two, plus
+     one for its NM name.  */
+  int *buckets;
+  size_t nbuckets;
+};
+
+/* Protects the LRU list, the REFS of all indexes and the DIR_INDEX of
+   all disknodes.  */
+static pthread_mutex_t dir_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Most recently used first.  */
+static struct dir_index *dir_index_lru, *dir_index_lru_tail;
+static size_t dir_index_entries;
+
+/* Hash NAME (of length NAMELEN), such that all the names isonamematch
+   matches against a name hash the same way: ignore case, a version
+   number and trailing dots.  */
+static size_t
+dir_index_hash (const char *name, size_t namelen)
+{
+  const char *semi = memchr (name, ';', namelen);
+  size_t len = semi ? semi - name : namelen;
+  size_t hash = 0;
+  size_t i;
+
+  while (len > 0 && name[len - 1] == '.')
+    len--;
+  if (len == 0)
+    /* `.' and `..' */
+    len = semi ? semi - name : namelen;
+
+  for (i = 0; i < len; i++)
+    hash = hash * 31 + tolower ((unsigned char) name[i]);
+  return hash;
+}
+
+/* Return the ISO 9660 name of DR in *NAME and *NAMELEN, with `.' and
+   `..' spelled out.  */
+static void
+iso_name (struct dirrect *dr, const char **name, size_t *namelen)
+{
+  if (dr->namelen == 1 && dr->name[0] == '\0')
+    {
+      *name = ".";
+      *namelen = 1;
+    }
+  else if (dr->namelen == 1 && dr->name[0] == '\1')
+    {
+      *name = "..";
+      *namelen = 2;
+    }
+  else
+    {
+      *name = (const char *) dr->name;
+      *namelen = dr->namelen;
+    }
+}
+
+static void
+free_dir_index (struct dir_index *index)
+{
+  size_t i;
+
+  for (i = 0; i < index->nentries; i++)
+    release_rrip (&index->entries[i].rr);
+  free (index->entries);
+  free (index->buckets);
+  free (index);
+}
+
+static void
+lru_unlink (struct dir_index *index)
+{
+  if (index->prev)
+    index->prev->next = index->next;
+  else
+    dir_index_lru = index->next;
+  if (index->next)
+    index->next->prev = index->prev;
+  else
+    dir_index_lru_tail = index->prev;
+}
+
+static void
+lru_push (struct dir_index *index)
+{
+  index->prev = 0;
+  index->next = dir_index_lru;
+  if (dir_index_lru)
+    dir_index_lru->prev = index;
+  else
+    dir_index_lru_tail = index;
+  dir_index_lru = index;
+}
+
+/* Forget INDEX, and return nonzero if it is no longer in use, in which
+   case the caller must free it once it has released DIR_INDEX_LOCK.
+   Hold DIR_INDEX_LOCK.  */
+static int
+evict_dir_index (struct dir_index *index)
+{
+  lru_unlink (index);
+  dir_index_entries -= index->nentries;
+  index->dir->dn->dir_index = 0;
+  return --index->refs == 0;
+}
+
+/* Release a reference to INDEX got from get_dir_index.  */
+static void
+release_dir_index (struct dir_index *index)
+{
+  int last;
+
+  pthread_mutex_lock (&dir_index_lock);
+  last = --index->refs == 0;
+  pthread_mutex_unlock (&dir_index_lock);
+
+  if (last)
+    free_dir_index (index);
+}
+
+void
+drop_dir_index (struct node *np)
+{
+  struct dir_index *index;
+  int last = 0;
+
+  pthread_mutex_lock (&dir_index_lock);
+  index = np->dn->dir_index;
+  if (index)
+    last = evict_dir_index (index);
+  pthread_mutex_unlock (&dir_index_lock);
+
+  if (last)
+    free_dir_index (index);
+}
+
+/* Build the index of directory DP in *INDEX.  Return EFBIG if the
+   directory has too many entries to be indexed.  */
+static error_t
+build_dir_index (struct node *dp, struct dir_index **index)
+{
+  struct dir_index *volatile new;
+  void *buf, *blkaddr, *currentoff;
+  size_t alloced = 0;
+  size_t i;
+  error_t err;
+
+  new = calloc (1, sizeof *new);
+  if (!new)
+    return ENOMEM;
+  new->dir = dp;
+
+  err = diskfs_catch_exception ();
+  if (err)
+    {
+      free_dir_index (new);
+      return err;
+    }
+
+  /* Walk the records the way dirscanblock does.  */
+  buf = disk_image + (dp->dn->file_start << store->log2_block_size);
+  for (blkaddr = buf;
+       blkaddr < buf + dp->dn_stat.st_size;
+       blkaddr += logical_sector_size)
+    {
+      size_t reclen;
+
+      for (currentoff = blkaddr;
+	   currentoff < blkaddr + logical_sector_size;
+	   currentoff += reclen)
+	{
+	  struct dirrect *entry = currentoff;
+	  struct dir_index_entry *e;
+
+	  reclen = entry->len;
+	  if (reclen == 0
+	      || reclen < sizeof (struct dirrect)
+	      || currentoff + reclen > blkaddr + logical_sector_size
+	      || reclen < sizeof (struct dirrect) + entry->namelen)
+	    break;
+
+	  if (new->nentries == alloced)
+	    {
+	      if (alloced == DIR_INDEX_MAX_ENTRIES)
+		{
+		  err = EFBIG;
+		  goto out;
+		}
+	      alloced = alloced ? 2 * alloced : 64;
+	      e = realloc (new->entries, alloced * sizeof *e);
+	      if (!e)
+		{
+		  err = ENOMEM;
+		  goto out;
+		}
+	      new->entries = e;
+	    }
+
+	  e = &new->entries[new->nentries];
+	  e->dr = entry;
+	  rrip_lookup (entry, &e->rr, 0);
+
+	  /* Ignore RE entries */
+	  if (e->rr.valid & VALID_RE)
+	    release_rrip (&e->rr);
+	  else
+	    new->nentries++;
+	}
+    }
+
+  /* Hash the entries.  Going backwards puts each chain in directory
+     order.  */
+  new->nbuckets = new->nentries ?: 1;
+  new->buckets = malloc (new->nbuckets * sizeof *new->buckets);
+  if (!new->buckets)
+    {
+      err = ENOMEM;
+      goto out;
+    }
+  for (i = 0; i < new->nbuckets; i++)
+    new->buckets[i] = -1;
+
+  for (i = new->nentries; i-- > 0; )
+    {
+      struct dir_index_entry *e = &new->entries[i];
+      const char *name;
+      size_t namelen, b;
+
+      iso_name (e->dr, &name, &namelen);
+      b = dir_index_hash (name, namelen) % new->nbuckets;
+      e->next[0] = new->buckets[b];
+      new->buckets[b] = 2 * i;
+
+      e->next[1] = -1;
+      if ((e->rr.valid & VALID_NM) && e->rr.name)
+	{
+	  b = (dir_index_hash (e->rr.name, strlen (e->rr.name))
+	       % new->nbuckets);
+	  e->next[1] = new->buckets[b];
+	  new->buckets[b] = 2 * i + 1;
+	}
+    }
+
+ out:
+  diskfs_end_catch_exception ();
+
+  if (err)
+    free_dir_index (new);
+  else
+    *index = new;
+  return err;
+}
+
+/* Return a reference to the index of directory DP, building it if need
+   be, or zero if DP is not to be indexed.  Hold DP's lock, which keeps
+   others from building the same index meanwhile, and release the
+   reference with release_dir_index.  */
+static struct dir_index *
+get_dir_index (struct node *dp)
+{
+  struct dir_index *index, *evicted = 0;
+  error_t err;
+
+  if (dp->dn->no_dir_index || dp->dn_stat.st_size <= logical_sector_size)
+    return 0;
+
+  pthread_mutex_lock (&dir_index_lock);
+  index = dp->dn->dir_index;
+  if (index)
+    {
+      lru_unlink (index);
+      lru_push (index);
+      index->refs++;
+    }
+  pthread_mutex_unlock (&dir_index_lock);
+  if (index)
+    return index;
+
+  err = build_dir_index (dp, &index);
+  if (err)
+    {
+      /* Do not try again for a directory too large; for other errors,
+	 just scan it this time.  */
+      if (err == EFBIG)
+	dp->dn->no_dir_index = 1;
+      return 0;
+    }
+
+  pthread_mutex_lock (&dir_index_lock);
+  assert_backtrace (!dp->dn->dir_index);
+
+  /* Make room, and free what that evicts only once unlocked.  The LRU
+     links of an evicted index are no longer used.  */
+  while (dir_index_lru_tail
+	 && dir_index_entries + index->nentries > DIR_INDEX_MAX_ENTRIES)
+    {
+      struct dir_index *victim = dir_index_lru_tail;
+
+      if (evict_dir_index (victim))
+	{
+	  victim->next = evicted;
+	  evicted = victim;
+	}
+    }
+
+  dir_index_entries += index->nentries;
+  index->refs = 2;		/* DP's and the caller's.  */
+  dp->dn->dir_index = index;
+  lru_push (index);
+  pthread_mutex_unlock (&dir_index_lock);
+
+  while (evicted)
+    {
+      struct dir_index *next = evicted->next;
+      free_dir_index (evicted);
+      evicted = next;
+    }
+
+  return index;
+}
+
+/* Look up NAME (of length NAMELEN) in the index of directory DP.
+   Return its record in *RECORD and a copy of its Rock Ridge fields in
+   *RR, as dirscanblock would.  Return EAGAIN if DP has no index.  */
+static error_t
+dir_index_lookup (struct node *dp, const char *name, size_t namelen,
+		  struct dirrect **record, struct rrip_lookup *rr)
+{
+  struct dir_index *index;
+  struct dir_index_entry *found = 0;
+  error_t err = 0;
+  int slot;
+
+  index = get_dir_index (dp);
+  if (!index)
+    return EAGAIN;
+
+  /* An entry may be in the chain twice; take the first match in
+     directory order, like a scan would.  A failed NM match leaves the
+     ISO 9660 name to match against, see rrip_match_lookup.  */
+  for (slot = index->buckets[dir_index_hash (name, namelen)
+			     % index->nbuckets];
+       slot != -1;
+       slot = index->entries[slot / 2].next[slot % 2])
+    {
+      struct dir_index_entry *e = &index->entries[slot / 2];
+
+      if (found && e >= found)
+	continue;
+
+      if (((e->rr.valid & VALID_NM) && e->rr.name
+	   && strlen (e->rr.name) == namelen
+	   && !memcmp (e->rr.name, name, namelen))
+	  || isonamematch ((const char *) e->dr->name, e->dr->namelen,
+			   name, namelen))
+	found = e;
+    }
+
+  if (found)
+    {
+      *record = found->dr;
+      err = copy_rrip (rr, &found->rr);
+    }
+  else
+    err = ENOENT;
+
+  release_dir_index (index);
+  return err;
+}
+
 /* Implement the diskfs_lookup callback from the diskfs library.  See
    <hurd/diskfs.h> for the interface specification. */
 error_t
@@ -93,20 +499,26 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
   if (type == RENAME)
     return EROFS;
 
-  buf = disk_image + (dp->dn->file_start << store->log2_block_size);
-
-  for (blockaddr = buf;
-       blockaddr < buf + dp->dn_stat.st_size;
-       blockaddr += logical_sector_size)
+  err = dir_index_lookup (dp, name, namelen, &ctx.dr, &ctx.rr);
+  if (err == EAGAIN)
     {
-      err = dirscanblock (blockaddr, name, namelen, &ctx.dr, &ctx.rr);
+      buf = disk_image + (dp->dn->file_start << store->log2_block_size);
 
-      if (!err)
-	break;
+      for (blockaddr = buf;
+	   blockaddr < buf + dp->dn_stat.st_size;
+	   blockaddr += logical_sector_size)
+	{
+	  err = dirscanblock (blockaddr, name, namelen, &ctx.dr, &ctx.rr);
+
+	  if (!err)
+	    break;
 
-      if (err != ENOENT)
-	return err;
+	  if (err != ENOENT)
+	    return err;
+	}
     }
+  else if (err && err != ENOENT)
+    return err;
 
   if ((!err && type == REMOVE)
       || (err == ENOENT && type == CREATE))
@@ -236,6 +648,8 @@ diskfs_get_directs (struct node *dp,
   void *dirbuf, *bufp;
   char *datap;
   volatile int ouralloc = 0;
+  struct dir_index *volatile index = 0;
+  size_t next_entry = entry;
   error_t err;
 
   /* Allocate some space to hold the returned data. */
@@ -249,15 +663,20 @@ diskfs_get_directs (struct node *dp,
   err = diskfs_catch_exception ();
   if (err)
     {
+      if (index)
+	release_dir_index (index);
       if (ouralloc)
 	munmap (*data, allocsize);
       return err;
     }
 
+  /* With an index, the entries are at hand.  */
+  index = get_dir_index (dp);
+
   /* Skip to ENTRY */
   dirbuf = disk_image + (dp->dn->file_start << store->log2_block_size);
   bufp = dirbuf;
-  for (i = 0; i < entry; i ++)
+  for (i = 0; !index && i < entry; i ++)
     {
       struct rrip_lookup rr;
 
@@ -296,26 +715,38 @@ diskfs_get_directs (struct node *dp,
   datap = *data;
   while (((nentries == -1) || (i < nentries))
 	 && (!bufsiz || datap - *data < bufsiz)
-	 && ((void *) bufp - dirbuf < dp->dn_stat.st_size))
+	 && (index
+	     ? next_entry < index->nentries
+	     : (void *) bufp - dirbuf < dp->dn_stat.st_size))
     {
-      struct rrip_lookup rr;
+      struct rrip_lookup rrbuf, *rr;
       const char *name;
       size_t namlen, reclen;
 
-      ep = (struct dirrect *) bufp;
+      if (index)
+	{
+	  ep = index->entries[next_entry].dr;
+	  rr = &index->entries[next_entry].rr;
+	  next_entry++;
+	}
+      else
+	{
+	  ep = (struct dirrect *) bufp;
 
-      /* Fetch Rock-Ridge information for this file */
-      rrip_lookup (ep, &rr, 0);
+	  /* Fetch Rock-Ridge information for this file */
+	  rr = &rrbuf;
+	  rrip_lookup (ep, rr, 0);
+	}
 
       /* Ignore and skip RE entries */
-      if (! (rr.valid & VALID_RE))
+      if (! (rr->valid & VALID_RE))
 	{
 	  /* See if there's room to hold this one */
-	  name = rr.valid & VALID_NM ? rr.name : (char *) ep->name;
-	  namlen = rr.valid & VALID_NM ? strlen (name) : ep->namelen;
+	  name = rr->valid & VALID_NM ? rr->name : (char *) ep->name;
+	  namlen = rr->valid & VALID_NM ? strlen (name) : ep->namelen;
 
 	  /* Name frobnication */
-	  if (!(rr.valid & VALID_NM))
+	  if (!(rr->valid & VALID_NM))
 	    {
 	      if (namlen == 1 && name[0] == '\0')
 		{
@@ -356,14 +787,17 @@ diskfs_get_directs (struct node *dp,
 
 	  /* Fill in entry */
 
-	  if (use_file_start_id (ep, &rr))
+	  if (use_file_start_id (ep, rr))
 	    {
 	      off_t file_start;
 
-	      err = calculate_file_start (ep, &file_start, &rr);
+	      err = calculate_file_start (ep, &file_start, rr);
 	      if (err)
 		{
-		  release_rrip (&rr);
+		  if (index)
+		    release_dir_index (index);
+		  else
+		    release_rrip (rr);
 		  diskfs_end_catch_exception ();
 		  if (ouralloc)
 		    munmap (*data, allocsize);
@@ -386,7 +820,10 @@ diskfs_get_directs (struct node *dp,
 	  i++;
 	}
 
-      release_rrip (&rr);
+      if (index)
+	continue;
+
+      release_rrip (rr);
       bufp = bufp + ep->len;
 
       /* If BUFP points at a null, then we have hit the last
@@ -397,6 +834,8 @@ diskfs_get_directs (struct node *dp,
 			 + logical_sector_size);
     }
 
+  if (index)
+    release_dir_index (index);
   diskfs_end_catch_exception ();
 
   /* If we didn't use all the pages of a buffer we allocated, free
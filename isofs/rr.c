@@ -45,6 +45,46 @@ release_rrip (struct rrip_lookup *rr)
     free (rr->trans);
 }
 
+/* Copy FROM into TO, which the caller must release with release_rrip.  */
+error_t
+copy_rrip (struct rrip_lookup *to, const struct rrip_lookup *from)
+{
+  *to = *from;
+  to->valid &= ~(VALID_NM | VALID_SL | VALID_TR);
+  to->name = to->target = to->trans = 0;
+
+  if ((from->valid & VALID_NM) && from->name)
+    {
+      to->name = strdup (from->name);
+      if (!to->name)
+	goto nomem;
+    }
+  to->valid |= from->valid & VALID_NM;
+
+  if ((from->valid & VALID_SL) && from->target)
+    {
+      to->target = strdup (from->target);
+      if (!to->target)
+	goto nomem;
+    }
+  to->valid |= from->valid & VALID_SL;
+
+  if ((from->valid & VALID_TR) && from->trans)
+    {
+      to->trans = malloc (from->translen);
+      if (!to->trans)
+	goto nomem;
+      memcpy (to->trans, from->trans, from->translen);
+    }
+  to->valid |= from->valid & VALID_TR;
+
+  return 0;
+
+ nomem:
+  release_rrip (to);
+  return ENOMEM;
+}
+
 
 /* Work function combining the three interfaces below. */
 static int
@@ -264,3 +264,4 @@ int rrip_match_lookup (struct dirrect *, const char *,
 void rrip_lookup (struct dirrect *, struct rrip_lookup *, int);
 void rrip_initialize (struct dirrect *);
 void release_rrip (struct rrip_lookup *);
+error_t copy_rrip (struct rrip_lookup *, const struct rrip_lookup *);
@@ -0,0 +1,433 @@
+/* Dispatching received frames to the filters that may accept them
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <mach.h>
+#include <hurd.h>
+
+#include "bpf_impl.h"
+#include "queue.h"
+#include "util.h"
+
+/* Limits of the analysis; a filter exceeding them is not indexed.  */
+#define DISPATCH_MAX_FIELDS	4
+#define DISPATCH_MAX_VALUES	16
+#define DISPATCH_MAX_WALKS	256
+
+/* The values a field may have for a filter to accept a frame.  */
+struct field_values {
+	int		size;
+	int		offset;
+	int		n_values;
+	unsigned long	values[DISPATCH_MAX_VALUES];
+};
+
+/* What analyse_filter learned about a filter.  */
+struct filter_fields {
+	int		n_paths;	/* accepting paths; -1 if unknown */
+	int		n_fields;
+	struct field_values fields[DISPATCH_MAX_FIELDS];
+};
+
+static struct field_values *
+find_field(struct field_values *fv, int n, int size, int offset)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (fv[i].size == size && fv[i].offset == offset)
+			return &fv[i];
+	return 0;
+}
+
+/* Whether VALUE is one of the values of FV.  */
+static int
+has_value(struct field_values *fv, unsigned long value)
+{
+	int i;
+
+	for (i = 0; i < fv->n_values; i++)
+		if (fv->values[i] == value)
+			return 1;
+	return 0;
+}
+
+/*
+ * Find the fields of the frame that INFP compares for equality with
+ * a constant on every path leading to an accepting return, and
+ * which constants those are.  The program is a DAG since jumps are
+ * forward, so its paths are simply enumerated.
+ */
+static void
+analyse_filter(net_rcv_port_t infp, struct filter_fields *ff)
+{
+	bpf_insn_t f = (bpf_insn_t)infp->filter;
+	int len = BPF_BYTES2LEN(CSPF_BYTES(infp->filter_end - infp->filter));
+	struct {
+		int size, offset;
+		unsigned long value;
+	} path[len];
+	int walks = 0;
+
+	void accept(int depth)
+	{
+		struct field_values pf[DISPATCH_MAX_FIELDS], *fv;
+		int i, n = 0;
+
+		/* Collect the constraints of this path by field.  */
+		for (i = 0; i < depth; i++) {
+			fv = find_field(pf, n, path[i].size, path[i].offset);
+			if (fv != 0) {
+				if (fv->values[0] != path[i].value)
+					return;	/* the path cannot be taken */
+				continue;
+			}
+			if (n == DISPATCH_MAX_FIELDS)
+				continue;
+			pf[n].size = path[i].size;
+			pf[n].offset = path[i].offset;
+			pf[n].n_values = 1;
+			pf[n].values[0] = path[i].value;
+			n++;
+		}
+
+		if (ff->n_paths++ == 0) {
+			memcpy(ff->fields, pf, n * sizeof pf[0]);
+			ff->n_fields = n;
+			return;
+		}
+
+		/* Keep the fields also constrained on this path, and
+		   add the value it requires.  */
+		for (i = 0; i < ff->n_fields; ) {
+			struct field_values *cur = &ff->fields[i];
+
+			fv = find_field(pf, n, cur->size, cur->offset);
+			if (fv != 0) {
+				if (has_value(cur, fv->values[0])) {
+					i++;
+					continue;
+				}
+				if (cur->n_values < DISPATCH_MAX_VALUES) {
+					cur->values[cur->n_values++] = fv->values[0];
+					i++;
+					continue;
+				}
+			}
+			*cur = ff->fields[--ff->n_fields];
+		}
+	}
+
+	/* Follow the program from instruction I.  A holds the field
+	   of SIZE at OFFSET if SIZE is not -1.  */
+	void walk(int i, int size, int offset, int depth)
+	{
+		bpf_insn_t p;
+
+		if (++walks > DISPATCH_MAX_WALKS)
+			ff->n_paths = -1;
+
+		for (; i < len && ff->n_paths >= 0; i++) {
+			p = &f[i];
+			switch (BPF_CLASS(p->code)) {
+				case BPF_RET:
+					if (p->code != (BPF_RET|BPF_K) || p->k != 0)
+						accept(depth);
+					return;
+
+				case BPF_LD:
+					if (BPF_MODE(p->code) == BPF_ABS) {
+						size = BPF_SIZE(p->code);
+						offset = p->k;
+					} else
+						size = -1;
+					break;
+
+				case BPF_ALU:
+					size = -1;
+					break;
+
+				case BPF_MISC:
+					if (p->code == (BPF_MISC|BPF_KEY))
+						return;
+					if (p->code == (BPF_MISC|BPF_TXA))
+						size = -1;
+					break;
+
+				case BPF_JMP:
+					if (BPF_OP(p->code) == BPF_JA) {
+						i += p->k;
+						break;
+					}
+					if (p->code == (BPF_JMP|BPF_JEQ|BPF_K)
+							&& size != -1) {
+						path[depth].size = size;
+						path[depth].offset = offset;
+						path[depth].value = p->k;
+						walk(i + 1 + p->jt, size, offset, depth + 1);
+					} else
+						walk(i + 1 + p->jt, size, offset, depth);
+					i += p->jf;
+					break;
+			}
+		}
+	}
+
+	ff->n_paths = 0;
+	ff->n_fields = 0;
+	walk(1, -1, 0, 0);
+}
+
+static unsigned int
+dispatch_hash(unsigned long value)
+{
+	return (unsigned int)(value ^ (value >> 16)) * 0x9e3779b1U;
+}
+
+void
+net_dispatch_free(struct net_dispatch *d)
+{
+	if (d == 0)
+		return;
+	free(d->table);
+	free(d->entries);
+	free(d->fps);
+	free(d);
+}
+
+/*
+ * Rebuild the index of the input filters of IFP.  It must be called
+ * whenever if_rcv_port_list or the filters on it change.
+ */
+void
+net_dispatch_update(if_filter_list_t *ifp)
+{
+	queue_head_t *list = &ifp->if_rcv_port_list;
+	struct net_dispatch *d, *old = ifp->rcv_dispatch;
+	net_rcv_port_t infp;
+	int i, j, e, n = 0, best, n_fps;
+	double best_cost;
+
+	queue_iterate(list, infp, net_rcv_port_t, input)
+		n++;
+
+	ifp->rcv_dispatch = 0;
+	if (n == 0) {
+		net_dispatch_free(old);
+		return;
+	}
+
+	net_rcv_port_t fps[n];
+	struct filter_fields ff[n];
+	struct field_values *fv[n];
+
+	i = 0;
+	queue_iterate(list, infp, net_rcv_port_t, input) {
+		fps[i] = infp;
+		analyse_filter(infp, &ff[i]);
+		i++;
+	}
+
+	/*
+	 * Estimate how many filters a frame would have to go through
+	 * if the field of SIZE at OFFSET were used: those that are not
+	 * indexed by it plus, on average over its values, those that
+	 * are.  A filter that never accepts anything is indexed by any
+	 * field, under no value at all.
+	 */
+	double cost(int size, int offset)
+	{
+		struct field_values *v;
+		int k, l, m, wild = 0, values = 0, distinct = 0;
+
+		for (k = 0; k < n; k++) {
+			if (ff[k].n_paths == 0)
+				continue;
+			v = (ff[k].n_paths < 0) ? 0
+				: find_field(ff[k].fields, ff[k].n_fields,
+					size, offset);
+			if (v == 0) {
+				wild++;
+				continue;
+			}
+			values += v->n_values;
+			/* Count each value at its first occurrence.  */
+			for (l = 0; l < v->n_values; l++) {
+				for (m = 0; m < k; m++) {
+					struct field_values *w;
+					if (ff[m].n_paths <= 0)
+						continue;
+					w = find_field(ff[m].fields, ff[m].n_fields,
+							size, offset);
+					if (w != 0 && has_value(w, v->values[l]))
+						break;
+				}
+				if (m == k)
+					distinct++;
+			}
+		}
+		return wild + (distinct ? (double)values / distinct : 0);
+	}
+
+	best = -1;
+	best_cost = n;
+	for (i = 0; i < n; i++) {
+		if (ff[i].n_paths <= 0)
+			continue;
+		for (j = 0; j < ff[i].n_fields; j++) {
+			double c = cost(ff[i].fields[j].size,
+					ff[i].fields[j].offset);
+			if (c < best_cost) {
+				best = i * DISPATCH_MAX_FIELDS + j;
+				best_cost = c;
+			}
+		}
+	}
+
+	d = calloc(1, sizeof *d);
+	if (d == 0)
+		goto out;
+	d->size = -1;
+
+	/* fv[i] is null for the filters that are not indexed.  */
+	for (i = 0; i < n; i++)
+		fv[i] = 0;
+	if (best != -1) {
+		struct field_values *bf = &ff[best / DISPATCH_MAX_FIELDS]
+			.fields[best % DISPATCH_MAX_FIELDS];
+		d->size = bf->size;
+		d->offset = bf->offset;
+		for (i = 0; i < n; i++) {
+			if (ff[i].n_paths == 0) {
+				/* Any field_values with no value will do.  */
+				fv[i] = &ff[i].fields[0];
+				fv[i]->n_values = 0;
+			} else if (ff[i].n_paths > 0)
+				fv[i] = find_field(ff[i].fields, ff[i].n_fields,
+						d->size, d->offset);
+		}
+	}
+
+	/* Gather the distinct values.  */
+	n_fps = 0;
+	for (i = 0; i < n; i++) {
+		if (fv[i] == 0)
+			d->n_wild++;
+		else
+			n_fps += fv[i]->n_values;
+	}
+	d->entries = malloc((n_fps + 1) * sizeof *d->entries);
+	if (d->entries == 0)
+		goto fail;
+	for (i = 0; i < n; i++) {
+		if (fv[i] == 0)
+			continue;
+		for (j = 0; j < fv[i]->n_values; j++) {
+			for (e = 0; e < d->n_entries; e++)
+				if (d->entries[e].value == fv[i]->values[j])
+					break;
+			if (e == d->n_entries) {
+				d->entries[e].value = fv[i]->values[j];
+				d->entries[e].count = 0;
+				d->n_entries++;
+			}
+		}
+	}
+
+	/* Lay out the candidates: the filters that are not indexed
+	   first, then those of each value, each in priority order.  */
+	d->fps = malloc((d->n_wild + d->n_entries * n + 1) * sizeof *d->fps);
+	if (d->fps == 0)
+		goto fail;
+	n_fps = 0;
+	for (i = 0; i < n; i++)
+		if (fv[i] == 0)
+			d->fps[n_fps++] = fps[i];
+	for (e = 0; e < d->n_entries; e++) {
+		struct net_dispatch_entry *ent = &d->entries[e];
+
+		ent->start = n_fps;
+		for (i = 0; i < n; i++) {
+			if (fv[i] == 0 || has_value(fv[i], ent->value))
+				d->fps[n_fps++] = fps[i];
+		}
+		ent->count = n_fps - ent->start;
+	}
+
+	/* Open-addressed table, at most half full.  */
+	for (d->mask = 1; d->mask < 2 * d->n_entries; d->mask <<= 1)
+		;
+	d->table = calloc(d->mask, sizeof *d->table);
+	if (d->table == 0)
+		goto fail;
+	d->mask--;
+	for (e = 0; e < d->n_entries; e++) {
+		unsigned int h = dispatch_hash(d->entries[e].value);
+		while (d->table[h & d->mask] != 0)
+			h++;
+		d->table[h & d->mask] = e + 1;
+	}
+
+	ifp->rcv_dispatch = d;
+	goto out;
+
+fail:
+	/* Without an index, every filter is run on every frame.  */
+	net_dispatch_free(d);
+out:
+	net_dispatch_free(old);
+}
+
+/*
+ * Set *FPP to the input filters of IFP that may accept the frame
+ * split into HEADER, of HLEN bytes, and P, in priority order, and
+ * return their number.  The caller still has to run each of them
+ * with bpf_do_filter.  If IFP has no index, because it has no filters
+ * or memory ran short while building it, return -1; the caller must
+ * then run all the filters on if_rcv_port_list.
+ */
+int
+net_dispatch(if_filter_list_t *ifp, char *p, char *header,
+		unsigned int hlen, net_rcv_port_t **fpp)
+{
+	struct net_dispatch *d = ifp->rcv_dispatch;
+	unsigned long value;
+	unsigned int h;
+	int e;
+
+	if (d == 0)
+		return -1;
+
+	/* If the field cannot be loaded, none of the indexed filters
+	   would get past the load.  */
+	if (d->size != -1
+			&& bpf_load(d->size, d->offset, p, header, hlen,
+				NET_RCV_MAX, &value)) {
+		for (h = dispatch_hash(value); (e = d->table[h & d->mask]) != 0; h++)
+			if (d->entries[e - 1].value == value) {
+				*fpp = &d->fps[d->entries[e - 1].start];
+				return d->entries[e - 1].count;
+			}
+	}
+
+	*fpp = d->fps;
+	return d->n_wild;
+}
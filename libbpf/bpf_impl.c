@@ -49,9 +49,11 @@
 static struct net_hash_header filter_hash_header[N_NET_HASH];
 
 /*
- * Execute the filter program starting at pc on the packet p
+ * Execute the filter program of infp on the packet p
  * wirelen is the length of the original packet
- * buflen is the amount of data present
+ *
+ * The program was compiled by bpf_compile when the filter
+ * was installed, see bpf_prog.c.
  *
  * @p: packet data.
  * @wirelen: data_count (in bytes)
@@ -63,277 +65,25 @@ bpf_do_filter(net_rcv_port_t infp, char *p,	unsigned int wirelen,
 		char *header, unsigned int hlen, net_hash_entry_t **hash_headpp,
 		net_hash_entry_t *entpp)
 {
-	bpf_insn_t pc, pc_end;
-	unsigned int buflen;
-
-	unsigned long A, X;
-	int k;
 	unsigned int mem[BPF_MEMWORDS];
+	int n_keys = 0;
+	int ret;
 
-	/* Generic pointer to either HEADER or P according to the specified offset. */
-	char *data = NULL;
-
-	pc = ((bpf_insn_t) infp->filter) + 1;
-	/* filter[0].code is (NETF_BPF | flags) */
-	pc_end = (bpf_insn_t)infp->filter_end;
-	buflen = NET_RCV_MAX;
 	*entpp = 0;			/* default */
 
-	A = 0;
-	X = 0;
-	for (; pc < pc_end; ++pc) {
-		switch (pc->code) {
-
-			default:
-				abort();
-			case BPF_RET|BPF_K:
-				if (infp->rcv_port == MACH_PORT_NULL &&
-						*entpp == 0) {
-					return 0;
-				}
-				return ((u_int)pc->k <= wirelen) ?
-					pc->k : wirelen;
-
-			case BPF_RET|BPF_A:
-				if (infp->rcv_port == MACH_PORT_NULL &&
-						*entpp == 0) {
-					return 0;
-				}
-				return ((u_int)A <= wirelen) ?
-					A : wirelen;
-
-			case BPF_RET|BPF_MATCH_IMM:
-				if (bpf_match ((net_hash_header_t)infp, pc->jt, mem,
-							hash_headpp, entpp)) {
-					return ((u_int)pc->k <= wirelen) ?
-						pc->k : wirelen;
-				}
-				return 0;
-
-			case BPF_LD|BPF_W|BPF_ABS:
-				k = pc->k;
-
-load_word:
-				if ((u_int)k + sizeof(long) <= hlen)
-					data = header;
-				else if ((u_int)k + sizeof(long) <= buflen) {
-					k -= hlen;
-					data = p;
-				} else
-					return 0;
-
-#ifdef BPF_ALIGN
-				if (((int)(data + k) & 3) != 0)
-					A = EXTRACT_LONG(&data[k]);
-				else
-#endif
-					A = ntohl(*(long *)(data + k));
-				continue;
-
-			case BPF_LD|BPF_H|BPF_ABS:
-				k = pc->k;
-
-load_half:
-				if ((u_int)k + sizeof(short) <= hlen)
-					data = header;
-				else if ((u_int)k + sizeof(short) <= buflen) {
-					k -= hlen;
-					data = p;
-				} else
-					return 0;
-
-				A = EXTRACT_SHORT(&data[k]);
-				continue;
-
-			case BPF_LD|BPF_B|BPF_ABS:
-				k = pc->k;
-
-load_byte:
-				if ((u_int)k < hlen)
-					data = header;
-				else if ((u_int)k < buflen) {
-					data = p;
-					k -= hlen;
-				} else
-					return 0;
-
-				A = data[k];
-				continue;
-
-			case BPF_LD|BPF_W|BPF_LEN:
-				A = wirelen;
-				continue;
-
-			case BPF_LDX|BPF_W|BPF_LEN:
-				X = wirelen;
-				continue;
-
-			case BPF_LD|BPF_W|BPF_IND:
-				k = X + pc->k;
-				goto load_word;
-
-			case BPF_LD|BPF_H|BPF_IND:
-				k = X + pc->k;
-				goto load_half;
-
-			case BPF_LD|BPF_B|BPF_IND:
-				k = X + pc->k;
-				goto load_byte;
-
-			case BPF_LDX|BPF_MSH|BPF_B:
-				k = pc->k;
-				if (k < hlen)
-					data = header;
-				else if (k < buflen) {
-					data = p;
-					k -= hlen;
-				} else
-					return 0;
-
-				X = (data[k] & 0xf) << 2;
-				continue;
+	ret = bpf_prog_run(infp->prog, p, wirelen, header, hlen,
+			NET_RCV_MAX, mem, &n_keys);
 
-			case BPF_LD|BPF_IMM:
-				A = pc->k;
-				continue;
-
-			case BPF_LDX|BPF_IMM:
-				X = pc->k;
-				continue;
-
-			case BPF_LD|BPF_MEM:
-				A = mem[pc->k];
-				continue;
-
-			case BPF_LDX|BPF_MEM:
-				X = mem[pc->k];
-				continue;
+	if (n_keys != 0)
+		return bpf_match((net_hash_header_t)infp, n_keys, mem,
+				hash_headpp, entpp) ? ret : 0;
 
-			case BPF_ST:
-				mem[pc->k] = A;
-				continue;
-
-			case BPF_STX:
-				mem[pc->k] = X;
-				continue;
-
-			case BPF_JMP|BPF_JA:
-				pc += pc->k;
-				continue;
-
-			case BPF_JMP|BPF_JGT|BPF_K:
-				pc += (A > pc->k) ? pc->jt : pc->jf;
-				continue;
-
-			case BPF_JMP|BPF_JGE|BPF_K:
-				pc += (A >= pc->k) ? pc->jt : pc->jf;
-				continue;
-
-			case BPF_JMP|BPF_JEQ|BPF_K:
-				pc += (A == pc->k) ? pc->jt : pc->jf;
-				continue;
-
-			case BPF_JMP|BPF_JSET|BPF_K:
-				pc += (A & pc->k) ? pc->jt : pc->jf;
-				continue;
-
-			case BPF_JMP|BPF_JGT|BPF_X:
-				pc += (A > X) ? pc->jt : pc->jf;
-				continue;
-
-			case BPF_JMP|BPF_JGE|BPF_X:
-				pc += (A >= X) ? pc->jt : pc->jf;
-				continue;
-
-			case BPF_JMP|BPF_JEQ|BPF_X:
-				pc += (A == X) ? pc->jt : pc->jf;
-				continue;
-
-			case BPF_JMP|BPF_JSET|BPF_X:
-				pc += (A & X) ? pc->jt : pc->jf;
-				continue;
-
-			case BPF_ALU|BPF_ADD|BPF_X:
-				A += X;
-				continue;
-
-			case BPF_ALU|BPF_SUB|BPF_X:
-				A -= X;
-				continue;
-
-			case BPF_ALU|BPF_MUL|BPF_X:
-				A *= X;
-				continue;
-
-			case BPF_ALU|BPF_DIV|BPF_X:
-				if (X == 0)
-					return 0;
-				A /= X;
-				continue;
-
-			case BPF_ALU|BPF_AND|BPF_X:
-				A &= X;
-				continue;
-
-			case BPF_ALU|BPF_OR|BPF_X:
-				A |= X;
-				continue;
-
-			case BPF_ALU|BPF_LSH|BPF_X:
-				A <<= X;
-				continue;
-
-			case BPF_ALU|BPF_RSH|BPF_X:
-				A >>= X;
-				continue;
-
-			case BPF_ALU|BPF_ADD|BPF_K:
-				A += pc->k;
-				continue;
-
-			case BPF_ALU|BPF_SUB|BPF_K:
-				A -= pc->k;
-				continue;
-
-			case BPF_ALU|BPF_MUL|BPF_K:
-				A *= pc->k;
-				continue;
-
-			case BPF_ALU|BPF_DIV|BPF_K:
-				A /= pc->k;
-				continue;
-
-			case BPF_ALU|BPF_AND|BPF_K:
-				A &= pc->k;
-				continue;
-
-			case BPF_ALU|BPF_OR|BPF_K:
-				A |= pc->k;
-				continue;
-
-			case BPF_ALU|BPF_LSH|BPF_K:
-				A <<= pc->k;
-				continue;
-
-			case BPF_ALU|BPF_RSH|BPF_K:
-				A >>= pc->k;
-				continue;
-
-			case BPF_ALU|BPF_NEG:
-				A = -A;
-				continue;
-
-			case BPF_MISC|BPF_TAX:
-				X = A;
-				continue;
-
-			case BPF_MISC|BPF_TXA:
-				A = X;
-				continue;
-		}
-	}
+	/* A plain return from a filter shared through the hash
+	   table does not designate any receiver.  */
+	if (infp->rcv_port == MACH_PORT_NULL)
+		return 0;
 
-	return 0;
+	return ret;
 }
 
 /*
@@ -581,6 +331,7 @@ net_set_filter(if_filter_list_t *ifp, mach_port_t rcv_port, int priority,
 	int               ret, is_new_infp;
 	io_return_t           rval;
 	boolean_t         in, out;
+	struct bpf_cinsn  prog[BPF_PROG_LEN(CSPF_BYTES(NET_MAX_FILTER))];
 
 	/* Check the filter syntax. */
 
@@ -589,7 +340,7 @@ net_set_filter(if_filter_list_t *ifp, mach_port_t rcv_port, int priority,
 	filter_bytes = CSPF_BYTES (filter_count);
 	match = (bpf_insn_t) 0;
 
-	if (filter_count == 0) {
+	if (filter_count == 0 || filter_count > NET_MAX_FILTER) {
 		return (D_INVALID_OPERATION);
 	} else if (!((filter[0] & NETF_IN) || (filter[0] & NETF_OUT))) {
 		return (D_INVALID_OPERATION); /* NETF_IN or NETF_OUT required */
@@ -597,6 +348,8 @@ net_set_filter(if_filter_list_t *ifp, mach_port_t rcv_port, int priority,
 		ret = bpf_validate((bpf_insn_t)filter, filter_bytes, &match);
 		if (!ret)
 			return (D_INVALID_OPERATION);
+		if (!bpf_compile((bpf_insn_t)filter, filter_bytes, prog))
+			return (D_INVALID_OPERATION);
 	} else {
 		return (D_INVALID_OPERATION);
 	}
@@ -739,6 +492,8 @@ hash_loop_end:
 		memcpy (my_infp->filter, filter, filter_bytes);
 		my_infp->filter_end =
 			(filter_t *)((char *)my_infp->filter + filter_bytes);
+		memcpy (my_infp->prog, prog,
+			BPF_PROG_LEN(filter_bytes) * sizeof (struct bpf_cinsn));
 
 		/* Insert my_infp according to priority */
 		if (in) {
@@ -783,6 +538,8 @@ hash_loop_end:
 clean_and_return:
 	/* No locks are held at this point. */
 
+	net_dispatch_update(ifp);
+
 	if (dead_infp != 0)
 		net_free_dead_infp(dead_infp);
 	if (dead_entp != 0)
@@ -794,6 +551,8 @@ clean_and_return:
 void
 destroy_filters (if_filter_list_t *ifp)
 {
+	net_dispatch_free(ifp->rcv_dispatch);
+	ifp->rcv_dispatch = 0;
 }
 
 void
@@ -862,6 +621,8 @@ hash_loop_end:
 	}
 	FILTER_ITERATE_END
 
+	net_dispatch_update(ifp);
+
 	if (dead_infp != 0)
 		net_free_dead_infp(dead_infp);
 	if (dead_entp != 0)
@@ -40,12 +40,16 @@
 
 #include <device/bpf.h>
 
+#include "bpf_prog.h"
 #include "queue.h"
 
+struct net_dispatch;
+
 typedef struct
 {
   queue_head_t if_rcv_port_list;	/* input filter list */
   queue_head_t if_snd_port_list;	/* output filter list */
+  struct net_dispatch *rcv_dispatch;	/* index of if_rcv_port_list */
 }if_filter_list_t;
 
 typedef	unsigned short	filter_t;
@@ -57,21 +61,6 @@ typedef filter_t	*filter_array_t;
 #define N_NET_HASH      4
 #define N_NET_HASH_KEYS 4
 
-#ifndef BPF_ALIGN
-#define EXTRACT_SHORT(p)	((u_short)ntohs(*(u_short *)p))
-#define EXTRACT_LONG(p)		(ntohl(*(u_long *)p))
-#else
-#define EXTRACT_SHORT(p)\
-	((u_short)\
-	 ((u_short)*((u_char *)p+0)<<8|\
-	  (u_short)*((u_char *)p+1)<<0))
-#define EXTRACT_LONG(p)\
-	((u_long)*((u_char *)p+0)<<24|\
-	 (u_long)*((u_char *)p+1)<<16|\
-	 (u_long)*((u_char *)p+2)<<8|\
-	 (u_long)*((u_char *)p+3)<<0)
-#endif
-
 #define HASH_ITERATE(head, elt) (elt) = (net_hash_entry_t) (head); do {
 #define HASH_ITERATE_END(head, elt) \
 	(elt) = (net_hash_entry_t) queue_next((queue_entry_t) (elt));	   \
@@ -106,6 +95,8 @@ struct net_rcv_port {
 	filter_t	*filter_end;	/* pointer to end of filter */
 	filter_t	filter[NET_MAX_FILTER];
 	/* filter operations */
+	struct bpf_cinsn prog[BPF_PROG_LEN(CSPF_BYTES(NET_MAX_FILTER))];
+	/* filter compiled by bpf_compile */
 };
 typedef struct net_rcv_port *net_rcv_port_t;
 
@@ -138,6 +129,37 @@ struct net_hash_header {
 
 typedef struct net_hash_header *net_hash_header_t;
 
+/*
+ * The receivers that may accept frames whose dispatch field
+ * has a given value.
+ */
+struct net_dispatch_entry {
+	unsigned long	value;
+	int		start;		/* first candidate in fps */
+	int		count;		/* number of candidates */
+};
+
+/*
+ * Index of the input filters of an interface, rebuilt by
+ * net_dispatch_update whenever the filters change.
+ *
+ * The filters are analysed to find a field of the frame (the
+ * Ethernet type, an IP address, ...) that most of them compare
+ * with constants before accepting anything.  A frame is then only
+ * run through the filters which accept the value it carries in that
+ * field, and through those that could not be indexed.
+ */
+struct net_dispatch {
+	int		size;		/* BPF_W, BPF_H or BPF_B; -1 if none */
+	int		offset;		/* offset of the field */
+	int		n_wild;		/* candidates for any other value */
+	int		n_entries;
+	unsigned int	mask;		/* size of table - 1 */
+	int		*table;		/* index in entries + 1, or 0 */
+	struct net_dispatch_entry *entries;
+	net_rcv_port_t	*fps;		/* candidates, in priority order */
+};
+
 int bpf_do_filter(net_rcv_port_t infp, char *p,	unsigned int wirelen,
 		char *header, unsigned int hlen, net_hash_entry_t **hash_headpp,
 		net_hash_entry_t *entpp);
@@ -158,4 +180,9 @@ void remove_dead_filter (if_filter_list_t *ifp,
 		queue_head_t *if_port_list, mach_port_t dead_port);
 void destroy_filters (if_filter_list_t *ifp);
 
+void net_dispatch_update (if_filter_list_t *ifp);
+void net_dispatch_free (struct net_dispatch *d);
+int net_dispatch (if_filter_list_t *ifp, char *p, char *header,
+		unsigned int hlen, net_rcv_port_t **fpp);
+
 #endif /* _DEVICE_BPF_H_ */
@@ -0,0 +1,397 @@
+/* Pre-compiled BPF filter programs
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
+
+/* A filter is translated once, when it is installed, into an array of
+   `struct bpf_cinsn' whose opcodes index a table of label addresses.
+   Each instruction then dispatches directly to the next one instead
+   of going back through a single switch, jump offsets are resolved to
+   absolute indexes, and the common "load a packet field and compare
+   it with a constant" pair is fused into a single instruction.
+
+   This file deliberately depends on nothing but <device/bpf.h>, so
+   that benchmarks/bpf-bench.c can build it on any GNU system.  */
+
+#include <arpa/inet.h>
+
+#include "bpf_prog.h"
+
+enum
+{
+	OP_RET_K,
+	OP_RET_A,
+	OP_MATCH,
+	OP_LD_W_ABS,
+	OP_LD_H_ABS,
+	OP_LD_B_ABS,
+	OP_LD_W_IND,
+	OP_LD_H_IND,
+	OP_LD_B_IND,
+	OP_LD_W_LEN,
+	OP_LDX_W_LEN,
+	OP_LDX_MSH,
+	OP_LD_IMM,
+	OP_LDX_IMM,
+	OP_LD_MEM,
+	OP_LDX_MEM,
+	OP_ST,
+	OP_STX,
+	OP_JA,
+	OP_JGT_K,
+	OP_JGE_K,
+	OP_JEQ_K,
+	OP_JSET_K,
+	OP_JGT_X,
+	OP_JGE_X,
+	OP_JEQ_X,
+	OP_JSET_X,
+	OP_ADD_X,
+	OP_SUB_X,
+	OP_MUL_X,
+	OP_DIV_X,
+	OP_AND_X,
+	OP_OR_X,
+	OP_LSH_X,
+	OP_RSH_X,
+	OP_ADD_K,
+	OP_SUB_K,
+	OP_MUL_K,
+	OP_DIV_K,
+	OP_AND_K,
+	OP_OR_K,
+	OP_LSH_K,
+	OP_RSH_K,
+	OP_NEG,
+	OP_TAX,
+	OP_TXA,
+	/* Superinstructions: an absolute load followed by BPF_JEQ|BPF_K.  */
+	OP_LD_W_ABS_JEQ,
+	OP_LD_H_ABS_JEQ,
+	OP_LD_B_ABS_JEQ,
+	OP_COUNT
+};
+
+/*
+ * Translate the filter program F of BYTES bytes, which must already
+ * have been accepted by bpf_validate, into PROG.  PROG must have
+ * room for BPF_PROG_LEN(BYTES) instructions; index I of PROG
+ * corresponds to index I of F.
+ *
+ * Return 0 if F uses an unknown opcode, jumps backwards or out of the
+ * program, divides by a zero constant or addresses scratch memory out
+ * of range; such programs are rejected at install time instead of
+ * misbehaving on the first packet that reaches the offending
+ * instruction.  Otherwise return 1.
+ */
+int
+bpf_compile(bpf_insn_t f, int bytes, bpf_cinsn_t prog)
+{
+	int i, len;
+	bpf_insn_t p;
+	bpf_cinsn_t c;
+
+	len = BPF_BYTES2LEN(bytes);
+
+	/* f[0] is the NETF_BPF header and is never executed.  */
+	prog[0].op = OP_RET_K;
+	prog[0].k = 0;
+
+	for (i = 1; i < len; ++i) {
+		p = &f[i];
+		c = &prog[i];
+		c->k = p->k;
+		c->k2 = 0;
+		c->jt = i + 1 + p->jt;
+		c->jf = i + 1 + p->jf;
+
+		switch (p->code) {
+			default:
+				return 0;
+
+			case BPF_RET|BPF_K:		c->op = OP_RET_K; break;
+			case BPF_RET|BPF_A:		c->op = OP_RET_A; break;
+			case BPF_RET|BPF_MATCH_IMM:
+				c->op = OP_MATCH;
+				c->jt = p->jt;		/* number of keys */
+				break;
+
+			case BPF_MISC|BPF_KEY:
+				/* Keys are only data for the preceding MATCH;
+				   reaching one rejects the packet.  */
+				c->op = OP_RET_K;
+				c->k = 0;
+				break;
+
+			case BPF_LD|BPF_W|BPF_ABS:	c->op = OP_LD_W_ABS; break;
+			case BPF_LD|BPF_H|BPF_ABS:	c->op = OP_LD_H_ABS; break;
+			case BPF_LD|BPF_B|BPF_ABS:	c->op = OP_LD_B_ABS; break;
+			case BPF_LD|BPF_W|BPF_IND:	c->op = OP_LD_W_IND; break;
+			case BPF_LD|BPF_H|BPF_IND:	c->op = OP_LD_H_IND; break;
+			case BPF_LD|BPF_B|BPF_IND:	c->op = OP_LD_B_IND; break;
+			case BPF_LD|BPF_W|BPF_LEN:	c->op = OP_LD_W_LEN; break;
+			case BPF_LDX|BPF_W|BPF_LEN:	c->op = OP_LDX_W_LEN; break;
+			case BPF_LDX|BPF_MSH|BPF_B:	c->op = OP_LDX_MSH; break;
+			case BPF_LD|BPF_IMM:		c->op = OP_LD_IMM; break;
+			case BPF_LDX|BPF_IMM:		c->op = OP_LDX_IMM; break;
+
+			case BPF_LD|BPF_MEM:		c->op = OP_LD_MEM; goto mem;
+			case BPF_LDX|BPF_MEM:		c->op = OP_LDX_MEM; goto mem;
+			case BPF_ST:			c->op = OP_ST; goto mem;
+			case BPF_STX:			c->op = OP_STX;
+mem:
+				if (p->k < 0 || p->k >= BPF_MEMWORDS)
+					return 0;
+				break;
+
+			case BPF_JMP|BPF_JA:
+				if (p->k < 0 || i + 1 + p->k >= len)
+					return 0;
+				c->op = OP_JA;
+				c->jt = c->jf = i + 1 + p->k;
+				break;
+
+			case BPF_JMP|BPF_JGT|BPF_K:	c->op = OP_JGT_K; break;
+			case BPF_JMP|BPF_JGE|BPF_K:	c->op = OP_JGE_K; break;
+			case BPF_JMP|BPF_JEQ|BPF_K:	c->op = OP_JEQ_K; break;
+			case BPF_JMP|BPF_JSET|BPF_K:	c->op = OP_JSET_K; break;
+			case BPF_JMP|BPF_JGT|BPF_X:	c->op = OP_JGT_X; break;
+			case BPF_JMP|BPF_JGE|BPF_X:	c->op = OP_JGE_X; break;
+			case BPF_JMP|BPF_JEQ|BPF_X:	c->op = OP_JEQ_X; break;
+			case BPF_JMP|BPF_JSET|BPF_X:	c->op = OP_JSET_X; break;
+
+			case BPF_ALU|BPF_ADD|BPF_X:	c->op = OP_ADD_X; break;
+			case BPF_ALU|BPF_SUB|BPF_X:	c->op = OP_SUB_X; break;
+			case BPF_ALU|BPF_MUL|BPF_X:	c->op = OP_MUL_X; break;
+			case BPF_ALU|BPF_DIV|BPF_X:	c->op = OP_DIV_X; break;
+			case BPF_ALU|BPF_AND|BPF_X:	c->op = OP_AND_X; break;
+			case BPF_ALU|BPF_OR|BPF_X:	c->op = OP_OR_X; break;
+			case BPF_ALU|BPF_LSH|BPF_X:	c->op = OP_LSH_X; break;
+			case BPF_ALU|BPF_RSH|BPF_X:	c->op = OP_RSH_X; break;
+			case BPF_ALU|BPF_ADD|BPF_K:	c->op = OP_ADD_K; break;
+			case BPF_ALU|BPF_SUB|BPF_K:	c->op = OP_SUB_K; break;
+			case BPF_ALU|BPF_MUL|BPF_K:	c->op = OP_MUL_K; break;
+			case BPF_ALU|BPF_DIV|BPF_K:
+				if (p->k == 0)
+					return 0;
+				c->op = OP_DIV_K;
+				break;
+			case BPF_ALU|BPF_AND|BPF_K:	c->op = OP_AND_K; break;
+			case BPF_ALU|BPF_OR|BPF_K:	c->op = OP_OR_K; break;
+			case BPF_ALU|BPF_LSH|BPF_K:	c->op = OP_LSH_K; break;
+			case BPF_ALU|BPF_RSH|BPF_K:	c->op = OP_RSH_K; break;
+			case BPF_ALU|BPF_NEG:		c->op = OP_NEG; break;
+			case BPF_MISC|BPF_TAX:		c->op = OP_TAX; break;
+			case BPF_MISC|BPF_TXA:		c->op = OP_TXA; break;
+		}
+
+		if (BPF_CLASS(p->code) == BPF_JMP && (c->jt >= len || c->jf >= len))
+			return 0;
+	}
+
+	/* Falling off the end rejects the packet.  */
+	prog[len].op = OP_RET_K;
+	prog[len].k = 0;
+
+	/*
+	 * Fuse a load from a fixed offset with the comparison that
+	 * follows it.  The jump instruction is left in place, so that
+	 * other jumps landing on it still work.
+	 */
+	for (i = 1; i + 1 < len; ++i) {
+		c = &prog[i];
+		if (f[i + 1].code != (BPF_JMP|BPF_JEQ|BPF_K))
+			continue;
+		switch (c->op) {
+			case OP_LD_W_ABS:	c->op = OP_LD_W_ABS_JEQ; break;
+			case OP_LD_H_ABS:	c->op = OP_LD_H_ABS_JEQ; break;
+			case OP_LD_B_ABS:	c->op = OP_LD_B_ABS_JEQ; break;
+			default:		continue;
+		}
+		c->k2 = c[1].k;
+		c->jt = c[1].jt;
+		c->jf = c[1].jf;
+	}
+
+	return 1;
+}
+
+/*
+ * Run the compiled program PROG on the packet P, with the same
+ * conventions as bpf_do_filter.  MEM is the scratch memory, of
+ * BPF_MEMWORDS words.
+ *
+ * Return the number of bytes to accept.  If the program ends with a
+ * MATCH instruction, *N_KEYS is set to the number of keys, which have
+ * been left at the start of MEM, and the caller must look them up
+ * before accepting the packet; otherwise it is left untouched.
+ */
+int
+bpf_prog_run(bpf_cinsn_t prog, char *p, unsigned int wirelen,
+		char *header, unsigned int hlen, unsigned int buflen,
+		unsigned int *mem, int *n_keys)
+{
+	static const void *const dispatch[OP_COUNT] = {
+		[OP_RET_K] = &&ret_k,
+		[OP_RET_A] = &&ret_a,
+		[OP_MATCH] = &&match,
+		[OP_LD_W_ABS] = &&ld_w_abs,
+		[OP_LD_H_ABS] = &&ld_h_abs,
+		[OP_LD_B_ABS] = &&ld_b_abs,
+		[OP_LD_W_IND] = &&ld_w_ind,
+		[OP_LD_H_IND] = &&ld_h_ind,
+		[OP_LD_B_IND] = &&ld_b_ind,
+		[OP_LD_W_LEN] = &&ld_w_len,
+		[OP_LDX_W_LEN] = &&ldx_w_len,
+		[OP_LDX_MSH] = &&ldx_msh,
+		[OP_LD_IMM] = &&ld_imm,
+		[OP_LDX_IMM] = &&ldx_imm,
+		[OP_LD_MEM] = &&ld_mem,
+		[OP_LDX_MEM] = &&ldx_mem,
+		[OP_ST] = &&st,
+		[OP_STX] = &&stx,
+		[OP_JA] = &&ja,
+		[OP_JGT_K] = &&jgt_k,
+		[OP_JGE_K] = &&jge_k,
+		[OP_JEQ_K] = &&jeq_k,
+		[OP_JSET_K] = &&jset_k,
+		[OP_JGT_X] = &&jgt_x,
+		[OP_JGE_X] = &&jge_x,
+		[OP_JEQ_X] = &&jeq_x,
+		[OP_JSET_X] = &&jset_x,
+		[OP_ADD_X] = &&add_x,
+		[OP_SUB_X] = &&sub_x,
+		[OP_MUL_X] = &&mul_x,
+		[OP_DIV_X] = &&div_x,
+		[OP_AND_X] = &&and_x,
+		[OP_OR_X] = &&or_x,
+		[OP_LSH_X] = &&lsh_x,
+		[OP_RSH_X] = &&rsh_x,
+		[OP_ADD_K] = &&add_k,
+		[OP_SUB_K] = &&sub_k,
+		[OP_MUL_K] = &&mul_k,
+		[OP_DIV_K] = &&div_k,
+		[OP_AND_K] = &&and_k,
+		[OP_OR_K] = &&or_k,
+		[OP_LSH_K] = &&lsh_k,
+		[OP_RSH_K] = &&rsh_k,
+		[OP_NEG] = &&neg,
+		[OP_TAX] = &&tax,
+		[OP_TXA] = &&txa,
+		[OP_LD_W_ABS_JEQ] = &&ld_w_abs_jeq,
+		[OP_LD_H_ABS_JEQ] = &&ld_h_abs_jeq,
+		[OP_LD_B_ABS_JEQ] = &&ld_b_abs_jeq,
+	};
+	bpf_cinsn_t pc;
+	unsigned long A, X;
+	int k;
+	char *data;
+
+#define NEXT		goto *dispatch[(++pc)->op]
+#define JUMP(cond)	goto *dispatch[(pc = prog + ((cond) ? pc->jt : pc->jf))->op]
+
+#define LOAD(size, off) do {						\
+		if (! bpf_load(size, off, p, header, hlen, buflen, &A))	\
+			return 0;					\
+	} while (0)
+
+	A = 0;
+	X = 0;
+	pc = prog;
+	NEXT;
+
+ret_k:
+	return ((u_int)pc->k <= wirelen) ? pc->k : wirelen;
+
+ret_a:
+	return ((u_int)A <= wirelen) ? A : wirelen;
+
+match:
+	*n_keys = pc->jt;
+	return ((u_int)pc->k <= wirelen) ? pc->k : wirelen;
+
+ld_w_abs:	LOAD(BPF_W, pc->k); NEXT;
+ld_h_abs:	LOAD(BPF_H, pc->k); NEXT;
+ld_b_abs:	LOAD(BPF_B, pc->k); NEXT;
+ld_w_ind:	LOAD(BPF_W, X + pc->k); NEXT;
+ld_h_ind:	LOAD(BPF_H, X + pc->k); NEXT;
+ld_b_ind:	LOAD(BPF_B, X + pc->k); NEXT;
+
+ld_w_abs_jeq:	LOAD(BPF_W, pc->k); JUMP(A == pc->k2);
+ld_h_abs_jeq:	LOAD(BPF_H, pc->k); JUMP(A == pc->k2);
+ld_b_abs_jeq:	LOAD(BPF_B, pc->k); JUMP(A == pc->k2);
+
+ld_w_len:	A = wirelen; NEXT;
+ldx_w_len:	X = wirelen; NEXT;
+
+ldx_msh:
+	k = pc->k;
+	if ((u_int)k < hlen)
+		data = header;
+	else if ((u_int)k < buflen) {
+		data = p;
+		k -= hlen;
+	} else
+		return 0;
+	X = (data[k] & 0xf) << 2;
+	NEXT;
+
+ld_imm:		A = pc->k; NEXT;
+ldx_imm:	X = pc->k; NEXT;
+ld_mem:		A = mem[pc->k]; NEXT;
+ldx_mem:	X = mem[pc->k]; NEXT;
+st:		mem[pc->k] = A; NEXT;
+stx:		mem[pc->k] = X; NEXT;
+
+ja:		JUMP(1);
+jgt_k:		JUMP(A > pc->k);
+jge_k:		JUMP(A >= pc->k);
+jeq_k:		JUMP(A == pc->k);
+jset_k:		JUMP(A & pc->k);
+jgt_x:		JUMP(A > X);
+jge_x:		JUMP(A >= X);
+jeq_x:		JUMP(A == X);
+jset_x:		JUMP(A & X);
+
+add_x:		A += X; NEXT;
+sub_x:		A -= X; NEXT;
+mul_x:		A *= X; NEXT;
+div_x:
+	if (X == 0)
+		return 0;
+	A /= X;
+	NEXT;
+and_x:		A &= X; NEXT;
+or_x:		A |= X; NEXT;
+lsh_x:		A <<= X; NEXT;
+rsh_x:		A >>= X; NEXT;
+add_k:		A += pc->k; NEXT;
+sub_k:		A -= pc->k; NEXT;
+mul_k:		A *= pc->k; NEXT;
+div_k:		A /= pc->k; NEXT;
+and_k:		A &= pc->k; NEXT;
+or_k:		A |= pc->k; NEXT;
+lsh_k:		A <<= pc->k; NEXT;
+rsh_k:		A >>= pc->k; NEXT;
+neg:		A = -A; NEXT;
+tax:		X = A; NEXT;
+txa:		A = X; NEXT;
+
+#undef NEXT
+#undef JUMP
+#undef LOAD
+}
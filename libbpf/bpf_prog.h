@@ -0,0 +1,109 @@
+/* Pre-compiled BPF filter programs
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
+
+#ifndef BPF_PROG_H
+#define BPF_PROG_H
+
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <device/bpf.h>
+
+#ifndef BPF_ALIGN
+#define EXTRACT_SHORT(p)	((u_short)ntohs(*(u_short *)p))
+#define EXTRACT_LONG(p)		(ntohl(*(u_long *)p))
+#else
+#define EXTRACT_SHORT(p)\
+	((u_short)\
+	 ((u_short)*((u_char *)p+0)<<8|\
+	  (u_short)*((u_char *)p+1)<<0))
+#define EXTRACT_LONG(p)\
+	((u_long)*((u_char *)p+0)<<24|\
+	 (u_long)*((u_char *)p+1)<<16|\
+	 (u_long)*((u_char *)p+2)<<8|\
+	 (u_long)*((u_char *)p+3)<<0)
+#endif
+
+/*
+ * A BPF instruction after translation by bpf_compile.
+ *
+ * OP is a dense opcode used to index the threaded dispatch table
+ * of bpf_prog_run; JT and JF are absolute indexes of the jump
+ * targets.  Fused instructions (a load followed by a conditional
+ * jump) keep the load offset in K and the jump operand in K2.
+ * For a MATCH instruction, JT holds the number of keys.
+ */
+struct bpf_cinsn {
+	unsigned short	op;
+	unsigned short	jt;
+	unsigned short	jf;
+	int		k;
+	int		k2;
+};
+typedef struct bpf_cinsn *bpf_cinsn_t;
+
+/* Number of compiled instructions needed for a program of BYTES bytes
+   (the program itself plus a terminating reject).  */
+#define BPF_PROG_LEN(bytes)	(BPF_BYTES2LEN(bytes) + 1)
+
+/*
+ * Load the field of SIZE (BPF_W, BPF_H or BPF_B) at offset K of a
+ * frame split into HEADER, of HLEN bytes, and P, into *A.  Return 0
+ * if K is out of bounds.  The bounds are those of the interpreter
+ * inherited from Mach's net_io.c.
+ */
+static inline int
+bpf_load(int size, int k, char *p, char *header, unsigned int hlen,
+		unsigned int buflen, unsigned long *A)
+{
+	unsigned int len = (size == BPF_W) ? sizeof(long) : sizeof(short);
+	char *data;
+
+	if (size == BPF_B ? (u_int)k < hlen : (u_int)k + len <= hlen)
+		data = header;
+	else if (size == BPF_B ? (u_int)k < buflen : (u_int)k + len <= buflen) {
+		k -= hlen;
+		data = p;
+	} else
+		return 0;
+
+	switch (size) {
+		case BPF_W:
+#ifdef BPF_ALIGN
+			if (((long)(data + k) & 3) != 0)
+				*A = EXTRACT_LONG(&data[k]);
+			else
+#endif
+				*A = ntohl(*(long *)(data + k));
+			break;
+		case BPF_H:
+			*A = EXTRACT_SHORT(&data[k]);
+			break;
+		default:
+			*A = data[k];
+			break;
+	}
+	return 1;
+}
+
+int bpf_compile (bpf_insn_t f, int bytes, bpf_cinsn_t prog);
+int bpf_prog_run (bpf_cinsn_t prog, char *p, unsigned int wirelen,
+		char *header, unsigned int hlen, unsigned int buflen,
+		unsigned int *mem, int *n_keys);
+
+#endif /* BPF_PROG_H */
@@ -23,6 +23,7 @@
 #include <error.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "fs_U.h"
 
@@ -49,6 +50,8 @@ error_t cmd_lock (char *);
 error_t cmd_list (char *);
 error_t cmd_seek (char *);
 error_t cmd_exec (char *);
+error_t cmd_stress (char *);
+error_t cmd_bench (char *);
 
 struct command commands [] =
   {
@@ -61,7 +64,13 @@ struct command commands [] =
     { "list", cmd_list, "list all locks' status" },
     { "seek", cmd_seek, "PO1 ... Print the position of the given po.\n"
       "\tPO1=N ... Seek a given po." },
-    { "exec", cmd_exec, "Execute a built in echoing the command."}
+    { "exec", cmd_exec, "Execute a built in echoing the command."},
+    { "stress", cmd_stress, "iterations [seed]\n"
+      "\tLock and unlock random regions, checking the locks against\n"
+      "\ta simple model.  Drops all the locks first." },
+    { "bench", cmd_bench, "locks\n"
+      "\tTime taking, testing and dropping the given number of locks.\n"
+      "\tDrops all the locks first." }
   };
 
 error_t
@@ -288,6 +297,221 @@ cmd_exec (char *arg)
   return 0;
 }
 
+/* Drop the locks of all the peropens.  */
+static void
+unlock_all (void)
+{
+  struct flock64 lock = { .l_type = F_UNLCK, .l_whence = SEEK_SET };
+  int i;
+
+  for (i = 0; i < PEROPENS; i ++)
+    fshelp_rlock_tweak (&box, NULL, &peropens[i], O_RDWR, file_size, 0,
+			F_SETLK64, &lock, MACH_PORT_NULL);
+}
+
+/* The stress test locks bytes 0 to STRESS_REGION - 1 of the file, and
+   everything after it; the model keeps the type of lock each peropen
+   holds on every byte, with the bytes from STRESS_REGION on in the last
+   slot.  */
+#define STRESS_REGION 64
+
+static int model[PEROPENS][STRESS_REGION + 1];
+
+/* Check the lock list of peropen I against the model; return 0 if they
+   agree.  */
+static int
+stress_check (int i)
+{
+  int bytes[STRESS_REGION + 1];
+  struct rlock_list *l;
+  loff_t end = 0;
+  int b;
+
+  for (b = 0; b <= STRESS_REGION; b ++)
+    bytes[b] = F_UNLCK;
+  for (l = *peropens[i].locks; l; l = l->po.next)
+    {
+      if (l->start < end || end == -1)
+	{
+	  printf ("%3d: lock at %ld out of order or overlapping\n",
+		  i, (long) l->start);
+	  return 1;
+	}
+      end = l->len ? l->start + l->len : -1;
+
+      for (b = l->start; b < STRESS_REGION && (end == -1 || b < end); b ++)
+	bytes[b] = l->type;
+      if (end == -1)
+	bytes[STRESS_REGION] = l->type;
+    }
+
+  for (b = 0; b <= STRESS_REGION; b ++)
+    if (bytes[b] != model[i][b])
+      {
+	printf ("%3d: byte %d has lock %d, expected %d\n",
+		i, b, bytes[b], model[i][b]);
+	return 1;
+      }
+
+  return 0;
+}
+
+error_t
+cmd_stress (char *args)
+{
+  int iterations, seed = 1, n, i;
+
+  n = sscanf (args, "%d %d", &iterations, &seed);
+  if (n < 1)
+    {
+      printf ("Syntax error.\n");
+      return 0;
+    }
+
+  unlock_all ();
+  for (i = 0; i < PEROPENS; i ++)
+    for (n = 0; n <= STRESS_REGION; n ++)
+      model[i][n] = F_UNLCK;
+  srand (seed);
+
+  for (n = 0; n < iterations; n ++)
+    {
+      int po = rand () % PEROPENS;
+      int start = rand () % STRESS_REGION;
+      int len = rand () % (STRESS_REGION - start + 1);
+      int type = (int []) { F_UNLCK, F_RDLCK, F_WRLCK }[rand () % 3];
+      int last = len ? start + len - 1 : STRESS_REGION;
+      int conflict = 0, b;
+      struct flock64 lock;
+      error_t err;
+
+      if (type != F_UNLCK)
+	for (i = 0; i < PEROPENS; i ++)
+	  for (b = start; b <= last; b ++)
+	    if (i != po && model[i][b] != F_UNLCK
+		&& (model[i][b] == F_WRLCK || type == F_WRLCK))
+	      conflict = 1;
+
+      if (type != F_UNLCK)
+	{
+	  lock = (struct flock64) { .l_type = type, .l_whence = SEEK_SET,
+				    .l_start = start, .l_len = len };
+	  err = fshelp_rlock_tweak (&box, NULL, &peropens[po], O_RDWR,
+				    file_size, 0, F_GETLK64, &lock,
+				    MACH_PORT_NULL);
+	  if (err || (lock.l_type != F_UNLCK) != conflict)
+	    {
+	      printf ("%d: getlk %d %d %d %d: got %d, expected %s\n",
+		      n, po, start, len, type, lock.l_type,
+		      conflict ? "a conflict" : "none");
+	      return EIO;
+	    }
+	}
+
+      lock = (struct flock64) { .l_type = type, .l_whence = SEEK_SET,
+				.l_start = start, .l_len = len };
+      err = fshelp_rlock_tweak (&box, NULL, &peropens[po], O_RDWR,
+				file_size, 0, F_SETLK64, &lock,
+				MACH_PORT_NULL);
+      if (err != (conflict ? EAGAIN : 0))
+	{
+	  printf ("%d: lock %d %d %d %d: %s\n",
+		  n, po, start, len, type, strerror (err));
+	  return EIO;
+	}
+
+      /* A read lock leaves the write locks the peropen already has.  */
+      if (! conflict)
+	for (b = start; b <= last; b ++)
+	  if (type != F_RDLCK || model[po][b] != F_WRLCK)
+	    model[po][b] = type;
+
+      if (stress_check (po))
+	{
+	  printf ("%d: after lock %d %d %d %d\n", n, po, start, len, type);
+	  return EIO;
+	}
+    }
+
+  unlock_all ();
+  printf ("%d iterations passed\n", iterations);
+  return 0;
+}
+
+/* Return the time in seconds between A and B.  */
+static double
+elapsed (struct timespec *a, struct timespec *b)
+{
+  return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+error_t
+cmd_bench (char *args)
+{
+  struct timespec t0, t1, t2, t3;
+  struct flock64 lock;
+  int locks, i;
+  error_t err;
+
+  if (sscanf (args, "%d", &locks) != 1 || locks <= 0)
+    {
+      printf ("Syntax error.\n");
+      return 0;
+    }
+
+  unlock_all ();
+
+  /* Peropen 0 write locks every other byte, the way a database locks its
+     records; peropen 1 then tests each byte in between, and peropen 0
+     drops its locks again.  */
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < locks; i ++)
+    {
+      lock = (struct flock64) { .l_type = F_WRLCK, .l_whence = SEEK_SET,
+				.l_start = 2 * i, .l_len = 1 };
+      err = fshelp_rlock_tweak (&box, NULL, &peropens[0], O_RDWR,
+				file_size, 0, F_SETLK64, &lock,
+				MACH_PORT_NULL);
+      if (err)
+	return err;
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  for (i = 0; i < locks; i ++)
+    {
+      lock = (struct flock64) { .l_type = F_WRLCK, .l_whence = SEEK_SET,
+				.l_start = 2 * i + 1, .l_len = 1 };
+      err = fshelp_rlock_tweak (&box, NULL, &peropens[1], O_RDWR,
+				file_size, 0, F_GETLK64, &lock,
+				MACH_PORT_NULL);
+      if (err)
+	return err;
+      if (lock.l_type != F_UNLCK)
+	return EIO;
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &t2);
+  for (i = locks - 1; i >= 0; i --)
+    {
+      lock = (struct flock64) { .l_type = F_UNLCK, .l_whence = SEEK_SET,
+				.l_start = 2 * i, .l_len = 1 };
+      err = fshelp_rlock_tweak (&box, NULL, &peropens[0], O_RDWR,
+				file_size, 0, F_SETLK64, &lock,
+				MACH_PORT_NULL);
+      if (err)
+	return err;
+    }
+  clock_gettime (CLOCK_MONOTONIC, &t3);
+
+  if (*peropens[0].locks)
+    return EIO;
+
+  printf ("%d locks: lock %.2fus, test %.2fus, unlock %.2fus each\n",
+	  locks, elapsed (&t0, &t1) * 1e6 / locks,
+	  elapsed (&t1, &t2) * 1e6 / locks, elapsed (&t2, &t3) * 1e6 / locks);
+  return 0;
+}
+
 int main (int argc, char *argv[])
 {
   int i;
@@ -253,7 +253,10 @@ error_t fshelp_acquire_lock (struct lock_box *box, int *user,
 /* Unique to a node; initialize with fshelp_rlock_init.  */
 struct rlock_box
 {
-  struct rlock_list *locks;	/* List of locks on the file.  */
+  /* The locks on the file, as a tree ordered by start, and as a tree
+     ordered by peropen and then by start (see rlock.h).  */
+  struct rlock_list *locks;
+  struct rlock_list *po_locks;
 };
 
 error_t fshelp_rlock_init (struct rlock_box *box);
@@ -265,6 +268,7 @@ FSHELP_EXTERN_INLINE
 error_t fshelp_rlock_init (struct rlock_box *box)
 {
   box->locks = NULL;
+  box->po_locks = NULL;
   return 0;
 }
 
@@ -38,10 +38,9 @@ fshelp_rlock_drop_peropen (struct rlock_peropen *po)
 	  pthread_cond_broadcast (&l->wait);
 	}
 
-      list_unlink (node, l);
-      pthread_cond_destroy(&l->wait);
-
       t = l->po.next;
+      rlock_unlink (l);
+      pthread_cond_destroy(&l->wait);
       free (l);
     }
 
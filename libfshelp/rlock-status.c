@@ -36,17 +36,23 @@ int fshelp_rlock_peropen_status (struct rlock_peropen *po)
   return LOCK_SH;
 }
 
+/* Return true if there is a write lock in the tree of locks L.  */
+static int
+has_write_lock (struct rlock_list *l)
+{
+  return l && (l->type == F_WRLCK
+	       || has_write_lock (l->by_start.left)
+	       || has_write_lock (l->by_start.right));
+}
+
 /* Like fshelp_rlock_peropen_status except for all users of NODE.  */
 int fshelp_rlock_node_status (struct rlock_box *box)
 {
-  struct rlock_list *l;
-
   if (! box->locks)
     return LOCK_UN;
 
-  for (l = box->locks; l; l = l->node.next)
-    if (l->type == F_WRLCK)
-      return LOCK_EX;
+  if (has_write_lock (box->locks))
+    return LOCK_EX;
 
   return LOCK_SH;
 }
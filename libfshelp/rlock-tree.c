@@ -0,0 +1,328 @@
+/* The lock trees of a node, for record locking.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Each lock of a node is in two AVL trees.  BOX->locks orders the locks
+   by start, and each lock also records the greatest end in its subtree:
+   an interval tree, in which the locks overlapping a region are found
+   without looking at the ones before or after it.  BOX->po_locks orders
+   the locks by peropen and then by start, so that the lock of a
+   peropen preceding an offset is found without walking its list.  */
+
+#include "fshelp.h"
+#include "rlock.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stddef.h>
+
+/* One of the two trees.  */
+struct tree
+{
+  /* Offset of the rlock_tree_link in a struct rlock_list.  */
+  size_t link;
+  /* Compare two locks; ties are broken by address so that each lock has
+     a place of its own.  */
+  int (*cmp) (const struct rlock_list *a, const struct rlock_list *b);
+  /* Whether MAX_END is maintained.  */
+  int augmented;
+};
+
+#define LINK(t, l) ((struct rlock_tree_link *) ((char *) (l) + (t)->link))
+
+static int
+cmp_address (const struct rlock_list *a, const struct rlock_list *b)
+{
+  return a < b ? -1 : a > b;
+}
+
+static int
+cmp_start (const struct rlock_list *a, const struct rlock_list *b)
+{
+  if (a->start != b->start)
+    return a->start < b->start ? -1 : 1;
+  return cmp_address (a, b);
+}
+
+static int
+cmp_po (const struct rlock_list *a, const struct rlock_list *b)
+{
+  if (a->po_id != b->po_id)
+    return (uintptr_t) a->po_id < (uintptr_t) b->po_id ? -1 : 1;
+  return cmp_start (a, b);
+}
+
+static const struct tree by_start =
+  { offsetof (struct rlock_list, by_start), cmp_start, 1 };
+static const struct tree by_po =
+  { offsetof (struct rlock_list, by_po), cmp_po, 0 };
+
+static inline int
+height (const struct tree *t, struct rlock_list *l)
+{
+  return l ? LINK (t, l)->height : 0;
+}
+
+/* Recompute the height of L, and its MAX_END, from its children.  */
+static void
+update (const struct tree *t, struct rlock_list *l)
+{
+  struct rlock_list *left = LINK (t, l)->left;
+  struct rlock_list *right = LINK (t, l)->right;
+  int hl = height (t, left), hr = height (t, right);
+
+  LINK (t, l)->height = (hl > hr ? hl : hr) + 1;
+
+  if (t->augmented)
+    {
+      l->max_end = rlock_end (l);
+      if (left && left->max_end > l->max_end)
+	l->max_end = left->max_end;
+      if (right && right->max_end > l->max_end)
+	l->max_end = right->max_end;
+    }
+}
+
+static struct rlock_list *
+rotate_right (const struct tree *t, struct rlock_list *l)
+{
+  struct rlock_list *left = LINK (t, l)->left;
+
+  LINK (t, l)->left = LINK (t, left)->right;
+  LINK (t, left)->right = l;
+  update (t, l);
+  update (t, left);
+  return left;
+}
+
+static struct rlock_list *
+rotate_left (const struct tree *t, struct rlock_list *l)
+{
+  struct rlock_list *right = LINK (t, l)->right;
+
+  LINK (t, l)->right = LINK (t, right)->left;
+  LINK (t, right)->left = l;
+  update (t, l);
+  update (t, right);
+  return right;
+}
+
+/* Restore the balance of the subtree L, whose children are balanced and
+   differ in height by at most two, and return its new root.  */
+static struct rlock_list *
+balance (const struct tree *t, struct rlock_list *l)
+{
+  struct rlock_list *left = LINK (t, l)->left;
+  struct rlock_list *right = LINK (t, l)->right;
+  int diff = height (t, left) - height (t, right);
+
+  if (diff > 1)
+    {
+      if (height (t, LINK (t, left)->left)
+	  < height (t, LINK (t, left)->right))
+	LINK (t, l)->left = rotate_left (t, left);
+      return rotate_right (t, l);
+    }
+  if (diff < -1)
+    {
+      if (height (t, LINK (t, right)->right)
+	  < height (t, LINK (t, right)->left))
+	LINK (t, l)->right = rotate_right (t, right);
+      return rotate_left (t, l);
+    }
+
+  update (t, l);
+  return l;
+}
+
+static struct rlock_list *
+tree_insert (const struct tree *t, struct rlock_list *root,
+	     struct rlock_list *l)
+{
+  if (! root)
+    {
+      LINK (t, l)->left = LINK (t, l)->right = NULL;
+      update (t, l);
+      return l;
+    }
+
+  if (t->cmp (l, root) < 0)
+    LINK (t, root)->left = tree_insert (t, LINK (t, root)->left, l);
+  else
+    LINK (t, root)->right = tree_insert (t, LINK (t, root)->right, l);
+  return balance (t, root);
+}
+
+/* Remove the first lock of the subtree ROOT, returning it in *MIN, and
+   return the new root.  */
+static struct rlock_list *
+tree_remove_min (const struct tree *t, struct rlock_list *root,
+		 struct rlock_list **min)
+{
+  if (! LINK (t, root)->left)
+    {
+      *min = root;
+      return LINK (t, root)->right;
+    }
+
+  LINK (t, root)->left = tree_remove_min (t, LINK (t, root)->left, min);
+  return balance (t, root);
+}
+
+static struct rlock_list *
+tree_remove (const struct tree *t, struct rlock_list *root,
+	     struct rlock_list *l)
+{
+  int c;
+
+  assert (root);
+
+  c = t->cmp (l, root);
+  if (c < 0)
+    LINK (t, root)->left = tree_remove (t, LINK (t, root)->left, l);
+  else if (c > 0)
+    LINK (t, root)->right = tree_remove (t, LINK (t, root)->right, l);
+  else
+    {
+      struct rlock_list *left = LINK (t, root)->left;
+      struct rlock_list *right = LINK (t, root)->right;
+      struct rlock_list *min;
+
+      if (! right)
+	return left;
+
+      right = tree_remove_min (t, right, &min);
+      LINK (t, min)->left = left;
+      LINK (t, min)->right = right;
+      return balance (t, min);
+    }
+
+  return balance (t, root);
+}
+
+/* Return the last lock in the list of the peropen PO_ID in BOX which
+   starts before START, or NULL.  */
+static struct rlock_list *
+po_before (struct rlock_box *box, void *po_id, loff_t start)
+{
+  struct rlock_list *l = box->po_locks, *found = NULL;
+
+  while (l)
+    if ((uintptr_t) l->po_id < (uintptr_t) po_id
+	|| (l->po_id == po_id && l->start < start))
+      {
+	if (l->po_id == po_id)
+	  found = l;
+	l = l->by_po.right;
+      }
+    else
+      l = l->by_po.left;
+
+  /* While a lock is split, two locks of the peropen may briefly share a
+     start; their order in the list need not be the one in the tree.  */
+  while (found && found->po.next && found->po.next->start < start)
+    found = found->po.next;
+
+  return found;
+}
+
+void
+rlock_link (struct rlock_box *box, struct rlock_peropen *po,
+	    struct rlock_list *l)
+{
+  struct rlock_list *prev = po_before (box, po->locks, l->start);
+  struct rlock_list **e = prev ? &prev->po.next : po->locks;
+
+  l->po.next = *e;
+  if (l->po.next)
+    l->po.next->po.prevp = &l->po.next;
+  l->po.prevp = e;
+  *e = l;
+
+  l->box = box;
+  box->locks = tree_insert (&by_start, box->locks, l);
+  box->po_locks = tree_insert (&by_po, box->po_locks, l);
+}
+
+void
+rlock_unlink (struct rlock_list *l)
+{
+  struct rlock_box *box = l->box;
+
+  box->locks = tree_remove (&by_start, box->locks, l);
+  box->po_locks = tree_remove (&by_po, box->po_locks, l);
+  list_unlink (po, l);
+}
+
+void
+rlock_set_region (struct rlock_list *l, loff_t start, loff_t len)
+{
+  struct rlock_box *box = l->box;
+
+  /* The order of the locks changes, and so does MAX_END all the way up
+     to the root: take L out of the trees and put it back.  */
+  box->locks = tree_remove (&by_start, box->locks, l);
+  box->po_locks = tree_remove (&by_po, box->po_locks, l);
+  l->start = start;
+  l->len = len;
+  box->locks = tree_insert (&by_start, box->locks, l);
+  box->po_locks = tree_insert (&by_po, box->po_locks, l);
+}
+
+struct rlock_list *
+rlock_po_first (struct rlock_box *box, void *po_id, loff_t start)
+{
+  struct rlock_list *l = po_before (box, po_id, start);
+
+  return l ?: *(struct rlock_list **) po_id;
+}
+
+/* Return the first lock of the subtree L as in rlock_find_conflict, for
+   the region from START to END.  */
+static struct rlock_list *
+find_conflict (struct rlock_list *l, void *po_id,
+	       loff_t start, loff_t end, int type)
+{
+  struct rlock_list *c;
+
+  if (! l || l->max_end <= start)
+    /* Everything here ends before the region.  */
+    return NULL;
+
+  c = find_conflict (l->by_start.left, po_id, start, end, type);
+  if (c)
+    return c;
+
+  if (l->start >= end)
+    /* L and everything after it start after the region.  */
+    return NULL;
+
+  if (l->po_id != po_id
+      && (l->type == F_WRLCK || type == F_WRLCK)
+      && rlock_end (l) > start)
+    return l;
+
+  return find_conflict (l->by_start.right, po_id, start, end, type);
+}
+
+struct rlock_list *
+rlock_find_conflict (struct rlock_box *box, void *po_id,
+		     loff_t start, loff_t len, int type)
+{
+  return find_conflict (box->locks, po_id, start,
+			len == 0 ? (loff_t) INT64_MAX : start + len, type);
+}
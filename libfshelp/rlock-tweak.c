@@ -30,14 +30,6 @@
 #include <hurd.h>
 #include <hurd/process.h>
 
-static inline long overlap (loff_t start, loff_t len, struct rlock_list *l)
-{
-  return ((len == 0 && l->len == 0)
-	  || (len == 0 && l->start + l->len > start)
-	  || (l->len == 0 && start + len > l->start)
-	  || (l->start + l->len > start && start + len > l->start));
-}
-
 error_t
 fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 		    struct rlock_peropen *po, int open_mode,
@@ -56,16 +48,14 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
       l->len = len;
       l->type = type;
 
-      list_link (po, po->locks, l);
-      list_link (node, &box->locks, l);
+      rlock_link (box, po, l);
       return l;
     }
 
   inline void
   rele_lock (struct rlock_list *l, int wake_waiters)
     {
-      list_unlink (po, l);
-      list_unlink (node, l);
+      rlock_unlink (l);
 
       if (wake_waiters && l->waiting)
 	pthread_cond_broadcast (&l->wait);
@@ -77,10 +67,13 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
   error_t
   unlock_region (loff_t start, loff_t len)
     {
-      struct rlock_list *l;
+      struct rlock_list *l, *next;
 
-      for (l = *po->locks; l; l = l->po.next)
+      /* Locks before this one end before START.  */
+      for (l = rlock_po_first (box, po->locks, start); l; l = next)
 	{
+	  next = l->po.next;
+
 	  if (l->len != 0 && l->start + l->len <= start)
 	    /* We start after the locked region ends.  */
 	    {
@@ -109,9 +102,10 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 	      assert (len != 0);
 	      assert (l->len == 0 || start + len < l->start + l->len);
 
-	      if (l->len != 0)
-		l->len -= start + len - l->start;
-	      l->start = start + len;
+	      rlock_set_region (l, start + len,
+				l->len != 0
+				  ? l->len - (start + len - l->start)
+				  : 0);
 
 	      if (l->waiting)
 		{
@@ -128,7 +122,7 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 	      assert (len == 0
 		      || (l->len != 0 && l->start + l->len <= start + len));
 
-	      l->len = start - l->start;
+	      rlock_set_region (l, l->start, start - l->start);
 
 	      if (l->waiting)
 		{
@@ -157,7 +151,7 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 	      if (! upper_half)
 		return ENOMEM;
 
-	      l->len = start - l->start;
+	      rlock_set_region (l, l->start, start - l->start);
 
 	      return 0;
 	    }
@@ -175,31 +169,17 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
       return 0;
     }
 
-  inline struct rlock_list *
-  find_conflict (loff_t start, loff_t len, int type)
-    {
-      struct rlock_list *l;
-
-      for (l = box->locks; l; l = l->node.next)
-	{
-	  if (po->locks == l->po_id)
-	    continue;
-
-	  if ((l->type == F_WRLCK || type == F_WRLCK)
-	      && overlap (start, len, l))
-	    return l;
-	}
-
-      return NULL;
-    }
-
   inline error_t
   merge_in (loff_t start, loff_t len, int type)
     {
-      struct rlock_list *l;
+      struct rlock_list *l, *next;
 
-      for (l = *po->locks; l; l = l->po.next)
+      /* Locks before this one end before START, and cannot even be
+	 merged with the new one.  */
+      for (l = rlock_po_first (box, po->locks, start); l; l = next)
 	{
+	  next = l->po.next;
+
 	  if (l->start <= start
 	      && (l->len == 0
 		  || (len != 0
@@ -244,13 +224,12 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 		{
 		  loff_t shift = start - l->start;
 
-		  if (l->len != 0)
-		    l->len -= shift;
-		  l->start += shift;
+		  rlock_set_region (l, l->start + shift,
+				    l->len != 0 ? l->len - shift : 0);
 		}
 
 	      if (tail)
-	        l->len = tail->start - l->start;
+		rlock_set_region (l, l->start, tail->start - l->start);
 
 	      if (! tail)
 		/* There is a chance we can merge some more.  */
@@ -345,7 +324,7 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 		{
 		  assert (l->type == F_RDLCK);
 
-		  l->len -= l->start + l->len - start;
+		  rlock_set_region (l, l->start, start - l->start);
 
 		  /* Don't create the lock now; we might be able to
 		     consume more locks.  */
@@ -369,9 +348,7 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 		  continue;
 		}
 	    }
-	  else if (start < l->start
-		   && (l->len == 0
-		       || l->start <= start + len))
+	  else if (start < l->start && l->start <= start + len)
 	    /* Our start falls before the locked region and our
 	       end falls (inclusively) between it or one byte before it.
 	       Note, we know that we do not consume the entire locked
@@ -383,9 +360,8 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 	      if (type == l->type)
 		/* Merge the two areas.  */
 		{
-		  if (l->len)
-		    l->len += l->start - start;
-		  l->start = start;
+		  rlock_set_region (l, start,
+				    l->len ? l->len + l->start - start : 0);
 		  return 0;
 		}
 	      else if (l->start == start + len)
@@ -407,9 +383,8 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
 		  if (! e)
 		    return ENOMEM;
 
-		  if (l->len)
-		    l->len -= common;
-		  l->start += common;
+		  rlock_set_region (l, l->start + common,
+				    l->len ? l->len - common : 0);
 
 		  return 0;
 		}
@@ -510,7 +485,7 @@ fshelp_rlock_tweak (struct rlock_box *box, pthread_mutex_t *mutex,
     return unlock_region (start, len);
 
 retry:
-  e = find_conflict (start, len, lock->l_type);
+  e = rlock_find_conflict (box, po->locks, start, len, lock->l_type);
 
   if (cmd == F_GETLK64)
     {
@@ -28,6 +28,7 @@
 #endif
 
 #include <pthread.h>
+#include <stdint.h>
 #include <string.h>
 
 struct rlock_linked_list
@@ -36,15 +37,34 @@ struct rlock_linked_list
   struct rlock_list **prevp;
 };
 
+/* Links of a lock in one of the AVL trees of its rlock_box.  */
+struct rlock_tree_link
+{
+  struct rlock_list *left;
+  struct rlock_list *right;
+  int height;
+};
+
 struct rlock_list
 {
   loff_t start;
   loff_t len;
   int type;
 
-  struct rlock_linked_list node;
+  /* The locks of the peropen, sorted by start.  */
   struct rlock_linked_list po;
 
+  /* All the locks of the node, ordered by start, and the greatest end
+     of the locks in this subtree, so that overlapping locks are found
+     without looking at the others.  */
+  struct rlock_tree_link by_start;
+  loff_t max_end;
+
+  /* All the locks of the node, ordered by peropen and then by start.  */
+  struct rlock_tree_link by_po;
+
+  struct rlock_box *box;
+
   pthread_cond_t wait;
   int waiting;
 
@@ -60,27 +80,12 @@ rlock_list_init (struct rlock_peropen *po, struct rlock_list *l)
   return 0;
 }
 
-/* void list_list (X ={po,node}, struct rlock_list **head,
-		   struct rlock_list *node)
-
-   Insert a node in the given list, X, in sorted order.  */
-#define list_link(X, head, node)				\
-	do							\
-	  {							\
-	    struct rlock_list **e;				\
-	    for (e = head;					\
-		 *e && ((*e)->start < node->start);		\
-		 e = &(*e)->X.next)				\
-	      ;							\
-	    node->X.next = *e;					\
-	    if (node->X.next)					\
-	      node->X.next->X.prevp = &node->X.next;		\
-	    node->X.prevp = e;					\
-	    *e = node;						\
-	  }							\
-	while (0)
+/* The end of the region locked by L; a length of zero means up to the
+   end of the file.  */
+#define rlock_end(l) \
+	((l)->len == 0 ? (loff_t) INT64_MAX : (l)->start + (l)->len)
 
-/* void list_unlock (X = {po,node}, struct rlock_list *node)  */
+/* void list_unlock (X = po, struct rlock_list *node)  */
 #define list_unlink(X, node)					\
 	do							\
 	  {							\
@@ -90,4 +95,31 @@ rlock_list_init (struct rlock_peropen *po, struct rlock_list *l)
 	  }							\
 	while (0)
 
+/* The lock trees of a node (see rlock-tree.c).  Lookups, insertions and
+   removals take a time logarithmic in the number of locks on the node.  */
+
+/* Add the lock L of peropen PO to BOX: to its trees, and to the list of
+   locks of PO, before any other lock of PO starting at the same offset.  */
+void rlock_link (struct rlock_box *box, struct rlock_peropen *po,
+		 struct rlock_list *l);
+
+/* Remove the lock L from its box and from the list of its peropen.  */
+void rlock_unlink (struct rlock_list *l);
+
+/* Change the region locked by L to START and LEN.  */
+void rlock_set_region (struct rlock_list *l, loff_t start, loff_t len);
+
+/* Return the first lock of the peropen PO_ID in BOX that may overlap or
+   touch a region starting at START: the last one that starts before
+   START, or if there is none, the first one.  The following locks of
+   the peropen are reached through the po list.  */
+struct rlock_list *rlock_po_first (struct rlock_box *box, void *po_id,
+				   loff_t start);
+
+/* Return the lock in BOX with the lowest start which is not owned by the
+   peropen PO_ID, overlaps the region of START and LEN, and conflicts with
+   a lock of type TYPE, or NULL if there is none.  */
+struct rlock_list *rlock_find_conflict (struct rlock_box *box, void *po_id,
+					loff_t start, loff_t len, int type);
+
 #endif /* FSHELP_RLOCK_H */
@@ -187,6 +187,10 @@ struct ftp_conn
 
   int use_passive : 1;		/* If true, first try passive data conns.  */
 
+  int features_valid : 1;	/* True if the FEAT reply has been read.  */
+  int use_mlst : 1;		/* If true, the server supports the MLST and
+				   MLSD commands (RFC 3659).  */
+
   struct sockaddr *actv_data_addr;/* Address of port for active data conns.  */
 };
 
@@ -220,6 +224,21 @@ error_t ftp_conn_unix_append_name (struct ftp_conn *conn,
 error_t ftp_conn_unix_basename (struct ftp_conn *conn, char **name);
 
 extern struct ftp_conn_syshooks ftp_conn_unix_syshooks;
+
+/* Machine-readable listings (RFC 3659), used instead of the syshooks when
+   the server supports them.  */
+extern error_t ftp_conn_mlsd_start_get_stats (struct ftp_conn *conn,
+					      const char *name,
+					      int contents, int *fd,
+					      void **state);
+extern error_t ftp_conn_mlsd_cont_get_stats (struct ftp_conn *conn,
+					     int fd, void *state,
+					     ftp_conn_add_stat_fun_t add_stat,
+					     void *hook);
+extern error_t ftp_conn_mlst_get_stats (struct ftp_conn *conn,
+					const char *name,
+					ftp_conn_add_stat_fun_t add_stat,
+					void *hook);
 
 error_t
 ftp_conn_get_raw_reply (struct ftp_conn *conn,
@@ -290,6 +309,12 @@ error_t ftp_conn_finish_transfer (struct ftp_conn *conn);
    over which the data can be read.  */
 error_t ftp_conn_start_retrieve (struct ftp_conn *conn, const char *name, int *data);
 
+/* Start retreiving file NAME over CONN from byte OFFSET on, returning a file
+   descriptor in DATA over which the data can be read.  If the server cannot
+   restart transfers, EOPNOTSUPP is returned.  */
+error_t ftp_conn_start_retrieve_at (struct ftp_conn *conn, const char *name,
+				    off_t offset, int *data);
+
 /* Start retreiving a list of files in NAME over CONN, returning a file
    descriptor in DATA over which the data can be read.  */
 error_t ftp_conn_start_list (struct ftp_conn *conn, const char *name, int *data);
@@ -298,6 +323,12 @@ error_t ftp_conn_start_list (struct ftp_conn *conn, const char *name, int *data)
    descriptor in DATA over which the data can be read.  */
 error_t ftp_conn_start_dir (struct ftp_conn *conn, const char *name, int *data);
 
+/* Start retreiving a machine-readable listing of directory NAME over CONN
+   (the MLSD command), returning a file descriptor in DATA over which the
+   data can be read.  */
+error_t ftp_conn_start_mlsd (struct ftp_conn *conn, const char *name,
+			     int *data);
+
 /* Start storing into file NAME over CONN, returning a file descriptor in DATA
    into which the data can be written.  */
 error_t ftp_conn_start_store (struct ftp_conn *conn, const char *name, int *data);
@@ -0,0 +1,419 @@
+/* Machine-readable directory listings (RFC 3659)
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <libgen.h> /* For dirname().  */
+#ifdef HAVE_HURD_HURD_TYPES_H
+#include <hurd/hurd_types.h>
+#endif
+
+#include <ftpconn.h>
+#include "priv.h"
+
+/* Uid/gid to use when we don't know about a particular user name.  */
+#define DEFAULT_UID 65535
+#define DEFAULT_GID 65535
+
+/* Each entry of a listing is a line `FACT=VALUE;FACT=VALUE; NAME', where
+   the facts are things like `type=file', `size=1024' or
+   `modify=20260101120000', and NAME is the file name, without any
+   directory.  Which facts are present depends on the server, so we make do
+   with whatever we get.  */
+
+/* Translate the facts at the beginning of the listing entry LINE into STAT,
+   returning the file name in *NAME, and if it is a symlink whose target the
+   server told us, the target in *SYMLINK_TARGET (or 0).  LINE is modified.
+   If LINE describes the listed directory itself or its parent, STAT is
+   filled in anyway, but EAGAIN is returned.  */
+static error_t
+parse_entry (char *line, struct stat *stat, char **name, char **symlink_target)
+{
+  char *p = line, *end = strchr (line, ' ');
+  int have_mode = 0, ignore = 0;
+  const char *perm = 0;
+
+  if (! end)
+    return EGRATUITOUS;
+  *end = '\0';
+  *name = end + 1;
+  *symlink_target = 0;
+
+  memset (stat, 0, sizeof *stat);
+
+#ifdef FSTYPE_FTP
+  stat->st_fstype = FSTYPE_FTP;
+#endif
+
+  stat->st_nlink = 1;
+  stat->st_uid = DEFAULT_UID;
+  stat->st_gid = DEFAULT_GID;
+  stat->st_mode = S_IFREG;
+
+  while (*p)
+    {
+      char *fact = p, *val;
+
+      p += strcspn (p, ";");
+      if (*p)
+	*p++ = '\0';
+
+      val = strchr (fact, '=');
+      if (! val)
+	continue;
+      *val++ = '\0';
+
+      if (strcasecmp (fact, "type") == 0)
+	{
+	  if (strcasecmp (val, "dir") == 0)
+	    stat->st_mode = (stat->st_mode & ~S_IFMT) | S_IFDIR;
+	  else if (strcasecmp (val, "cdir") == 0
+		   || strcasecmp (val, "pdir") == 0)
+	    /* The listed directory itself, or its parent.  */
+	    {
+	      stat->st_mode = (stat->st_mode & ~S_IFMT) | S_IFDIR;
+	      ignore = 1;
+	    }
+	  else if (strncasecmp (val, "OS.unix=slink", 13) == 0
+		   || strcasecmp (val, "OS.unix=symlink") == 0)
+	    {
+	      stat->st_mode = (stat->st_mode & ~S_IFMT) | S_IFLNK;
+	      if (val[13] == ':' && val[14])
+		*symlink_target = val + 14;
+	    }
+	  /* Anything else is taken as a plain file.  */
+	}
+      else if (strcasecmp (fact, "size") == 0
+	       || strcasecmp (fact, "sizd") == 0)
+	stat->st_size = strtoull (val, 0, 10);
+      else if (strcasecmp (fact, "modify") == 0)
+	{
+	  struct tm tm;
+	  char *frac;
+
+	  /* YYYYMMDDHHMMSS[.sss], in UTC.  */
+	  memset (&tm, 0, sizeof tm);
+	  frac = strptime (val, "%Y%m%d%H%M%S", &tm);
+	  if (! frac)
+	    return EGRATUITOUS;
+	  stat->st_mtim.tv_sec = timegm (&tm);
+	  if (*frac == '.')
+	    {
+	      long ns = 0;
+	      int digits = 0;
+
+	      for (frac++; isdigit (*frac) && digits < 9; frac++, digits++)
+		ns = ns * 10 + (*frac - '0');
+	      for (; digits < 9; digits++)
+		ns *= 10;
+	      stat->st_mtim.tv_nsec = ns;
+	    }
+	}
+      else if (strcasecmp (fact, "unix.mode") == 0)
+	{
+	  stat->st_mode |= strtoul (val, 0, 8) & 07777;
+	  have_mode = 1;
+	}
+      else if (strcasecmp (fact, "unix.uid") == 0)
+	stat->st_uid = strtoul (val, 0, 10);
+      else if (strcasecmp (fact, "unix.gid") == 0)
+	stat->st_gid = strtoul (val, 0, 10);
+      else if (strcasecmp (fact, "unix.owner") == 0)
+	{
+	  struct passwd *pw = isdigit (*val) ? 0 : getpwnam (val);
+	  stat->st_uid = pw ? pw->pw_uid : strtoul (val, 0, 10);
+	}
+      else if (strcasecmp (fact, "unix.group") == 0)
+	{
+	  struct group *gr = isdigit (*val) ? 0 : getgrnam (val);
+	  stat->st_gid = gr ? gr->gr_gid : strtoul (val, 0, 10);
+	}
+      else if (strcasecmp (fact, "perm") == 0)
+	perm = val;
+    }
+
+  if (!have_mode && perm)
+    /* The permissions are only what we may do with the file; show them as
+       the permissions of everybody.  */
+    {
+      if (strpbrk (perm, "rRlL"))
+	stat->st_mode |= S_IRUSR | S_IRGRP | S_IROTH;
+      if (strpbrk (perm, "wWaAcCmMdDfF"))
+	stat->st_mode |= S_IWUSR;
+      if (S_ISDIR (stat->st_mode) && strpbrk (perm, "eE"))
+	stat->st_mode |= S_IXUSR | S_IXGRP | S_IXOTH;
+    }
+  else if (! have_mode)
+    stat->st_mode |= S_ISDIR (stat->st_mode) ? 0755 : 0644;
+
+#ifdef HAVE_STAT_ST_AUTHOR
+  stat->st_author = stat->st_uid;
+#endif
+
+  stat->st_blocks = stat->st_size >> 9;
+
+  /* atime and ctime are the same as mtime.  */
+  stat->st_atim = stat->st_ctim = stat->st_mtim;
+
+  return ignore ? EAGAIN : 0;
+}
+
+struct get_stats_state
+{
+  int contents;			/* Are we looking for directory contents?  */
+  char *searched_name;		/* If we are not, then we are only
+				   looking for this name.  */
+  int found;			/* True if SEARCHED_NAME was seen.  */
+
+  char *buf;			/* Input not yet parsed.  */
+  size_t buf_len;		/* Length of contents in BUF.  */
+  size_t buf_alloced;		/* Allocated size of BUF.  */
+};
+
+/* Start an operation to get a list of file-stat structures for NAME, using
+   the MLSD command, and return a file-descriptor for reading on, and a
+   state structure in STATE suitable for passing to
+   ftp_conn_mlsd_cont_get_stats.  If CONTENTS is true, NAME must refer to a
+   directory, and the contents will be returned, otherwise, the (single)
+   result will refer to NAME.  */
+error_t
+ftp_conn_mlsd_start_get_stats (struct ftp_conn *conn,
+			       const char *name, int contents,
+			       int *fd, void **state)
+{
+  error_t err;
+  struct get_stats_state *s = malloc (sizeof (struct get_stats_state));
+
+  if (! s)
+    return ENOMEM;
+
+  s->contents = contents;
+  s->searched_name = 0;
+  s->found = 0;
+  s->buf_len = 0;
+  s->buf_alloced = 4096;
+  s->buf = malloc (s->buf_alloced);
+  if (! s->buf)
+    {
+      free (s);
+      return ENOMEM;
+    }
+
+  if (contents)
+    err = ftp_conn_start_mlsd (conn, name, fd);
+  else if (! strcmp (name, "/"))
+    /* There's no parent directory to list.  */
+    err = EINVAL;
+  else
+    /* List the parent directory, and search for the entry.  */
+    {
+      s->searched_name = strdup (basename (strdupa (name)));
+      if (! s->searched_name)
+	err = ENOMEM;
+      else
+	err = ftp_conn_start_mlsd (conn, dirname (strdupa (name)), fd);
+    }
+
+  if (err)
+    {
+      free (s->searched_name);
+      free (s->buf);
+      free (s);
+    }
+  else
+    *state = s;
+
+  return err;
+}
+
+/* Parse the listing entry LINE for the operation S, and pass it on to
+   ADD_STAT.  */
+static error_t
+add_entry (struct get_stats_state *s, char *line,
+	   ftp_conn_add_stat_fun_t add_stat, void *hook)
+{
+  struct stat stat;
+  char *name, *symlink_target;
+  error_t err = parse_entry (line, &stat, &name, &symlink_target);
+
+  if (err == EAGAIN)
+    /* Not a real entry.  */
+    return 0;
+  if (err)
+    return err;
+
+  if (! s->contents)
+    {
+      if (strcmp (name, s->searched_name) != 0)
+	return 0;
+      s->found = 1;
+    }
+
+  return (*add_stat) (name, &stat, symlink_target, hook);
+}
+
+/* Read stats information from FD, calling ADD_STAT for each new stat (HOOK
+   is passed to ADD_STAT).  FD and STATE should be returned from
+   ftp_conn_mlsd_start_get_stats.  If this function returns EAGAIN, then it
+   should be called again to finish the job (possibly after calling select
+   on FD); if it returns 0, then it is finished, and FD and STATE are
+   deallocated.  */
+error_t
+ftp_conn_mlsd_cont_get_stats (struct ftp_conn *conn, int fd, void *state,
+			      ftp_conn_add_stat_fun_t add_stat, void *hook)
+{
+  char *p, *nl;
+  ssize_t rd;
+  error_t err = 0;
+  struct get_stats_state *s = state;
+  int (*icheck) (struct ftp_conn *conn) = conn->hooks->interrupt_check;
+
+  if (s->buf_len == s->buf_alloced)
+    /* A line that doesn't fit; make room for the rest of it.  */
+    {
+      char *new_buf = realloc (s->buf, s->buf_alloced * 2);
+      if (! new_buf)
+	{
+	  err = ENOMEM;
+	  rd = 1;		/* The transfer must be aborted.  */
+	  goto finished;
+	}
+      s->buf = new_buf;
+      s->buf_alloced *= 2;
+    }
+
+  rd = read (fd, s->buf + s->buf_len, s->buf_alloced - s->buf_len);
+  if (rd < 0)
+    {
+      err = errno;
+      goto finished;
+    }
+
+  if (icheck && (*icheck) (conn))
+    {
+      err = EINTR;
+      goto finished;
+    }
+
+  s->buf_len += rd;
+
+  /* Parse all the complete lines, or at EOF, whatever is left.  */
+  p = s->buf;
+  while (p < s->buf + s->buf_len)
+    {
+      char *end;
+
+      nl = memchr (p, '\n', s->buf + s->buf_len - p);
+      if (nl)
+	end = nl;
+      else if (rd == 0)
+	end = s->buf + s->buf_len;
+      else
+	break;
+
+      if (end > p && end[-1] == '\r')
+	end--;
+      *end = '\0';
+
+      if (end > p)
+	{
+	  err = add_entry (s, p, add_stat, hook);
+	  if (err)
+	    goto finished;
+	}
+
+      p = nl ? nl + 1 : s->buf + s->buf_len;
+    }
+
+  if (rd == 0)
+    /* EOF.  */
+    {
+      if (!s->contents && !s->found)
+	err = ENOENT;
+      goto finished;
+    }
+
+  /* Move any partial line to the beginning for the next call.  */
+  s->buf_len -= p - s->buf;
+  if (s->buf_len > 0)
+    memmove (s->buf, p, s->buf_len);
+
+  return EAGAIN;
+
+finished:
+  /* We're finished (with an error if ERR != 0), deallocate everything &
+     return.  */
+  free (s->buf);
+  free (s->searched_name);
+  free (s);
+  close (fd);
+
+  if (err && rd > 0)
+    ftp_conn_abort (conn);
+  else if (err)
+    ftp_conn_finish_transfer (conn);
+  else
+    err = ftp_conn_finish_transfer (conn);
+
+  return err;
+}
+
+/* Get the stat information for the single file NAME with the MLST command,
+   calling ADD_STAT with it (HOOK is passed to ADD_STAT).  Unlike a listing,
+   this needs no data connection.  */
+error_t
+ftp_conn_mlst_get_stats (struct ftp_conn *conn, const char *name,
+			 ftp_conn_add_stat_fun_t add_stat, void *hook)
+{
+  int reply;
+  const char *txt;
+  char *line, *end, *entry_name, *symlink_target;
+  struct stat stat;
+  error_t err = ftp_conn_cmd_reopen (conn, "mlst", name, &reply, &txt);
+
+  if (err)
+    return err;
+  if (reply != REPLY_FCMD_OK)
+    return unexpected_reply (conn, reply, txt, ftp_conn_poss_file_errs);
+
+  /* The reply is a line of text, then the entry, starting with a space,
+     and then another line of text.  */
+  line = strchr (txt, '\n');
+  if (! line || line[1] != ' ')
+    return EGRATUITOUS;
+  line = strdupa (line + 2);
+  end = strchr (line, '\n');
+  if (end)
+    *end = '\0';
+
+  err = parse_entry (line, &stat, &entry_name, &symlink_target);
+  if (err == EAGAIN)
+    /* Some servers describe a directory as `cdir'; that's fine here.  */
+    err = 0;
+  if (err)
+    return err;
+
+  /* ENTRY_NAME is however the server names the file; give back the name
+     the caller expects.  */
+  return (*add_stat) (basename (strdupa (name)), &stat, symlink_target, hook);
+}
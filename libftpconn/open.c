@@ -136,6 +136,41 @@ ftp_conn_choose_syshooks (struct ftp_conn *conn, const char *syst)
     ftp_conn_set_syshooks (conn, &ftp_conn_unix_syshooks);
 }
 
+/* Find out which optional commands CONN's server supports.  */
+static error_t
+ftp_conn_get_features (struct ftp_conn *conn)
+{
+  int reply;
+  const char *txt;
+  error_t err = ftp_conn_cmd (conn, "feat", 0, &reply, &txt);
+
+  if (! err)
+    {
+      conn->use_mlst = 0;
+      if (reply == REPLY_FEATURES)
+	/* After a first line of text, each feature is on a line of its own,
+	   starting with a space.  */
+	{
+	  const char *line = strchr (txt, '\n');
+
+	  while (line)
+	    {
+	      line++;
+	      while (*line == ' ')
+		line++;
+	      if (strncasecmp (line, "MLST", 4) == 0
+		  && (line[4] == ' ' || line[4] == '\n' || line[4] == '\0'))
+		conn->use_mlst = 1;
+	      line = strchr (line, '\n');
+	    }
+	}
+      /* Old servers don't know FEAT, and so have no features.  */
+      conn->features_valid = 1;
+    }
+
+  return err;
+}
+
 /* Sets CONN's syshooks by querying the remote system to see what type it is. */
 static error_t
 ftp_conn_sysify (struct ftp_conn *conn)
@@ -226,6 +261,9 @@ ftp_conn_open (struct ftp_conn *conn)
     /* Try again now. */
     err = ftp_conn_sysify (conn);
 
+  if (!err && !conn->features_valid)
+    err = ftp_conn_get_features (conn);
+
   if (!err && conn->type)
     /* Set the connection type.  */
     {
@@ -33,6 +33,7 @@
 #define REPLY_DELAY	120	/* Service ready in nnn minutes */
 
 #define REPLY_OK	200	/* Command OK */
+#define REPLY_FEATURES	211	/* System status (the FEAT reply) */
 #define REPLY_SYSTYPE	215	/* NAME version */
 #define REPLY_HELLO	220	/* Service ready for new user */
 #define REPLY_ABORT_OK	225	/* ABOR command successful */
@@ -164,8 +164,11 @@ ftp_conn_get_raw_reply (struct ftp_conn *conn, int *reply,
   do {									      \
     if (reply_txt)		/* Only accumulate if wanted.  */	      \
       {									      \
-	error_t err =							      \
-	  ftp_conn_add_reply_txt (conn, &reply_txt_offs, txt, len);	      \
+	error_t err = 0;						      \
+	if (reply_txt_offs > 0)	/* Separate the lines.  */		      \
+	  err = ftp_conn_add_reply_txt (conn, &reply_txt_offs, "\n", 1);     \
+	if (! err)							      \
+	  err = ftp_conn_add_reply_txt (conn, &reply_txt_offs, txt, len);    \
 	if (err)							      \
 	  return err;							      \
       }									      \
@@ -28,12 +28,23 @@
    return a file-descriptor for reading on, and a state structure in STATE
    suitable for passing to cont_get_stats.  If CONTENTS is true, NAME must
    refer to a directory, and the contents will be returned, otherwise, the
-   (single) result will refer to NAME.  */
+   (single) result will refer to NAME.  If the server supports machine
+   readable listings (MLSD), they are used instead of the syshooks.  */
 error_t
 ftp_conn_start_get_stats (struct ftp_conn *conn,
 			  const char *name, int contents,
 			  int *fd, void **state)
 {
+  if (conn->use_mlst)
+    {
+      error_t err =
+	ftp_conn_mlsd_start_get_stats (conn, name, contents, fd, state);
+      if (err != EOPNOTSUPP)
+	return err;
+      /* The server advertised MLST, but doesn't know MLSD after all.  */
+      conn->use_mlst = 0;
+    }
+
   if (conn->syshooks.start_get_stats)
     return
       (*conn->syshooks.start_get_stats) (conn, name, contents, fd, state);
@@ -50,7 +61,9 @@ error_t
 ftp_conn_cont_get_stats (struct ftp_conn *conn, int fd, void *state,
 			 ftp_conn_add_stat_fun_t add_stat, void *hook)
 {
-  if (conn->syshooks.cont_get_stats)
+  if (conn->use_mlst)
+    return ftp_conn_mlsd_cont_get_stats (conn, fd, state, add_stat, hook);
+  else if (conn->syshooks.cont_get_stats)
     return (*conn->syshooks.cont_get_stats) (conn, fd, state, add_stat, hook);
   else
     return EOPNOTSUPP;
@@ -67,8 +80,18 @@ ftp_conn_get_stats (struct ftp_conn *conn,
 {
   int fd;
   void *state;
-  error_t err = ftp_conn_start_get_stats (conn, name, contents, &fd, &state);
+  error_t err;
+
+  if (!contents && conn->use_mlst)
+    /* This takes a single command, without a data connection.  */
+    {
+      err = ftp_conn_mlst_get_stats (conn, name, add_stat, hook);
+      if (err != EOPNOTSUPP)
+	return err;
+      conn->use_mlst = 0;
+    }
 
+  err = ftp_conn_start_get_stats (conn, name, contents, &fd, &state);
   if (err)
     return err;
 
@@ -19,6 +19,7 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <netinet/in.h>
 
@@ -199,14 +200,15 @@ ftp_conn_abort_open_data (struct ftp_conn *conn, int data)
     return ftp_conn_abort_open_actv_data (conn, data);
 }
 
-/* Start a transfer command CMD/ARG, returning a file descriptor in DATA.
-   POSS_ERRS is a list of errnos to try matching against any resulting error
-   text.  */
-error_t
-ftp_conn_start_transfer (struct ftp_conn *conn,
-			 const char *cmd, const char *arg,
-			 const error_t *poss_errs,
-			 int *data)
+/* Start a transfer command CMD/ARG, returning a file descriptor in DATA,
+   after telling the server to start the transfer at byte RESTART if that is
+   not zero.  POSS_ERRS is a list of errnos to try matching against any
+   resulting error text.  */
+static error_t
+start_transfer (struct ftp_conn *conn, off_t restart,
+		const char *cmd, const char *arg,
+		const error_t *poss_errs,
+		int *data)
 {
   error_t err = ftp_conn_start_open_data (conn, data);
 
@@ -215,6 +217,23 @@ ftp_conn_start_transfer (struct ftp_conn *conn,
       int reply;
       const char *txt;
 
+      if (restart > 0)
+	/* The REST command must come just before the transfer command.  */
+	{
+	  char pos[3 * sizeof (off_t) + 1];
+
+	  snprintf (pos, sizeof pos, "%lld", (long long) restart);
+	  err = ftp_conn_cmd (conn, "rest", pos, &reply, &txt);
+	  if (!err && !REPLY_IS_INCOMPLETE (reply))
+	    err = (REPLY_IS_FAILURE (reply) && reply != REPLY_CLOSED)
+	      ? EOPNOTSUPP : unexpected_reply (conn, reply, txt, 0);
+	  if (err)
+	    {
+	      ftp_conn_abort_open_data (conn, *data);
+	      return err;
+	    }
+	}
+
       err = ftp_conn_cmd (conn, cmd, arg, &reply, &txt);
       if (!err && !REPLY_IS_PRELIM (reply))
 	err = unexpected_reply (conn, reply, txt, poss_errs);
@@ -228,6 +247,18 @@ ftp_conn_start_transfer (struct ftp_conn *conn,
   return err;
 }
 
+/* Start a transfer command CMD/ARG, returning a file descriptor in DATA.
+   POSS_ERRS is a list of errnos to try matching against any resulting error
+   text.  */
+error_t
+ftp_conn_start_transfer (struct ftp_conn *conn,
+			 const char *cmd, const char *arg,
+			 const error_t *poss_errs,
+			 int *data)
+{
+  return start_transfer (conn, 0, cmd, arg, poss_errs, data);
+}
+
 /* Wait for the reply signalling the end of a data transfer.  */
 error_t
 ftp_conn_finish_transfer (struct ftp_conn *conn)
@@ -250,6 +281,19 @@ ftp_conn_start_retrieve (struct ftp_conn *conn, const char *name, int *data)
     ftp_conn_start_transfer (conn, "retr", name, ftp_conn_poss_file_errs, data);
 }
 
+/* Start retreiving file NAME over CONN from byte OFFSET on, returning a file
+   descriptor in DATA over which the data can be read.  If the server cannot
+   restart transfers, EOPNOTSUPP is returned.  */
+error_t
+ftp_conn_start_retrieve_at (struct ftp_conn *conn, const char *name,
+			    off_t offset, int *data)
+{
+  if (! name)
+    return EINVAL;
+  return start_transfer (conn, offset, "retr", name,
+			 ftp_conn_poss_file_errs, data);
+}
+
 /* Start retreiving a list of files in NAME over CONN, returning a file
    descriptor in DATA over which the data can be read.  */
 error_t
@@ -268,6 +312,16 @@ ftp_conn_start_dir (struct ftp_conn *conn, const char *name, int *data)
     ftp_conn_start_transfer (conn, "list", name, ftp_conn_poss_file_errs, data);
 }
 
+/* Start retreiving a machine-readable listing of directory NAME over CONN
+   (the MLSD command), returning a file descriptor in DATA over which the
+   data can be read.  */
+error_t
+ftp_conn_start_mlsd (struct ftp_conn *conn, const char *name, int *data)
+{
+  return
+    ftp_conn_start_transfer (conn, "mlsd", name, ftp_conn_poss_file_errs, data);
+}
+
 /* Start storing into file NAME over CONN, returning a file descriptor in DATA
    into which the data can be written.  */
 error_t
@@ -19,6 +19,7 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include <hurd.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert-backtrace.h>
@@ -364,6 +365,51 @@ proc_stat_list_add_pgrp (struct proc_stat_list *pp, pid_t pgrp,
 
 /* ---------------------------------------------------------------- */
 
+/* The flags that proc_stat_set_flags may set for different proc_stats in
+   several threads at once: all those which only need RPCs concerning the
+   process itself, as opposed to those which update the shared state of
+   the ps context, such as its user and tty tables, or run user hooks.  */
+#define PSTAT_CONCURRENT_FLAGS \
+  (~(PSTAT_OWNER | PSTAT_TTY | PSTAT_USER_MASK))
+
+/* The number of threads setting flags at once.  */
+#define SET_FLAGS_THREADS 8
+
+/* Shared state of the threads started by proc_stat_list_set_flags.  */
+struct set_flags_work
+{
+  pthread_mutex_t lock;
+  struct proc_stat **procs;
+  unsigned num_procs;
+  unsigned next;		/* The next proc_stat to examine.  */
+  ps_flags_t flags;
+};
+
+static void *
+set_flags_thread (void *arg)
+{
+  struct set_flags_work *work = arg;
+
+  for (;;)
+    {
+      struct proc_stat *ps;
+
+      pthread_mutex_lock (&work->lock);
+      if (work->next == work->num_procs)
+	{
+	  pthread_mutex_unlock (&work->lock);
+	  return NULL;
+	}
+      ps = work->procs[work->next++];
+      pthread_mutex_unlock (&work->lock);
+
+      /* Errors are noticed by the final pass.  Threads are left to it
+	 too, as setting their flags sets those of their process.  */
+      if (!proc_stat_is_thread (ps) && !proc_stat_has (ps, work->flags))
+	proc_stat_set_flags (ps, work->flags);
+    }
+}
+
 /* Try to set FLAGS in each proc_stat in PP (but they may still not be set
    -- you have to check).  If a fatal error occurs, the error code is
    returned, otherwise 0.  */
@@ -373,6 +419,40 @@ proc_stat_list_set_flags (struct proc_stat_list *pp, ps_flags_t flags)
   unsigned nprocs = pp->num_procs;
   struct proc_stat **procs = pp->proc_stats;
 
+  /* Get the process information from the proc server in a single RPC
+     where possible.  */
+  _proc_stats_fetch_procinfo (pp->context, procs, nprocs, flags);
+
+  if (nprocs > 1 && (flags & PSTAT_CONCURRENT_FLAGS)
+      && !(pp->context->user_hooks && pp->context->user_hooks->fetch))
+    /* Make the remaining per-process RPCs from several threads, so that
+       their latencies overlap.  The flags that touch the context are set
+       by the serial pass below.  A user fetch hook may be called for any
+       flag, so it rules this out.  */
+    {
+      struct set_flags_work work =
+	{
+	  .procs = procs, .num_procs = nprocs, .next = 0,
+	  .flags = flags & PSTAT_CONCURRENT_FLAGS,
+	};
+      pthread_t threads[SET_FLAGS_THREADS];
+      int nthreads, i;
+
+      pthread_mutex_init (&work.lock, NULL);
+      for (nthreads = 0;
+	   nthreads < SET_FLAGS_THREADS && nthreads < nprocs - 1;
+	   nthreads++)
+	if (pthread_create (&threads[nthreads], NULL, set_flags_thread, &work))
+	  break;
+
+      /* Work along, and do everything if no thread could be started.  */
+      set_flags_thread (&work);
+
+      for (i = 0; i < nthreads; i++)
+	pthread_join (threads[i], NULL);
+      pthread_mutex_destroy (&work.lock);
+    }
+
   while (nprocs-- > 0)
     {
       struct proc_stat *ps = *procs++;
@@ -103,22 +103,29 @@ thread_state (thread_basic_info_t bi)
 /* Fetches process information from the set in PSTAT_PROCINFO, returning it
    in PI & PI_SIZE.  NEED is the information, and HAVE is the what we already
    have.  */
+/* The set of PSTAT_ flags that we can get for many processes at once using
+   proc_getprocinfos.  */
+#define PSTAT_PROCINFO_BULK \
+ (PSTAT_PROCINFO & ~(PSTAT_THREAD_WAITS | PSTAT_THREAD_WAIT))
+
+/* How PSTAT_ flags translate to proc_getprocinfo flags.  */
+static const struct { ps_flags_t ps_flag; int pi_flags; } map[] =
+{
+  { PSTAT_TASK_BASIC,     PI_FETCH_TASKINFO				},
+  { PSTAT_TASK_EVENTS,    PI_FETCH_TASKEVENTS				},
+  { PSTAT_NUM_THREADS,    PI_FETCH_THREADS				},
+  { PSTAT_THREAD_BASIC,   PI_FETCH_THREAD_BASIC | PI_FETCH_THREADS	},
+  { PSTAT_THREAD_SCHED,   PI_FETCH_THREAD_SCHED | PI_FETCH_THREADS	},
+  { PSTAT_THREAD_WAITS,   PI_FETCH_THREAD_WAITS | PI_FETCH_THREADS	},
+  { 0, }
+};
+
 static error_t
 fetch_procinfo (process_t server, pid_t pid,
 		ps_flags_t need, ps_flags_t *have,
 		struct procinfo **pi, size_t *pi_size,
 		char **waits, size_t *waits_len)
 {
-  static const struct { ps_flags_t ps_flag; int pi_flags; } map[] =
-  {
-    { PSTAT_TASK_BASIC,     PI_FETCH_TASKINFO				},
-    { PSTAT_TASK_EVENTS,    PI_FETCH_TASKEVENTS				},
-    { PSTAT_NUM_THREADS,    PI_FETCH_THREADS				},
-    { PSTAT_THREAD_BASIC,   PI_FETCH_THREAD_BASIC | PI_FETCH_THREADS	},
-    { PSTAT_THREAD_SCHED,   PI_FETCH_THREAD_SCHED | PI_FETCH_THREADS	},
-    { PSTAT_THREAD_WAITS,   PI_FETCH_THREAD_WAITS | PI_FETCH_THREADS	},
-    { 0, }
-  };
   int pi_flags = 0;
   int i;
 
@@ -608,6 +615,53 @@ clone (void *src, size_t size)
   return dst;
 }
 
+/* Update the fields of PS which are derived from its procinfo, now that
+   it has the information HAVE, after having HAD.  Returns HAVE, plus
+   anything else that could be derived.  */
+static ps_flags_t
+update_procinfo_fields (struct proc_stat *ps, ps_flags_t had, ps_flags_t have)
+{
+  struct procinfo *pi = ps->proc_info;
+
+  /* Update dependent fields.  We redo these even if we've already
+     gotten them, as the information will be newer.  */
+  if (have & PSTAT_TASK_BASIC)
+    ps->task_basic_info = &pi->taskinfo;
+  if (have & PSTAT_TASK_EVENTS)
+    ps->task_events_info = &pi->taskevents;
+  if (have & PSTAT_NUM_THREADS)
+    ps->num_threads = count_threads (pi, have);
+  if (had & PSTAT_THREAD_BASIC)
+    free (ps->thread_basic_info);
+  if (have & PSTAT_THREAD_BASIC)
+    ps->thread_basic_info = summarize_thread_basic_info (pi, have);
+  if (had & PSTAT_THREAD_SCHED)
+    free (ps->thread_sched_info);
+  if (have & PSTAT_THREAD_SCHED)
+    ps->thread_sched_info = summarize_thread_sched_info (pi);
+  if (have & PSTAT_THREAD_WAITS)
+    /* Thread-waits info can be used to generate thread-wait info. */
+    {
+      summarize_thread_waits (pi,
+			      ps->thread_waits, ps->thread_waits_len,
+			      &ps->thread_wait, &ps->thread_rpc);
+      have |= PSTAT_THREAD_WAIT;
+    }
+  else if (!(have & PSTAT_NO_MSGPORT)
+	   && (have & PSTAT_NUM_THREADS) && ps->num_threads > 3)
+    /* More than 3 threads (1 user thread + libc signal thread +
+       possible itimer thread) always results in this value for the
+       process's thread_wait field.  For fewer threads, we should
+       have fetched thread_waits info and hit the previous case.  */
+    {
+      ps->thread_wait = "*";
+      ps->thread_rpc = 0;
+      have |= PSTAT_THREAD_WAIT;
+    }
+
+  return have;
+}
+
 /* Add the information specified by NEED to PS which we can get with
    proc_getprocinfo.  */
 static ps_flags_t
@@ -615,7 +669,6 @@ set_procinfo_flags (struct proc_stat *ps, ps_flags_t need, ps_flags_t have)
 {
   if (have & PSTAT_PID)
     {
-      struct procinfo *pi;
       ps_flags_t had = have;
 
       if (! (have & PSTAT_PROCINFO))
@@ -646,43 +699,7 @@ set_procinfo_flags (struct proc_stat *ps, ps_flags_t need, ps_flags_t have)
 	}
 
       have = merge_procinfo (ps, need, have);
-      pi = ps->proc_info;
-
-      /* Update dependent fields.  We redo these even if we've already
-	 gotten them, as the information will be newer.  */
-      if (have & PSTAT_TASK_BASIC)
-	ps->task_basic_info = &pi->taskinfo;
-      if (have & PSTAT_TASK_EVENTS)
-	ps->task_events_info = &pi->taskevents;
-      if (have & PSTAT_NUM_THREADS)
-	ps->num_threads = count_threads (pi, have);
-      if (had & PSTAT_THREAD_BASIC)
-	free (ps->thread_basic_info);
-      if (have & PSTAT_THREAD_BASIC)
-	ps->thread_basic_info = summarize_thread_basic_info (pi, have);
-      if (had & PSTAT_THREAD_SCHED)
-	free (ps->thread_sched_info);
-      if (have & PSTAT_THREAD_SCHED)
-	ps->thread_sched_info = summarize_thread_sched_info (pi);
-      if (have & PSTAT_THREAD_WAITS)
-	/* Thread-waits info can be used to generate thread-wait info. */
-	{
-	  summarize_thread_waits (pi,
-				  ps->thread_waits, ps->thread_waits_len,
-				  &ps->thread_wait, &ps->thread_rpc);
-	  have |= PSTAT_THREAD_WAIT;
-	}
-      else if (!(have & PSTAT_NO_MSGPORT)
-	       && (have & PSTAT_NUM_THREADS) && ps->num_threads > 3)
-	/* More than 3 threads (1 user thread + libc signal thread +
-	   possible itimer thread) always results in this value for the
-	   process's thread_wait field.  For fewer threads, we should
-	   have fetched thread_waits info and hit the previous case.  */
-	{
-	  ps->thread_wait = "*";
-	  ps->thread_rpc = 0;
-	  have |= PSTAT_THREAD_WAIT;
-	}
+      have = update_procinfo_fields (ps, had, have);
     }
   else
     /* For a thread, we get use the proc_info from the containing process. */
@@ -1054,6 +1071,128 @@ proc_stat_set_flags (struct proc_stat *ps, ps_flags_t flags)
   return 0;
 }
 
+/* ---------------------------------------------------------------- */
+
+/* Set when the proc server turned out not to implement proc_getprocinfos,
+   so that we don't keep asking.  */
+static int no_bulk_procinfo;
+
+/* Fetch from the proc server of CONTEXT with a single proc_getprocinfos
+   call the information in PSTAT_PROCINFO_BULK that each of the NUM_PROCS
+   processes in PROCS needs for FLAGS.  Only processes for which nothing
+   has been fetched with proc_getprocinfo yet are considered, and anything
+   not fetched here is left for proc_stat_set_flags to get as usual.  */
+error_t
+_proc_stats_fetch_procinfo (struct ps_context *context,
+			    struct proc_stat **procs, unsigned num_procs,
+			    ps_flags_t flags)
+{
+  pid_t *pids;
+  struct proc_stat **which;
+  unsigned i, n = 0;
+  int pi_flags = 0;
+  struct procinfo *pis = 0;
+  size_t pis_len = 0, pos;
+  int *fetched = 0;
+  size_t fetched_len = 0;
+  error_t err;
+
+  if (no_bulk_procinfo || num_procs < 2)
+    return 0;
+
+  pids = NEWVEC (pid_t, num_procs);
+  which = NEWVEC (struct proc_stat *, num_procs);
+  if (!pids || !which)
+    {
+      FREE (pids);
+      FREE (which);
+      return ENOMEM;
+    }
+
+  for (i = 0; i < num_procs; i++)
+    {
+      struct proc_stat *ps = procs[i];
+      ps_flags_t need;
+      int j;
+
+      if (proc_stat_is_thread (ps) || (ps->flags & PSTAT_PROCINFO))
+	continue;
+
+      need = add_preconditions (flags, context) & ~ps->failed;
+      if (need & PSTAT_THREAD_WAIT)
+	/* See set_procinfo_flags.  */
+	need |= PSTAT_NUM_THREADS;
+      need &= PSTAT_PROCINFO_BULK;
+      if (! need)
+	continue;
+
+      for (j = 0; map[j].ps_flag; j++)
+	if (need & map[j].ps_flag)
+	  pi_flags |= map[j].pi_flags;
+      pids[n] = ps->pid;
+      which[n++] = ps;
+    }
+
+  err = 0;
+  if (n >= 2)
+    err = proc_getprocinfos (ps_context_server (context), pids, n, pi_flags,
+			     (procinfo_t *) &pis, &pis_len,
+			     &fetched, &fetched_len);
+  if (err == MIG_BAD_ID || err == EOPNOTSUPP)
+    no_bulk_procinfo = 1;
+  if (n < 2 || err)
+    {
+      FREE (pids);
+      FREE (which);
+      return err;
+    }
+
+  pis_len *= sizeof (int);
+  pos = 0;
+  for (i = 0; i < n && i < fetched_len; i++)
+    {
+      struct proc_stat *ps = which[i];
+      struct procinfo *pi = (struct procinfo *) ((char *) pis + pos);
+      ps_flags_t have;
+      size_t size;
+      int j;
+
+      if (fetched[i] == -1)
+	continue;
+
+      size = sizeof (struct procinfo);
+      if (pos + size > pis_len)
+	break;
+      if (pi_flags & (PI_FETCH_THREAD_BASIC | PI_FETCH_THREAD_SCHED))
+	size += pi->nthreads * sizeof (pi->threadinfos[0]);
+      if (pos + size > pis_len)
+	break;
+      pos += size;
+
+      ps->proc_info = clone (pi, size);
+      if (! ps->proc_info)
+	continue;
+      ps->proc_info_size = size;
+      ps->proc_info_vm_alloced = 0;
+      ps->thread_waits = 0;
+      ps->thread_waits_len = 0;
+
+      have = ps->flags | PSTAT_PROC_INFO;
+      for (j = 0; map[j].ps_flag; j++)
+	if ((fetched[i] & map[j].pi_flags) == map[j].pi_flags)
+	  have |= map[j].ps_flag;
+      have &= ~PSTAT_THREAD_WAITS;
+
+      ps->flags = update_procinfo_fields (ps, ps->flags, have);
+    }
+
+  munmap (pis, pis_len);
+  munmap (fetched, fetched_len * sizeof (int));
+  FREE (pids);
+  FREE (which);
+  return 0;
+}
+
 /* ---------------------------------------------------------------- */
 /* Discard PS and any resources it holds.  */
 void
@@ -468,6 +468,15 @@ extern char *proc_stat_state_tags;
 error_t _proc_stat_create (pid_t pid, struct ps_context *context,
 			   struct proc_stat **ps);
 
+/* Fetch with a single RPC as much as possible of the information from
+   proc_getprocinfo that each of the NUM_PROCS proc_stats in PROCS, from
+   the ps context PC, needs for FLAGS.  The rest is fetched as usual by
+   proc_stat_set_flags.  Users shouldn't use this routine, use
+   proc_stat_list_set_flags instead.  */
+error_t _proc_stats_fetch_procinfo (struct ps_context *pc,
+				    struct proc_stat **procs,
+				    unsigned num_procs, ps_flags_t flags);
+
 /* Frees PS and any memory/ports it references.  Users shouldn't use this
    routine; proc_stats are normally freed only when their ps_context goes
    away.  Insubordinate users will make sure they free the thread proc_stats
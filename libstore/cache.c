@@ -0,0 +1,813 @@
+/* Caching store backend
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
+
+/* A cache store sits on top of another store, and keeps recently used
+   parts of it in memory, in fixed-size `lines'.  Lines are evicted in
+   least recently used order.  Writes either go straight through to the
+   underlying store, updating any cached copy, or just dirty the cached
+   line, which is written back when it is evicted or the store is
+   flushed.  When reads are sequential, the lines following them are read
+   along with the ones asked for.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "store.h"
+
+#define DEFAULT_SIZE		(16*1024*1024)
+#define DEFAULT_LINE_SIZE	(64*1024)
+#define DEFAULT_READAHEAD	(256*1024)
+
+struct cache_line
+{
+  struct cache_line *hnext;	/* Hash chain.  */
+  struct cache_line *next, *prev; /* LRU list, most recent first.  */
+  store_offset_t num;		/* Which line of the store this is.  */
+  size_t len;			/* Only short at the end of the store.  */
+  int dirty;
+  int busy;			/* Being read from the underlying store.  */
+  char data[0];
+};
+
+struct cache_state
+{
+  /* The whole cache is locked for the duration of each operation, except
+     while writing through to the underlying store, and while reading lines
+     from it; those lines are marked busy meanwhile, and FETCHED is
+     signalled when they are filled in.  */
+  pthread_mutex_t lock;
+  pthread_cond_t fetched;
+
+  /* Held across each write through, so that the cached copy ends up like
+     the underlying store when writes overlap.  */
+  pthread_mutex_t write_lock;
+
+  unsigned int refs;		/* Stores sharing this cache.  */
+
+  size_t line_size;		/* A power of two.  */
+  unsigned log2_line_size;
+  size_t num_lines, max_lines;
+  size_t readahead;		/* In lines.  */
+  int writeback;
+
+  struct cache_line **hash;
+  size_t hash_mask;
+  struct cache_line *lru_head, *lru_tail;
+
+  /* The line following the last one read, to detect sequential reads.  */
+  store_offset_t next_seq;
+};
+
+static struct cache_line *
+lookup (struct cache_state *cache, store_offset_t num)
+{
+  struct cache_line *line;
+  for (line = cache->hash[num & cache->hash_mask]; line; line = line->hnext)
+    if (line->num == num)
+      break;
+  return line;
+}
+
+/* Return line number NUM of CACHE, waiting for it to be read first if it
+   is being read.  */
+static struct cache_line *
+lookup_ready (struct cache_state *cache, store_offset_t num)
+{
+  struct cache_line *line;
+  while ((line = lookup (cache, num)) && line->busy)
+    pthread_cond_wait (&cache->fetched, &cache->lock);
+  return line;
+}
+
+/* Move LINE to the head of CACHE's LRU list.  If LINE isn't in the list
+   yet, its NEXT and PREV fields must be null.  */
+static void
+touch (struct cache_state *cache, struct cache_line *line)
+{
+  if (cache->lru_head == line)
+    return;
+
+  if (line->prev)
+    line->prev->next = line->next;
+  if (line->next)
+    line->next->prev = line->prev;
+  else if (cache->lru_tail == line)
+    cache->lru_tail = line->prev;
+
+  line->prev = 0;
+  line->next = cache->lru_head;
+  if (cache->lru_head)
+    cache->lru_head->prev = line;
+  else
+    cache->lru_tail = line;
+  cache->lru_head = line;
+}
+
+/* Write LINE of STORE back to the underlying store if it is dirty.  */
+static error_t
+write_back (struct store *store, struct cache_line *line)
+{
+  struct cache_state *cache = store->hook;
+  struct store *child = store->children[0];
+  size_t amount;
+  error_t err;
+
+  if (! line->dirty)
+    return 0;
+
+  err = store_write (child,
+		     (line->num << cache->log2_line_size)
+		     >> child->log2_block_size,
+		     line->data, line->len, &amount);
+  if (!err && amount < line->len)
+    err = EIO;
+  if (! err)
+    line->dirty = 0;
+  return err;
+}
+
+/* Remove LINE from CACHE and free it.  */
+static void
+drop_line (struct cache_state *cache, struct cache_line *line)
+{
+  struct cache_line **lp;
+
+  if (line->prev)
+    line->prev->next = line->next;
+  else
+    cache->lru_head = line->next;
+  if (line->next)
+    line->next->prev = line->prev;
+  else
+    cache->lru_tail = line->prev;
+
+  for (lp = &cache->hash[line->num & cache->hash_mask]; *lp != line;
+       lp = &(*lp)->hnext)
+    ;
+  *lp = line->hnext;
+
+  free (line);
+  cache->num_lines--;
+}
+
+/* Throw out the least recently used line of STORE, writing it back first
+   if necessary.  If that fails, throw out the least recently used clean
+   line instead, so that one line that can't be written back doesn't keep
+   the cache from making room.  Lines being read can't be thrown out;
+   return EBUSY if there are only those.  */
+static error_t
+evict (struct store *store)
+{
+  struct cache_state *cache = store->hook;
+  struct cache_line *line = cache->lru_tail;
+  error_t err;
+
+  while (line && line->busy)
+    line = line->prev;
+  if (! line)
+    return EBUSY;
+
+  err = write_back (store, line);
+  if (err)
+    {
+      while (line && (line->dirty || line->busy))
+	line = line->prev;
+      if (! line)
+	return err;
+    }
+
+  drop_line (cache, line);
+  return 0;
+}
+
+/* Return a new line for line number NUM of STORE, making room for it if
+   necessary.  Its contents are uninitialized.  */
+static error_t
+new_line (struct store *store, store_offset_t num, struct cache_line **linep)
+{
+  struct cache_state *cache = store->hook;
+  struct cache_line *line, **bucket;
+  store_offset_t start = num << cache->log2_line_size;
+
+  while (cache->num_lines >= cache->max_lines)
+    {
+      error_t err = evict (store);
+      if (err)
+	return err;
+    }
+
+  line = malloc (sizeof *line + cache->line_size);
+  if (! line)
+    return ENOMEM;
+
+  line->num = num;
+  line->len = (store->size - start < cache->line_size
+	       ? store->size - start : cache->line_size);
+  line->dirty = 0;
+  line->busy = 0;
+  line->next = line->prev = 0;
+  bucket = &cache->hash[num & cache->hash_mask];
+  line->hnext = *bucket;
+  *bucket = line;
+  cache->num_lines++;
+  touch (cache, line);
+
+  *linep = line;
+  return 0;
+}
+
+/* Read up to COUNT lines of STORE, starting with line number FIRST, from
+   the underlying store in a single request, and add them to the cache.
+   None of them may be cached already.  The cache is unlocked during the
+   read; the lines are added first, marked busy, so that nobody else
+   fetches or evicts them meanwhile.  */
+static error_t
+fetch (struct store *store, store_offset_t first, size_t count)
+{
+  struct cache_state *cache = store->hook;
+  struct store *child = store->children[0];
+  store_offset_t start = first << cache->log2_line_size;
+  size_t amount, ofs, made, i;
+  void *buf = 0;
+  size_t len = 0;
+  error_t err = 0;
+
+  /* Read fewer lines if the others are all busy.  */
+  for (made = 0; made < count; made++)
+    {
+      struct cache_line *line;
+      err = new_line (store, first + made, &line);
+      if (err)
+	break;
+      line->busy = 1;
+    }
+  if (made == 0)
+    return err;
+
+  amount = made << cache->log2_line_size;
+  if (amount > store->size - start)
+    amount = store->size - start;
+
+  pthread_mutex_unlock (&cache->lock);
+  err = store_read (child, start >> child->log2_block_size, amount,
+		    &buf, &len);
+  pthread_mutex_lock (&cache->lock);
+
+  for (i = 0, ofs = 0; i < made; i++, ofs += cache->line_size)
+    {
+      struct cache_line *line = lookup (cache, first + i);
+
+      line->busy = 0;
+      if (err || ofs >= len)
+	drop_line (cache, line);
+      else
+	{
+	  if (len - ofs < line->len)
+	    line->len = len - ofs; /* Short read.  */
+	  memcpy (line->data, buf + ofs, line->len);
+	}
+    }
+  pthread_cond_broadcast (&cache->fetched);
+
+  if (! err)
+    munmap (buf, len);
+  return err;
+}
+
+/* Return line number NUM of STORE, reading it from the underlying store if
+   it isn't cached.  When reading, also read up to EXTRA lines following
+   it that aren't cached yet.  */
+static error_t
+get_line (struct store *store, store_offset_t num, size_t extra,
+	  struct cache_line **linep)
+{
+  struct cache_state *cache = store->hook;
+  store_offset_t last_line = (store->size - 1) >> cache->log2_line_size;
+  error_t err;
+
+  if (extra > cache->max_lines - 1)
+    extra = cache->max_lines - 1;
+
+  for (;;)
+    {
+      *linep = lookup (cache, num);
+      if (*linep && ! (*linep)->busy)
+	{
+	  touch (cache, *linep);
+	  return 0;
+	}
+
+      if (! *linep)
+	{
+	  size_t count = 1;
+
+	  /* Read as many missing lines at once as we can, but no more than
+	     fit in the cache.  */
+	  while (count <= extra && num + count <= last_line
+		 && ! lookup (cache, num + count))
+	    count++;
+
+	  err = fetch (store, num, count);
+	  if (err != EBUSY)
+	    break;
+	}
+
+      /* Wait for someone else's read of this line, or of any line if
+	 they're all being read.  */
+      pthread_cond_wait (&cache->fetched, &cache->lock);
+    }
+
+  if (! err)
+    *linep = lookup (cache, num);
+  if (!err && ! *linep)
+    err = EIO;
+  return err;
+}
+
+static error_t
+cache_read (struct store *store,
+	    store_offset_t addr, size_t index, size_t amount,
+	    void **buf, size_t *len)
+{
+  struct cache_state *cache = store->hook;
+  store_offset_t start = addr << store->log2_block_size;
+  store_offset_t first, last, num;
+  size_t done = 0, extra;
+  char *data = *buf;
+  error_t err = 0;
+
+  if (amount == 0)
+    {
+      *len = 0;
+      return 0;
+    }
+
+  if (*len < amount)
+    {
+      data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (data == MAP_FAILED)
+	return errno;
+    }
+
+  first = start >> cache->log2_line_size;
+  last = (start + amount - 1) >> cache->log2_line_size;
+
+  pthread_mutex_lock (&cache->lock);
+
+  /* Read ahead only if this read continues the previous one.  */
+  extra = (first == cache->next_seq || first + 1 == cache->next_seq
+	   ? cache->readahead : 0);
+
+  for (num = first; !err && num <= last; num++)
+    {
+      struct cache_line *line;
+
+      err = get_line (store, num, last - num + extra, &line);
+      if (! err)
+	{
+	  size_t ofs = start + done - (num << cache->log2_line_size);
+	  size_t n = line->len - ofs;
+	  if (n > amount - done)
+	    n = amount - done;
+	  memcpy (data + done, line->data + ofs, n);
+	  done += n;
+	}
+    }
+  cache->next_seq = last + 1;
+
+  pthread_mutex_unlock (&cache->lock);
+
+  if (err)
+    {
+      if (data != *buf)
+	munmap (data, amount);
+      return err;
+    }
+
+  *buf = data;
+  *len = done;
+  return 0;
+}
+
+static error_t
+cache_write (struct store *store,
+	     store_offset_t addr, size_t index, const void *buf, size_t len,
+	     size_t *amount)
+{
+  struct cache_state *cache = store->hook;
+  store_offset_t start = addr << store->log2_block_size;
+  store_offset_t num;
+  size_t done = 0;
+  error_t err = 0;
+
+  *amount = 0;
+
+  if (! cache->writeback)
+    {
+      /* Write through, and then update whatever we have cached of what
+	 was actually written.  Reads that fetch lines meanwhile either
+	 see the new data or are done before the update.  */
+      pthread_mutex_lock (&cache->write_lock);
+      err = store_write (store->children[0], addr, buf, len, amount);
+      len = err ? 0 : *amount;
+    }
+
+  pthread_mutex_lock (&cache->lock);
+
+  num = start >> cache->log2_line_size;
+  while (done < len)
+    {
+      size_t ofs = start + done - (num << cache->log2_line_size);
+      size_t n = cache->line_size - ofs;
+      struct cache_line *line;
+
+      if (n > len - done)
+	n = len - done;
+
+      /* Wait for a read of the line to finish, or it would overwrite what
+	 we write.  */
+      line = lookup_ready (cache, num);
+
+      if (! line && cache->writeback)
+	{
+	  store_offset_t left = store->size - (start + done);
+
+	  /* Lines that are completely overwritten needn't be read.  */
+	  if (ofs == 0 && n == (left < cache->line_size
+				? left : cache->line_size))
+	    err = new_line (store, num, &line);
+	  else
+	    err = get_line (store, num, 0, &line);
+	  if (err == EBUSY)
+	    {
+	      /* All the lines are being read; try again when one is.  */
+	      pthread_cond_wait (&cache->fetched, &cache->lock);
+	      continue;
+	    }
+	  if (err)
+	    break;
+	}
+
+      if (line)
+	{
+	  memcpy (line->data + ofs, buf + done, n);
+	  if (cache->writeback)
+	    {
+	      line->dirty = 1;
+	      touch (cache, line);
+	    }
+	}
+      done += n;
+      num++;
+    }
+
+  pthread_mutex_unlock (&cache->lock);
+  if (! cache->writeback)
+    pthread_mutex_unlock (&cache->write_lock);
+
+  if (cache->writeback)
+    {
+      /* Like store_write, return a short write rather than an error if
+	 anything could be written.  */
+      *amount = done;
+      if (done > 0)
+	err = 0;
+    }
+  return err;
+}
+
+/* Write back all dirty lines of STORE.  CACHE must be locked.  */
+static error_t
+write_back_all (struct store *store)
+{
+  struct cache_state *cache = store->hook;
+  struct cache_line *line;
+  error_t err = 0;
+
+  /* Start from the oldest lines, which are the likeliest to be evicted
+     next anyway.  */
+  for (line = cache->lru_tail; line; line = line->prev)
+    {
+      error_t line_err = write_back (store, line);
+      if (! err)
+	err = line_err;
+    }
+  return err;
+}
+
+static error_t
+cache_flush (struct store *store)
+{
+  struct cache_state *cache = store->hook;
+  error_t err;
+
+  pthread_mutex_lock (&cache->lock);
+  err = write_back_all (store);
+  pthread_mutex_unlock (&cache->lock);
+
+  return err ?: store_flush (store->children[0]);
+}
+
+static error_t
+cache_trim (struct store *store, store_offset_t addr, size_t index,
+	    size_t len)
+{
+  struct cache_state *cache = store->hook;
+  store_offset_t start = addr << store->log2_block_size;
+  store_offset_t num;
+  error_t err;
+
+  pthread_mutex_lock (&cache->lock);
+
+  /* Drop pending writes to lines that are completely trimmed, so they
+     aren't written back on top of the trim later.  Partially trimmed
+     lines are simply written back first.  */
+  for (num = start >> cache->log2_line_size;
+       (num << cache->log2_line_size) < start + len; num++)
+    {
+      struct cache_line *line = lookup (cache, num);
+      if (line && line->dirty)
+	{
+	  store_offset_t lstart = num << cache->log2_line_size;
+	  if (lstart >= start && lstart + line->len <= start + len)
+	    line->dirty = 0;
+	  else
+	    {
+	      err = write_back (store, line);
+	      if (err)
+		{
+		  pthread_mutex_unlock (&cache->lock);
+		  return err;
+		}
+	    }
+	}
+    }
+
+  err = store_trim (store->children[0], addr, len);
+
+  pthread_mutex_unlock (&cache->lock);
+  return err;
+}
+
+static error_t
+cache_set_size (struct store *store, size_t newsize)
+{
+  return EOPNOTSUPP;
+}
+
+static void
+cache_cleanup (struct store *store)
+{
+  struct cache_state *cache = store->hook;
+  struct cache_line *line, *next;
+  unsigned int refs;
+
+  if (! cache)
+    return;
+
+  pthread_mutex_lock (&cache->lock);
+  refs = --cache->refs;
+  if (refs == 0)
+    /* There's nobody left to tell about errors.  */
+    write_back_all (store);
+  pthread_mutex_unlock (&cache->lock);
+
+  if (refs > 0)
+    return;
+
+  for (line = cache->lru_head; line; line = next)
+    {
+      next = line->next;
+      free (line);
+    }
+  free (cache->hash);
+  free (cache);
+}
+
+/* Clones share the cache, so that each sees what the others wrote, and
+   dirty lines are written back only once.  */
+static error_t
+cache_clone (const struct store *from, struct store *to)
+{
+  struct cache_state *cache = from->hook;
+
+  pthread_mutex_lock (&cache->lock);
+  cache->refs++;
+  pthread_mutex_unlock (&cache->lock);
+  to->hook = cache;
+
+  return 0;
+}
+
+/* Parse the options at the start of NAME, returning the name of the
+   underlying store in REST.  */
+static error_t
+parse_options (const char *name, size_t *size, size_t *line_size,
+	       size_t *readahead, int *writeback, const char **rest)
+{
+  error_t parse_opt (const char *key, size_t key_len,
+		     const char *value, size_t value_len)
+    {
+      size_t *val;
+      char *end;
+
+#define KEY_IS(k) (key_len == sizeof (k) - 1 && ! strncmp (key, k, key_len))
+#define VALUE_IS(v) (value_len == sizeof (v) - 1 \
+		     && ! strncmp (value, v, value_len))
+
+      if (KEY_IS ("mode"))
+	{
+	  if (VALUE_IS ("writeback"))
+	    *writeback = 1;
+	  else if (VALUE_IS ("writethrough"))
+	    *writeback = 0;
+	  else
+	    return EINVAL;
+	  return 0;
+	}
+      else if (KEY_IS ("size"))
+	val = size;
+      else if (KEY_IS ("line"))
+	val = line_size;
+      else if (KEY_IS ("readahead"))
+	val = readahead;
+      else
+	return EINVAL;
+
+#undef KEY_IS
+#undef VALUE_IS
+
+      if (_store_parse_size (value, val, &end) || end != value + value_len)
+	return EINVAL;
+      return 0;
+    }
+
+  *size = DEFAULT_SIZE;
+  *line_size = DEFAULT_LINE_SIZE;
+  *readahead = DEFAULT_READAHEAD;
+  *writeback = 0;
+
+  return _store_parse_options (name, parse_opt, rest);
+}
+
+static error_t
+cache_validate_name (const char *name,
+		     const struct store_class *const *classes)
+{
+  size_t size, line_size, readahead;
+  int writeback;
+  const char *rest;
+
+  if (! name)
+    return EINVAL;
+  return parse_options (name, &size, &line_size, &readahead, &writeback,
+			&rest);
+}
+
+static error_t
+cache_open (const char *name, int flags,
+	    const struct store_class *const *classes,
+	    struct store **store)
+{
+  return store_cache_open (name, flags, classes, store);
+}
+
+const struct store_class store_cache_class =
+{
+  -1, "cache",
+  read: cache_read,
+  write: cache_write,
+  set_size: cache_set_size,
+  cleanup: cache_cleanup,
+  clone: cache_clone,
+  open: cache_open,
+  validate_name: cache_validate_name,
+  flush: cache_flush,
+  trim: cache_trim,
+};
+STORE_STD_CLASS (cache);
+
+/* Return a new store in STORE which caches up to SIZE bytes of the store
+   FROM in memory, in units of LINE_SIZE bytes; FROM is consumed.  */
+error_t
+store_cache_create (struct store *from, size_t size, size_t line_size,
+		    size_t readahead, int writeback, int flags,
+		    struct store **store)
+{
+  struct cache_state *cache;
+  struct store_run run;
+  size_t hash_size;
+  error_t err;
+
+  if ((line_size & (line_size - 1)) || line_size < from->block_size
+      || from->block_size == 0 || size < line_size)
+    return EINVAL;
+
+  cache = calloc (1, sizeof *cache);
+  if (! cache)
+    return ENOMEM;
+  pthread_mutex_init (&cache->lock, NULL);
+  pthread_cond_init (&cache->fetched, NULL);
+  pthread_mutex_init (&cache->write_lock, NULL);
+  cache->refs = 1;
+  cache->line_size = line_size;
+  cache->log2_line_size = ffs (line_size) - 1;
+  cache->max_lines = size / line_size;
+  cache->readahead = readahead / line_size;
+  cache->writeback = writeback;
+  cache->next_seq = -1;
+
+  for (hash_size = 1; hash_size < cache->max_lines; hash_size <<= 1)
+    ;
+  cache->hash = calloc (hash_size, sizeof *cache->hash);
+  if (! cache->hash)
+    {
+      free (cache);
+      return ENOMEM;
+    }
+  cache->hash_mask = hash_size - 1;
+
+  run.start = 0;
+  run.length = from->blocks;
+  err = _store_create (&store_cache_class, MACH_PORT_NULL,
+		       flags | (from->flags & STORE_HARD_READONLY),
+		       from->block_size, &run, 1, 0, store);
+  if (err)
+    {
+      free (cache->hash);
+      free (cache);
+      return err;
+    }
+
+  (*store)->hook = cache;
+  err = store_set_children (*store, &from, 1);
+  if (! err && from->name)
+    {
+      if (asprintf (&(*store)->name, "%s:%s",
+		    from->class->name, from->name) < 0)
+	{
+	  (*store)->name = 0;
+	  err = ENOMEM;
+	}
+    }
+  if (err)
+    {
+      /* Don't free FROM along with the new store; the caller still owns
+	 it after a failure.  */
+      (*store)->num_children = 0;
+      store_free (*store);
+    }
+
+  return err;
+}
+
+/* Open the cache store NAME -- which consists of optional "KEY=VALUE:"
+   prefixes, another store-class name, a ':', and a name for that store
+   class to open -- and return the corresponding store in STORE.  CLASSES is
+   used to select classes specified by the type name; if it is 0,
+   STORE_STD_CLASSES is used.  */
+error_t
+store_cache_open (const char *name, int flags,
+		  const struct store_class *const *classes,
+		  struct store **store)
+{
+  struct store *from;
+  size_t size, line_size, readahead;
+  int writeback;
+  const char *rest;
+  error_t err = parse_options (name, &size, &line_size, &readahead,
+			       &writeback, &rest);
+
+  if (err)
+    return err;
+
+  err = store_typed_open (rest, flags, classes, &from);
+  if (! err)
+    {
+      err = store_cache_create (from, size, line_size, readahead, writeback,
+				flags, store);
+      if (err)
+	store_free (from);
+    }
+
+  return err;
+}
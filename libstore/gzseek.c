@@ -0,0 +1,708 @@
+/* Random-access gzip store backend
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
+
+/* Unlike the gunzip store, which decompresses everything into memory when
+   it is created, this store makes one pass over the compressed data to
+   build an index of access points, and then decompresses chunks between
+   access points on demand, keeping a bounded number of them cached.  An
+   access point records where a deflate block starts in both the
+   compressed and uncompressed data, along with the 32KiB of uncompressed
+   data preceding it, which is needed to resume decompression there.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "store.h"
+
+#define IN_BUFFERING	(256*1024)
+
+/* Size of the deflate history window.  */
+#define WINSIZE		32768
+
+/* Defaults for the distance between access points, and the amount of
+   uncompressed data cached.  */
+#define DEFAULT_SPAN	(1024*1024)
+#define DEFAULT_CACHE	(16*1024*1024)
+
+struct gzseek_point
+{
+  store_offset_t out;		/* Offset in the uncompressed data.  */
+  store_offset_t in;		/* Offset of the first whole byte of input.  */
+  int bits;			/* Bits of the previous byte to use, or 0.  */
+  void *window;			/* Compressed copy of the history window.  */
+  size_t window_len;
+};
+
+/* A decompressed chunk, which is the data between two access points.  */
+struct gzseek_chunk
+{
+  struct gzseek_chunk *next, *prev; /* LRU list, most recent first.  */
+  size_t point;			/* Index of the access point it starts at.  */
+  char *data;
+  size_t len;
+};
+
+struct gzseek_state
+{
+  struct gzseek_point *points;
+  size_t num_points;
+
+  pthread_mutex_t lock;		/* Protects the cache and REFS.  */
+  unsigned int refs;		/* Stores sharing this state.  */
+  struct gzseek_chunk **chunks;	/* Cached chunk for each access point.  */
+  struct gzseek_chunk *lru_head, *lru_tail;
+  size_t cached, cache_max;
+};
+
+/* Read LEN bytes at byte offset OFFSET in FROM into BUF, returning the
+   amount actually read in AMOUNT, which is only less than LEN at the end
+   of FROM.  */
+static error_t
+read_bytes (struct store *from, store_offset_t offset, char *buf, size_t len,
+	    size_t *amount)
+{
+  size_t mask = from->block_size - 1;
+  store_offset_t start = offset & ~(store_offset_t) mask;
+  size_t skip = offset - start;
+  size_t want;
+  void *data = 0;
+  size_t data_len = 0;
+  error_t err;
+
+  *amount = 0;
+  if (offset >= from->size)
+    return 0;
+  if (len > from->size - offset)
+    len = from->size - offset;
+
+  want = (skip + len + mask) & ~mask;
+  err = store_read (from, start >> from->log2_block_size, want,
+		    &data, &data_len);
+  if (err)
+    return err;
+
+  if (data_len > skip)
+    {
+      *amount = data_len - skip < len ? data_len - skip : len;
+      memcpy (buf, data + skip, *amount);
+    }
+  munmap (data, data_len);
+  return 0;
+}
+
+/* Add an access point at the given position to STATE, with WINDOW holding
+   the history, wrapped around at LEFT.  */
+static error_t
+add_point (struct gzseek_state *state, int bits, store_offset_t in,
+	   store_offset_t out, size_t left, const unsigned char *window)
+{
+  struct gzseek_point *points, *point;
+  unsigned char history[WINSIZE];
+  uLongf clen = compressBound (WINSIZE);
+
+  if ((state->num_points & (state->num_points - 1)) == 0)
+    /* Grow the vector in powers of two.  */
+    {
+      size_t n = state->num_points ? state->num_points * 2 : 8;
+      points = realloc (state->points, n * sizeof *points);
+      if (! points)
+	return ENOMEM;
+      state->points = points;
+    }
+
+  point = &state->points[state->num_points];
+  point->out = out;
+  point->in = in;
+  point->bits = bits;
+
+  /* Unwrap the history, and keep it compressed; it is only needed when
+     decompressing a chunk that isn't cached.  */
+  memcpy (history, window + WINSIZE - left, left);
+  memcpy (history + left, window, WINSIZE - left);
+  point->window = malloc (clen);
+  if (! point->window)
+    return ENOMEM;
+  if (compress (point->window, &clen, history, WINSIZE) != Z_OK)
+    {
+      free (point->window);
+      return ENOMEM;
+    }
+  point->window_len = clen;
+  state->num_points++;
+
+  return 0;
+}
+
+/* Decompress all of FROM once, recording an access point every SPAN bytes
+   of output in STATE.  The total uncompressed size is returned in SIZE.  */
+static error_t
+build_index (struct store *from, struct gzseek_state *state, size_t span,
+	     store_offset_t *size)
+{
+  z_stream strm;
+  unsigned char *input, *window;
+  store_offset_t totin = 0, totout = 0, last = 0, in_addr = 0;
+  error_t err = 0;
+  int ret = Z_OK;
+
+  input = malloc (IN_BUFFERING);
+  window = calloc (1, WINSIZE);
+  if (! input || ! window)
+    {
+      free (input);
+      free (window);
+      return ENOMEM;
+    }
+
+  memset (&strm, 0, sizeof strm);
+  /* Automatically detect gzip or zlib headers.  */
+  if (inflateInit2 (&strm, 32 + MAX_WBITS) != Z_OK)
+    {
+      free (input);
+      free (window);
+      return ENOMEM;
+    }
+
+  do
+    {
+      size_t got;
+
+      err = read_bytes (from, in_addr, (char *) input, IN_BUFFERING, &got);
+      if (err)
+	break;
+      if (got == 0)
+	{
+	  err = EINVAL;		/* Truncated.  */
+	  break;
+	}
+      in_addr += got;
+      strm.next_in = input;
+      strm.avail_in = got;
+
+      do
+	{
+	  if (strm.avail_out == 0)
+	    {
+	      strm.next_out = window;
+	      strm.avail_out = WINSIZE;
+	    }
+
+	  /* Stop at the end of each deflate block, so we can tell where
+	     blocks start.  */
+	  totin += strm.avail_in;
+	  totout += strm.avail_out;
+	  ret = inflate (&strm, Z_BLOCK);
+	  totin -= strm.avail_in;
+	  totout -= strm.avail_out;
+
+	  if (ret == Z_MEM_ERROR)
+	    err = ENOMEM;
+	  else if (ret != Z_OK && ret != Z_STREAM_END)
+	    err = EINVAL;
+	  else if (ret == Z_OK
+		   && (strm.data_type & 128) && ! (strm.data_type & 64)
+		   && (totout == 0 || totout - last > span))
+	    /* At the end of a block which isn't the last one.  */
+	    {
+	      err = add_point (state, strm.data_type & 7, totin, totout,
+			       strm.avail_out, window);
+	      last = totout;
+	    }
+	}
+      while (!err && ret != Z_STREAM_END && strm.avail_in != 0);
+    }
+  while (!err && ret != Z_STREAM_END);
+
+  /* Like the gunzip store, we stop at the end of the first stream.  */
+  inflateEnd (&strm);
+  free (input);
+  free (window);
+
+  *size = totout;
+  return err;
+}
+
+/* Decompress the chunk starting at access point INDEX of STATE into DATA,
+   which has room for exactly LEN bytes.  */
+static error_t
+inflate_chunk (struct store *from, struct gzseek_state *state, size_t index,
+	       char *data, size_t len)
+{
+  struct gzseek_point *point = &state->points[index];
+  unsigned char *input, history[WINSIZE];
+  uLongf hlen = WINSIZE;
+  store_offset_t in_addr = point->in;
+  z_stream strm;
+  error_t err = 0;
+  int ret;
+
+  if (uncompress (history, &hlen, point->window, point->window_len) != Z_OK)
+    return EIO;
+
+  input = malloc (IN_BUFFERING);
+  if (! input)
+    return ENOMEM;
+
+  memset (&strm, 0, sizeof strm);
+  if (inflateInit2 (&strm, -MAX_WBITS) != Z_OK)
+    {
+      free (input);
+      return ENOMEM;
+    }
+
+  if (point->bits)
+    /* The block starts in the middle of the previous byte.  */
+    {
+      unsigned char byte;
+      size_t got;
+
+      err = read_bytes (from, point->in - 1, (char *) &byte, 1, &got);
+      if (!err && got != 1)
+	err = EIO;
+      if (! err)
+	inflatePrime (&strm, point->bits, byte >> (8 - point->bits));
+    }
+  if (! err)
+    inflateSetDictionary (&strm, history, WINSIZE);
+
+  strm.next_out = (unsigned char *) data;
+  strm.avail_out = len;
+  while (!err && strm.avail_out > 0)
+    {
+      if (strm.avail_in == 0)
+	{
+	  size_t got;
+
+	  err = read_bytes (from, in_addr, (char *) input, IN_BUFFERING, &got);
+	  if (err)
+	    break;
+	  if (got == 0)
+	    {
+	      err = EIO;
+	      break;
+	    }
+	  in_addr += got;
+	  strm.next_in = input;
+	  strm.avail_in = got;
+	}
+
+      ret = inflate (&strm, Z_NO_FLUSH);
+      if (ret == Z_MEM_ERROR)
+	err = ENOMEM;
+      else if (ret == Z_STREAM_END)
+	{
+	  if (strm.avail_out > 0)
+	    err = EIO;
+	  break;
+	}
+      else if (ret != Z_OK)
+	err = EIO;
+    }
+
+  inflateEnd (&strm);
+  free (input);
+  return err;
+}
+
+/* Unlink CHUNK from the LRU list of STATE.  */
+static void
+lru_unlink (struct gzseek_state *state, struct gzseek_chunk *chunk)
+{
+  if (chunk->prev)
+    chunk->prev->next = chunk->next;
+  else
+    state->lru_head = chunk->next;
+  if (chunk->next)
+    chunk->next->prev = chunk->prev;
+  else
+    state->lru_tail = chunk->prev;
+}
+
+/* Put CHUNK at the head of the LRU list of STATE.  */
+static void
+lru_push (struct gzseek_state *state, struct gzseek_chunk *chunk)
+{
+  chunk->prev = 0;
+  chunk->next = state->lru_head;
+  if (state->lru_head)
+    state->lru_head->prev = chunk;
+  else
+    state->lru_tail = chunk;
+  state->lru_head = chunk;
+}
+
+static void
+chunk_free (struct gzseek_chunk *chunk)
+{
+  munmap (chunk->data, chunk->len);
+  free (chunk);
+}
+
+/* Return the chunk starting at access point INDEX of STORE, decompressing
+   it if it isn't cached.  STATE is locked on return, which keeps the chunk
+   from being evicted.  */
+static error_t
+get_chunk (struct store *store, size_t index, struct gzseek_chunk **chunkp)
+{
+  struct gzseek_state *state = store->hook;
+  struct gzseek_chunk *chunk;
+  error_t err;
+
+  pthread_mutex_lock (&state->lock);
+  chunk = state->chunks[index];
+  if (chunk)
+    {
+      lru_unlink (state, chunk);
+      lru_push (state, chunk);
+      *chunkp = chunk;
+      return 0;
+    }
+  pthread_mutex_unlock (&state->lock);
+
+  /* Decompress without holding the lock, so readers of other chunks can
+     proceed.  */
+  chunk = malloc (sizeof *chunk);
+  if (! chunk)
+    return ENOMEM;
+  chunk->point = index;
+  chunk->len = (index + 1 < state->num_points
+		? state->points[index + 1].out : store->size)
+	       - state->points[index].out;
+  chunk->data = mmap (0, chunk->len, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (chunk->data == MAP_FAILED)
+    {
+      free (chunk);
+      return errno;
+    }
+
+  err = inflate_chunk (store->children[0], state, index,
+		       chunk->data, chunk->len);
+  if (err)
+    {
+      chunk_free (chunk);
+      return err;
+    }
+
+  pthread_mutex_lock (&state->lock);
+  if (state->chunks[index])
+    /* Somebody beat us to it.  */
+    {
+      chunk_free (chunk);
+      chunk = state->chunks[index];
+      lru_unlink (state, chunk);
+    }
+  else
+    {
+      state->chunks[index] = chunk;
+      state->cached += chunk->len;
+    }
+  lru_push (state, chunk);
+
+  /* Make room, but always keep the chunk we are returning.  */
+  while (state->cached > state->cache_max && state->lru_tail != chunk)
+    {
+      struct gzseek_chunk *victim = state->lru_tail;
+      lru_unlink (state, victim);
+      state->chunks[victim->point] = 0;
+      state->cached -= victim->len;
+      chunk_free (victim);
+    }
+
+  *chunkp = chunk;
+  return 0;
+}
+
+/* Return the index of the access point in STATE at or before OFFSET.  */
+static size_t
+find_point (struct gzseek_state *state, store_offset_t offset)
+{
+  size_t lo = 0, hi = state->num_points;
+
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (state->points[mid].out <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static error_t
+gzseek_read (struct store *store,
+	     store_offset_t addr, size_t index, size_t amount,
+	     void **buf, size_t *len)
+{
+  struct gzseek_state *state = store->hook;
+  size_t point, done = 0;
+  char *data = *buf;
+  error_t err = 0;
+
+  if (*len < amount)
+    {
+      data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (data == MAP_FAILED)
+	return errno;
+    }
+
+  point = find_point (state, addr);
+  while (!err && done < amount)
+    {
+      struct gzseek_chunk *chunk;
+
+      err = get_chunk (store, point, &chunk);
+      if (! err)
+	{
+	  size_t ofs = addr + done - state->points[point].out;
+	  size_t n = chunk->len - ofs;
+	  if (n > amount - done)
+	    n = amount - done;
+	  memcpy (data + done, chunk->data + ofs, n);
+	  pthread_mutex_unlock (&state->lock);
+	  done += n;
+	  point++;
+	}
+    }
+
+  if (err)
+    {
+      if (data != *buf)
+	munmap (data, amount);
+      return err;
+    }
+
+  *buf = data;
+  *len = amount;
+  return 0;
+}
+
+static error_t
+gzseek_write (struct store *store,
+	      store_offset_t addr, size_t index, const void *buf, size_t len,
+	      size_t *amount)
+{
+  return EROFS;
+}
+
+static error_t
+gzseek_set_size (struct store *store, size_t newsize)
+{
+  return EOPNOTSUPP;
+}
+
+static void
+gzseek_cleanup (struct store *store)
+{
+  struct gzseek_state *state = store->hook;
+  struct gzseek_chunk *chunk, *next;
+  unsigned int refs;
+  size_t i;
+
+  if (! state)
+    return;
+
+  pthread_mutex_lock (&state->lock);
+  refs = --state->refs;
+  pthread_mutex_unlock (&state->lock);
+  if (refs > 0)
+    return;
+
+  for (chunk = state->lru_head; chunk; chunk = next)
+    {
+      next = chunk->next;
+      chunk_free (chunk);
+    }
+  for (i = 0; i < state->num_points; i++)
+    free (state->points[i].window);
+  free (state->points);
+  free (state->chunks);
+  free (state);
+}
+
+/* Clones share the index and the cache, which never change underneath
+   them except under the lock.  */
+static error_t
+gzseek_clone (const struct store *from, struct store *to)
+{
+  struct gzseek_state *state = from->hook;
+
+  pthread_mutex_lock (&state->lock);
+  state->refs++;
+  pthread_mutex_unlock (&state->lock);
+  to->hook = state;
+
+  return 0;
+}
+
+/* Parse the options at the start of NAME, returning the name of the
+   underlying store in REST.  */
+static error_t
+parse_options (const char *name, size_t *span, size_t *cache_max,
+	       const char **rest)
+{
+  error_t parse_opt (const char *key, size_t key_len,
+		     const char *value, size_t value_len)
+    {
+      size_t *val;
+      char *end;
+
+      if (key_len == 4 && ! strncmp (key, "span", 4))
+	val = span;
+      else if (key_len == 5 && ! strncmp (key, "cache", 5))
+	val = cache_max;
+      else
+	return EINVAL;
+
+      if (_store_parse_size (value, val, &end) || end != value + value_len)
+	return EINVAL;
+      return 0;
+    }
+
+  *span = DEFAULT_SPAN;
+  *cache_max = DEFAULT_CACHE;
+
+  return (_store_parse_options (name, parse_opt, rest)
+	  ?: *span == 0 ? EINVAL : 0);
+}
+
+static error_t
+gzseek_validate_name (const char *name,
+		      const struct store_class *const *classes)
+{
+  size_t span, cache_max;
+  const char *rest;
+
+  if (! name)
+    return EINVAL;
+  return parse_options (name, &span, &cache_max, &rest);
+}
+
+static error_t
+gzseek_open (const char *name, int flags,
+	     const struct store_class *const *classes,
+	     struct store **store)
+{
+  return store_gzseek_open (name, flags, classes, store);
+}
+
+const struct store_class store_gzseek_class =
+{
+  -1, "gzseek",
+  read: gzseek_read,
+  write: gzseek_write,
+  set_size: gzseek_set_size,
+  cleanup: gzseek_cleanup,
+  clone: gzseek_clone,
+  open: gzseek_open,
+  validate_name: gzseek_validate_name,
+};
+STORE_STD_CLASS (gzseek);
+
+/* Return a new store in STORE which contains the uncompressed contents of
+   the store FROM, decompressed on demand with access points every SPAN
+   bytes, caching at most CACHE_MAX bytes of it; FROM is consumed.  */
+error_t
+store_gzseek_create (struct store *from, size_t span, size_t cache_max,
+		     int flags, struct store **store)
+{
+  struct gzseek_state *state;
+  struct store_run run;
+  error_t err;
+
+  state = calloc (1, sizeof *state);
+  if (! state)
+    return ENOMEM;
+  pthread_mutex_init (&state->lock, NULL);
+  state->refs = 1;
+  state->cache_max = cache_max;
+
+  run.start = 0;
+  err = build_index (from, state, span, &run.length);
+  if (! err)
+    {
+      state->chunks = calloc (state->num_points, sizeof *state->chunks);
+      if (! state->chunks)
+	err = ENOMEM;
+    }
+  if (! err)
+    err = _store_create (&store_gzseek_class, MACH_PORT_NULL,
+			 flags | STORE_HARD_READONLY | STORE_READONLY,
+			 1, &run, 1, 0, store);
+  if (err)
+    {
+      struct store dummy = { hook: state };
+      gzseek_cleanup (&dummy);
+      return err;
+    }
+
+  (*store)->hook = state;
+  err = store_set_children (*store, &from, 1);
+  if (! err && from->name)
+    {
+      if (asprintf (&(*store)->name, "%s:%s",
+		    from->class->name, from->name) < 0)
+	{
+	  (*store)->name = 0;
+	  err = ENOMEM;
+	}
+    }
+  if (err)
+    {
+      /* Don't free FROM along with the new store; the caller still owns
+	 it after a failure.  */
+      (*store)->num_children = 0;
+      store_free (*store);
+    }
+
+  return err;
+}
+
+/* Open the gzseek store NAME -- which consists of optional "span=SIZE:" and
+   "cache=SIZE:" prefixes, another store-class name, a ':', and a name for
+   that store class to open -- and return the corresponding store in STORE.
+   CLASSES is used to select classes specified by the type name; if it is
+   0, STORE_STD_CLASSES is used.  */
+error_t
+store_gzseek_open (const char *name, int flags,
+		   const struct store_class *const *classes,
+		   struct store **store)
+{
+  struct store *from;
+  size_t span, cache_max;
+  const char *rest;
+  error_t err = parse_options (name, &span, &cache_max, &rest);
+
+  if (err)
+    return err;
+
+  err = store_typed_open (rest, flags | STORE_HARD_READONLY, classes, &from);
+  if (! err)
+    {
+      err = store_gzseek_create (from, span, cache_max, flags, store);
+      if (err)
+	store_free (from);
+    }
+
+  return err;
+}
@@ -29,34 +29,88 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <pthread.h>
 
 
 // Avoid dragging in the resolver when linking statically.
 #pragma weak gethostbyname
 
-
+
 /* The nbd protocol, such as it is, is not really specified anywhere.
    These message layouts and constants were culled from the nbd-server and
-   Linux kernel nbd module sources.  */
+   Linux kernel nbd module sources, and from the protocol description that
+   ships with nbd-server these days.  */
 
 #define NBD_INIT_MAGIC		"NBDMAGIC\x00\x00\x42\x02\x81\x86\x12\x53"
+#define NBD_OPTS_MAGIC		"NBDMAGICIHAVEOPT"
+#define NBD_OPT_MAGIC		0x49484156454f5054ULL /* "IHAVEOPT" */
+#define NBD_OPT_REPLY_MAGIC	0x0003e889045565a9ULL
 
 #define NBD_REQUEST_MAGIC	(htonl (0x25609513))
 #define NBD_REPLY_MAGIC		(htonl (0x67446698))
-
-#define NBD_IO_MAX		10240
+#define NBD_STRUCTURED_REPLY_MAGIC (htonl (0x668e33ef))
+
+/* Handshake flags of a newstyle server, echoed back by the client.  */
+#define NBD_FLAG_FIXED_NEWSTYLE	0x0001
+#define NBD_FLAG_NO_ZEROES	0x0002
+
+/* Options a newstyle client can send, and the server's answers.  */
+#define NBD_OPT_EXPORT_NAME	1
+#define NBD_OPT_STRUCTURED_REPLY 8
+#define NBD_REP_ACK		1
+
+/* Transmission flags, telling what the export supports.  */
+#define NBD_FLAG_HAS_FLAGS	0x0001
+#define NBD_FLAG_READ_ONLY	0x0002
+#define NBD_FLAG_SEND_FLUSH	0x0004
+#define NBD_FLAG_SEND_TRIM	0x0020
+
+/* Request types.  */
+#define NBD_CMD_READ		0
+#define NBD_CMD_WRITE		1
+#define NBD_CMD_DISC		2
+#define NBD_CMD_FLUSH		3
+#define NBD_CMD_TRIM		4
+
+/* Structured reply chunk flags and types.  */
+#define NBD_REPLY_FLAG_DONE	0x0001
+#define NBD_REPLY_TYPE_NONE	0
+#define NBD_REPLY_TYPE_OFFSET_DATA 1
+#define NBD_REPLY_TYPE_OFFSET_HOLE 2
+#define NBD_REPLY_TYPE_ERROR	0x8000 /* Bit set in all error types.  */
+
+/* Error values sent by the server, which are Linux errno values.  */
+#define NBD_EPERM		1
+#define NBD_EIO			5
+#define NBD_ENOMEM		12
+#define NBD_EINVAL		22
+#define NBD_ENOSPC		28
+#define NBD_EOVERFLOW		75
+#define NBD_ENOTSUP		95
+#define NBD_ESHUTDOWN		108
+
+/* The largest request we send; bigger reads and writes are split into
+   several requests, which are all sent before waiting for any reply.  */
+#define NBD_IO_MAX		(64 * 1024)
+
+/* The largest trim request we send; the length field is only 32 bits.  */
+#define NBD_TRIM_MAX		(1U << 30)
+
+/* How many requests one read or write keeps outstanding at once.  */
+#define NBD_WINDOW		32
 
 struct nbd_startup
 {
   char magic[16];		/* NBD_INIT_MAGIC */
   uint64_t size;		/* size in bytes, 64 bits in net order */
-  char reserved[128];		/* zeros, we don't check it */
+  uint32_t flags;		/* transmission flags, in net order */
+  char reserved[124];		/* zeros, we don't check it */
 };
 
 struct nbd_request
 {
   uint32_t magic;		/* NBD_REQUEST_MAGIC */
-  uint32_t type;		/* 0 read, 1 write, 2 disconnect */
+  uint32_t type;		/* NBD_CMD_* */
   uint64_t handle;		/* returned in reply */
   uint64_t from;
   uint32_t len;
@@ -69,7 +123,33 @@ struct nbd_reply
   uint64_t handle;		/* value from request */
 } __attribute__ ((packed));
 
-
+/* A structured reply chunk; it starts out like a simple reply, but
+   carries a type and the length of the payload that follows.  */
+struct nbd_structured_reply
+{
+  uint32_t magic;		/* NBD_STRUCTURED_REPLY_MAGIC */
+  uint16_t flags;		/* NBD_REPLY_FLAG_* */
+  uint16_t type;		/* NBD_REPLY_TYPE_* */
+  uint64_t handle;		/* value from request */
+  uint32_t length;		/* of the payload */
+} __attribute__ ((packed));
+
+struct nbd_option
+{
+  uint64_t magic;		/* NBD_OPT_MAGIC */
+  uint32_t option;		/* NBD_OPT_* */
+  uint32_t length;		/* of the data that follows */
+} __attribute__ ((packed));
+
+struct nbd_option_reply
+{
+  uint64_t magic;		/* NBD_OPT_REPLY_MAGIC */
+  uint32_t option;		/* value from the option */
+  uint32_t type;		/* NBD_REP_* */
+  uint32_t length;		/* of the data that follows */
+} __attribute__ ((packed));
+
+
 /* i/o functions.  */
 
 #if BYTE_ORDER == BIG_ENDIAN
@@ -82,188 +162,525 @@ struct nbd_reply
 #endif
 #define ntohll htonll
 
+/* A request that has been sent to the server, and whose reply has not
+   been completely received yet.  */
+struct nbd_inflight
+{
+  struct nbd_inflight *next;	/* In the connection's hash chain.  */
+  uint64_t handle;
+  store_offset_t from;		/* Byte offset the request is for.  */
+  char *data;			/* Where read data goes.  */
+  size_t len;
+  int done;
+  error_t err;
+};
+
+#define NBD_INFLIGHT_HASH	64
 
-static inline error_t
-read_reply (struct store *store, uint64_t handle)
+/* The state of the connection to an nbd server, kept in the store's hook.
+   Any number of threads can have requests outstanding on it; each one
+   sends its requests, and then waits for their replies.  Whichever waiting
+   thread finds nobody reading from the socket reads replies, handing each
+   to the request with the matching handle, until its own are done.  */
+struct nbd_conn
 {
-  struct nbd_reply reply;
-  char *buf = (void *) &reply;
-  mach_msg_type_number_t cc = sizeof reply;
-  error_t err = io_read (store->port, &buf, &cc, -1, cc);
-  if (err)
-    return err;
-  if (buf != (void *) &reply)
+  pthread_mutex_t lock;		/* Protects the fields below.  */
+  pthread_cond_t wakeup;	/* Signalled when a reply has been read.  */
+
+  /* Held while sending a request and its payload.  */
+  pthread_mutex_t send_lock;
+
+  struct nbd_inflight *inflight[NBD_INFLIGHT_HASH];
+  uint64_t next_handle;
+
+  int receiving;		/* A thread is reading replies.  */
+  error_t broken;		/* Set when the connection is unusable.  */
+
+  uint16_t tflags;		/* NBD_FLAG_* from the handshake.  */
+  int structured;		/* Replies are structured.  */
+
+  unsigned int refs;		/* Stores sharing this connection.  */
+  unsigned int active;		/* Those of them still using the socket.  */
+};
+
+static inline struct nbd_inflight **
+inflight_bucket (struct nbd_conn *conn, uint64_t handle)
+{
+  return &conn->inflight[handle % NBD_INFLIGHT_HASH];
+}
+
+/* Translate ERROR, as sent by the server, into an errno value.  */
+static error_t
+nbd_error (uint32_t error)
+{
+  switch (error)
     {
-      memcpy (&reply, buf, sizeof reply);
-      munmap (buf, cc);
+    case 0:		return 0;
+    case NBD_EPERM:	return EPERM;
+    case NBD_ENOMEM:	return ENOMEM;
+    case NBD_EINVAL:	return EINVAL;
+    case NBD_ENOSPC:	return ENOSPC;
+    case NBD_EOVERFLOW:	return EOVERFLOW;
+    case NBD_ENOTSUP:	return EOPNOTSUPP;
+    case NBD_ESHUTDOWN:	return ESHUTDOWN;
+    default:		return EIO;
+    }
+}
+
+/* Read exactly LEN bytes from PORT into BUF.  */
+static error_t
+read_exact (mach_port_t port, void *buf, size_t len)
+{
+  while (len > 0)
+    {
+      char *data = buf;
+      mach_msg_type_number_t cc = len;
+      error_t err = io_read (port, &data, &cc, -1, len);
+      if (err)
+	return err;
+      if (data != buf)
+	{
+	  memcpy (buf, data, cc < len ? cc : len);
+	  munmap (data, cc);
+	}
+      if (cc == 0 || cc > len)
+	return EIO;
+      buf += cc;
+      len -= cc;
     }
-  if (cc != sizeof reply)
-    return EIO;
-  if (reply.magic != NBD_REPLY_MAGIC)
-    return EIO;
-  if (reply.handle != handle)
-    return EIO;
-  if (reply.error != 0)
-    return EIO;
   return 0;
 }
 
+/* Read and throw away LEN bytes from PORT.  */
 static error_t
-nbd_write (struct store *store,
-	   store_offset_t addr, size_t index, const void *buf, size_t len,
-	   size_t *amount)
+skip_exact (mach_port_t port, size_t len)
+{
+  char scratch[256];
+  error_t err = 0;
+
+  while (!err && len > 0)
+    {
+      size_t chunk = len < sizeof scratch ? len : sizeof scratch;
+      err = read_exact (port, scratch, chunk);
+      len -= chunk;
+    }
+  return err;
+}
+
+/* Write exactly LEN bytes from BUF to PORT.  */
+static error_t
+write_exact (mach_port_t port, const void *buf, size_t len)
 {
+  while (len > 0)
+    {
+      mach_msg_type_number_t cc;
+      error_t err = io_write (port, (char *) buf, len, -1, &cc);
+      if (err)
+	return err;
+      if (cc == 0)
+	return EIO;
+      buf += cc;
+      len -= cc;
+    }
+  return 0;
+}
+
+/* Fail every outstanding request on CONN with ERR, and refuse any new
+   ones.  CONN must be locked, and nobody may be receiving.  */
+static void
+conn_break (struct nbd_conn *conn, error_t err)
+{
+  int i;
+  struct nbd_inflight *ir;
+
+  if (! conn->broken)
+    conn->broken = err;
+  for (i = 0; i < NBD_INFLIGHT_HASH; i++)
+    for (ir = conn->inflight[i]; ir; ir = ir->next)
+      if (! ir->done)
+	{
+	  ir->done = 1;
+	  ir->err = conn->broken;
+	}
+  pthread_cond_broadcast (&conn->wakeup);
+}
+
+/* Send a request of type TYPE for LEN bytes at byte offset FROM, followed
+   by LEN bytes of PAYLOAD if that is not null, and add IR to the set of
+   requests awaiting a reply.  Read data will be put in DATA.  */
+static error_t
+nbd_send (struct store *store, struct nbd_inflight *ir, int type,
+	  store_offset_t from, size_t len, const void *payload, char *data)
+{
+  struct nbd_conn *conn = store->hook;
   struct nbd_request req =
   {
     magic: NBD_REQUEST_MAGIC,
-    type: htonl (1),		/* WRITE */
+    type: htonl (type),
+    from: htonll (from),
+    len: htonl (len),
   };
+  struct nbd_inflight **bucket;
   error_t err;
-  mach_msg_type_number_t cc;
 
-  addr <<= store->log2_block_size;
-  *amount = 0;
+  ir->from = from;
+  ir->data = data;
+  ir->len = len;
+  ir->done = 0;
+  ir->err = 0;
 
-  do
+  pthread_mutex_lock (&conn->lock);
+  err = conn->broken;
+  if (! err)
     {
-      size_t chunk = len < NBD_IO_MAX ? len : NBD_IO_MAX, nwrote;
-      req.from = htonll (addr);
-      req.len = htonl (chunk);
+      /* The handle is opaque to the server, so there is no need to put
+	 it in network order.  */
+      ir->handle = req.handle = conn->next_handle++;
+      bucket = inflight_bucket (conn, ir->handle);
+      ir->next = *bucket;
+      *bucket = ir;
+    }
+  pthread_mutex_unlock (&conn->lock);
+  if (err)
+    return err;
 
-      err = io_write (store->port, (char *) &req, sizeof req, -1, &cc);
-      if (err)
-	return err;
-      if (cc != sizeof req)
-	return EIO;
+  pthread_mutex_lock (&conn->send_lock);
+  err = write_exact (store->port, &req, sizeof req);
+  if (!err && payload)
+    err = write_exact (store->port, payload, len);
+  pthread_mutex_unlock (&conn->send_lock);
 
-      nwrote = 0;
-      do
-	{
-	  err = io_write (store->port, (char *) buf, chunk - nwrote, -1, &cc);
-	  if (err)
-	    return err;
-	  buf += cc;
-	  nwrote += cc;
-	} while (nwrote < chunk);
+  if (err)
+    {
+      /* A partial request leaves the stream in an unknown state, so the
+	 connection can't be used anymore.  The caller still has to wait
+	 for IR, which will fail once nobody is reading replies into the
+	 buffers of the other outstanding requests.  */
+      pthread_mutex_lock (&conn->lock);
+      if (! conn->broken)
+	conn->broken = err;
+      pthread_mutex_unlock (&conn->lock);
+    }
 
-      err = read_reply (store, req.handle);
-      if (err)
-	return err;
+  return 0;
+}
 
-      addr += chunk;
-      *amount += chunk;
-      len -= chunk;
-    } while (len > 0);
+/* Return the outstanding request with HANDLE, or null if there is none.  */
+static struct nbd_inflight *
+nbd_find (struct nbd_conn *conn, uint64_t handle)
+{
+  struct nbd_inflight *ir;
 
-  return 0;
+  pthread_mutex_lock (&conn->lock);
+  for (ir = *inflight_bucket (conn, handle); ir; ir = ir->next)
+    if (ir->handle == handle && ! ir->done)
+      break;
+  pthread_mutex_unlock (&conn->lock);
+
+  return ir;
 }
 
+/* Mark IR done with error ERR, and wake up whoever waits for it.  */
+static void
+nbd_complete (struct nbd_conn *conn, struct nbd_inflight *ir, error_t err)
+{
+  pthread_mutex_lock (&conn->lock);
+  if (! ir->err)
+    ir->err = err;
+  ir->done = 1;
+  pthread_cond_broadcast (&conn->wakeup);
+  pthread_mutex_unlock (&conn->lock);
+}
+
+/* Make IR fail with ERR once it is done, unless it already failed.  */
+static void
+nbd_fail (struct nbd_conn *conn, struct nbd_inflight *ir, error_t err)
+{
+  pthread_mutex_lock (&conn->lock);
+  if (! ir->err)
+    ir->err = err;
+  pthread_mutex_unlock (&conn->lock);
+}
+
+/* Read the payload of a structured reply chunk of type TYPE and length
+   LENGTH for IR.  An error return means the stream is out of sync.  */
 static error_t
-nbd_read (struct store *store,
-	  store_offset_t addr, size_t index, size_t amount,
-	  void **buf, size_t *len)
+nbd_read_chunk (struct store *store, struct nbd_inflight *ir,
+		uint16_t type, uint32_t length)
 {
-  struct nbd_request req =
+  struct
   {
-    magic: NBD_REQUEST_MAGIC,
-    type: htonl (0),		/* READ */
-  };
+    uint64_t offset;
+    uint32_t size;
+  } __attribute__ ((packed)) hdr;
+  struct nbd_conn *conn = store->hook;
+  store_offset_t offset;
   error_t err;
-  size_t ofs, chunk;
-  char *databuf, *piecebuf;
-  size_t databuflen, piecelen;
-
-  /* Send a request for the largest possible piece of remaining data and
-     read the first piece of its reply into PIECEBUF, PIECELEN.  The amount
-     requested can be found in CHUNK.  */
-  inline error_t request_chunk (char **buf, size_t *len)
+
+  switch (type)
     {
-      mach_msg_type_number_t cc;
+    case NBD_REPLY_TYPE_NONE:
+      return length == 0 ? 0 : EIO;
 
-      chunk = (amount - ofs) < NBD_IO_MAX ? (amount - ofs) : NBD_IO_MAX;
+    case NBD_REPLY_TYPE_OFFSET_DATA:
+      if (length < sizeof hdr.offset)
+	return EIO;
+      err = read_exact (store->port, &hdr.offset, sizeof hdr.offset);
+      if (err)
+	return err;
+      offset = ntohll (hdr.offset);
+      length -= sizeof hdr.offset;
+      if (offset < ir->from || offset + length > ir->from + ir->len)
+	return EIO;
+      if (! ir->data)
+	{
+	  /* Data for a request that reads nothing.  */
+	  nbd_fail (conn, ir, EIO);
+	  return skip_exact (store->port, length);
+	}
+      return read_exact (store->port, ir->data + (offset - ir->from), length);
 
-      req.from = htonll (addr);
-      req.len = htonl (chunk);
+    case NBD_REPLY_TYPE_OFFSET_HOLE:
+      if (length != sizeof hdr)
+	return EIO;
+      err = read_exact (store->port, &hdr, sizeof hdr);
+      if (err)
+	return err;
+      offset = ntohll (hdr.offset);
+      hdr.size = ntohl (hdr.size);
+      if (offset < ir->from || offset + hdr.size > ir->from + ir->len)
+	return EIO;
+      if (! ir->data)
+	{
+	  nbd_fail (conn, ir, EIO);
+	  return 0;
+	}
+      memset (ir->data + (offset - ir->from), 0, hdr.size);
+      return 0;
 
-      /* Advance ADDR immediately, so it always points past what we've
-	 already requested.  */
-      addr += chunk;
+    default:
+      if (type & NBD_REPLY_TYPE_ERROR)
+	{
+	  uint32_t error;
 
-      return (io_write (store->port, (char *) &req, sizeof req, -1, &cc) ?
-	      : cc != sizeof req ? EIO
-	      : read_reply (store, req.handle) ?
-	      : io_read (store->port, buf, len, (off_t) -1, chunk));
+	  if (length < sizeof error)
+	    return EIO;
+	  err = read_exact (store->port, &error, sizeof error);
+	  if (err)
+	    return err;
+	  nbd_fail (conn, ir, nbd_error (ntohl (error)) ?: EIO);
+	  length -= sizeof error;
+	}
+      /* Skip the message and offset of errors, and chunk types we don't
+	 understand.  */
+      return skip_exact (store->port, length);
     }
+}
 
-  addr <<= store->log2_block_size;
+/* Read one reply, or one chunk of a structured reply, from the server and
+   hand it to the request it belongs to.  An error return means the
+   connection is unusable.  */
+static error_t
+nbd_receive (struct store *store)
+{
+  struct nbd_conn *conn = store->hook;
+  struct nbd_structured_reply reply;
+  struct nbd_inflight *ir;
+  error_t err;
 
-  /* Read the first piece, which can go directly into the caller's buffer.  */
-  databuf = *buf;
-  piecelen = databuflen = *len;
-  err = request_chunk (&databuf, &piecelen);
+  /* A simple reply is a prefix of a structured one.  */
+  err = read_exact (store->port, &reply, sizeof (struct nbd_reply));
   if (err)
     return err;
-  if (databuflen >= amount)
+
+  if (reply.magic == NBD_REPLY_MAGIC)
     {
-      /* That got it all.  We're done.  */
-      *buf = databuf;
-      *len = piecelen;
-      return 0;
+      uint32_t error = ((struct nbd_reply *) &reply)->error;
+
+      ir = nbd_find (conn, ((struct nbd_reply *) &reply)->handle);
+      if (! ir)
+	return EIO;
+      /* Only successful reads are followed by data.  */
+      if (error == 0 && ir->data)
+	err = read_exact (store->port, ir->data, ir->len);
+      if (! err)
+	nbd_complete (conn, ir, nbd_error (ntohl (error)));
+      return err;
     }
 
-  /* We haven't read the entire amount yet.  */
-  ofs = 0;
-  do
+  if (reply.magic != NBD_STRUCTURED_REPLY_MAGIC || ! conn->structured)
+    return EIO;
+
+  err = read_exact (store->port, (char *) &reply + sizeof (struct nbd_reply),
+		    sizeof reply - sizeof (struct nbd_reply));
+  if (err)
+    return err;
+
+  ir = nbd_find (conn, reply.handle);
+  if (! ir)
+    return EIO;
+  err = nbd_read_chunk (store, ir, ntohs (reply.type), ntohl (reply.length));
+  if (!err && (ntohs (reply.flags) & NBD_REPLY_FLAG_DONE))
+    nbd_complete (conn, ir, 0);
+  return err;
+}
+
+/* Wait until IR, which was started with nbd_send, is done, and return its
+   error.  */
+static error_t
+nbd_wait (struct store *store, struct nbd_inflight *ir)
+{
+  struct nbd_conn *conn = store->hook;
+  struct nbd_inflight **irp;
+
+  pthread_mutex_lock (&conn->lock);
+  while (! ir->done)
+    if (conn->receiving)
+      pthread_cond_wait (&conn->wakeup, &conn->lock);
+    else if (conn->broken)
+      conn_break (conn, conn->broken);
+    else
+      {
+	error_t err;
+
+	conn->receiving = 1;
+	pthread_mutex_unlock (&conn->lock);
+
+	err = nbd_receive (store);
+
+	pthread_mutex_lock (&conn->lock);
+	conn->receiving = 0;
+	if (err)
+	  conn_break (conn, err);
+	else
+	  /* Let another waiter take over reading if IR is done.  */
+	  pthread_cond_broadcast (&conn->wakeup);
+      }
+
+  for (irp = inflight_bucket (conn, ir->handle); *irp != ir;
+       irp = &(*irp)->next)
+    ;
+  *irp = ir->next;
+  pthread_mutex_unlock (&conn->lock);
+
+  return ir->err;
+}
+
+/* Send a request of type TYPE for the LEN bytes at byte offset FROM, split
+   into pieces of at most MAX bytes, keeping up to NBD_WINDOW of them
+   outstanding at once.  If BUF is not null, it is sent along with a
+   write, or receives the data of a read.  */
+static error_t
+nbd_transfer (struct store *store, int type, store_offset_t from,
+	      size_t len, size_t max, char *buf)
+{
+  struct nbd_inflight window[NBD_WINDOW];
+  size_t num_pieces = (len + max - 1) / max;
+  size_t sent = 0, done = 0;
+  error_t err = 0;
+
+  while (done < num_pieces)
     {
-      /* Account for what we just read.  */
-      ofs += piecelen;
-      chunk -= piecelen;
-      if (ofs == amount)
+      if (!err && sent < num_pieces && sent - done < NBD_WINDOW)
 	{
-	  /* That got it all.  We're done.  */
-	  *buf = databuf;
-	  *len = ofs;
-	  return 0;
+	  size_t ofs = sent * max;
+	  size_t chunk = len - ofs < max ? len - ofs : max;
+	  char *piece = buf ? buf + ofs : 0;
+
+	  err = nbd_send (store, &window[sent % NBD_WINDOW], type,
+			  from + ofs, chunk,
+			  type == NBD_CMD_WRITE ? piece : 0,
+			  type == NBD_CMD_READ ? piece : 0);
+	  if (! err)
+	    sent++;
+	}
+      else if (done < sent)
+	{
+	  error_t ir_err = nbd_wait (store, &window[done++ % NBD_WINDOW]);
+	  if (! err)
+	    err = ir_err;
 	}
+      else
+	break;
+    }
 
-      /* Now we'll read another piece of the data, hopefully
-	 into the latter part of the existing buffer.  */
-      piecebuf = databuf + ofs;
-      piecelen = databuflen - ofs;
+  return err;
+}
 
-      if (chunk > 0)
-	/* We haven't finishing reading the last chunk we requested.  */
-	err = io_read (store->port, &piecebuf, &piecelen,
-		       (off_t) -1, chunk);
-      else
-	/* Request the next chunk from the server.  */
-	err = request_chunk (&piecebuf, &piecelen);
+static error_t
+nbd_write (struct store *store,
+	   store_offset_t addr, size_t index, const void *buf, size_t len,
+	   size_t *amount)
+{
+  error_t err;
 
-      if (!err && piecebuf != databuf + ofs)
-	{
-	  /* Now we have two discontiguous pieces of the buffer.  */
-	  size_t newbuflen = round_page (databuflen + piecelen);
-	  char *newbuf = mmap (0, newbuflen,
-			       PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
-	  if (newbuf == MAP_FAILED)
-	    {
-	      err = errno;
-	      break;
-	    }
-	  memcpy (newbuf, databuf, ofs);
-	  memcpy (newbuf + ofs, piecebuf, piecelen);
-	  if (databuf != *buf)
-	    munmap (databuf, databuflen);
-	  databuf = newbuf;
-	  databuflen = newbuflen;
-	}
-    } while (! err);
+  *amount = 0;
+  err = nbd_transfer (store, NBD_CMD_WRITE, addr << store->log2_block_size,
+		      len, NBD_IO_MAX, (char *) buf);
+  if (! err)
+    *amount = len;
+
+  return err;
+}
+
+static error_t
+nbd_read (struct store *store,
+	  store_offset_t addr, size_t index, size_t amount,
+	  void **buf, size_t *len)
+{
+  error_t err;
+  char *data = *buf;
+
+  if (*len < amount)
+    {
+      data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (data == MAP_FAILED)
+	return errno;
+    }
+
+  err = nbd_transfer (store, NBD_CMD_READ, addr << store->log2_block_size,
+		      amount, NBD_IO_MAX, data);
+  if (err)
+    {
+      if (data != *buf)
+	munmap (data, amount);
+      return err;
+    }
+
+  *buf = data;
+  *len = amount;
+  return 0;
+}
+
+static error_t
+nbd_flush (struct store *store)
+{
+  struct nbd_conn *conn = store->hook;
+  struct nbd_inflight ir;
+  error_t err;
+
+  if (! (conn->tflags & NBD_FLAG_SEND_FLUSH))
+    /* The server doesn't cache writes.  */
+    return 0;
 
-  if (databuf != *buf)
-    munmap (databuf, databuflen);
+  err = nbd_send (store, &ir, NBD_CMD_FLUSH, 0, 0, 0, 0);
+  if (! err)
+    err = nbd_wait (store, &ir);
   return err;
 }
 
+static error_t
+nbd_trim (struct store *store, store_offset_t addr, size_t index, size_t len)
+{
+  struct nbd_conn *conn = store->hook;
+
+  if (! (conn->tflags & NBD_FLAG_SEND_TRIM))
+    return EOPNOTSUPP;
+
+  return nbd_transfer (store, NBD_CMD_TRIM, addr << store->log2_block_size,
+		       len, NBD_TRIM_MAX, 0);
+}
+
 static error_t
 nbd_set_size (struct store *store, size_t newsize)
 {
@@ -326,17 +743,159 @@ nbd_validate_name (const char *name,
   return 0;
 }
 
+/* Read exactly LEN bytes from the socket SOCK into BUF.  */
+static error_t
+sock_read (int sock, void *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t cc = read (sock, buf, len);
+      if (cc < 0)
+	return errno;
+      if (cc == 0)
+	return EGRATUITOUS;	/* ? */
+      buf += cc;
+      len -= cc;
+    }
+  return 0;
+}
+
+/* Write exactly LEN bytes from BUF to the socket SOCK.  */
+static error_t
+sock_write (int sock, const void *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t cc = write (sock, buf, len);
+      if (cc < 0)
+	return errno;
+      buf += cc;
+      len -= cc;
+    }
+  return 0;
+}
+
+/* Send the option OPTION with no data on SOCK.  */
+static error_t
+sock_send_option (int sock, uint32_t option)
+{
+  struct nbd_option opt =
+  {
+    magic: htonll (NBD_OPT_MAGIC),
+    option: htonl (option),
+    length: 0,
+  };
+  return sock_write (sock, &opt, sizeof opt);
+}
+
+/* Negotiate with the server at the other end of SOCK, and return the size
+   of its (default) export in SIZE and its transmission flags in TFLAGS.
+   STRUCTURED is set if the server agreed to send structured replies.  Both
+   old-style servers and new-style servers are understood.  */
+static error_t
+nbd_handshake (int sock, int *mod_flags, store_offset_t *size,
+	       uint16_t *tflags, int *structured)
+{
+  struct nbd_startup ns;
+  error_t err;
+
+  *structured = 0;
+
+  err = sock_read (sock, ns.magic, sizeof ns.magic);
+  if (err)
+    return err;
+
+  if (memcmp (ns.magic, NBD_INIT_MAGIC, sizeof ns.magic) == 0)
+    {
+      /* An old-style server just tells us about its one export.  */
+      err = sock_read (sock, (char *) &ns + sizeof ns.magic,
+		       sizeof ns - sizeof ns.magic);
+      if (err)
+	return err;
+      *size = ntohll (ns.size);
+      *tflags = ntohl (ns.flags);
+    }
+  else if (memcmp (ns.magic, NBD_OPTS_MAGIC, sizeof ns.magic) == 0)
+    {
+      uint16_t hflags;
+      uint32_t cflags;
+      struct
+      {
+	uint64_t size;
+	uint16_t flags;
+      } __attribute__ ((packed)) export;
+
+      err = sock_read (sock, &hflags, sizeof hflags);
+      if (err)
+	return err;
+      hflags = ntohs (hflags);
+      cflags = htonl (hflags & (NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES));
+      err = sock_write (sock, &cflags, sizeof cflags);
+      if (err)
+	return err;
+
+      if (hflags & NBD_FLAG_FIXED_NEWSTYLE)
+	/* Only servers doing fixed new-style negotiation are guaranteed to
+	   answer options they don't know instead of hanging up.  */
+	{
+	  struct nbd_option_reply rep;
+	  uint32_t len;
+
+	  err = sock_send_option (sock, NBD_OPT_STRUCTURED_REPLY);
+	  if (! err)
+	    err = sock_read (sock, &rep, sizeof rep);
+	  if (err)
+	    return err;
+	  if (rep.magic != htonll (NBD_OPT_REPLY_MAGIC)
+	      || rep.option != htonl (NBD_OPT_STRUCTURED_REPLY))
+	    return EGRATUITOUS;
+
+	  /* Skip any message accompanying the reply.  */
+	  for (len = ntohl (rep.length); !err && len > 0; )
+	    {
+	      char scratch[128];
+	      size_t chunk = len < sizeof scratch ? len : sizeof scratch;
+	      err = sock_read (sock, scratch, chunk);
+	      len -= chunk;
+	    }
+	  if (err)
+	    return err;
+
+	  *structured = (ntohl (rep.type) == NBD_REP_ACK);
+	}
+
+      /* Select the default export, whose name is empty.  */
+      err = sock_send_option (sock, NBD_OPT_EXPORT_NAME);
+      if (! err)
+	err = sock_read (sock, &export, sizeof export);
+      if (!err && ! (hflags & NBD_FLAG_NO_ZEROES))
+	err = sock_read (sock, ns.reserved, sizeof ns.reserved);
+      if (err)
+	return err;
+      *size = ntohll (export.size);
+      *tflags = ntohs (export.flags);
+    }
+  else
+    return EGRATUITOUS;	/* ? */
+
+  if (! (*tflags & NBD_FLAG_HAS_FLAGS))
+    *tflags = 0;
+  if (*tflags & NBD_FLAG_READ_ONLY)
+    *mod_flags |= STORE_HARD_READONLY;
+
+  return 0;
+}
+
 static error_t
 nbdopen (const char *name, int *mod_flags,
-	 socket_t *sockport, size_t *blocksize, store_offset_t *size)
+	 socket_t *sockport, size_t *blocksize, store_offset_t *size,
+	 uint16_t *tflags, int *structured)
 {
+  error_t err;
   int sock;
   struct sockaddr_in sin;
   const struct hostent *he;
   char **ap;
-  struct nbd_startup ns;
-  ssize_t cc;
-  size_t ofs;
   unsigned long int port;
   char *hostname, *p, *endp;
 
@@ -392,56 +951,78 @@ nbdopen (const char *name, int *mod_flags,
     }
   if (errno != 0)		/* last connect failed */
     {
-      error_t err = errno;
+      err = errno;
       close (sock);
       return err;
     }
 
   /* Read the startup packet, which tells us the size of the store.  */
-  ofs = 0;
-  do {
-    cc = read (sock, (char *) &ns + ofs, sizeof ns - ofs);
-    if (cc < 0)
-      {
-	error_t err = errno;
-	close (sock);
-	return err;
-      }
-    ofs += cc;
-  } while (cc > 0 && ofs < sizeof ns);
-
-  if (ofs != sizeof ns
-      || memcmp (ns.magic, NBD_INIT_MAGIC, sizeof ns.magic) != 0)
+  err = nbd_handshake (sock, mod_flags, size, tflags, structured);
+  if (err)
     {
       close (sock);
-      return EGRATUITOUS;	/* ? */
+      return err;
     }
 
-  *size = ntohll (ns.size);
   *sockport = getdport (sock);
   close (sock);
 
   return 0;
 }
 
+/* Stop using the socket of STORE.  The connection is only shut down when
+   no clone of STORE uses it anymore.  */
 static void
 nbdclose (struct store *store)
 {
-  if (store->port != MACH_PORT_NULL)
+  struct nbd_conn *conn = store->hook;
+  int last;
+
+  if (store->port == MACH_PORT_NULL)
+    return;
+
+  pthread_mutex_lock (&conn->lock);
+  last = --conn->active == 0;
+  pthread_mutex_unlock (&conn->lock);
+
+  if (last)
     {
       /* Send a disconnect message, but don't wait for a reply.  */
       struct nbd_request req =
       {
 	magic: NBD_REQUEST_MAGIC,
-	type: htonl (2),	/* disconnect */
+	type: htonl (NBD_CMD_DISC),
       };
-      mach_msg_type_number_t cc;
-      (void) io_write (store->port, (char *) &req, sizeof req, -1, &cc);
+      pthread_mutex_lock (&conn->send_lock);
+      (void) write_exact (store->port, &req, sizeof req);
+      pthread_mutex_unlock (&conn->send_lock);
+
+      pthread_mutex_lock (&conn->lock);
+      if (! conn->broken)
+	conn->broken = ESHUTDOWN;
+      pthread_mutex_unlock (&conn->lock);
+    }
+
+  /* Close the socket, or drop our reference to it.  */
+  mach_port_deallocate (mach_task_self (), store->port);
+  store->port = MACH_PORT_NULL;
+}
+
+/* Return a new connection state for one store using its socket.  */
+static struct nbd_conn *
+conn_create (void)
+{
+  struct nbd_conn *conn = calloc (1, sizeof *conn);
 
-      /* Close the socket.  */
-      mach_port_deallocate (mach_task_self (), store->port);
-      store->port = MACH_PORT_NULL;
+  if (conn)
+    {
+      pthread_mutex_init (&conn->lock, NULL);
+      pthread_cond_init (&conn->wakeup, NULL);
+      pthread_mutex_init (&conn->send_lock, NULL);
+      conn->refs = 1;
+      conn->active = 1;
     }
+  return conn;
 }
 
 static error_t
@@ -460,16 +1041,96 @@ nbd_set_flags (struct store *store, int flags)
 static error_t
 nbd_clear_flags (struct store *store, int flags)
 {
+  struct nbd_conn *conn = store->hook;
+  uint16_t tflags;
+  int structured;
+  struct nbd_conn *fresh = NULL;
+  unsigned int refs;
   error_t err = 0;
   if ((flags & ~STORE_INACTIVE) != 0)
     err = EINVAL;
+  if (! (store->flags & STORE_INACTIVE))
+    /* Still connected.  */
+    return err;
+
+  pthread_mutex_lock (&conn->lock);
+  refs = conn->refs;
+  pthread_mutex_unlock (&conn->lock);
+  if (refs > 1)
+    {
+      /* Clones still use the old connection; the new socket gets its
+	 own.  */
+      fresh = conn_create ();
+      if (! fresh)
+	return ENOMEM;
+    }
+
   err = store->name
     ? nbdopen (store->name, &store->flags,
-	       &store->port, &store->block_size, &store->size)
+	       &store->port, &store->block_size, &store->size,
+	       &tflags, &structured)
     : ENOENT;
-  if (! err)
-    store->flags &= ~STORE_INACTIVE;
-  return err;
+  if (err)
+    {
+      free (fresh);
+      return err;
+    }
+
+  if (fresh)
+    {
+      pthread_mutex_lock (&conn->lock);
+      refs = --conn->refs;
+      pthread_mutex_unlock (&conn->lock);
+      if (refs == 0)
+	free (conn);
+      store->hook = conn = fresh;
+    }
+
+  pthread_mutex_lock (&conn->lock);
+  conn->broken = 0;
+  conn->active = 1;
+  conn->tflags = tflags;
+  conn->structured = structured;
+  pthread_mutex_unlock (&conn->lock);
+
+  store->flags &= ~STORE_INACTIVE;
+  return 0;
+}
+
+static void
+nbd_cleanup (struct store *store)
+{
+  struct nbd_conn *conn = store->hook;
+  unsigned int refs;
+
+  if (! conn)
+    return;
+
+  pthread_mutex_lock (&conn->lock);
+  refs = --conn->refs;
+  if (store->port != MACH_PORT_NULL)
+    conn->active--;
+  pthread_mutex_unlock (&conn->lock);
+
+  if (refs == 0)
+    free (conn);
+}
+
+/* Clones share the socket, so they must share the state of the connection
+   as well for replies to find their requests.  */
+static error_t
+nbd_clone (const struct store *from, struct store *to)
+{
+  struct nbd_conn *conn = from->hook;
+
+  pthread_mutex_lock (&conn->lock);
+  conn->refs++;
+  if (to->port != MACH_PORT_NULL)
+    conn->active++;
+  pthread_mutex_unlock (&conn->lock);
+  to->hook = conn;
+
+  return 0;
 }
 
 const struct store_class store_nbd_class =
@@ -484,18 +1145,35 @@ const struct store_class store_nbd_class =
   encode: store_std_leaf_encode,
   decode: nbd_decode,
   set_flags: nbd_set_flags, clear_flags: nbd_clear_flags,
+  cleanup: nbd_cleanup,
+  clone: nbd_clone,
+  flush: nbd_flush,
+  trim: nbd_trim,
 };
 STORE_STD_CLASS (nbd);
 
 /* Create a store from an existing socket to an nbd server.
-   The initial handshake has already been done.  */
+   The initial handshake has already been done.  Since we weren't there to
+   see it, assume simple replies and no optional requests.  */
 error_t
 _store_nbd_create (mach_port_t port, int flags, size_t block_size,
 		   const struct store_run *runs, size_t num_runs,
 		   struct store **store)
 {
-  return _store_create (&store_nbd_class,
-			port, flags, block_size, runs, num_runs, 0, store);
+  error_t err;
+  struct nbd_conn *conn = conn_create ();
+
+  if (! conn)
+    return ENOMEM;
+
+  err = _store_create (&store_nbd_class,
+		       port, flags, block_size, runs, num_runs, 0, store);
+  if (err)
+    free (conn);
+  else
+    (*store)->hook = conn;
+
+  return err;
 }
 
 /* Open a new store backed by the named nbd server.  */
@@ -506,15 +1184,22 @@ store_nbd_open (const char *name, int flags, struct store **store)
   socket_t sock;
   struct store_run run;
   size_t blocksize;
+  uint16_t tflags;
+  int structured;
 
   run.start = 0;
-  err = nbdopen (name, &flags, &sock, &blocksize, &run.length);
+  err = nbdopen (name, &flags, &sock, &blocksize, &run.length,
+		 &tflags, &structured);
   if (!err)
     {
       run.length /= blocksize;
       err = _store_nbd_create (sock, flags, blocksize, &run, 1, store);
       if (! err)
 	{
+	  struct nbd_conn *conn = (*store)->hook;
+	  conn->tflags = tflags;
+	  conn->structured = structured;
+
 	  if (!strncmp (name, url_prefix, sizeof url_prefix - 1))
 	    err = store_set_name (*store, name);
 	  else
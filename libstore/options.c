@@ -0,0 +1,77 @@
+/* Parsing options in store names
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "store.h"
+
+/* Parse a size, with an optional K, M or G suffix, from the start of ARG,
+   returning it in SIZE and a pointer to the character after it in END.  */
+error_t
+_store_parse_size (const char *arg, size_t *size, char **end)
+{
+  unsigned long long val = strtoull (arg, end, 0);
+
+  if (*end == arg)
+    return EINVAL;
+  switch (**end)
+    {
+    case 'g': case 'G':
+      val <<= 10;
+      /* Fall through.  */
+    case 'm': case 'M':
+      val <<= 10;
+      /* Fall through.  */
+    case 'k': case 'K':
+      val <<= 10;
+      ++*end;
+    }
+  *size = val;
+  return 0;
+}
+
+/* Call FUN for each "KEY=VALUE:" prefix of NAME, with KEY_LEN the length
+   of KEY and VALUE_LEN the length of VALUE, and return a pointer to the
+   rest of NAME in REST.  Since store type names can't contain an `=',
+   the first component without one ends the options.  */
+error_t
+_store_parse_options (const char *name,
+		      error_t (*fun) (const char *key, size_t key_len,
+				      const char *value, size_t value_len),
+		      const char **rest)
+{
+  for (;;)
+    {
+      const char *colon = strchr (name, ':');
+      const char *equals = strchr (name, '=');
+      error_t err;
+
+      if (! colon || ! equals || colon < equals)
+	break;
+
+      err = (*fun) (name, equals - name, equals + 1, colon - equals - 1);
+      if (err)
+	return err;
+      name = colon + 1;
+    }
+
+  *rest = name;
+  return 0;
+}
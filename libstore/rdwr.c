@@ -18,10 +18,15 @@
    with this program; if not, write to the Free Software Foundation, Inc.,
    59 Temple Place - Suite 330, Boston, MA 02111, USA. */
 
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <pthread.h>
 
 #include "store.h"
+
+/* Requests smaller than this are never split up between threads.  */
+#define STORE_PARALLEL_MIN	(64 * 1024)
 
 /* Returns in RUN the tail of STORE's run list, who's first run contains
    ADDR, and is not a hole, and in RUNS_END a pointer pointing at the end of
@@ -89,6 +94,263 @@ store_next_run (struct store *store, struct store_run *runs_end,
     return 1;
 }
 
+/* A piece of a request that lies within a single run.  */
+struct store_seg
+{
+  store_offset_t addr;		/* Underlying address.  */
+  size_t index;			/* Index of the run.  */
+  size_t ofs, len;		/* Position in the whole buffer, in bytes.  */
+  size_t done;			/* Amount actually transferred.  */
+  error_t err;
+};
+
+/* Return the number of pieces the LEN bytes at ADDR in STORE span, up to
+   the first hole, and if SEGS isn't null, describe them in it.  */
+static size_t
+store_find_segs (struct store *store, store_offset_t addr, size_t len,
+		 struct store_seg *segs)
+{
+  size_t index, num = 0, ofs = 0;
+  store_offset_t base;
+  struct store_run *run, *runs_end;
+  int block_shift = store->log2_block_size;
+
+  addr = store_find_first_run (store, addr, &run, &runs_end, &base, &index);
+  if (addr < 0)
+    return 0;
+
+  while (len > 0 && run->start >= 0)
+    {
+      size_t seg_len = ((len >> block_shift) <= run->length - addr
+			? len : (run->length - addr) << block_shift);
+      if (segs)
+	{
+	  segs[num].addr = base + run->start + addr;
+	  segs[num].index = index;
+	  segs[num].ofs = ofs;
+	  segs[num].len = seg_len;
+	  segs[num].done = 0;
+	  segs[num].err = 0;
+	}
+      num++;
+      ofs += seg_len;
+      len -= seg_len;
+      addr = 0;
+      if (len > 0 && ! store_next_run (store, runs_end, &run, &base, &index))
+	break;
+    }
+
+  return num;
+}
+
+/* The pieces of a request handled by one thread, which are all those for
+   a single run index, done in order.  */
+struct store_seg_worker
+{
+  struct store *store;
+  struct store_seg *segs;
+  size_t num_segs;
+  size_t index;
+  char *buf;			/* The whole buffer.  */
+  int write;
+  enum { SEG_QUEUED, SEG_RUNNING, SEG_DONE } state;
+  struct store_seg_worker *next, **prevp; /* In the queue while queued.  */
+};
+
+/* At most this many threads are ever started to transfer pieces.  */
+#define STORE_PARALLEL_THREADS	8
+
+/* The pool of threads shared by all parallel requests.  POOL_LOCK protects
+   the queue, the count and the state of every worker.  */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static struct store_seg_worker *pool_queue, **pool_queue_end = &pool_queue;
+static int pool_threads;
+
+static void
+pool_dequeue (struct store_seg_worker *w)
+{
+  *w->prevp = w->next;
+  if (w->next)
+    w->next->prevp = w->prevp;
+  else
+    pool_queue_end = w->prevp;
+}
+
+static void
+store_seg_work (struct store_seg_worker *w)
+{
+  struct store *store = w->store;
+  struct store_seg *seg;
+
+  for (seg = w->segs; seg < w->segs + w->num_segs; seg++)
+    if (seg->index == w->index)
+      {
+	if (w->write)
+	  seg->err = (*store->class->write) (store, seg->addr, seg->index,
+					     w->buf + seg->ofs, seg->len,
+					     &seg->done);
+	else
+	  {
+	    void *seg_buf = w->buf + seg->ofs;
+	    size_t seg_len = seg->len;
+	    seg->err = (*store->class->read) (store, seg->addr, seg->index,
+					      seg->len, &seg_buf, &seg_len);
+	    if (! seg->err)
+	      {
+		if (seg_buf != w->buf + seg->ofs)
+		  {
+		    memcpy (w->buf + seg->ofs, seg_buf, seg_len);
+		    munmap (seg_buf, seg_len);
+		  }
+		seg->done = seg_len;
+	      }
+	  }
+
+	/* Anything after a failure or a short transfer is of no use.  */
+	if (seg->err || seg->done < seg->len)
+	  break;
+      }
+}
+
+static void *
+store_pool_thread (void *arg)
+{
+  pthread_mutex_lock (&pool_lock);
+  for (;;)
+    {
+      struct store_seg_worker *w = pool_queue;
+
+      if (! w)
+	{
+	  pthread_cond_wait (&pool_work, &pool_lock);
+	  continue;
+	}
+
+      pool_dequeue (w);
+      w->state = SEG_RUNNING;
+      pthread_mutex_unlock (&pool_lock);
+
+      store_seg_work (w);
+
+      pthread_mutex_lock (&pool_lock);
+      w->state = SEG_DONE;
+      pthread_cond_broadcast (&pool_done);
+    }
+
+  return 0;
+}
+
+/* Transfer the LEN bytes at ADDR in STORE to or from BUF, handing the
+   pieces for each run index to a different thread, so that independent
+   underlying stores are kept busy at the same time.  The amount
+   transferred up to the first piece that failed or was short is returned
+   in AMOUNT, and the error of that piece, if any, as the value.  If the
+   request doesn't span several run indexes, EAGAIN is returned without
+   doing anything.  */
+static error_t
+store_parallel_rdwr (struct store *store, store_offset_t addr, char *buf,
+		     size_t len, int write, size_t *amount)
+{
+  size_t num_segs = store_find_segs (store, addr, len, 0);
+  size_t max_workers = num_segs < store->num_runs ? num_segs : store->num_runs;
+  struct store_seg *segs;
+  size_t num_workers = 0, i, k;
+  error_t err;
+
+  if (max_workers < 2)
+    return EAGAIN;
+
+  segs = malloc (num_segs * sizeof *segs);
+  if (! segs)
+    return EAGAIN;		/* Just do it sequentially.  */
+  store_find_segs (store, addr, len, segs);
+
+  struct store_seg_worker workers[max_workers];
+
+  for (i = 0; i < num_segs; i++)
+    {
+      for (k = 0; k < num_workers; k++)
+	if (workers[k].index == segs[i].index)
+	  break;
+      if (k == num_workers)
+	{
+	  workers[k].store = store;
+	  workers[k].segs = segs;
+	  workers[k].num_segs = num_segs;
+	  workers[k].index = segs[i].index;
+	  workers[k].buf = buf;
+	  workers[k].write = write;
+	  num_workers++;
+	}
+    }
+
+  if (num_workers < 2)
+    {
+      free (segs);
+      return EAGAIN;
+    }
+
+  /* Queue all but the first worker's share, which the calling thread does
+     itself, and start more threads if there is work for them.  */
+  pthread_mutex_lock (&pool_lock);
+  for (k = 1; k < num_workers; k++)
+    {
+      workers[k].state = SEG_QUEUED;
+      workers[k].next = 0;
+      workers[k].prevp = pool_queue_end;
+      *pool_queue_end = &workers[k];
+      pool_queue_end = &workers[k].next;
+    }
+  for (k = 1; k < num_workers && pool_threads < STORE_PARALLEL_THREADS; k++)
+    {
+      pthread_t thread;
+      if (pthread_create (&thread, NULL, store_pool_thread, NULL))
+	break;
+      pthread_detach (thread);
+      pool_threads++;
+    }
+  pthread_cond_broadcast (&pool_work);
+  pthread_mutex_unlock (&pool_lock);
+
+  store_seg_work (&workers[0]);
+
+  /* Whatever the pool hasn't got to yet is done here too, so that the
+     request finishes even when every thread is busy, perhaps waiting for
+     the pieces of a request on an underlying store.  */
+  pthread_mutex_lock (&pool_lock);
+  for (k = 1; k < num_workers; k++)
+    if (workers[k].state == SEG_QUEUED)
+      {
+	pool_dequeue (&workers[k]);
+	workers[k].state = SEG_RUNNING;
+	pthread_mutex_unlock (&pool_lock);
+	store_seg_work (&workers[k]);
+	pthread_mutex_lock (&pool_lock);
+	workers[k].state = SEG_DONE;
+      }
+  for (k = 1; k < num_workers; k++)
+    while (workers[k].state != SEG_DONE)
+      pthread_cond_wait (&pool_done, &pool_lock);
+  pthread_mutex_unlock (&pool_lock);
+
+  *amount = 0;
+  err = 0;
+  for (i = 0; i < num_segs; i++)
+    {
+      err = segs[i].err;
+      if (err)
+	break;
+      *amount += segs[i].done;
+      if (segs[i].done < segs[i].len)
+	break;
+    }
+
+  free (segs);
+  return err;
+}
+
 /* Write LEN bytes from BUF to STORE at ADDR.  Returns the amount written
    in AMOUNT.  ADDR is in BLOCKS (as defined by STORE->block_size).  */
 error_t
@@ -111,6 +373,14 @@ store_write (struct store *store,
   if (store->block_size != 0 && (len & (store->block_size - 1)) != 0)
     return EINVAL;
 
+  if (store->class->parallel && len >= STORE_PARALLEL_MIN)
+    {
+      err = store_parallel_rdwr (store, addr, (char *) buf, len, 1, amount);
+      if (err != EAGAIN)
+	/* As below, errors past the first piece just make a short write.  */
+	return *amount > 0 ? 0 : err;
+    }
+
   addr = store_find_first_run (store, addr, &run, &runs_end, &base, &index);
   if (addr < 0)
     err = EIO;
@@ -176,7 +446,7 @@ store_read (struct store *store,
 	    store_offset_t addr, size_t amount, void **buf, size_t *len)
 {
   size_t index;
-  store_offset_t base;
+  store_offset_t base, start = addr;
   struct store_run *run, *runs_end;
   int block_shift = store->log2_block_size;
   store_read_meth_t read = store->class->read;
@@ -199,6 +469,7 @@ store_read (struct store *store,
     {
       error_t err;
       int all;
+      size_t done;
       /* WHOLE_BUF and WHOLE_BUF_LEN will point to a buff that's large enough
 	 to hold the entire request.  This is initially whatever the user
 	 passed in, but we'll change it as necessary.  */
@@ -245,20 +516,28 @@ store_read (struct store *store,
 
       buf_end = whole_buf;
 
-      err = seg_read (base + run->start + addr,
-		      (run->length - addr) << block_shift, &all);
-      while (!err && all && amount > 0
-	     && store_next_run (store, runs_end, &run, &base, &index))
+      if (store->class->parallel && amount >= STORE_PARALLEL_MIN
+	  && (err = store_parallel_rdwr (store, start, whole_buf, amount, 0,
+					 &done)) != EAGAIN)
+	/* The pieces were read concurrently.  */
+	buf_end += done;
+      else
 	{
-	  if (run->start < 0)
-	    /* A hole!  Can't read here.  Must stop.  */
-	    break;
-	  else
-	    err = seg_read (base + run->start,
-			    (amount >> block_shift) <= run->length
-			    ? amount /* This run has the rest.  */
-			    : (run->length << block_shift), /* Whole run.  */
-			    &all);
+	  err = seg_read (base + run->start + addr,
+			  (run->length - addr) << block_shift, &all);
+	  while (!err && all && amount > 0
+		 && store_next_run (store, runs_end, &run, &base, &index))
+	    {
+	      if (run->start < 0)
+		/* A hole!  Can't read here.  Must stop.  */
+		break;
+	      else
+		err = seg_read (base + run->start,
+				(amount >> block_shift) <= run->length
+				? amount /* This run has the rest.  */
+				: (run->length << block_shift), /* Whole run.  */
+				&all);
+	    }
 	}
 
       /* The actual amount read.  */
@@ -296,3 +575,70 @@ store_set_size (struct store *store, size_t newsize)
 
   return err;
 }
+
+/* Wait until everything written to STORE has reached stable storage.  */
+error_t
+store_flush (struct store *store)
+{
+  error_t err = 0;
+  size_t k;
+
+  if (store->class->flush)
+    return (*store->class->flush) (store);
+
+  for (k = 0; !err && k < store->num_children; k++)
+    err = store_flush (store->children[k]);
+
+  return err;
+}
+
+/* Tell STORE that the LEN bytes at ADDR no longer hold useful data, so
+   that the underlying storage may discard them.  ADDR is in BLOCKS (as
+   defined by STORE->block_size).  */
+error_t
+store_trim (struct store *store, store_offset_t addr, size_t len)
+{
+  error_t err;
+  size_t index;
+  store_offset_t base;
+  struct store_run *run, *runs_end;
+  int block_shift = store->log2_block_size;
+  store_trim_meth_t trim = store->class->trim;
+
+  if (! trim)
+    return EOPNOTSUPP;
+
+  if (store->flags & STORE_READONLY)
+    return EROFS;
+
+  if ((addr << block_shift) + len > store->size)
+    return EIO;
+
+  if (store->block_size != 0 && (len & (store->block_size - 1)) != 0)
+    return EINVAL;
+
+  addr = store_find_first_run (store, addr, &run, &runs_end, &base, &index);
+  if (addr < 0)
+    return EIO;
+
+  /* Unlike writes, there is no partial result to report, so just walk the
+     runs, skipping holes, until everything has been handed down.  */
+  for (;;)
+    {
+      size_t try = (len >> block_shift) <= run->length - addr
+		   ? len : (run->length - addr) << block_shift;
+
+      err = (run->start < 0 ? 0
+	     : (*trim) (store, base + run->start + addr, index, try));
+      if (err)
+	return err;
+
+      len -= try;
+      if (len == 0)
+	return 0;
+
+      if (! store_next_run (store, runs_end, &run, &base, &index))
+	return EIO;
+      addr = 0;
+    }
+}
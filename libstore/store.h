@@ -136,6 +136,10 @@ typedef error_t (*store_read_meth_t)(struct store *store,
 				     void **buf, mach_msg_type_number_t *len);
 typedef error_t (*store_set_size_meth_t)(struct store *store,
 					 size_t newsize);
+typedef error_t (*store_flush_meth_t)(struct store *store);
+typedef error_t (*store_trim_meth_t)(struct store *store,
+				     store_offset_t addr, size_t index,
+				     size_t len);
 
 struct store_enc;		/* fwd decl */
 
@@ -208,6 +212,26 @@ struct store_class
 
   /* Return a memory object paging on STORE.  */
   error_t (*map) (const struct store *store, vm_prot_t prot, mach_port_t *memobj);
+
+  /* The members from here on were added later, at the end so that the
+     others stay where they were.  This still changes the size of the
+     structure, and libstore reads them from every class, so store classes
+     defined outside of libstore (such as store modules) must be recompiled
+     against this header.  New members must only be added at the end.  */
+
+  /* Make sure everything written to STORE so far has reached stable
+     storage.  If this is 0, the children of STORE (if any) are flushed.  */
+  store_flush_meth_t flush;
+
+  /* Tell the storage that the LEN bytes at the underlying address ADDR are
+     no longer in use.  INDEX varies from 0 to the number of runs in STORE.
+     If this is 0, store_trim returns EOPNOTSUPP.  */
+  store_trim_meth_t trim;
+
+  /* If nonzero, runs with different indexes are backed by independent
+     storage, so the pieces of a large request spanning several of them
+     may be transferred by concurrent calls to READ or WRITE.  */
+  int parallel;
 };
 
 /* Return a new store in STORE, which refers to the storage underlying
@@ -295,6 +319,20 @@ store_is_securely_returnable (struct store *store, int open_flags)
    the set of runs & the block size.  */
 void _store_derive (struct store *store);
 
+/* Parse a size, with an optional K, M or G suffix, from the start of ARG,
+   returning it in SIZE and a pointer to the character after it in END.  */
+error_t _store_parse_size (const char *arg, size_t *size, char **end);
+
+/* Call FUN for each "KEY=VALUE:" prefix of NAME, with KEY_LEN the length
+   of KEY and VALUE_LEN the length of VALUE, and return a pointer to the
+   rest of NAME in REST.  This is used by filter classes such as gzseek and
+   cache, whose names are options followed by another store's name.  */
+error_t _store_parse_options (const char *name,
+			      error_t (*fun) (const char *key, size_t key_len,
+					      const char *value,
+					      size_t value_len),
+			      const char **rest);
+
 /* Return in TO a copy of FROM.  */
 error_t store_clone (struct store *from, struct store **to);
 
@@ -320,6 +358,15 @@ error_t store_read (struct store *store,
 /* Set STORE's size to NEWSIZE (in bytes).  */
 error_t store_set_size (struct store *store, size_t newsize);
 
+/* Wait until everything written to STORE has reached stable storage.  */
+error_t store_flush (struct store *store);
+
+/* Tell STORE that the LEN bytes at ADDR no longer hold useful data, so
+   that the underlying storage may discard them.  ADDR is in BLOCKS (as
+   defined by STORE->block_size).  Returns EOPNOTSUPP if STORE's class
+   cannot do this.  */
+error_t store_trim (struct store *store, store_offset_t addr, size_t len);
+
 /* If STORE was created using store_create, remove the reference to the
    source from which it was created.  */
 void store_close_source (struct store *store);
@@ -467,6 +514,25 @@ error_t store_copy_open (const char *name, int flags,
 			 const struct store_class *const *classes,
 			 struct store **store);
 
+/* Return a new store in STORE which caches up to SIZE bytes of the store
+   FROM in memory, in units of LINE_SIZE bytes (a power of two at least as
+   large as FROM's block size); FROM is consumed.  If WRITEBACK is nonzero,
+   writes only dirty the cache and reach FROM when lines are evicted or the
+   store is flushed with store_flush; otherwise they go straight to FROM.
+   Sequential reads fetch up to READAHEAD bytes more than asked for.  */
+error_t store_cache_create (struct store *from, size_t size, size_t line_size,
+			    size_t readahead, int writeback, int flags,
+			    struct store **store);
+
+/* Open the cache store NAME -- which consists of optional "size=SIZE:",
+   "line=SIZE:", "readahead=SIZE:" and "mode=writeback:" or
+   "mode=writethrough:" prefixes, another store-class name, a ':', and a
+   name for that store class to open -- and return the corresponding store
+   in STORE.  CLASSES is as if passed to store_find_class, which see.  */
+error_t store_cache_open (const char *name, int flags,
+			  const struct store_class *const *classes,
+			  struct store **store);
+
 /* Return a new store in STORE which contains the memory buffer BUF, of
    length BUF_LEN.  BUF must be vm_allocated, and will be consumed.  */
 error_t store_buffer_create (void *buf, size_t buf_len, int flags,
@@ -486,6 +552,24 @@ error_t store_gunzip_open (const char *name, int flags,
 			   const struct store_class *const *classes,
 			   struct store **store);
 
+/* Return a new store in STORE which contains the uncompressed contents of
+   the gzip or zlib compressed store FROM; FROM is consumed.  Rather than
+   decompressing everything up front, an index of access points every SPAN
+   bytes of uncompressed data is built, and chunks between access points
+   are decompressed on demand; at most CACHE_MAX bytes of them are kept.  */
+error_t store_gzseek_create (struct store *from, size_t span,
+			     size_t cache_max, int flags,
+			     struct store **store);
+
+/* Open the gzseek store NAME -- which consists of optional "span=SIZE:"
+   and "cache=SIZE:" prefixes (SIZE may have a K, M or G suffix), another
+   store-class name, a ':', and a name for that store class to open -- and
+   return the corresponding store in STORE.  CLASSES is as if passed to
+   store_find_class, which see.  */
+error_t store_gzseek_open (const char *name, int flags,
+			   const struct store_class *const *classes,
+			   struct store **store);
+
 /* Return a new store in STORE which contains a snapshot of the uncompressed
    contents of the store FROM; FROM is consumed.  BLOCK_SIZE is the desired
    block size of the result.  */
@@ -623,7 +707,9 @@ extern const struct store_class store_concat_class;
 extern const struct store_class store_remap_class;
 extern const struct store_class store_query_class;
 extern const struct store_class store_copy_class;
+extern const struct store_class store_cache_class;
 extern const struct store_class store_gunzip_class;
+extern const struct store_class store_gzseek_class;
 extern const struct store_class store_bunzip2_class;
 extern const struct store_class store_typed_open_class;
 extern const struct store_class store_url_open_class;
@@ -113,7 +113,8 @@ store_ileave_class =
 {
   STORAGE_INTERLEAVE, "interleave", stripe_read, stripe_write, stripe_set_size,
   ileave_allocate_encoding, ileave_encode, ileave_decode,
-  store_set_child_flags, store_clear_child_flags, 0, 0, stripe_remap
+  store_set_child_flags, store_clear_child_flags, 0, 0, stripe_remap,
+  parallel: 1
 };
 STORE_STD_CLASS (ileave);
 
@@ -158,7 +159,7 @@ store_concat_class =
   STORAGE_CONCAT, "concat", stripe_read, stripe_write, stripe_set_size,
   concat_allocate_encoding, concat_encode, concat_decode,
   store_set_child_flags, store_clear_child_flags, 0, 0, stripe_remap,
-  store_concat_open
+  store_concat_open, parallel: 1
 };
 STORE_STD_CLASS (concat);
 
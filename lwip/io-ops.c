@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <errno.h>
+#include <string.h>
 
 #include <lwip/sockets.h>
 
@@ -39,14 +40,12 @@ lwip_S_io_write (struct sock_user *user,
 		 off_t offset, mach_msg_type_number_t * amount)
 {
   int sent;
-  int sockflags;
 
   if (!user)
     return EOPNOTSUPP;
 
-  sockflags = lwip_fcntl (user->sock->sockno, F_GETFL, 0);
   sent = lwip_send (user->sock->sockno, data, datalen,
-		    (sockflags & O_NONBLOCK) ? MSG_DONTWAIT : 0);
+		    sock_nonblock (user->sock) ? MSG_DONTWAIT : 0);
 
   if (sent >= 0)
     {
@@ -61,47 +60,104 @@ lwip_S_io_read (struct sock_user * user,
 		data_t *data,
 		size_t * datalen, off_t offset, mach_msg_type_number_t amount)
 {
-  error_t err;
-  int alloced = 0;
-  int flags;
+  int nonblock;
+  int got;
+  int more;
+  char *buf;
 
   if (!user)
     return EOPNOTSUPP;
 
-  /* Instead of this, we should peek and the socket and only
-     allocate as much as necessary. */
-  if (amount > *datalen)
+  nonblock = sock_nonblock (user->sock);
+
+  if (amount <= *datalen || user->sock->type != SOCK_STREAM)
     {
-      *data = mmap (0, amount, PROT_READ | PROT_WRITE, MAP_ANON, 0, 0);
-      if (*data == MAP_FAILED)
-	/* Should check whether errno is indeed ENOMEM --
-	   but this can't be done in a straightforward way,
-	   because the glue headers #undef errno. */
-	return ENOMEM;
-      alloced = 1;
+      /* A datagram must be read at once.  */
+      if (amount > *datalen)
+	{
+	  buf = mmap (0, amount, PROT_READ | PROT_WRITE, MAP_ANON, 0, 0);
+	  if (buf == MAP_FAILED)
+	    /* Should check whether errno is indeed ENOMEM --
+	       but this can't be done in a straightforward way,
+	       because the glue headers #undef errno. */
+	    return ENOMEM;
+	}
+      else
+	buf = *data;
+
+      got = lwip_recv (user->sock->sockno, buf, amount,
+		       nonblock ? MSG_DONTWAIT : 0);
+      if (got < 0)
+	{
+	  error_t err = errno;
+	  if (buf != *data)
+	    munmap (buf, amount);
+	  return err;
+	}
+      if (buf != *data)
+	{
+	  *data = buf;
+	  if (round_page (got) < round_page (amount))
+	    munmap (buf + round_page (got),
+		    round_page (amount) - round_page (got));
+	}
+      *datalen = got;
+      return 0;
     }
 
-  /* Get flags */
-  flags = lwip_fcntl (user->sock->sockno, F_GETFL, 0);
+  /* Readers usually ask for much more than what is waiting, so first
+     take what is already there in the reply buffer, and only map pages
+     when that is not enough.  */
+  got = lwip_recv (user->sock->sockno, *data, *datalen, MSG_DONTWAIT);
+  if (got < 0 && (errno != EWOULDBLOCK || nonblock))
+    return errno;
+  if (got >= 0 && got < *datalen)
+    {
+      *datalen = got;
+      return 0;
+    }
 
-  err = lwip_recv (user->sock->sockno, *data, amount,
-		   (flags & O_NONBLOCK) ? MSG_DONTWAIT : 0);
+  buf = mmap (0, amount, PROT_READ | PROT_WRITE, MAP_ANON, 0, 0);
+  if (buf == MAP_FAILED)
+    {
+      if (got > 0)
+	{
+	  /* Return what we have */
+	  *datalen = got;
+	  return 0;
+	}
+      return ENOMEM;
+    }
 
-  if (err < 0)
+  if (got > 0)
     {
-      if (alloced)
-	munmap (*data, amount);
+      /* There may be more: take it without blocking, as we already
+	 have something to return.  */
+      memcpy (buf, *data, got);
+      more = lwip_recv (user->sock->sockno, buf + got, amount - got,
+			MSG_DONTWAIT);
+      if (more > 0)
+	got += more;
     }
   else
     {
-      *datalen = err;
-      if (alloced && round_page (*datalen) < round_page (amount))
-	munmap (*data + round_page (*datalen),
-		round_page (amount) - round_page (*datalen));
-      errno = 0;
+      /* Nothing yet, wait for it.  */
+      got = lwip_recv (user->sock->sockno, buf, amount, 0);
+      if (got < 0)
+	{
+	  error_t err = errno;
+	  munmap (buf, amount);
+	  return err;
+	}
     }
 
-  return errno;
+  *data = buf;
+  *datalen = got;
+  if (round_page (got) < round_page (amount))
+    munmap (buf + round_page (got),
+	    round_page (amount) - round_page (got));
+
+  return 0;
 }
 
 error_t
@@ -139,7 +195,9 @@ lwip_S_io_set_all_openmodes (struct sock_user * user, int bits)
   else
     opt = 0;
 
-  lwip_ioctl (user->sock->sockno, FIONBIO, &opt);
+  if (lwip_ioctl (user->sock->sockno, FIONBIO, &opt) == 0)
+    __atomic_store_n (&user->sock->flags, bits & O_NONBLOCK,
+		      __ATOMIC_RELAXED);
 
   return errno;
 }
@@ -164,7 +222,8 @@ lwip_S_io_set_some_openmodes (struct sock_user * user, int bits)
   if (bits & O_NONBLOCK)
     {
       int opt = 1;
-      lwip_ioctl (user->sock->sockno, FIONBIO, &opt);
+      if (lwip_ioctl (user->sock->sockno, FIONBIO, &opt) == 0)
+	__atomic_or_fetch (&user->sock->flags, O_NONBLOCK, __ATOMIC_RELAXED);
     }
 
   return errno;
@@ -180,7 +239,9 @@ lwip_S_io_clear_some_openmodes (struct sock_user * user, int bits)
   if (bits & O_NONBLOCK)
     {
       int opt = 0;
-      lwip_ioctl (user->sock->sockno, FIONBIO, &opt);
+      if (lwip_ioctl (user->sock->sockno, FIONBIO, &opt) == 0)
+	__atomic_and_fetch (&user->sock->flags, ~O_NONBLOCK,
+			    __ATOMIC_RELAXED);
     }
 
   return errno;
@@ -26,6 +26,7 @@
 #define LWIP_HURD_H
 
 #include <sys/socket.h>
+#include <fcntl.h>
 #include <hurd/ports.h>
 #include <hurd/trivfs.h>
 #include <refcount.h>
@@ -58,8 +59,20 @@ struct socket
   int sockno;
   mach_port_t identity;
   refcount_t refcnt;
+  /* SOCK_STREAM, SOCK_DGRAM or SOCK_RAW.  */
+  int type;
+  /* The O_NONBLOCK flag as last set through the io interface, so that
+     reading and writing don't have to ask lwip for it.  */
+  int flags;
 };
 
+/* Whether operations on SOCK must not block.  */
+static inline int
+sock_nonblock (struct socket *sock)
+{
+  return __atomic_load_n (&sock->flags, __ATOMIC_RELAXED) & O_NONBLOCK;
+}
+
 /* Multiple sock_user's can point to the same socket. */
 struct sock_user
 {
@@ -28,10 +28,14 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <error.h>
 #include <device/device.h>
 #include <device/net_status.h>
+#include <device/device_request.h>
+#include <mach/mig_errors.h>
 #include <net/if.h>
 #include <net/if_arp.h>
 
@@ -43,8 +47,10 @@
 #include <lwip/snmp.h>
 #include <lwip/ethip6.h>
 #include <lwip/etharp.h>
+#include <netif/ethernet.h>
 #include <lwip/sockets.h>
 #include <lwip/inet.h>
+#include <lwip/tcpip.h>
 
 /* Get the MAC address from an array of int */
 #define GET_HWADDR_BYTE(x,n)  (((char*)x)[n])
@@ -261,130 +267,245 @@ hurdethif_device_close (struct netif *netif)
 }
 
 /*
- * Called from lwip when outgoing data is ready
+ * Called from lwip when outgoing data is ready.
+ *
+ * The frame is sent with an asynchronous request, so we don't wait for
+ * the device to handle a frame before producing the next one.  The
+ * data is copied into the message, so the pbuf can be released as soon
+ * as the request is sent.
  */
 static err_t
 hurdethif_output (struct netif *netif, struct pbuf *p)
 {
   error_t err;
   hurdethif *ethif = netif_get_state (netif);
-  int count;
+  char gather[p->tot_len != p->len ? p->tot_len : 1];
+  char *data;
   uint8_t tried;
 
-  if (p->tot_len != p->len)
-    /* Drop the packet */
-    return ERR_OK;
-
-  tried = 0;
-  /* Send the data from the pbuf to the interface, one pbuf at a
-     time. The size of the data in each pbuf is kept in the ->len
-     variable. */
-  do
+  if (p->tot_len == p->len)
+    data = p->payload;
+  else
     {
-      tried++;
-      err = device_write (ethif->ether_port, D_NOWAIT, 0,
-			  p->payload, p->len, &count);
-      if (err)
-	{
-	  if (tried == 2)
-	    /* Too many tries, abort */
-	    break;
+      /* Gather the chain into a single frame */
+      pbuf_copy_partial (p, gather, p->tot_len, 0);
+      data = gather;
+    }
 
-	  if (err == EMACH_SEND_INVALID_DEST || err == EMIG_SERVER_DIED)
-	    {
-	      /* Device probably just died, try to reopen it.  */
-	      hurdethif_device_close (netif);
-	      hurdethif_device_open (netif);
-	    }
-	}
-      else if (count != p->len)
-	/* Incomplete package sent, reattempt */
-	err = -1;
+  for (tried = 0; tried < 2; tried++)
+    {
+      err = device_write_request (ethif->ether_port, MACH_PORT_NULL,
+				  D_NOWAIT, 0, data, p->tot_len);
+      if (err != EMACH_SEND_INVALID_DEST && err != EMIG_SERVER_DIED)
+	break;
+
+      /* Device probably just died, try to reopen it.  */
+      hurdethif_device_close (netif);
+      hurdethif_device_open (netif);
     }
-  while (err);
 
   return ERR_OK;
 }
 
 /*
- * Called from the demuxer when incoming data is ready
+ * Buffer for one incoming message.
+ *
+ * When lwip supports custom pbufs, received frames are not copied:
+ * the pbuf points into the message buffer, which is recycled when the
+ * pbuf is freed.
  */
-void
-hurdethif_input (struct netif *netif, struct net_rcv_msg *msg)
+struct hurdethif_rxbuf
 {
-  struct pbuf *p, *q;
+#if LWIP_SUPPORT_CUSTOM_PBUF
+  struct pbuf_custom pc;
+#endif
+  struct hurdethif_rxbuf *next;
+  struct net_rcv_msg msg;
+};
+
+/* Maximum number of frames handed to the tcpip thread at once */
+#define HURDETHIF_RX_BATCH	32
+
+/*
+ * Maximum number of message buffers held by pbufs.  Past that, frames
+ * are copied into pool pbufs so that the data queued on sockets doesn't
+ * pin whole message buffers.
+ */
+#define HURDETHIF_RX_MAX_REFS	256
+
+/* Maximum number of message buffers kept for reuse */
+#define HURDETHIF_RX_MAX_FREE	64
+
+/* Frames received and not yet handed to the tcpip thread */
+struct hurdethif_batch
+{
+  int count;
+  struct netif *netif[HURDETHIF_RX_BATCH];
+  struct pbuf *p[HURDETHIF_RX_BATCH];
+};
+
+static pthread_mutex_t rxbuf_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hurdethif_rxbuf *rxbuf_free_list;
+static int rxbuf_nfree;
+#if LWIP_SUPPORT_CUSTOM_PBUF
+static int rxbuf_nrefs;
+#endif
+
+static struct hurdethif_rxbuf *
+rxbuf_get (void)
+{
+  struct hurdethif_rxbuf *buf;
+
+  pthread_mutex_lock (&rxbuf_lock);
+  buf = rxbuf_free_list;
+  if (buf)
+    {
+      rxbuf_free_list = buf->next;
+      rxbuf_nfree--;
+    }
+  pthread_mutex_unlock (&rxbuf_lock);
+
+  if (!buf)
+    buf = malloc (sizeof (struct hurdethif_rxbuf));
+
+  return buf;
+}
+
+static void
+rxbuf_put (struct hurdethif_rxbuf *buf)
+{
+  pthread_mutex_lock (&rxbuf_lock);
+  if (rxbuf_nfree < HURDETHIF_RX_MAX_FREE)
+    {
+      buf->next = rxbuf_free_list;
+      rxbuf_free_list = buf;
+      rxbuf_nfree++;
+      buf = NULL;
+    }
+  pthread_mutex_unlock (&rxbuf_lock);
+
+  free (buf);
+}
+
+#if LWIP_SUPPORT_CUSTOM_PBUF
+/* Called by lwip when the last reference to a received frame is gone */
+static void
+rxbuf_pbuf_free (struct pbuf *p)
+{
+  struct hurdethif_rxbuf *buf = (struct hurdethif_rxbuf *) p;
+
+  __atomic_sub_fetch (&rxbuf_nrefs, 1, __ATOMIC_RELAXED);
+  rxbuf_put (buf);
+}
+#endif
+
+/* Copy the frame in MSG into a new chain of pool pbufs */
+static struct pbuf *
+hurdethif_copy_frame (struct net_rcv_msg *msg, uint16_t len)
+{
+  struct pbuf *p;
+
+  p = pbuf_alloc (PBUF_RAW, len, PBUF_POOL);
+  if (p)
+    {
+      pbuf_take (p, msg->header, PBUF_LINK_HLEN);
+      pbuf_take_at (p, msg->packet + sizeof (struct packet_header),
+		    len - PBUF_LINK_HLEN, PBUF_LINK_HLEN);
+    }
+
+  return p;
+}
+
+/*
+ * Make a pbuf of the frame in BUF.  BUF is consumed.
+ */
+static struct pbuf *
+hurdethif_input (struct hurdethif_rxbuf *buf)
+{
+  struct net_rcv_msg *msg = &buf->msg;
+  struct pbuf *p;
   uint16_t len;
-  uint16_t off;
-  uint16_t next_read;
 
   /* Get the size of the whole packet */
   len = PBUF_LINK_HLEN
     + msg->packet_type.msgt_number - sizeof (struct packet_header);
 
-  /* Allocate an empty pbuf chain for the data */
-  p = pbuf_alloc (PBUF_RAW, len, PBUF_POOL);
-
-  if (p)
+#if LWIP_SUPPORT_CUSTOM_PBUF
+  if (__atomic_load_n (&rxbuf_nrefs, __ATOMIC_RELAXED) < HURDETHIF_RX_MAX_REFS)
     {
+      char *frame = msg->packet + sizeof (struct packet_header)
+	- PBUF_LINK_HLEN;
+
       /*
-       * Iterate to fill the pbuf chain.
-       * 
-       * First read the Ethernet header from msg->header. Then read the
-       * payload from msg->packet
+       * Move the Ethernet header right before the payload.  This only
+       * overwrites the packet header, its type descriptor and the
+       * unused end of msg->header, which we don't need anymore.
        */
-      q = p;
-      off = 0;
-      do
+      memcpy (frame, msg->header, PBUF_LINK_HLEN);
+
+      buf->pc.custom_free_function = rxbuf_pbuf_free;
+      p = pbuf_alloced_custom (PBUF_RAW, len, PBUF_REF, &buf->pc, frame, len);
+      if (p)
 	{
-	  if (off < PBUF_LINK_HLEN)
-	    {
-	      /* We still haven't ended copying the header */
-	      next_read = (off + q->len) > PBUF_LINK_HLEN ?
-		(PBUF_LINK_HLEN - off) : q->len;
-	      memcpy (q->payload, msg->header + off, next_read);
-
-	      if ((off + q->len) > PBUF_LINK_HLEN)
-		memcpy (q->payload + PBUF_LINK_HLEN,
-			msg->packet + sizeof (struct packet_header),
-			q->len - next_read);
-	    }
-	  else
-	    /* The header is copyied yet */
-	    memcpy (q->payload, msg->packet +
-		    sizeof (struct packet_header) + off - PBUF_LINK_HLEN,
-		    q->len);
+	  __atomic_add_fetch (&rxbuf_nrefs, 1, __ATOMIC_RELAXED);
+	  return p;
+	}
+    }
+#endif
 
-	  off += q->len;
+  p = hurdethif_copy_frame (msg, len);
+  rxbuf_put (buf);
 
-	  /* q->tot_len == q->len means this was the last pbuf in the chain */
-	  if (q->tot_len == q->len)
-	    break;
-	  else
-	    q = q->next;
-	}
-      while (1);
+  return p;
+}
 
-      /* Pass the pbuf chain to he input function */
-      if (netif->input (p, netif) != ERR_OK)
-	{
-	  LWIP_DEBUGF (NETIF_DEBUG, ("hurdethif_input: IP input error\n"));
-	  pbuf_free (p);
-	  p = NULL;
-	}
+/*
+ * Called in the tcpip thread with a batch of received frames
+ */
+static void
+hurdethif_input_batch (void *arg)
+{
+  struct hurdethif_batch *batch = arg;
+  int i;
+
+  for (i = 0; i < batch->count; i++)
+    /* This is what tcpip_input does in the tcpip thread */
+    if (ethernet_input (batch->p[i], batch->netif[i]) != ERR_OK)
+      {
+	LWIP_DEBUGF (NETIF_DEBUG, ("hurdethif_input: IP input error\n"));
+	pbuf_free (batch->p[i]);
+      }
+
+  free (batch);
+}
+
+/* Hand the frames of BATCH to the tcpip thread */
+static void
+hurdethif_flush (struct hurdethif_batch *batch)
+{
+  int i;
+
+  if (batch->count == 0)
+    {
+      free (batch);
+      return;
+    }
+
+  if (tcpip_callback (hurdethif_input_batch, batch) != ERR_OK)
+    {
+      for (i = 0; i < batch->count; i++)
+	pbuf_free (batch->p[i]);
+      free (batch);
     }
 }
 
-/* Demux incoming RPCs from the device */
-int
-hurdethif_demuxer (mach_msg_header_t * inp, mach_msg_header_t * outp)
+/* Find the interface a message from the device was sent to */
+static struct netif *
+hurdethif_lookup (mach_msg_header_t * inp)
 {
-  struct net_rcv_msg *msg = (struct net_rcv_msg *) inp;
   struct netif *netif;
   mach_port_t local_port;
 
-  if (inp->msgh_id != NET_RCV_MSG_ID)
-    return 0;
-
   if (MACH_MSGH_BITS_LOCAL (inp->msgh_bits) ==
       MACH_MSG_TYPE_PROTECTED_PAYLOAD)
     {
@@ -406,16 +527,7 @@ hurdethif_demuxer (mach_msg_header_t * inp, mach_msg_header_t * outp)
     if (local_port == netif_get_state (netif)->readptname)
       break;
 
-  if (!netif)
-    {
-      if (inp->msgh_remote_port != MACH_PORT_NULL)
-	mach_port_deallocate (mach_task_self (), inp->msgh_remote_port);
-      return 1;
-    }
-
-  hurdethif_input (netif, msg);
-
-  return 1;
+  return netif;
 }
 
 /*
@@ -541,11 +653,130 @@ hurdethif_device_init (struct netif *netif)
   return ERR_OK;
 }
 
+/*
+ * Answer a message that is not a frame the way a MIG server answers
+ * a request it does not know, and destroy it.
+ */
+static void
+hurdethif_bad_msg (mach_msg_header_t * inp)
+{
+  static const mach_msg_type_t RetCodeType = {
+    /* msgt_name = */ MACH_MSG_TYPE_INTEGER_32,
+    /* msgt_size = */ 32,
+    /* msgt_number = */ 1,
+    /* msgt_inline = */ TRUE,
+    /* msgt_longform = */ FALSE,
+    /* msgt_deallocate = */ FALSE,
+    /* msgt_unused = */ 0
+  };
+  mig_reply_header_t reply;
+  error_t err;
+
+  reply.Head.msgh_bits =
+    MACH_MSGH_BITS (MACH_MSGH_BITS_REMOTE (inp->msgh_bits), 0);
+  reply.Head.msgh_size = sizeof reply;
+  reply.Head.msgh_remote_port = inp->msgh_remote_port;
+  reply.Head.msgh_local_port = MACH_PORT_NULL;
+  reply.Head.msgh_seqno = 0;
+  reply.Head.msgh_id = inp->msgh_id + 100;
+  reply.RetCodeType = RetCodeType;
+  reply.RetCode = MIG_BAD_ID;
+
+  /* Everything but the reply port goes */
+  inp->msgh_remote_port = MACH_PORT_NULL;
+  mach_msg_destroy (inp);
+
+  if (!MACH_PORT_VALID (reply.Head.msgh_remote_port))
+    return;
+
+  /* Don't let a client hold up the reception of frames */
+  err = mach_msg (&reply.Head, MACH_SEND_MSG | MACH_SEND_TIMEOUT,
+		  sizeof reply, 0, MACH_PORT_NULL, 0, MACH_PORT_NULL);
+  if (err)
+    mach_msg_destroy (&reply.Head);
+}
+
+/*
+ * Receive the frames from the devices.
+ *
+ * After each message, we keep receiving without blocking as long as
+ * there are queued messages, and hand all the frames to the tcpip thread
+ * at once.  This saves a switch to the tcpip thread for each frame.
+ */
 static void *
 hurdethif_input_thread (void *arg)
 {
-  ports_manage_port_operations_one_thread (etherport_bucket,
-					   hurdethif_demuxer, 0);
+  struct hurdethif_batch *batch = NULL;
+  struct hurdethif_rxbuf *buf;
+  struct netif *netif;
+  mach_msg_header_t *inp;
+  error_t err;
+
+  while (1)
+    {
+      buf = rxbuf_get ();
+      if (!buf)
+	{
+	  error (0, ENOMEM, "Cannot receive from the network");
+	  sleep (1);
+	  continue;
+	}
+      inp = &buf->msg.msg_hdr;
+
+      err = mach_msg (inp, MACH_RCV_MSG | (batch ? MACH_RCV_TIMEOUT : 0),
+		      0, sizeof (struct net_rcv_msg), etherport_bucket->portset,
+		      0, MACH_PORT_NULL);
+      if (err)
+	{
+	  rxbuf_put (buf);
+	  if (err == MACH_RCV_TIMED_OUT)
+	    {
+	      /* No more queued messages */
+	      hurdethif_flush (batch);
+	      batch = NULL;
+	    }
+	  else
+	    error (0, err, "mach_msg");
+	  continue;
+	}
+
+      if (inp->msgh_id != NET_RCV_MSG_ID)
+	{
+	  hurdethif_bad_msg (inp);
+	  rxbuf_put (buf);
+	  continue;
+	}
+
+      netif = hurdethif_lookup (inp);
+      if (!netif)
+	{
+	  if (inp->msgh_remote_port != MACH_PORT_NULL)
+	    mach_port_deallocate (mach_task_self (), inp->msgh_remote_port);
+	  rxbuf_put (buf);
+	  continue;
+	}
+
+      if (!batch)
+	{
+	  batch = malloc (sizeof (struct hurdethif_batch));
+	  if (!batch)
+	    {
+	      rxbuf_put (buf);
+	      continue;
+	    }
+	  batch->count = 0;
+	}
+
+      batch->p[batch->count] = hurdethif_input (buf);
+      if (batch->p[batch->count])
+	batch->netif[batch->count++] = netif;
+
+      if (batch->count == HURDETHIF_RX_BATCH)
+	{
+	  hurdethif_flush (batch);
+	  batch = NULL;
+	}
+    }
 
   return 0;
 }
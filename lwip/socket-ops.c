@@ -57,6 +57,7 @@ lwip_S_socket_create (struct trivfs_protid *master,
   if (!sock)
     return ENOMEM;
 
+  sock->type = sock_type;
   sock->sockno = lwip_socket (domain, sock_type, protocol);
   if (sock->sockno < 0)
     {
@@ -120,6 +121,7 @@ lwip_S_socket_accept (struct sock_user * user,
   if (!newsock)
     return ENOMEM;
 
+  newsock->type = sock->type;
   addr_len = sizeof (addr);
   newsock->sockno =
     lwip_accept (sock->sockno, (struct sockaddr *) &addr, &addr_len);
@@ -345,7 +347,6 @@ lwip_S_socket_send (struct sock_user * user,
 		    size_t controllen, mach_msg_type_number_t * amount)
 {
   int sent;
-  int sockflags;
   struct iovec iov = { (char*) data, datalen };
   struct msghdr m = { msg_name:addr ? &addr->address : 0,
     msg_namelen:addr ? addr->address.sa.sa_len : 0,
@@ -360,10 +361,9 @@ lwip_S_socket_send (struct sock_user * user,
   if (nports != 0 || controllen != 0)
     return EINVAL;
 
-  sockflags = lwip_fcntl (user->sock->sockno, F_GETFL, 0);
   /* XXX: missing !MSG_NOSIGNAL support, i.e. generate SIGPIPE */
   flags &= ~MSG_NOSIGNAL;
-  if (sockflags & O_NONBLOCK)
+  if (sock_nonblock (user->sock))
     flags |= MSG_DONTWAIT;
 
   sent = lwip_sendmsg (user->sock->sockno, &m, flags);
@@ -397,7 +397,6 @@ lwip_S_socket_recv (struct sock_user * user,
   error_t err;
   union { struct sockaddr_storage storage; struct sockaddr sa; } addr;
   int alloced = 0;
-  int sockflags;
   struct iovec iov;
   struct msghdr m = { msg_name: &addr.sa, msg_namelen:sizeof addr,
     msg_controllen: 0, msg_iov: &iov, msg_iovlen:1
@@ -422,8 +421,7 @@ lwip_S_socket_recv (struct sock_user * user,
   iov.iov_base = *data;
   iov.iov_len = amount;
 
-  sockflags = lwip_fcntl (user->sock->sockno, F_GETFL, 0);
-  if (sockflags & O_NONBLOCK)
+  if (sock_nonblock (user->sock))
     flags |= MSG_DONTWAIT;
 
   err = lwip_recvmsg (user->sock->sockno, &m, flags);
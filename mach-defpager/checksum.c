@@ -0,0 +1,203 @@
+/* CRC32C checksum for the Hurd default pager.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* The portable version reads eight bytes at a time through eight
+   tables ("slicing by 8").  The SSE4.2 version runs three independent
+   crc32 instruction streams over three adjacent lanes of each block,
+   hiding the latency of the instruction, and then merges the lane
+   checksums: shifting a CRC register over LANE zero bytes is linear,
+   so it is done with four table lookups.  */
+
+#include <pthread.h>
+
+#include "checksum.h"
+
+/* Reflected Castagnoli polynomial.  */
+#define CRC32C_POLY	0x82f63b78
+
+/* Bytes per lane of the three-way version.  */
+#define LANE		256
+
+static uint32_t crc_table[8][256];
+
+/* SHIFT_TABLE[K][B] is the CRC register B << 8K after LANE zero
+   bytes.  */
+static uint32_t shift_table[4][256];
+
+static int have_hw;
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void
+crc32c_init (void)
+{
+  uint32_t c;
+  int i, j, k;
+
+  for (i = 0; i < 256; i++)
+    {
+      c = i;
+      for (j = 0; j < 8; j++)
+	c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+      crc_table[0][i] = c;
+    }
+  for (i = 0; i < 256; i++)
+    for (k = 1; k < 8; k++)
+      crc_table[k][i] = (crc_table[k - 1][i] >> 8)
+			^ crc_table[0][crc_table[k - 1][i] & 0xff];
+
+  for (k = 0; k < 4; k++)
+    for (i = 0; i < 256; i++)
+      {
+	c = (uint32_t) i << (8 * k);
+	for (j = 0; j < LANE; j++)
+	  c = crc_table[0][c & 0xff] ^ (c >> 8);
+	shift_table[k][i] = c;
+      }
+
+#if defined __i386__ || defined __x86_64__
+  __builtin_cpu_init ();
+  have_hw = __builtin_cpu_supports ("sse4.2");
+#endif
+}
+
+/* Update the CRC register C with the LEN bytes at P.  */
+static uint32_t
+crc_update_sw (uint32_t c, const unsigned char *p, size_t len)
+{
+  while (len > 0 && ((uintptr_t) p & 7) != 0)
+    {
+      c = crc_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+      len--;
+    }
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while (len >= 8)
+    {
+      uint32_t lo = *(const uint32_t *) p ^ c;
+      uint32_t hi = *(const uint32_t *) (p + 4);
+
+      c = crc_table[7][lo & 0xff]
+	  ^ crc_table[6][(lo >> 8) & 0xff]
+	  ^ crc_table[5][(lo >> 16) & 0xff]
+	  ^ crc_table[4][lo >> 24]
+	  ^ crc_table[3][hi & 0xff]
+	  ^ crc_table[2][(hi >> 8) & 0xff]
+	  ^ crc_table[1][(hi >> 16) & 0xff]
+	  ^ crc_table[0][hi >> 24];
+      p += 8;
+      len -= 8;
+    }
+#endif
+
+  while (len > 0)
+    {
+      c = crc_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+      len--;
+    }
+  return c;
+}
+
+#if defined __i386__ || defined __x86_64__
+#include <nmmintrin.h>
+
+/* Return the CRC register C after LANE zero bytes.  */
+static inline uint32_t
+crc_shift (uint32_t c)
+{
+  return shift_table[0][c & 0xff] ^ shift_table[1][(c >> 8) & 0xff]
+	 ^ shift_table[2][(c >> 16) & 0xff] ^ shift_table[3][c >> 24];
+}
+
+#ifdef __x86_64__
+typedef uint64_t word_t;
+#define crc_word(c, w)	((uint32_t) _mm_crc32_u64 ((c), (w)))
+#else
+typedef uint32_t word_t;
+#define crc_word(c, w)	_mm_crc32_u32 ((c), (w))
+#endif
+
+__attribute__ ((target ("sse4.2")))
+static uint32_t
+crc_update_hw (uint32_t c, const unsigned char *p, size_t len)
+{
+  while (len > 0 && ((uintptr_t) p & (sizeof (word_t) - 1)) != 0)
+    {
+      c = _mm_crc32_u8 (c, *p++);
+      len--;
+    }
+
+  while (len >= 3 * LANE)
+    {
+      const word_t *a = (const word_t *) p;
+      const word_t *b = (const word_t *) (p + LANE);
+      const word_t *e = (const word_t *) (p + 2 * LANE);
+      uint32_t c1 = 0, c2 = 0;
+      size_t i;
+
+      for (i = 0; i < LANE / sizeof (word_t); i++)
+	{
+	  c = crc_word (c, a[i]);
+	  c1 = crc_word (c1, b[i]);
+	  c2 = crc_word (c2, e[i]);
+	}
+      c = crc_shift (crc_shift (c) ^ c1) ^ c2;
+      p += 3 * LANE;
+      len -= 3 * LANE;
+    }
+
+  while (len >= sizeof (word_t))
+    {
+      c = crc_word (c, *(const word_t *) p);
+      p += sizeof (word_t);
+      len -= sizeof (word_t);
+    }
+  while (len > 0)
+    {
+      c = _mm_crc32_u8 (c, *p++);
+      len--;
+    }
+  return c;
+}
+#endif
+
+uint32_t
+crc32c_sw (uint32_t crc, const void *buf, size_t len)
+{
+  pthread_once (&init_once, crc32c_init);
+  return ~crc_update_sw (~crc, buf, len);
+}
+
+uint32_t
+crc32c (uint32_t crc, const void *buf, size_t len)
+{
+  pthread_once (&init_once, crc32c_init);
+#if defined __i386__ || defined __x86_64__
+  if (have_hw)
+    return ~crc_update_hw (~crc, buf, len);
+#endif
+  return ~crc_update_sw (~crc, buf, len);
+}
+
+int
+crc32c_hw_available (void)
+{
+  pthread_once (&init_once, crc32c_init);
+  return have_hw;
+}
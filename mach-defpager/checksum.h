@@ -0,0 +1,40 @@
+/* CRC32C checksum for the Hurd default pager.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#ifndef _checksum_h
+#define _checksum_h 1
+
+/* This does not depend on Mach, so that benchmarks/crc32c-bench.c can
+   be built on any system.  */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Return the CRC32C (Castagnoli) of the LEN bytes at BUF, continuing
+   the checksum CRC of the data before them (0 to start).  This uses
+   the SSE4.2 crc32 instruction when the processor has it.  */
+uint32_t crc32c (uint32_t crc, const void *buf, size_t len);
+
+/* The same, never using the crc32 instruction.  */
+uint32_t crc32c_sw (uint32_t crc, const void *buf, size_t len);
+
+/* Return nonzero if crc32c uses the crc32 instruction.  */
+int crc32c_hw_available (void);
+
+#endif /* checksum.h */
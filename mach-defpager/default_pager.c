@@ -57,9 +57,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdarg.h>
 
 #include <file_io.h>
+#include "checksum.h"
 
 #include "memory_object_S.h"
 #include "memory_object_default_S.h"
@@ -107,14 +109,13 @@ synchronized_printf (const char *fmt, ...)
  */
 #define	PARALLEL 1
 
-#if	0
-#define	CHECKSUM	1
-#endif
-
 #define	USE_PRECIOUS	1
 
-#define	ptoa(p)	((p)*vm_page_size)
-#define	atop(a)	((a)/vm_page_size)
+/*
+ * Maximum number of pages moved by a single clustered read or write.
+ */
+#define	DEFAULT_PAGER_CLUSTER	16
+
 
 partition_t partition_of(x)
       int x;
@@ -152,6 +153,68 @@ part_id(const char *name)
 	return (id << 8) | xorid;
 }
 
+/*
+ * Pages are only checksummed when asked for, on all the partitions
+ * and the compressed pool, or on the partitions named.  Partitions
+ * named not to be are left out either way.  These are set from the
+ * command line before any partition exists.
+ */
+static boolean_t	checksum_all;
+static const char	**checksum_names;
+static int		checksum_count;
+static const char	**no_checksum_names;
+static int		no_checksum_count;
+
+static void
+add_name(names, count, name)
+	const char	***names;
+	int		*count;
+	const char	*name;
+{
+	*names = realloc(*names, (*count + 1) * sizeof(char *));
+	if (*names == NULL)
+	    panic("partition checksum names: out of memory");
+	(*names)[(*count)++] = name;
+}
+
+static boolean_t
+name_listed(names, count, name)
+	const char	**names;
+	int		count;
+	const char	*name;
+{
+	int	i;
+
+	for (i = 0; i < count; i++)
+	    if (strcmp(names[i], name) == 0)
+		return (TRUE);
+	return (FALSE);
+}
+
+void
+partition_enable_checksum(const char *name)
+{
+	if (name == NULL)
+	    checksum_all = TRUE;
+	else
+	    add_name(&checksum_names, &checksum_count, name);
+}
+
+void
+partition_disable_checksum(const char *name)
+{
+	add_name(&no_checksum_names, &no_checksum_count, name);
+}
+
+static boolean_t
+partition_checksummed(const char *name)
+{
+	if (name_listed(no_checksum_names, no_checksum_count, name))
+	    return (FALSE);
+	return (checksum_all
+		|| name_listed(checksum_names, checksum_count, name));
+}
+
 void
 partition_init()
 {
@@ -199,6 +262,7 @@ new_partition (const char *name, struct file_direct *fdp,
 	part->bitmap	= (bm_entry_t *)malloc(bmsize);
 	part->going_away= FALSE;
 	part->file = fdp;
+	part->checksum	= partition_checksummed(name);
 
 	memset ((char *)part->bitmap, 0, bmsize);
 
@@ -407,6 +471,27 @@ new_partition (const char *name, struct file_direct *fdp,
 	return part;
 }
 
+/*
+ * Build the summary of the allocation bitmap of PART, once all the
+ * unusable blocks are marked in the bitmap.  Bits past the end of the
+ * bitmap are set, so that the search never goes there.
+ */
+static void
+partition_init_summary (partition_t part)
+{
+	unsigned int	limit, slimit, i;
+
+	limit = howmany(part->total_size, NB_BM);
+	slimit = howmany(limit, NB_BM);
+	part->summary = (bm_entry_t *) calloc(slimit, sizeof(bm_entry_t));
+	if (part->summary == 0)
+		no_paging_space(TRUE);
+	for (i = 0; i < slimit * NB_BM; i++)
+		if (i >= limit || part->bitmap[i] == BM_MASK)
+			part->summary[i / NB_BM] |= 1 << (i % NB_BM);
+	part->hint = 0;
+}
+
 /*
  * Create a partition descriptor,
  * add it to the list of all such.
@@ -422,6 +507,7 @@ create_paging_partition(const char *name,
 	part = new_partition (name, fdp, linux_signature);
 	if (!part)
 	  return;
+	partition_init_summary (part);
 
 	pthread_mutex_lock(&all_partitions.lock);
 	{
@@ -430,6 +516,22 @@ create_paging_partition(const char *name,
 		for (i = 0; i < all_partitions.n_partitions; i++)
 			if (partition_of(i) == 0) break;
 
+		/*
+		 * The last indexes stand for the compressed pool
+		 * and for no partition at all.
+		 */
+		if (i >= ZSWAP_INDEX) {
+			pthread_mutex_unlock(&all_partitions.lock);
+			printf("(default pager): "
+			       "Too many paging partitions!  SKIPPING %s!\n",
+			       name);
+			free(part->bitmap);
+			free(part->summary);
+			free(part->name);
+			free(part);
+			return;
+		}
+
 		if (i == all_partitions.n_partitions) {
 			partition_t	*new_list, *old_list;
 			int		n;
@@ -509,16 +611,18 @@ ddprintf ("choose_partition(%x,%d,%d)\n",size,cur_part,i);
 /*
  * Allocate a page in a paging partition
  * The partition is returned unlocked.
+ * If block NEAR is free, it is the one allocated: this keeps pages
+ * which are adjacent in an object adjacent in the partition.
  */
 vm_offset_t
-pager_alloc_page(pindex, lock_it)
+pager_alloc_page(pindex, lock_it, near)
 	p_index_t	pindex;
 	boolean_t	lock_it;
+	vm_offset_t	near;
 {
 	int	bm_e;
 	int	bit;
-	int	limit;
-	bm_entry_t	*bm;
+	unsigned int	s, slimit;
 	partition_t	part;
 	static char	here[] = "%spager_alloc_page";
 
@@ -540,31 +644,40 @@ ddprintf ("pager_alloc_page(%d,%d)\n",pindex,lock_it);
 	    return (NO_BLOCK);
 	}
 
-	limit = howmany(part->total_size, NB_BM);
-	bm = part->bitmap;
-	for (bm_e = 0; bm_e < limit; bm_e++, bm++)
-	    if (*bm != BM_MASK)
+	if (near != NO_BLOCK && near < part->total_size
+	    && (part->bitmap[near / NB_BM] & (1 << (near % NB_BM))) == 0) {
+	    bm_e = near / NB_BM;
+	    bit = near % NB_BM;
+	    goto found;
+	}
+
+	/*
+	 * Find a bitmap entry with a free block through the summary,
+	 * starting where the last search stopped.
+	 */
+	slimit = howmany(howmany(part->total_size, NB_BM), NB_BM);
+	for (s = part->hint; s < slimit; s++)
+	    if (part->summary[s] != BM_MASK)
 		break;
 
-	if (bm_e == limit)
+	if (s == slimit)
 	    panic(here,my_name);
+	part->hint = s;
+
+	bm_e = s * NB_BM + ffs(~part->summary[s]) - 1;
 
 	/*
-	 * Find and set the proper bit
+	 * Find the proper bit
 	 */
-	{
-	    bm_entry_t	b = *bm;
-
-	    for (bit = 0; bit < NB_BM; bit++)
-		if ((b & (1<<bit)) == 0)
-		    break;
-	    if (bit == NB_BM)
-		panic(here,my_name);
-
-	    *bm = b | (1<<bit);
-	    part->free--;
+	bit = ffs(~part->bitmap[bm_e]) - 1;
+	if (bit < 0)
+	    panic(here,my_name);
 
-	}
+    found:
+	part->bitmap[bm_e] |= 1 << bit;
+	if (part->bitmap[bm_e] == BM_MASK)
+	    part->summary[bm_e / NB_BM] |= 1 << (bm_e % NB_BM);
+	part->free--;
 
 	pthread_mutex_unlock(&part->p_lock);
 
@@ -583,6 +696,11 @@ pager_dealloc_page(pindex, page, lock_it)
 	partition_t	part;
 	int	bit, bm_e;
 
+	if (pindex == ZSWAP_INDEX) {
+	    zswap_free(page);
+	    return;
+	}
+
 	/* be paranoid */
 	if (no_partition(pindex))
 	    panic("%sdealloc_page",my_name);
@@ -599,18 +717,38 @@ ddprintf ("pager_dealloc_page(%d,%lx,%d)\n",pindex,page,lock_it);
 	    pthread_mutex_lock(&part->p_lock);
 
 	part->bitmap[bm_e] &= ~(1<<bit);
+	part->summary[bm_e / NB_BM] &= ~(1 << (bm_e % NB_BM));
+	if (bm_e / NB_BM < part->hint)
+	    part->hint = bm_e / NB_BM;
 	part->free++;
 
 	if (lock_it)
 	    pthread_mutex_unlock(&part->p_lock);
 }
-
+
 /*
  * Object sizes are rounded up to the next power of 2,
  * unless they are bigger than a given maximum size.
  */
 vm_size_t	max_doubled_size = 4 * 1024 * 1024;	/* 4 meg */
 
+/*
+ * Number of entries allocated for the indirect map of an object of
+ * SIZE pages.  This is a power of 2, so that an object extended little
+ * by little does not have its whole indirect map copied each time.
+ * The entries past INDIRECT_PAGEMAP_ENTRIES(SIZE) are always null.
+ */
+static vm_size_t
+indirect_map_capacity(vm_size_t size)
+{
+	vm_size_t	entries = INDIRECT_PAGEMAP_ENTRIES(size);
+	vm_size_t	n = 1;
+
+	while (n < entries)
+	    n <<= 1;
+	return n;
+}
+
 /*
  * Return first level map for pager.
  * If there is no such map, than allocate it.
@@ -631,7 +769,7 @@ dp_map_t pager_get_direct_map(pager)
 	    dp_map_t		init_value;
 
 	    if (INDIRECT_PAGEMAP(size)) {
-		alloc_size = INDIRECT_PAGEMAP_SIZE(size);
+		alloc_size = indirect_map_capacity(size) * sizeof(vm_offset_t *);
 		init_value = (dp_map_t)0;
 	    } else {
 		alloc_size = PAGEMAP_SIZE(size);
@@ -658,9 +796,6 @@ pager_alloc(pager, part, size)
 	vm_size_t	size;	/* in BYTES */
 {
 	int    i;
-#ifdef	CHECKSUM
-	dp_map_t mapptr, emapptr;
-#endif
 
 	pthread_mutex_init(&pager->lock, NULL);
 #if	DEBUG_READER_CONFLICTS
@@ -668,6 +803,10 @@ pager_alloc(pager, part, size)
 	pager->writer = FALSE;
 #endif
 	pager->cur_partition = part;
+	pager->ra_next = 0;
+	pager->ra_addr = 0;
+	pager->ra_size = 0;
+	pager->ra_gen = 0;
 
 	/*
 	 * Convert byte size to number of pages, then increase to the nearest
@@ -687,17 +826,8 @@ pager_alloc(pager, part, size)
 	pager->limit = (vm_size_t)-1;
 
 #ifdef	CHECKSUM
-	if (INDIRECT_PAGEMAP(size)) {
-		mapptr = (vm_offset_t *)
-			malloc(INDIRECT_PAGEMAP_SIZE(size));
-		for (i = INDIRECT_PAGEMAP_ENTRIES(size); --i >= 0;)
-			mapptr[i] = 0;
-	} else {
-		mapptr = (vm_offset_t *) malloc(PAGEMAP_SIZE(size));
-		for (i = 0; i < size; i++)
-			mapptr[i] = NO_CHECKSUM;
-	}
-	pager->checksum = mapptr;
+	pager->checksum = 0;
+	pager->checksum_blocks = 0;
 #endif	 /* CHECKSUM */
 }
 
@@ -832,31 +962,34 @@ pager_extend(pager, new_size)
 	    new_size = ROUNDUP_TO_PAGEMAP(new_size);
 
 	if (INDIRECT_PAGEMAP(old_size)) {
+	    if (indirect_map_capacity(new_size)
+		== indirect_map_capacity(old_size)) {
+		/*
+		 * The indirect block is large enough already.
+		 */
+		pager->size = new_size;
+#if	DEBUG_READER_CONFLICTS
+		pager->writer = FALSE;
+#endif
+		pthread_mutex_unlock(&pager->lock);
+		return;
+	    }
+
 	    /*
 	     * Pager already uses two levels.  Allocate
 	     * a larger indirect block.
 	     */
 	    new_mapptr = (dp_map_t)
-			malloc(INDIRECT_PAGEMAP_SIZE(new_size));
+			malloc(indirect_map_capacity(new_size)
+			       * sizeof(vm_offset_t *));
 	    old_mapptr = pager_get_direct_map(pager);
 	    for (i = 0; i < INDIRECT_PAGEMAP_ENTRIES(old_size); i++)
 		new_mapptr[i] = old_mapptr[i];
-	    for (; i < INDIRECT_PAGEMAP_ENTRIES(new_size); i++)
+	    for (; i < indirect_map_capacity(new_size); i++)
 		new_mapptr[i].indirect = (dp_map_t)0;
 	    free((char *)old_mapptr);
 	    pager->map = new_mapptr;
 	    pager->size = new_size;
-#ifdef	CHECKSUM
-	    new_mapptr = (vm_offset_t *)
-			malloc(INDIRECT_PAGEMAP_SIZE(new_size));
-	    old_mapptr = pager->checksum;
-	    for (i = 0; i < INDIRECT_PAGEMAP_ENTRIES(old_size); i++)
-		new_mapptr[i] = old_mapptr[i];
-	    for (; i < INDIRECT_PAGEMAP_ENTRIES(new_size); i++)
-		new_mapptr[i] = 0;
-	    free((char *)old_mapptr);
-	    pager->checksum = new_mapptr;
-#endif	 /* CHECKSUM */
 #if	DEBUG_READER_CONFLICTS
 	    pager->writer = FALSE;
 #endif
@@ -903,35 +1036,13 @@ pager_extend(pager, new_size)
 	     * Now allocate indirect map.
 	     */
 	    new_mapptr = (dp_map_t)
-			malloc(INDIRECT_PAGEMAP_SIZE(new_size));
+			malloc(indirect_map_capacity(new_size)
+			       * sizeof(vm_offset_t *));
 	    new_mapptr[0].indirect = old_mapptr;
-	    for (i = 1; i < INDIRECT_PAGEMAP_ENTRIES(new_size); i++)
+	    for (i = 1; i < indirect_map_capacity(new_size); i++)
 		new_mapptr[i].indirect = 0;
 	    pager->map = new_mapptr;
 	    pager->size = new_size;
-#ifdef	CHECKSUM
-	    /*
-	     * Allocate new second-level map first.
-	     */
-	    new_mapptr = (vm_offset_t *)malloc(PAGEMAP_SIZE(PAGEMAP_ENTRIES));
-	    old_mapptr = pager->checksum;
-	    for (i = 0; i < old_size; i++)
-		new_mapptr[i] = old_mapptr[i];
-	    for (; i < PAGEMAP_ENTRIES; i++)
-		new_mapptr[i] = NO_CHECKSUM;
-	    free((char *)old_mapptr);
-	    old_mapptr = new_mapptr;
-
-	    /*
-	     * Now allocate indirect map.
-	     */
-	    new_mapptr = (vm_offset_t *)
-			malloc(INDIRECT_PAGEMAP_SIZE(new_size));
-	    new_mapptr[0] = (vm_offset_t) old_mapptr;
-	    for (i = 1; i < INDIRECT_PAGEMAP_ENTRIES(new_size); i++)
-		new_mapptr[i] = 0;
-	    pager->checksum = new_mapptr;
-#endif	 /* CHECKSUM */
 #if	DEBUG_READER_CONFLICTS
 	    pager->writer = FALSE;
 #endif
@@ -950,17 +1061,6 @@ pager_extend(pager, new_size)
 	free((char *)old_mapptr);
 	pager->map = new_mapptr;
 	pager->size = new_size;
-#ifdef	CHECKSUM
-	new_mapptr = (vm_offset_t *)
-		malloc(PAGEMAP_SIZE(new_size));
-	old_mapptr = pager->checksum;
-	for (i = 0; i < old_size; i++)
-	    new_mapptr[i] = old_mapptr[i];
-	for (; i < new_size; i++)
-	    new_mapptr[i] = NO_CHECKSUM;
-	free((char *)old_mapptr);
-	pager->checksum = new_mapptr;
-#endif	 /* CHECKSUM */
 #if	DEBUG_READER_CONFLICTS
 	pager->writer = FALSE;
 #endif
@@ -1029,10 +1129,14 @@ pager_truncate(dpager_t pager, vm_size_t new_size)	/* in pages */
 
       if (INDIRECT_PAGEMAP (new_size))
 	{
-	  const dp_map_t old_mapptr = pager->map;
-	  pager->map = (dp_map_t) malloc (INDIRECT_PAGEMAP_SIZE(new_size));
-	  memcpy (pager->map, old_mapptr, INDIRECT_PAGEMAP_SIZE(new_size));
-	  free ((char *) old_mapptr);
+	  const vm_size_t n = indirect_map_capacity (new_size);
+	  if (n != indirect_map_capacity (old_size))
+	    {
+	      const dp_map_t old_mapptr = pager->map;
+	      pager->map = (dp_map_t) malloc (n * sizeof (vm_offset_t *));
+	      memcpy (pager->map, old_mapptr, n * sizeof (vm_offset_t *));
+	      free ((char *) old_mapptr);
+	    }
 	}
       else
 	{
@@ -1057,12 +1161,27 @@ pager_truncate(dpager_t pager, vm_size_t new_size)	/* in pages */
     }
 
  done:
-  pager->size = new_size;
-  pthread_mutex_unlock(&pager->lock);
-
 #ifdef	CHECKSUM
-#error write me
+  /* Forget the checksums of the pages past the new end.  */
+  {
+    vm_size_t n, j;
+
+    for (n = (new_size + PAGEMAP_ENTRIES - 1) / PAGEMAP_ENTRIES;
+	 n < pager->checksum_blocks;
+	 ++n)
+      {
+	free (pager->checksum[n]);
+	pager->checksum[n] = 0;
+      }
+    n = new_size / PAGEMAP_ENTRIES;
+    if (n < pager->checksum_blocks && pager->checksum[n])
+      for (j = new_size % PAGEMAP_ENTRIES; j < PAGEMAP_ENTRIES; ++j)
+	pager->checksum[n][j] = NO_CHECKSUM;
+  }
 #endif	 /* CHECKSUM */
+
+  pager->size = new_size;
+  pthread_mutex_unlock(&pager->lock);
 }
 
 
@@ -1182,7 +1301,7 @@ pager_move_page(block)
 		return ret;
 
 	/* this unlocks the new partition */
-	new_offset = pager_alloc_page(new_pindex, FALSE);
+	new_offset = pager_alloc_page(new_pindex, FALSE, NO_BLOCK);
 	if (new_offset == NO_BLOCK)
 		panic(here,my_name);
 
@@ -1225,91 +1344,168 @@ ddprintf ("pager_move_page(%x,%d,%d)\n",block.block.p_offset,old_pindex,new_pind
 /*
  * Return the checksum for a block.
  */
-int
+vm_offset_t
 pager_get_checksum(pager, offset)
 	dpager_t	pager;
 	vm_offset_t		offset;
 {
 	vm_offset_t	f_page;
-	int checksum;
+	vm_offset_t	checksum = NO_CHECKSUM;
 
 	f_page = atop(offset);
 
 	pthread_mutex_lock(&pager->lock);	/* XXX lock_read */
-	if (f_page >= pager->size)
-	    panic("%spager_get_checksum",my_name);
-
-	if (INDIRECT_PAGEMAP(pager->size)) {
-	    vm_offset_t *mapptr;
-
-	    mapptr = (vm_offset_t *)pager->checksum[f_page/PAGEMAP_ENTRIES];
-	    if (mapptr == 0)
-		checksum = NO_CHECKSUM;
-	    else
-		checksum = mapptr[f_page%PAGEMAP_ENTRIES];
-	}
-	else {
-	    checksum = pager->checksum[f_page];
-	}
-
+	if (f_page / PAGEMAP_ENTRIES < pager->checksum_blocks
+	    && pager->checksum[f_page / PAGEMAP_ENTRIES] != 0)
+	    checksum = pager->checksum[f_page / PAGEMAP_ENTRIES]
+				      [f_page % PAGEMAP_ENTRIES];
 	pthread_mutex_unlock(&pager->lock);
 	return (checksum);
 }
 
 /*
- * Remember the checksum for a block.
+ * Remember the checksum for a block.  If there is no memory for it,
+ * the block is simply not verified when read back.
  */
-int
+void
 pager_put_checksum(pager, offset, checksum)
 	dpager_t	pager;
 	vm_offset_t		offset;
-	int			checksum;
+	vm_offset_t		checksum;
 {
 	vm_offset_t	f_page;
-	static char		here[] = "%spager_put_checksum";
+	vm_size_t	n;
+	vm_offset_t	*cksumptr;
+	int		i;
 
 	f_page = atop(offset);
+	n = f_page / PAGEMAP_ENTRIES;
 
 	pthread_mutex_lock(&pager->lock);	/* XXX lock_read */
-	if (f_page >= pager->size)
-	    panic(here,my_name);
-
-	if (INDIRECT_PAGEMAP(pager->size)) {
-	    vm_offset_t *mapptr;
-
-	    mapptr = (vm_offset_t *)pager->checksum[f_page/PAGEMAP_ENTRIES];
-	    if (mapptr == 0)
-		panic(here,my_name);
-
-	    mapptr[f_page%PAGEMAP_ENTRIES] = checksum;
+	if (n >= pager->checksum_blocks) {
+	    vm_offset_t	**new_checksum;
+	    vm_size_t	count;
+
+	    if (checksum == NO_CHECKSUM)
+		goto out;
+	    count = pager->checksum_blocks * 2;
+	    if (count <= n)
+		count = n + 1;
+	    new_checksum = realloc(pager->checksum,
+				   count * sizeof *new_checksum);
+	    if (new_checksum == 0)
+		goto out;
+	    memset(new_checksum + pager->checksum_blocks, 0,
+		   (count - pager->checksum_blocks) * sizeof *new_checksum);
+	    pager->checksum = new_checksum;
+	    pager->checksum_blocks = count;
 	}
-	else {
-	    pager->checksum[f_page] = checksum;
+
+	cksumptr = pager->checksum[n];
+	if (cksumptr == 0) {
+	    if (checksum == NO_CHECKSUM)
+		goto out;
+	    cksumptr = (vm_offset_t *) malloc(PAGEMAP_SIZE(PAGEMAP_ENTRIES));
+	    if (cksumptr == 0)
+		goto out;
+	    for (i = 0; i < PAGEMAP_ENTRIES; i++)
+		cksumptr[i] = NO_CHECKSUM;
+	    pager->checksum[n] = cksumptr;
 	}
+	cksumptr[f_page % PAGEMAP_ENTRIES] = checksum;
+    out:
 	pthread_mutex_unlock(&pager->lock);
 }
 
 /*
- * Compute a checksum - XOR each 32-bit word.
+ * Compute a checksum - CRC32C.
  */
-int
+vm_offset_t
 compute_checksum(addr, size)
 	vm_offset_t	addr;
 	vm_size_t	size;
 {
-	int	checksum = NO_CHECKSUM;
-	int	*ptr;
-	int	count;
+	return ((vm_offset_t) crc32c(0, (void *)addr, size));
+}
 
-	ptr = (int *)addr;
-	count = size / sizeof(int);
+/*
+ * Whether the page stored in BLOCK gets a checksum.
+ */
+static boolean_t
+block_checksummed(block)
+	union dp_map	block;
+{
+	if (block.block.p_index == ZSWAP_INDEX)
+	    return (checksum_all);
+	return (partition_of(block.block.p_index)->checksum);
+}
+#endif	 /* CHECKSUM */
+
+/*
+ * Return the second-level map holding page F_PAGE of a paging object,
+ * and make F_PAGE an index in it.  The object is extended and the map
+ * allocated as needed.  Return 0 if out of memory.
+ * The pager is locked, but is unlocked while it is extended.
+ */
+static dp_map_t
+pager_map_leaf(pager, f_page)
+	dpager_t	pager;
+	vm_offset_t	*f_page;
+{
+	dp_map_t	mapptr;
 
-	while (--count >= 0)
-	    checksum ^= *ptr++;
+	while (*f_page >= pager->size) {
+	  ddprintf ("pager_map_leaf: extending: %lx %x\n", *f_page, pager->size);
 
-	return (checksum);
+	    /*
+	     * Paging object must be extended.
+	     * Remember that offset is 0-based, but size is 1-based.
+	     */
+#if	DEBUG_READER_CONFLICTS
+	    pager->readers--;
+#endif
+	    pthread_mutex_unlock(&pager->lock);
+	    pager_extend(pager, *f_page + 1);
+#if	DEBUG_READER_CONFLICTS
+	    if (pager->readers > 0)
+		default_pager_read_conflicts++;	/* would have proceeded with
+						   read/write lock */
+#endif
+	    pthread_mutex_lock(&pager->lock);	/* XXX lock_read */
+#if	DEBUG_READER_CONFLICTS
+	    pager->readers++;
+#endif
+	    ddprintf ("pager_map_leaf: done extending: %lx %x\n", *f_page, pager->size);
+	}
+
+	if (INDIRECT_PAGEMAP(pager->size)) {
+	  ddprintf ("pager_map_leaf: indirect\n");
+	    mapptr = pager_get_direct_map(pager);
+	    mapptr = mapptr[*f_page/PAGEMAP_ENTRIES].indirect;
+	    if (mapptr == 0) {
+		/*
+		 * Allocate the indirect block
+		 */
+		int i;
+		ddprintf ("pager_map_leaf: allocating indirect\n");
+
+		mapptr = (dp_map_t) malloc(PAGEMAP_SIZE(PAGEMAP_ENTRIES));
+		if (mapptr == 0) {
+		    /* out of space! */
+		    no_paging_space(TRUE);
+		    return 0;
+		}
+		pager->map[*f_page/PAGEMAP_ENTRIES].indirect = mapptr;
+		for (i = 0; i < PAGEMAP_ENTRIES; i++)
+		    invalidate_block(mapptr[i]);
+	    }
+	    *f_page %= PAGEMAP_ENTRIES;
+	}
+	else {
+	    mapptr = pager_get_direct_map(pager);
+	}
+	return mapptr;
 }
-#endif	 /* CHECKSUM */
 
 /*
  * Given an offset within a paging object, find the
@@ -1359,82 +1555,43 @@ pager_write_offset(pager, offset)
 			pager->cur_partition = new_part;
 	}
 
-	while (f_page >= pager->size) {
-	  ddprintf ("pager_write_offset: extending: %lx %x\n", f_page, pager->size);
+	mapptr = pager_map_leaf(pager, &f_page);
+	if (mapptr == 0)
+	    goto out;
 
+	block = mapptr[f_page];
+	ddprintf ("pager_write_offset: block starts as %p[%lx] %p\n", mapptr, f_page, block.indirect);
+	if (!no_block(block) && block.block.p_index == ZSWAP_INDEX) {
 	    /*
-	     * Paging object must be extended.
-	     * Remember that offset is 0-based, but size is 1-based.
+	     * The page was compressed, but this version of it
+	     * goes to disk.
 	     */
-#if	DEBUG_READER_CONFLICTS
-	    pager->readers--;
-#endif
-	    pthread_mutex_unlock(&pager->lock);
-	    pager_extend(pager, f_page + 1);
-#if	DEBUG_READER_CONFLICTS
-	    if (pager->readers > 0)
-		default_pager_read_conflicts++;	/* would have proceeded with
-						   read/write lock */
-#endif
-	    pthread_mutex_lock(&pager->lock);	/* XXX lock_read */
-#if	DEBUG_READER_CONFLICTS
-	    pager->readers++;
-#endif
-	    ddprintf ("pager_write_offset: done extending: %lx %x\n", f_page, pager->size);
-	}
-
-	if (INDIRECT_PAGEMAP(pager->size)) {
-	  ddprintf ("pager_write_offset: indirect\n");
-	    mapptr = pager_get_direct_map(pager);
-	    mapptr = mapptr[f_page/PAGEMAP_ENTRIES].indirect;
-	    if (mapptr == 0) {
-		/*
-		 * Allocate the indirect block
-		 */
-		int i;
-		ddprintf ("pager_write_offset: allocating indirect\n");
-
-		mapptr = (dp_map_t) malloc(PAGEMAP_SIZE(PAGEMAP_ENTRIES));
-		if (mapptr == 0) {
-		    /* out of space! */
-		    no_paging_space(TRUE);
-		    goto out;
-		}
-		pager->map[f_page/PAGEMAP_ENTRIES].indirect = mapptr;
-		for (i = 0; i < PAGEMAP_ENTRIES; i++)
-		    invalidate_block(mapptr[i]);
-#ifdef	CHECKSUM
-		{
-		    vm_offset_t *cksumptr;
-		    int j;
-
-		    cksumptr = (vm_offset_t *)
-				malloc(PAGEMAP_SIZE(PAGEMAP_ENTRIES));
-		    if (cksumptr == 0) {
-			/* out of space! */
-			no_paging_space(TRUE);
-			goto out;
-		    }
-		    pager->checksum[f_page/PAGEMAP_ENTRIES]
-			= (vm_offset_t)cksumptr;
-		    for (j = 0; j < PAGEMAP_ENTRIES; j++)
-			cksumptr[j] = NO_CHECKSUM;
-		}
-#endif	 /* CHECKSUM */
-	    }
-	    f_page %= PAGEMAP_ENTRIES;
-	}
-	else {
-	    mapptr = pager_get_direct_map(pager);
+	    zswap_free(block.block.p_offset);
+	    invalidate_block(block);
+	    mapptr[f_page] = block;
 	}
-
-	block = mapptr[f_page];
-	ddprintf ("pager_write_offset: block starts as %p[%lx] %p\n", mapptr, f_page, block.indirect);
 	if (no_block(block)) {
 	    vm_offset_t	off;
+	    vm_offset_t	near = NO_BLOCK;
+	    vm_size_t	entries;
+
+	    /*
+	     * Try to put the page right after the previous page of
+	     * the object, or right before the next one, so that
+	     * clustered paging finds them contiguous.
+	     */
+	    entries = INDIRECT_PAGEMAP(pager->size)
+		? PAGEMAP_ENTRIES : pager->size;
+	    if (f_page > 0 && !no_block(mapptr[f_page - 1])
+		&& mapptr[f_page - 1].block.p_index == pager->cur_partition)
+		near = mapptr[f_page - 1].block.p_offset + 1;
+	    else if (f_page + 1 < entries && !no_block(mapptr[f_page + 1])
+		     && mapptr[f_page + 1].block.p_index == pager->cur_partition
+		     && mapptr[f_page + 1].block.p_offset > 0)
+		near = mapptr[f_page + 1].block.p_offset - 1;
 
 	    /* get room now */
-	    off = pager_alloc_page(pager->cur_partition, TRUE);
+	    off = pager_alloc_page(pager->cur_partition, TRUE, near);
 	    if (off == NO_BLOCK) {
 		/*
 		 * Before giving up, try all other partitions.
@@ -1456,7 +1613,8 @@ dprintf("extending object %x (size %x) to %x.\n",
 		    pager->cur_partition = new_part;
 
 		    /* this unlocks the partition too */
-		    off = pager_alloc_page(pager->cur_partition, FALSE);
+		    off = pager_alloc_page(pager->cur_partition, FALSE,
+					   NO_BLOCK);
 
 		}
 
@@ -1483,6 +1641,39 @@ out:
 	return (block);
 }
 
+/*
+ * Record BLOCK as the block of the page at OFFSET in a paging object,
+ * returning the block it replaces in *OLD.  Return FALSE if out of
+ * memory.
+ */
+boolean_t
+pager_store_offset(pager, offset, block, old)
+	dpager_t	pager;
+	vm_offset_t	offset;
+	union dp_map	block;
+	union dp_map	*old;
+{
+	vm_offset_t	f_page;
+	dp_map_t	mapptr;
+
+	f_page = atop(offset);
+
+	pthread_mutex_lock(&pager->lock);	/* XXX lock_read */
+#if	DEBUG_READER_CONFLICTS
+	pager->readers++;
+#endif
+	mapptr = pager_map_leaf(pager, &f_page);
+	if (mapptr) {
+	    *old = mapptr[f_page];
+	    mapptr[f_page] = block;
+	}
+#if	DEBUG_READER_CONFLICTS
+	pager->readers--;
+#endif
+	pthread_mutex_unlock(&pager->lock);
+	return (mapptr != 0);
+}
+
 /*
  * Deallocate all of the blocks belonging to a paging object.
  * No locking needed because no other operations can be in progress.
@@ -1495,6 +1686,20 @@ pager_dealloc(pager)
 	dp_map_t	mapptr;
 	union dp_map	block;
 
+	if (pager->ra_addr) {
+	    (void) vm_deallocate(mach_task_self(), pager->ra_addr,
+				 pager->ra_size);
+	    pager->ra_addr = 0;
+	}
+
+#ifdef	CHECKSUM
+	for (i = 0; i < pager->checksum_blocks; i++)
+	    free((char *)pager->checksum[i]);
+	free((char *)pager->checksum);
+	pager->checksum = 0;
+	pager->checksum_blocks = 0;
+#endif	 /* CHECKSUM */
+
 	if (!pager->map)
 	    return;
 
@@ -1514,15 +1719,6 @@ pager_dealloc(pager)
 	    }
 	    free((char *)pager->map);
 	    pager->map = (dp_map_t) 0;
-#ifdef	CHECKSUM
-	    for (i = INDIRECT_PAGEMAP_ENTRIES(pager->size); --i >= 0; ) {
-		mapptr = (vm_offset_t *)pager->checksum[i];
-		if (mapptr) {
-		    free((char *)mapptr);
-		}
-	    }
-	    free((char *)pager->checksum);
-#endif	 /* CHECKSUM */
 	}
 	else {
 	    mapptr = pager->map;
@@ -1534,9 +1730,6 @@ pager_dealloc(pager)
 	    }
 	    free((char *)pager->map);
 	    pager->map = (dp_map_t) 0;
-#ifdef	CHECKSUM
-	    free((char *)pager->checksum);
-#endif	 /* CHECKSUM */
 	}
 }
 
@@ -1607,6 +1800,129 @@ ok:
 #define	PAGER_ABSENT	1
 #define	PAGER_ERROR	2
 
+/*
+ * Read-ahead.  A paging object remembers the offset following its
+ * last read.  When a read hits that offset, the swap blocks following
+ * the one being read are fetched along with it, as long as they hold
+ * the following pages of the object, and kept until these pages are
+ * requested or overwritten.
+ */
+
+/*
+ * Drop the read-ahead data of PAGER overlapping [OFFSET, OFFSET+SIZE).
+ */
+static void
+pager_ra_invalidate(pager, offset, size)
+	dpager_t	pager;
+	vm_offset_t	offset;
+	vm_size_t	size;
+{
+	pthread_mutex_lock(&pager->lock);
+	pager->ra_gen++;
+	if (pager->ra_addr
+	    && offset < pager->ra_offset + pager->ra_size
+	    && offset + size > pager->ra_offset) {
+	    (void) vm_deallocate(mach_task_self(), pager->ra_addr,
+				 pager->ra_size);
+	    pager->ra_addr = 0;
+	}
+	pthread_mutex_unlock(&pager->lock);
+}
+
+/*
+ * Copy the page at OFFSET, stored in BLOCK, from the read-ahead data
+ * of PAGER to ADDR.  Return FALSE if it is not there; *SEQUENTIAL is
+ * then set if the read follows the previous one, and *GEN to the
+ * write generation to pass to pager_ra_install.
+ */
+static boolean_t
+pager_ra_lookup(pager, block, offset, addr, sequential, gen)
+	dpager_t	pager;
+	union dp_map	block;
+	vm_offset_t	offset;
+	vm_offset_t	addr;
+	boolean_t	*sequential;
+	unsigned int	*gen;
+{
+	boolean_t	found = FALSE;
+
+	pthread_mutex_lock(&pager->lock);
+	if (pager->ra_addr
+	    && offset >= pager->ra_offset
+	    && offset < pager->ra_offset + pager->ra_size
+	    && block.block.p_index == pager->ra_block.block.p_index
+	    && block.block.p_offset == pager->ra_block.block.p_offset
+				     + atop(offset - pager->ra_offset)) {
+	    memcpy((char *)addr,
+		   (char *)pager->ra_addr + (offset - pager->ra_offset),
+		   vm_page_size);
+	    found = TRUE;
+	}
+	*sequential = (offset == pager->ra_next);
+	*gen = pager->ra_gen;
+	pager->ra_next = offset + vm_page_size;
+	pthread_mutex_unlock(&pager->lock);
+	return (found);
+}
+
+/*
+ * Return the number of pages of PAGER, starting with the one at
+ * OFFSET stored in BLOCK, that live in consecutive blocks of the
+ * same partition.
+ */
+static int
+pager_ra_cluster(pager, block, offset)
+	dpager_t	pager;
+	union dp_map	block;
+	vm_offset_t	offset;
+{
+	union dp_map	next;
+	int		n;
+
+	for (n = 1; n < DEFAULT_PAGER_CLUSTER; n++) {
+	    next = pager_read_offset(pager, offset + ptoa(n));
+	    if (no_block(next)
+		|| next.block.p_index != block.block.p_index
+		|| next.block.p_offset != block.block.p_offset + n)
+		break;
+	}
+	return (n);
+}
+
+/*
+ * Keep the SIZE bytes at ADDR, read from BLOCK, as the read-ahead data
+ * of PAGER for OFFSET, unless the object was written since GEN.
+ */
+static void
+pager_ra_install(pager, block, offset, addr, size, gen)
+	dpager_t	pager;
+	union dp_map	block;
+	vm_offset_t	offset;
+	vm_offset_t	addr;
+	vm_size_t	size;
+	unsigned int	gen;
+{
+	vm_offset_t	old_addr = 0;
+	vm_size_t	old_size = 0;
+
+	pthread_mutex_lock(&pager->lock);
+	if (pager->ra_gen != gen) {
+	    old_addr = addr;
+	    old_size = size;
+	} else {
+	    old_addr = pager->ra_addr;
+	    old_size = pager->ra_size;
+	    pager->ra_addr = addr;
+	    pager->ra_size = size;
+	    pager->ra_offset = offset;
+	    pager->ra_block = block;
+	}
+	pthread_mutex_unlock(&pager->lock);
+
+	if (old_addr)
+	    (void) vm_deallocate(mach_task_self(), old_addr, old_size);
+}
+
 /*
  * Read data from a default pager.  Addr is the address of a buffer
  * to fill.  Out_addr returns the buffer that contains the data;
@@ -1628,6 +1944,9 @@ default_read(ds, addr, size, offset, out_addr, deallocate, external)
 	vm_size_t	rsize;
 	int	rc;
 	boolean_t	first_time;
+	boolean_t	sequential;
+	unsigned int	gen;
+	int		n;
 	partition_t	part;
 #ifdef	CHECKSUM
 	vm_size_t	original_size = size;
@@ -1651,14 +1970,58 @@ default_read(ds, addr, size, offset, out_addr, deallocate, external)
 	    return (PAGER_ABSENT);
 	}
 
-	/*
-	 * Read it, trying for the entire page.
-	 */
+	*out_addr = addr;
+	if (block.block.p_index == ZSWAP_INDEX) {
+	    if (! zswap_read(block.block.p_offset, addr))
+		return (PAGER_ERROR);
+	    goto done;
+	}
+	if (pager_ra_lookup(ds, block, original_offset, addr,
+			    &sequential, &gen))
+	    goto done;
+
 	offset = ptoa(block.block.p_offset);
 ddprintf ("default_read(%lx,%x,%lx,%d)\n",addr,size,offset,block.block.p_index);
 	part   = partition_of(block.block.p_index);
+
+	/*
+	 * On a sequential read, fetch the pages that follow in the
+	 * same request, and keep them for the next reads.
+	 */
+	if (sequential && size == vm_page_size
+	    && (n = pager_ra_cluster(ds, block, original_offset)) > 1) {
+	    rc = page_read_file_direct(part->file,
+				       offset,
+				       ptoa(n),
+				       &raddr,
+				       &rsize);
+	    if (rc == 0 && rsize >= vm_page_size) {
+		memcpy((char *)addr, (char *)raddr, vm_page_size);
+		if (trunc_page(rsize) != rsize) {
+		    (void) vm_deallocate(mach_task_self(),
+					 raddr + trunc_page(rsize),
+					 vm_page_size);
+		    rsize = trunc_page(rsize);
+		}
+		if (rsize > vm_page_size) {
+		    block.block.p_offset++;
+		    pager_ra_install(ds, block,
+				     original_offset + vm_page_size,
+				     raddr + vm_page_size,
+				     rsize - vm_page_size, gen);
+		}
+		(void) vm_deallocate(mach_task_self(), raddr, vm_page_size);
+		goto done;
+	    }
+	    if (rc == 0)
+		(void) vm_deallocate(mach_task_self(), raddr,
+				     round_page(rsize));
+	}
+
+	/*
+	 * Read it, trying for the entire page.
+	 */
 	first_time = TRUE;
-	*out_addr = addr;
 
 	do {
 	    rc = page_read_file_direct(part->file,
@@ -1688,28 +2051,43 @@ ddprintf ("default_read(%lx,%x,%lx,%d)\n",addr,size,offset,block.block.p_index);
 	    size -= rsize;
 	} while (size != 0);
 
-#if	USE_PRECIOUS
-	if (deallocate)
-		pager_release_offset(ds, original_offset);
-#endif	/*USE_PRECIOUS*/
-
+    done:
 #ifdef	CHECKSUM
 	{
-	    int	write_checksum,
-		read_checksum;
+	    vm_offset_t	write_checksum,
+			read_checksum;
 
 	    write_checksum = pager_get_checksum(ds, original_offset);
-	    read_checksum = compute_checksum(*out_addr, original_size);
+	    read_checksum = write_checksum == NO_CHECKSUM ? NO_CHECKSUM
+			    : compute_checksum(*out_addr, original_size);
 	    if (write_checksum != read_checksum) {
-		panic(
-  "PAGER CHECKSUM ERROR: offset 0x%x, written 0x%x, read 0x%x",
-		    original_offset, write_checksum, read_checksum);
+		/*
+		 * Fail just this page, and keep its block, rather than
+		 * take the whole system down.
+		 */
+		dprintf(
+  "%s checksum error: offset 0x%lx, written 0x%lx, read 0x%lx\n",
+		    my_name, original_offset, write_checksum, read_checksum);
+		if (*out_addr != addr)
+		    (void) vm_deallocate(mach_task_self(), *out_addr,
+					 original_size);
+		return (PAGER_ERROR);
 	    }
 	}
 #endif	 /* CHECKSUM */
+
+#if	USE_PRECIOUS
+	if (deallocate)
+		pager_release_offset(ds, original_offset);
+#endif	/*USE_PRECIOUS*/
 	return (PAGER_SUCCESS);
 }
 
+/*
+ * Write SIZE bytes, at most DEFAULT_PAGER_CLUSTER pages, to a default
+ * pager.  Pages that land in consecutive blocks of a partition are
+ * written with a single request.
+ */
 int
 default_write(ds, addr, size, offset)
 	dpager_t	ds;
@@ -1717,57 +2095,112 @@ default_write(ds, addr, size, offset)
 	vm_size_t	size;
 	vm_offset_t	offset;
 {
-	union dp_map	block;
+	union dp_map	block[DEFAULT_PAGER_CLUSTER];
 	partition_t		part;
-	vm_size_t		wsize;
+	vm_offset_t		waddr, woffset;
+	vm_size_t		wsize, wresid;
+	int		i, j, n;
 	int		rc;
+	int		result = PAGER_SUCCESS;
 
 	ddprintf ("default_write: pager offset %lx\n", offset);
 
-	/*
-	 * Find block in paging partition
-	 */
-	block = pager_write_offset(ds, offset);
-	if ( no_block(block) )
-	    return (PAGER_ERROR);
+	n = atop(size);
+	assert_backtrace (n > 0 && n <= DEFAULT_PAGER_CLUSTER);
 
-#ifdef	CHECKSUM
 	/*
-	 * Save checksum
+	 * Compress pages in memory if possible,
+	 * otherwise find blocks in paging partition
 	 */
-	{
-	    int	checksum;
+	for (i = 0; i < n; i++) {
+	    vm_offset_t		slot;
+	    union dp_map	old;
+
+	    invalidate_block(block[i]);
+	    slot = zswap_store(addr + ptoa(i));
+	    if (slot != NO_BLOCK) {
+		block[i].block.p_offset = slot;
+		block[i].block.p_index = ZSWAP_INDEX;
+		if (pager_store_offset(ds, offset + ptoa(i), block[i], &old)) {
+		    if ( ! no_block(old))
+			pager_dealloc_page(old.block.p_index,
+					   old.block.p_offset, TRUE);
+		} else {
+		    zswap_free(slot);
+		    invalidate_block(block[i]);
+		}
+	    }
+	    if (no_block(block[i]))
+		block[i] = pager_write_offset(ds, offset + ptoa(i));
+#ifdef	CHECKSUM
+	    /*
+	     * Save checksum
+	     */
+	    if ( ! no_block(block[i])) {
+		vm_offset_t	checksum = NO_CHECKSUM;
 
-	    checksum = compute_checksum(addr, size);
-	    pager_put_checksum(ds, offset, checksum);
-	}
+		if (block_checksummed(block[i]))
+		    checksum = compute_checksum(addr + ptoa(i), vm_page_size);
+		pager_put_checksum(ds, offset + ptoa(i), checksum);
+	    }
 #endif	 /* CHECKSUM */
-	offset = ptoa(block.block.p_offset);
-ddprintf ("default_write(%lx,%x,%lx,%d)\n",addr,size,offset,block.block.p_index);
-	part   = partition_of(block.block.p_index);
+	}
+
+	pager_ra_invalidate(ds, offset, size);
+
+	for (i = 0; i < n; i = j) {
+	    if (no_block(block[i])) {
+		result = PAGER_ERROR;
+		j = i + 1;
+		continue;
+	    }
+	    if (block[i].block.p_index == ZSWAP_INDEX) {
+		j = i + 1;
+		continue;
+	    }
+	    for (j = i + 1; j < n; j++)
+		if (no_block(block[j])
+		    || block[j].block.p_index != block[i].block.p_index
+		    || block[j].block.p_offset != block[i].block.p_offset + (j - i))
+		    break;
+
+	    waddr   = addr + ptoa(i);
+	    woffset = ptoa(block[i].block.p_offset);
+	    wresid  = ptoa(j - i);
+ddprintf ("default_write(%lx,%x,%lx,%d)\n",waddr,wresid,woffset,block[i].block.p_index);
+	    part   = partition_of(block[i].block.p_index);
+
+	    /*
+	     * A cluster is written up to the end of the storage run
+	     * holding its first block; the rest goes in the next turn.
+	     */
+	    do {
+		rc = page_write_file_direct(part->file,
+					    woffset,
+					    waddr,
+					    wresid,
+					    &wsize);
+		if (rc == 0 && (wsize == 0 || wsize > wresid))
+		    rc = D_IO_ERROR;
+		if (rc != 0) {
+		    dprintf("*** PAGER ERROR: default_write: ");
+		    dprintf("ds=0x%p addr=0x%lx size=0x%x offset=0x%lx resid=0x%x\n",
+			    ds, waddr, wresid, woffset, wsize);
+		    result = PAGER_ERROR;
+		    break;
+		}
+		waddr += wsize;
+		woffset += wsize;
+		wresid -= wsize;
+	    } while (wresid != 0);
+	}
 
 	/*
-	 * There are various assumptions made here,we
-	 * will not get into the next disk 'block' by
-	 * accident. It might well be non-contiguous.
+	 * A concurrent read may have fetched the old contents
+	 * while we were writing.
 	 */
-	do {
-	    rc = page_write_file_direct(part->file,
-					offset,
-					addr,
-					size,
-					&wsize);
-	    if (rc != 0) {
-		dprintf("*** PAGER ERROR: default_write: ");
-		dprintf("ds=0x%p addr=0x%lx size=0x%x offset=0x%lx resid=0x%x\n",
-			ds, addr, size, offset, wsize);
-		return (PAGER_ERROR);
-	    }
-	    addr += wsize;
-	    offset += wsize;
-	    size -= wsize;
-	} while (size != 0);
-	return (PAGER_SUCCESS);
+	pager_ra_invalidate(ds, offset, size);
+	return (result);
 }
 
 boolean_t
@@ -1903,12 +2336,19 @@ dprintf("Partition x%p (id x%x) for %s, all_ok %d\n", part, id, name, all_ok);
 	}
 	pthread_mutex_unlock(&all_pagers.lock);
 
+	/*
+	 * Then the pages evicted from the compressed pool
+	 */
+	if (all_ok)
+		all_ok = zswap_realloc(pindex);
+
 	if (all_ok) {
 		/* No need to unlock partition, there are no refs left */
 
 		set_partition_of(pindex, 0);
 		*pp_private = part->file;
 		free(part->bitmap);
+		free(part->summary);
 		free(part->name);
 		free(part);
 		dprintf("%s Removed paging partition %s\n", my_name, name);
@@ -2620,7 +3060,7 @@ ddprintf ("seqnos_memory_object_data_initialize <%p>: pager_port_unlock: <%p>[s:
 /*
  * memory_object_data_return: split up the stuff coming in from
  * a memory_object_data_write call
- * into individual pages and pass them off to default_write.
+ * into clusters of pages and pass them off to default_write.
  */
 kern_return_t
 seqnos_memory_object_data_return(ds, seqno, pager_request,
@@ -2637,6 +3077,7 @@ seqnos_memory_object_data_return(ds, seqno, pager_request,
 {
 	register
 	vm_size_t	amount_sent;
+	vm_size_t	size;
 	static char	here[] = "%sdata_return";
 	int err;
 
@@ -2679,20 +3120,23 @@ seqnos_memory_object_data_return(ds, seqno, pager_request,
 
 	for (amount_sent = 0;
 	     amount_sent < data_cnt;
-	     amount_sent += vm_page_size) {
+	     amount_sent += size) {
 
 	    int result;
 
+	    size = data_cnt - amount_sent;
+	    if (size > ptoa(DEFAULT_PAGER_CLUSTER))
+		size = ptoa(DEFAULT_PAGER_CLUSTER);
 	    result = default_write(&ds->dpager,
 			      addr + amount_sent,
-			      vm_page_size,
+			      size,
 			      offset + amount_sent);
 	    if (result != KERN_SUCCESS) {
 		dstruct_lock(ds);
 		ds->errors++;
 		dstruct_unlock(ds);
 	    }
-	    default_pager_pageout_count++;
+	    default_pager_pageout_count += atop(size);
 	}
 
 	pager_port_finish_write(ds);
@@ -3213,6 +3657,17 @@ S_default_pager_info (mach_port_t pager,
 	return KERN_SUCCESS;
 }
 
+kern_return_t
+S_default_pager_compressed_info (mach_port_t pager,
+				 default_pager_compressed_info_t *infop)
+{
+	if (pager != default_pager_default_port)
+		return KERN_INVALID_ARGUMENT;
+
+	zswap_info(infop);
+	return KERN_SUCCESS;
+}
+
 kern_return_t
 S_default_pager_storage_info (mach_port_t pager,
 			      vm_size_array_t *size,
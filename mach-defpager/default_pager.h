@@ -34,10 +34,24 @@ kern_return_t add_paging_file(mach_port_t master_device_port,
 			      const char *file_name, int linux_signature);
 kern_return_t remove_paging_file (const char *file_name);
 
+/* Checksum the pages paged out to the partition or file NAME, or to
+   all of them and to the compressed pool if NAME is null; by default
+   nothing is checksummed.  This must be called before the partition is
+   added.  */
+void partition_enable_checksum(const char *name);
+
+/* Do not checksum the pages paged out to the partition or file NAME,
+   even if all the others are.  This must be called before the
+   partition is added.  */
+void partition_disable_checksum(const char *name);
+
 void paging_space_info(vm_size_t *totp, vm_size_t *freep);
 void no_paging_space(boolean_t out_of_memory);
 void overcommitted(boolean_t got_more_space, vm_size_t space);
 
 void panic (const char *fmt, ...) __attribute__ ((noreturn));
 
+/* Size of the compressed in-memory pool, in bytes; zero disables it.  */
+extern vm_size_t zswap_limit;
+
 #endif /* _DEFAULT_PAGER_H_ */
@@ -50,9 +50,12 @@ struct file_direct
   struct storage_run runs[0];
 };
 
-/* These are in fact only called to read or write a single page, from
-   default_pager.c::default_read/default_write.  The SIZE argument is
-   always vm_page_size and OFFSET is always page-aligned.  */
+/* These are called from default_pager.c::default_read/default_write
+   to read or write a cluster of pages.  The SIZE argument is always a
+   multiple of vm_page_size and OFFSET is always page-aligned.  A
+   cluster read or write stops at the end of the run containing OFFSET,
+   so *SIZE_READ or *SIZE_WRITTEN may be less than SIZE.  Only a single
+   page may span runs.  */
 
 int page_read_file_direct (struct file_direct *fdp,
 			   vm_offset_t offset,
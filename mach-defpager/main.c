@@ -78,12 +78,56 @@ static void
 nohandler (int sig)
 { }
 
+/* Parse SIZE, a number of bytes optionally followed by K, M or G.  */
+static vm_size_t
+parse_size (const char *size)
+{
+  char *end;
+  unsigned long long n = strtoull (size, &end, 0);
+
+  switch (*end)
+    {
+    case 'g': case 'G':
+      n <<= 10;
+      /* Fall through.  */
+    case 'm': case 'M':
+      n <<= 10;
+      /* Fall through.  */
+    case 'k': case 'K':
+      n <<= 10;
+      end++;
+    }
+  if (end == size || *end != '\0' || n != (vm_size_t) n)
+    error (1, 0, "invalid size: %s", size);
+  return n;
+}
+
 int
 main (int argc, char **argv)
 {
   const task_t my_task = mach_task_self();
   error_t err;
   memory_object_t defpager;
+  int foreground = 0;
+  int i;
+
+  for (i = 1; i < argc; i++)
+    if (!strcmp (argv[i], "-d"))
+      foreground = 1;
+    else if (!strncmp (argv[i], "--compressed-pool=", 18))
+      zswap_limit = round_page (parse_size (argv[i] + 18));
+    else if (!strcmp (argv[i], "-z") && i + 1 < argc)
+      zswap_limit = round_page (parse_size (argv[++i]));
+    else if (!strcmp (argv[i], "--checksum"))
+      partition_enable_checksum (NULL);
+    else if (!strncmp (argv[i], "--checksum=", 11))
+      partition_enable_checksum (argv[i] + 11);
+    else if (!strncmp (argv[i], "--no-checksum=", 14))
+      partition_disable_checksum (argv[i] + 14);
+    else if (!strcmp (argv[i], "-z"))
+      error (1, 0, "option requires an argument: -z");
+    else
+      error (1, 0, "unrecognized argument: %s", argv[i]);
 
   err = get_privileged_ports (&bootstrap_master_host_port,
 			      &bootstrap_master_device_port);
@@ -97,7 +141,7 @@ main (int argc, char **argv)
   if (MACH_PORT_VALID (defpager))
     error (2, 0, "Another default memory manager is already running");
 
-  if (!(argc == 2 && !strcmp (argv[1], "-d")))
+  if (!foreground)
     {
       /* We don't use the `daemon' function because we might exit back to the
 	 parent before the daemon has completed vm_set_default_memory_manager.
@@ -164,7 +208,7 @@ main (int argc, char **argv)
 
   default_pager_initialize (bootstrap_master_host_port);
 
-  if (!(argc == 2 && !strcmp (argv[1], "-d")))
+  if (!foreground)
     kill (getppid (), SIGUSR1);
 
   /*
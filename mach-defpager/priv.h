@@ -30,6 +30,7 @@
 #include <mach.h>
 #include <queue.h>
 #include <hurd/ihash.h>
+#include <hurd/default_pager_types.h>
 
 /*
  * Bitmap allocation.
@@ -56,7 +57,10 @@ struct part {
 	vm_size_t	free;		/* number of blocks free */
 	unsigned int	id;		/* named lookup */
 	bm_entry_t	*bitmap;	/* allocation map */
+	bm_entry_t	*summary;	/* bit set for each full bitmap entry */
+	unsigned int	hint;		/* summary entries below are full */
 	boolean_t	going_away;	/* destroy attempt in progress */
+	boolean_t	checksum;	/* checksum pages paged out here */
 	struct file_direct *file;	/* file paged to */
 };
 typedef	struct part	*partition_t;
@@ -111,6 +115,13 @@ typedef union dp_map	*dp_map_t;
 #define	no_block(e)		((e).indirect == (dp_map_t)NO_BLOCK)
 #define	invalidate_block(e)	((e).indirect = (dp_map_t)NO_BLOCK)
 
+/*
+ * Keep a checksum of each page paged out and verify it when the page
+ * is read back.  Which partitions get checksums is chosen at run time
+ * (see partition_enable_checksum).  This must be seen by struct dpager.
+ */
+#define	CHECKSUM	1
+
 struct dpager {
 	pthread_mutex_t	lock;		/* lock for extending block map */
 					/* XXX should be read-write lock */
@@ -124,8 +135,18 @@ struct dpager {
 	vm_size_t	byte_limit; /* limit, which wasn't
 				       rounded to page boundary */
 	p_index_t	cur_partition;
+	/* Read-ahead state, protected by LOCK.  */
+	vm_offset_t	ra_next;	/* offset following the last read */
+	vm_offset_t	ra_offset;	/* offset of the read-ahead data */
+	vm_offset_t	ra_addr;	/* read-ahead data, or 0 */
+	vm_size_t	ra_size;	/* size of the read-ahead data */
+	union dp_map	ra_block;	/* block holding RA_OFFSET */
+	unsigned int	ra_gen;		/* bumped by every write */
 #ifdef	CHECKSUM
-	vm_offset_t	*checksum;	/* checksum - parallel to block map */
+	/* Checksums of the pages, by blocks of PAGEMAP_ENTRIES allocated
+	   when a checksum is first stored in them.  */
+	vm_offset_t	**checksum;
+	vm_size_t	checksum_blocks; /* size of the CHECKSUM array */
 #define	NO_CHECKSUM	((vm_offset_t)-1)
 #endif	 /* CHECKSUM */
 };
@@ -199,4 +220,25 @@ struct pager_port {
 /* The list of pagers.  */
 extern struct pager_port all_pagers;
 
+#define	ptoa(p)	((p)*vm_page_size)
+#define	atop(a)	((a)/vm_page_size)
+
+partition_t	partition_of();
+p_index_t	choose_partition();
+vm_offset_t	pager_alloc_page();
+void		pager_dealloc_page();
+union dp_map	pager_move_page();
+
+/*
+ * Compressed in-memory tier (zswap.c).  Its pages are recorded in
+ * block maps as slots of the ZSWAP_INDEX pseudo-partition.
+ */
+#define	ZSWAP_INDEX	((p_index_t)(P_INDEX_INVALID - 1))
+
+vm_offset_t	zswap_store(vm_offset_t addr);
+boolean_t	zswap_read(vm_offset_t slot, vm_offset_t addr);
+void		zswap_free(vm_offset_t slot);
+boolean_t	zswap_realloc(p_index_t pindex);
+void		zswap_info(default_pager_compressed_info_t *infop);
+
 #endif /* __MACH_DEFPAGER_PRIV_H__ */
@@ -85,14 +85,16 @@ S_default_pager_paging_storage (mach_port_t pager,
   fdp->fd_size = 0;
   for (i = 0; i < nrun; i += 2)
     {
-      fdp->runs[i].start = runs[i];
-      fdp->runs[i].length = runs[i + 1];
-      if (fdp->runs[i].start + fdp->runs[i].length > devsize)
+      struct storage_run *r = &fdp->runs[i / 2];
+
+      r->start = runs[i];
+      r->length = runs[i + 1];
+      if (r->length == 0 || r->start + r->length > devsize)
 	{
 	  free (fdp);
 	  return EINVAL;
 	}
-      fdp->fd_size += fdp->runs[i].length;
+      fdp->fd_size += r->length;
     }
 
   /* Now really do it.  */
@@ -101,7 +103,7 @@ S_default_pager_paging_storage (mach_port_t pager,
 }
 
 
-/* Called to read a page from backing store.  */
+/* Called to read a cluster of pages from backing store.  */
 int
 page_read_file_direct (struct file_direct *fdp,
 		       vm_offset_t offset,
@@ -116,18 +118,26 @@ page_read_file_direct (struct file_direct *fdp,
   mach_msg_type_number_t nread;
 
   assert_backtrace (page_aligned (offset));
-  assert_backtrace (size == vm_page_size);
+  assert_backtrace (size > 0 && page_aligned (size));
 
   offset >>= fdp->bshift;
 
   assert_backtrace (offset + (size >> fdp->bshift) <= fdp->fd_size);
 
   /* Find the run containing the beginning of the page.  */
-  for (r = fdp->runs; offset > r->length; ++r)
+  for (r = fdp->runs; offset >= r->length; ++r)
     offset -= r->length;
 
+  if (size > vm_page_size && offset + (size >> fdp->bshift) > r->length)
+    {
+      /* Only read the pages of a cluster that fit in this run.  */
+      size = trunc_page ((r->length - offset) << fdp->bshift);
+      if (size == 0)
+	size = vm_page_size;
+    }
+
   if (offset + (size >> fdp->bshift) <= r->length)
-    /* The first run contains the whole page.  */
+    /* The first run contains the whole cluster.  */
     return device_read (fdp->device, 0, r->start + offset,
 			size, (char **) addr, size_read);
 
@@ -144,14 +154,16 @@ page_read_file_direct (struct file_direct *fdp,
     {
       readloc += nread;
       offset += nread >> fdp->bshift;
-      if (offset > r->length)
+      if (offset >= r->length)
 	offset -= r++->length;
 
       /* We always get another out-of-line page, so we have to copy
 	 out of that page and deallocate it.  */
+      nread = (r->length - offset) << fdp->bshift;
+      if (nread > size)
+	nread = size;
       err = device_read (fdp->device, 0, r->start + offset,
-			 (r->length - offset) << fdp->bshift,
-			 &page, &nread);
+			 nread, &page, &nread);
       if (err)
 	{
 	  vm_deallocate (mach_task_self (),
@@ -167,7 +179,7 @@ page_read_file_direct (struct file_direct *fdp,
   return 0;
 }
 
-/* Called to write a page to backing store.  */
+/* Called to write a cluster of pages to backing store.  */
 int
 page_write_file_direct(struct file_direct *fdp,
 		       vm_offset_t offset,
@@ -178,21 +190,32 @@ page_write_file_direct(struct file_direct *fdp,
   struct storage_run *r;
   error_t err;
   int wrote;
+  vm_size_t total = size;
 
   assert_backtrace (page_aligned (offset));
-  assert_backtrace (size == vm_page_size);
+  assert_backtrace (size > 0 && page_aligned (size));
 
   offset >>= fdp->bshift;
 
   assert_backtrace (offset + (size >> fdp->bshift) <= fdp->fd_size);
 
   /* Find the run containing the beginning of the page.  */
-  for (r = fdp->runs; offset > r->length; ++r)
+  for (r = fdp->runs; offset >= r->length; ++r)
     offset -= r->length;
 
+  if (size > vm_page_size && offset + (size >> fdp->bshift) > r->length)
+    {
+      /* Only write the pages of a cluster that fit in this run; the
+	 caller writes the rest with another call.  */
+      size = trunc_page ((r->length - offset) << fdp->bshift);
+      if (size == 0)
+	size = vm_page_size;
+      total = size;
+    }
+
   if (offset + (size >> fdp->bshift) <= r->length)
     {
-      /* The first run contains the whole page.  */
+      /* The first run contains the whole cluster.  */
       err = device_write (fdp->device, 0, r->start + offset,
 			  (char *) addr, size, &wrote);
       *size_written = wrote;
@@ -214,7 +237,7 @@ page_write_file_direct(struct file_direct *fdp,
 
       addr += wrote;
       offset += wrote >> fdp->bshift;
-      if (offset > r->length)
+      if (offset >= r->length)
 	offset -= r++->length;
 
       segsize = (r->length - offset) << fdp->bshift;
@@ -223,16 +246,12 @@ page_write_file_direct(struct file_direct *fdp,
       err = device_write (fdp->device, 0, r->start + offset,
 			  (char *) addr, segsize, &wrote);
       if (err)
-	{
-	  vm_deallocate (mach_task_self (),
-			 (vm_address_t) addr, vm_page_size);
-	  return err;
-	}
+	return err;
 
       size -= wrote;
     } while (size > 0);
 
-  *size_written = vm_page_size;
+  *size_written = total;
   return 0;
 }
 
@@ -0,0 +1,628 @@
+/* Compressed in-memory tier of the Hurd default pager.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Pages handed to the default pager are first compressed into a pool
+   of (wired) memory of at most ZSWAP_LIMIT bytes.  Such a page is
+   recorded in the block map of its object as a slot of the
+   ZSWAP_INDEX pseudo-partition.  When the pool is full, its least
+   recently used pages are written to a paging partition, and their
+   slot records the block they were written to until the object
+   rewrites or releases the page.  Pages which do not compress well
+   never enter the pool.  */
+
+#include <mach.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert-backtrace.h>
+
+#include <hurd/default_pager_types.h>
+
+#include "default_pager.h"
+#include "priv.h"
+
+/* Size of the pool, in bytes; zero disables the tier.  */
+vm_size_t zswap_limit;
+
+/* A page compressed to more than this many bytes is not worth
+   keeping in memory.  */
+#define ZSWAP_MAX_SIZE		(vm_page_size * 3 / 4)
+
+/* Number of pages written to disk at once when the pool is full.  */
+#define ZSWAP_EVICT_BATCH	16
+
+/* The block map keeps 24 bits of slot number.  */
+#define ZSWAP_MAX_SLOTS		(1 << 24)
+
+#define NO_SLOT			((vm_offset_t) -1)
+
+enum zslot_state
+{
+  ZS_FREE,			/* unused */
+  ZS_MEMORY,			/* compressed in the pool */
+  ZS_EVICTING,			/* being written to disk */
+  ZS_DEAD,			/* freed while being written to disk */
+  ZS_DISK,			/* written to disk */
+};
+
+struct zslot
+{
+  enum zslot_state state;
+  vm_size_t size;		/* size of the compressed data */
+  unsigned char *data;		/* compressed data, unless ZS_DISK */
+  union dp_map block;		/* block on disk, if ZS_DISK */
+  int readers;			/* reads of BLOCK in progress */
+  /* Free list link, or LRU list links of ZS_MEMORY slots.  */
+  vm_offset_t prev, next;
+};
+
+static pthread_mutex_t zswap_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled when the last read of the block of a slot is done.  */
+static pthread_cond_t zswap_read_done = PTHREAD_COND_INITIALIZER;
+static struct zslot *zslots;
+static vm_size_t zslots_count;
+static vm_offset_t zslots_free = NO_SLOT;
+
+/* The ZS_MEMORY slots, least recently used first.  */
+static vm_offset_t lru_first = NO_SLOT, lru_last = NO_SLOT;
+
+static vm_size_t zswap_used;	/* bytes of compressed data */
+static vm_size_t zswap_pages;	/* pages in the pool */
+static vm_size_t zswap_stores, zswap_hits, zswap_evictions, zswap_rejects;
+
+/* Compression.  This is a byte-oriented LZ77: each group of eight
+   items is preceded by a byte whose bits tell which items are
+   matches.  A literal is a single byte.  A match takes two bytes,
+   holding a 12-bit backward distance and a 4-bit length (minus 3);
+   a length field of 15 is followed by a byte to add to it.  */
+
+#define LZ_HASH_BITS	12
+#define LZ_MAX_DIST	4095
+#define LZ_MIN_MATCH	3
+#define LZ_MAX_MATCH	(LZ_MIN_MATCH + 15 + 255)
+
+static inline unsigned int
+lz_hash (const unsigned char *p)
+{
+  unsigned int v = p[0] | p[1] << 8 | p[2] << 16;
+  return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* Compress the LEN bytes at IN into the MAX bytes at OUT.  Return the
+   compressed size, or 0 if it would exceed MAX.  */
+static size_t
+lz_compress (const unsigned char *in, size_t len,
+	     unsigned char *out, size_t max)
+{
+  unsigned int table[1 << LZ_HASH_BITS];
+  const unsigned char *ip = in, *end = in + len;
+  unsigned char *op = out, *oend = out + max;
+  unsigned char *ctrl = NULL;
+  int bit = 8;
+
+  memset (table, 0, sizeof table);
+
+  while (ip < end)
+    {
+      if (bit == 8)
+	{
+	  if (op >= oend)
+	    return 0;
+	  ctrl = op++;
+	  *ctrl = 0;
+	  bit = 0;
+	}
+
+      if (end - ip >= LZ_MIN_MATCH)
+	{
+	  unsigned int h = lz_hash (ip);
+	  unsigned int cand = table[h];
+
+	  table[h] = ip - in + 1;
+	  if (cand)
+	    {
+	      const unsigned char *ref = in + cand - 1;
+	      size_t dist = ip - ref;
+
+	      if (dist <= LZ_MAX_DIST
+		  && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2])
+		{
+		  size_t n = LZ_MIN_MATCH, max_n = end - ip, l;
+
+		  if (max_n > LZ_MAX_MATCH)
+		    max_n = LZ_MAX_MATCH;
+		  while (n < max_n && ref[n] == ip[n])
+		    n++;
+
+		  l = n - LZ_MIN_MATCH;
+		  if (oend - op < (l < 15 ? 2 : 3))
+		    return 0;
+		  *ctrl |= 1 << bit++;
+		  *op++ = dist >> 4;
+		  *op++ = (dist & 15) << 4 | (l < 15 ? l : 15);
+		  if (l >= 15)
+		    *op++ = l - 15;
+		  ip += n;
+		  continue;
+		}
+	    }
+	}
+
+      if (op >= oend)
+	return 0;
+      *op++ = *ip++;
+      bit++;
+    }
+
+  return op - out;
+}
+
+/* Decompress the LEN bytes at IN into the OUTLEN bytes at OUT.
+   Return 0 on success, -1 if the data is corrupt.  */
+static int
+lz_decompress (const unsigned char *in, size_t len,
+	       unsigned char *out, size_t outlen)
+{
+  const unsigned char *ip = in, *iend = in + len;
+  unsigned char *op = out, *oend = out + outlen;
+
+  while (ip < iend)
+    {
+      unsigned int ctrl = *ip++;
+      int bit;
+
+      for (bit = 0; bit < 8 && ip < iend; bit++)
+	if (ctrl & (1 << bit))
+	  {
+	    size_t dist, n;
+	    const unsigned char *ref;
+
+	    if (iend - ip < 2)
+	      return -1;
+	    dist = ip[0] << 4 | ip[1] >> 4;
+	    n = ip[1] & 15;
+	    ip += 2;
+	    if (n == 15)
+	      {
+		if (ip >= iend)
+		  return -1;
+		n += *ip++;
+	      }
+	    n += LZ_MIN_MATCH;
+
+	    if (dist == 0 || dist > (size_t) (op - out)
+		|| n > (size_t) (oend - op))
+	      return -1;
+	    /* The source may overlap the destination.  */
+	    for (ref = op - dist; n > 0; n--)
+	      *op++ = *ref++;
+	  }
+	else
+	  {
+	    if (op >= oend)
+	      return -1;
+	    *op++ = *ip++;
+	  }
+    }
+
+  return op == oend ? 0 : -1;
+}
+
+/* Slot management.  ZSWAP_LOCK must be held.  */
+
+static void
+lru_unlink (vm_offset_t slot)
+{
+  struct zslot *s = &zslots[slot];
+
+  if (s->prev == NO_SLOT)
+    lru_first = s->next;
+  else
+    zslots[s->prev].next = s->next;
+  if (s->next == NO_SLOT)
+    lru_last = s->prev;
+  else
+    zslots[s->next].prev = s->prev;
+}
+
+static void
+lru_append (vm_offset_t slot)
+{
+  struct zslot *s = &zslots[slot];
+
+  s->prev = lru_last;
+  s->next = NO_SLOT;
+  if (lru_last == NO_SLOT)
+    lru_first = slot;
+  else
+    zslots[lru_last].next = slot;
+  lru_last = slot;
+}
+
+static vm_offset_t
+zslot_alloc (void)
+{
+  vm_offset_t slot;
+
+  if (zslots_free == NO_SLOT)
+    {
+      vm_size_t n = zslots_count ? zslots_count * 2 : 1024;
+      struct zslot *new;
+      vm_offset_t i;
+
+      if (n > ZSWAP_MAX_SLOTS)
+	n = ZSWAP_MAX_SLOTS;
+      if (n == zslots_count)
+	return NO_SLOT;
+      new = realloc (zslots, n * sizeof *new);
+      if (new == NULL)
+	return NO_SLOT;
+      zslots = new;
+      for (i = n; i-- > zslots_count; )
+	{
+	  zslots[i].state = ZS_FREE;
+	  zslots[i].readers = 0;
+	  zslots[i].next = zslots_free;
+	  zslots_free = i;
+	}
+      zslots_count = n;
+    }
+
+  slot = zslots_free;
+  zslots_free = zslots[slot].next;
+  return slot;
+}
+
+static void
+zslot_release (vm_offset_t slot)
+{
+  zslots[slot].state = ZS_FREE;
+  zslots[slot].data = NULL;
+  zslots[slot].next = zslots_free;
+  zslots_free = slot;
+}
+
+/* Write the least recently used pages of the pool to disk.  Return
+   FALSE if none could be.  ZSWAP_LOCK is held, but released while
+   doing I/O.  */
+static boolean_t
+zswap_evict (void)
+{
+  vm_offset_t slot[ZSWAP_EVICT_BATCH];
+  unsigned char *data[ZSWAP_EVICT_BATCH];
+  vm_size_t size[ZSWAP_EVICT_BATCH];
+  union dp_map block[ZSWAP_EVICT_BATCH];
+  union dp_map dead[ZSWAP_EVICT_BATCH];
+  int i, j, n, ndead = 0, nwritten = 0;
+  p_index_t pindex;
+  vm_offset_t buf, near = NO_BLOCK;
+
+  for (n = 0; n < ZSWAP_EVICT_BATCH && lru_first != NO_SLOT; n++)
+    {
+      slot[n] = lru_first;
+      lru_unlink (slot[n]);
+      zslots[slot[n]].state = ZS_EVICTING;
+      data[n] = zslots[slot[n]].data;
+      size[n] = zslots[slot[n]].size;
+    }
+  if (n == 0)
+    return FALSE;
+
+  pthread_mutex_unlock (&zswap_lock);
+
+  /* Allocate consecutive blocks if possible, and write each run of
+     them at once.  */
+  for (i = 0; i < n; i++)
+    invalidate_block (block[i]);
+  pindex = choose_partition (ptoa (n), P_INDEX_INVALID);
+  if (no_partition (pindex))
+    pindex = choose_partition (ptoa (1), P_INDEX_INVALID);
+  if (! no_partition (pindex))
+    for (i = 0; i < n; i++)
+      {
+	vm_offset_t off = pager_alloc_page (pindex, TRUE, near);
+	if (off == NO_BLOCK)
+	  break;
+	block[i].block.p_index = pindex;
+	block[i].block.p_offset = off;
+	near = off + 1;
+      }
+
+  buf = (vm_offset_t) malloc (ptoa (n));
+  for (i = 0; buf && i < n; i++)
+    if (! no_block (block[i])
+	&& lz_decompress (data[i], size[i], (unsigned char *) buf + ptoa (i),
+			  vm_page_size))
+      panic ("zswap: corrupt compressed page");
+
+  for (i = 0; buf && i < n; i = j)
+    {
+      partition_t part;
+      vm_offset_t waddr, woffset;
+      vm_size_t wresid, wsize;
+
+      if (no_block (block[i]))
+	break;
+      for (j = i + 1; j < n; j++)
+	if (no_block (block[j])
+	    || block[j].block.p_offset != block[i].block.p_offset + (j - i))
+	  break;
+
+      part = partition_of (pindex);
+      waddr = buf + ptoa (i);
+      woffset = ptoa (block[i].block.p_offset);
+      wresid = ptoa (j - i);
+      do
+	{
+	  if (page_write_file_direct (part->file, woffset, waddr, wresid,
+				      &wsize) != 0)
+	    break;
+	  waddr += wsize;
+	  woffset += wsize;
+	  wresid -= wsize;
+	}
+      while (wresid != 0);
+      if (wresid != 0)
+	break;
+      nwritten = j;
+    }
+  free ((void *) buf);
+
+  /* The pages past NWRITTEN go back to the pool.  */
+  for (i = nwritten; i < n; i++)
+    if (! no_block (block[i]))
+      {
+	pager_dealloc_page (block[i].block.p_index, block[i].block.p_offset,
+			    TRUE);
+	invalidate_block (block[i]);
+      }
+
+  pthread_mutex_lock (&zswap_lock);
+  for (i = 0; i < n; i++)
+    {
+      struct zslot *s = &zslots[slot[i]];
+
+      if (s->state == ZS_DEAD)
+	{
+	  if (i < nwritten)
+	    dead[ndead++] = block[i];
+	  free (s->data);
+	  zswap_used -= s->size;
+	  zswap_pages--;
+	  zslot_release (slot[i]);
+	}
+      else if (i < nwritten)
+	{
+	  free (s->data);
+	  zswap_used -= s->size;
+	  zswap_pages--;
+	  zswap_evictions++;
+	  s->data = NULL;
+	  s->block = block[i];
+	  s->state = ZS_DISK;
+	}
+      else
+	{
+	  s->state = ZS_MEMORY;
+	  lru_append (slot[i]);
+	}
+    }
+
+  if (ndead)
+    {
+      pthread_mutex_unlock (&zswap_lock);
+      for (i = 0; i < ndead; i++)
+	pager_dealloc_page (dead[i].block.p_index, dead[i].block.p_offset,
+			    TRUE);
+      pthread_mutex_lock (&zswap_lock);
+    }
+
+  return nwritten > 0;
+}
+
+/* Compress the page at ADDR into the pool.  Return its slot, or
+   NO_BLOCK if it has to go to disk.  */
+vm_offset_t
+zswap_store (vm_offset_t addr)
+{
+  unsigned char *buf, *shrunk;
+  vm_size_t size;
+  vm_offset_t slot;
+
+  if (zswap_limit == 0)
+    return NO_BLOCK;
+
+  buf = malloc (ZSWAP_MAX_SIZE);
+  if (buf == NULL)
+    return NO_BLOCK;
+  size = lz_compress ((unsigned char *) addr, vm_page_size,
+		      buf, ZSWAP_MAX_SIZE);
+  if (size == 0 || size > zswap_limit)
+    {
+      free (buf);
+      pthread_mutex_lock (&zswap_lock);
+      zswap_rejects++;
+      pthread_mutex_unlock (&zswap_lock);
+      return NO_BLOCK;
+    }
+  shrunk = realloc (buf, size);
+  if (shrunk)
+    buf = shrunk;
+
+  pthread_mutex_lock (&zswap_lock);
+  while (zswap_used + size > zswap_limit)
+    if (! zswap_evict ())
+      break;
+  if (zswap_used + size > zswap_limit
+      || (slot = zslot_alloc ()) == NO_SLOT)
+    {
+      pthread_mutex_unlock (&zswap_lock);
+      free (buf);
+      return NO_BLOCK;
+    }
+
+  zslots[slot].state = ZS_MEMORY;
+  zslots[slot].data = buf;
+  zslots[slot].size = size;
+  lru_append (slot);
+  zswap_used += size;
+  zswap_pages++;
+  zswap_stores++;
+  pthread_mutex_unlock (&zswap_lock);
+
+  return slot;
+}
+
+/* Read the page stored in SLOT into the page at ADDR.  Return FALSE
+   on I/O error.  */
+boolean_t
+zswap_read (vm_offset_t slot, vm_offset_t addr)
+{
+  struct zslot *s;
+  union dp_map block;
+  partition_t part;
+  vm_offset_t raddr;
+  vm_size_t rsize;
+
+  pthread_mutex_lock (&zswap_lock);
+  s = &zslots[slot];
+  if (s->state != ZS_DISK)
+    {
+      assert_backtrace (s->state == ZS_MEMORY || s->state == ZS_EVICTING);
+      if (lz_decompress (s->data, s->size, (unsigned char *) addr,
+			 vm_page_size))
+	panic ("zswap: corrupt compressed page");
+      if (s->state == ZS_MEMORY)
+	{
+	  lru_unlink (slot);
+	  lru_append (slot);
+	}
+      zswap_hits++;
+      pthread_mutex_unlock (&zswap_lock);
+      return TRUE;
+    }
+  /* Keep zswap_realloc from moving the block, and its partition from
+     going away, until the read is done.  */
+  block = s->block;
+  s->readers++;
+  pthread_mutex_unlock (&zswap_lock);
+
+  part = partition_of (block.block.p_index);
+  if (page_read_file_direct (part->file, ptoa (block.block.p_offset),
+			     vm_page_size, &raddr, &rsize) != 0)
+    rsize = 0;
+  else if (rsize != vm_page_size)
+    (void) vm_deallocate (mach_task_self (), raddr, round_page (rsize));
+  else
+    {
+      memcpy ((void *) addr, (void *) raddr, vm_page_size);
+      (void) vm_deallocate (mach_task_self (), raddr, vm_page_size);
+    }
+
+  pthread_mutex_lock (&zswap_lock);
+  /* ZSLOTS may have moved meanwhile.  */
+  if (--zslots[slot].readers == 0)
+    pthread_cond_broadcast (&zswap_read_done);
+  pthread_mutex_unlock (&zswap_lock);
+
+  return rsize == vm_page_size;
+}
+
+/* Release SLOT.  */
+void
+zswap_free (vm_offset_t slot)
+{
+  struct zslot *s;
+  union dp_map block;
+
+  pthread_mutex_lock (&zswap_lock);
+  s = &zslots[slot];
+  switch (s->state)
+    {
+    case ZS_MEMORY:
+      lru_unlink (slot);
+      free (s->data);
+      zswap_used -= s->size;
+      zswap_pages--;
+      zslot_release (slot);
+      break;
+
+    case ZS_EVICTING:
+      /* zswap_evict releases it when done.  */
+      s->state = ZS_DEAD;
+      break;
+
+    case ZS_DISK:
+      block = s->block;
+      zslot_release (slot);
+      pthread_mutex_unlock (&zswap_lock);
+      pager_dealloc_page (block.block.p_index, block.block.p_offset, TRUE);
+      return;
+
+    default:
+      panic ("zswap: freeing free slot %lu", (unsigned long) slot);
+    }
+  pthread_mutex_unlock (&zswap_lock);
+}
+
+/* Move the pages written to paging partition PINDEX to other
+   partitions.  The partition is locked.  Return FALSE if some could
+   not be moved.  */
+boolean_t
+zswap_realloc (p_index_t pindex)
+{
+  vm_offset_t slot;
+  union dp_map block;
+
+  pthread_mutex_lock (&zswap_lock);
+  for (slot = 0; slot < zslots_count; slot++)
+    if (zslots[slot].state == ZS_DISK
+	&& zslots[slot].block.block.p_index == pindex)
+      {
+	/* Wait for the reads of the block; the slot may be freed
+	   meanwhile.  */
+	while (zslots[slot].readers > 0)
+	  pthread_cond_wait (&zswap_read_done, &zswap_lock);
+	if (zslots[slot].state != ZS_DISK)
+	  continue;
+	block = pager_move_page (zslots[slot].block);
+	if (no_block (block))
+	  {
+	    pthread_mutex_unlock (&zswap_lock);
+	    return FALSE;
+	  }
+	zslots[slot].block = block;
+      }
+  pthread_mutex_unlock (&zswap_lock);
+  return TRUE;
+}
+
+void
+zswap_info (default_pager_compressed_info_t *infop)
+{
+  pthread_mutex_lock (&zswap_lock);
+  infop->dci_pool_limit = zswap_limit;
+  infop->dci_pool_used = zswap_used;
+  infop->dci_pages = zswap_pages;
+  infop->dci_stores = zswap_stores;
+  infop->dci_hits = zswap_hits;
+  infop->dci_evictions = zswap_evictions;
+  infop->dci_rejects = zswap_rejects;
+  pthread_mutex_unlock (&zswap_lock);
+}
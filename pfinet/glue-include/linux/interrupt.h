@@ -20,27 +20,20 @@ extern pthread_mutex_t net_bh_lock;
 */
 
 /* See sched.c::net_bh_worker comments.  */
-extern pthread_cond_t net_bh_wakeup;
-extern int net_bh_raised;
-
 #define NET_BH	0xb00bee51
 
-/* The only call to this ever reached is in net/core/dev.c::netif_rx,
-   to announce having enqueued a packet on `backlog'.  */
+void net_bh_queue (struct sk_buff_head *queue);
+void net_rx_enqueue (struct sk_buff *skb);
+void net_rx_clear (struct device *dev);
+
+/* Packets are only queued by net/core/dev.c::netif_rx, which wakes up
+   the worker threads of sched.c itself.  */
 static inline void
 mark_bh (int bh)
 {
   assert_backtrace (bh == NET_BH);
-  net_bh_raised = 1;
-  pthread_cond_broadcast (&net_bh_wakeup);
 }
 
-void net_bh (void);
-static inline void
-init_bh (int bh, void (*fn) (void))
-{
-  assert_backtrace (bh == NET_BH);
-  assert_backtrace (fn == &net_bh);
-}
+#define init_bh(bh, fn)		assert_backtrace ((bh) == NET_BH)
 
 #endif
@@ -717,6 +717,9 @@ static void netdev_wakeup(void)
 
 static void dev_clear_backlog(struct device *dev)
 {
+#ifdef _HURD_
+	net_rx_clear(dev);
+#else
 	struct sk_buff *curr;
 	unsigned long flags;
 
@@ -751,6 +754,7 @@ static void dev_clear_backlog(struct device *dev)
 		netdev_dropping = 0;
 #endif
 	}
+#endif
 }
 
 /*
@@ -767,6 +771,10 @@ void netif_rx(struct sk_buff *skb)
 	skb->stamp = xtime;
 #endif
 
+#ifdef _HURD_
+	/* pfinet spreads the packets over several queues, see sched.c.  */
+	net_rx_enqueue(skb);
+#else
 	/* The code is rearranged so that the path is the most
 	   short when CPU is congested, but is still operating.
 	 */
@@ -795,6 +803,7 @@ void netif_rx(struct sk_buff *skb)
 	netdev_dropping = 1;
 	atomic_inc(&netdev_rx_dropped);
 	kfree_skb(skb);
+#endif
 }
 
 #ifdef CONFIG_BRIDGE
@@ -836,7 +845,15 @@ static inline void handle_bridge(struct sk_buff *skb, unsigned short type)
  *	mark_bh(NET_BH);
  */
 
+#ifdef _HURD_
+/*
+ *	pfinet runs the packets of each of its receive queues separately,
+ *	taking them out of the queue before calling us.
+ */
+void net_bh_queue(struct sk_buff_head *queue)
+#else
 void net_bh(void)
+#endif
 {
 	struct packet_type *ptype;
 	struct packet_type *pt_prev;
@@ -853,6 +870,10 @@ void net_bh(void)
 #endif
 #endif
 
+#ifndef _HURD_
+	struct sk_buff_head *queue = &backlog;
+#endif
+
 	NET_PROFILE_ENTER(net_bh);
 	/*
 	 *	Can we send anything now? We want to clear the
@@ -878,7 +899,7 @@ void net_bh(void)
 	 *	disabling interrupts.
 	 */
 
-	while (!skb_queue_empty(&backlog))
+	while (!skb_queue_empty(queue))
 	{
 		struct sk_buff * skb;
 
@@ -891,13 +912,13 @@ void net_bh(void)
 		/*
 		 *	We have a packet. Therefore the queue has shrunk
 		 */
-		skb = skb_dequeue(&backlog);
+		skb = skb_dequeue(queue);
 
 #ifndef _HURD_
 #ifdef CONFIG_CPU_IS_SLOW
 		if (ave_busy > 128*16) {
 			kfree_skb(skb);
-			while ((skb = skb_dequeue(&backlog)) != NULL)
+			while ((skb = skb_dequeue(queue)) != NULL)
 				kfree_skb(skb);
 			break;
 		}
@@ -74,6 +74,16 @@ static atomic_t net_skbcount = ATOMIC_INIT(0);
 static atomic_t net_allocs = ATOMIC_INIT(0);
 static atomic_t net_fails  = ATOMIC_INIT(0);
 
+#ifdef _HURD_
+/* The packet receiver thread allocates and drops buffers without
+   global_lock, so these must really be atomic.  */
+#define skb_stat_inc(v)	__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_RELAXED)
+#define skb_stat_dec(v)	__atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_RELAXED)
+#else
+#define skb_stat_inc(v)	atomic_inc(v)
+#define skb_stat_dec(v)	atomic_dec(v)
+#endif
+
 extern atomic_t ip_frag_mem;
 
 static kmem_cache_t *skbuff_head_cache;
@@ -145,11 +155,11 @@ struct sk_buff *alloc_skb(unsigned int size,int gfp_mask)
 	 * skbuff_head entry in /proc/slabinfo. We keep it only for emergency
 	 * cases.
 	 */
-	atomic_inc(&net_allocs);
+	skb_stat_inc(&net_allocs);
 
 	skb->truesize = size;
 
-	atomic_inc(&net_skbcount);
+	skb_stat_inc(&net_skbcount);
 
 	/* Load the data pointers. */
 	skb->head = data;
@@ -169,7 +179,7 @@ struct sk_buff *alloc_skb(unsigned int size,int gfp_mask)
 nodata:
 	kmem_cache_free(skbuff_head_cache, skb);
 nohead:
-	atomic_inc(&net_fails);
+	skb_stat_inc(&net_fails);
 	return NULL;
 }
 
@@ -208,7 +218,7 @@ void kfree_skbmem(struct sk_buff *skb)
 		kfree(skb->head);
 
 	kmem_cache_free(skbuff_head_cache, skb);
-	atomic_dec(&net_skbcount);
+	skb_stat_dec(&net_skbcount);
 }
 
 /*
@@ -244,8 +254,8 @@ struct sk_buff *skb_clone(struct sk_buff *skb, int gfp_mask)
 	atomic_inc(skb_datarefp(skb));
 	skb->cloned = 1;
        
-	atomic_inc(&net_allocs);
-	atomic_inc(&net_skbcount);
+	skb_stat_inc(&net_allocs);
+	skb_stat_inc(&net_skbcount);
 	dst_clone(n->dst);
 	n->cloned = 1;
 	n->next = n->prev = NULL;
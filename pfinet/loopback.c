@@ -73,9 +73,8 @@ static int loopback_xmit(struct sk_buff *skb, struct device *dev)
 #endif
 
 	/*
-	 *	Calling netif_rx() requires locking net_bh_lock, which
-	 *	has already been done since this function is called by
-	 *	the net_bh worker thread.
+	 *	netif_rx() takes the lock of the receive queue itself,
+	 *	see sched.c.
 	 */
 
 	netif_rx(skb);
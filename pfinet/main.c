@@ -288,7 +288,6 @@ main (int argc,
   error_t err;
   mach_port_t bootstrap;
   struct stat st;
-  pthread_t thread;
 
   pfinet_bucket = ports_create_bucket ();
   addrport_class = ports_create_class (clean_addrport, 0);
@@ -300,14 +299,7 @@ main (int argc,
 
   init_time ();
   ethernet_initialize ();
-  err = pthread_create (&thread, NULL, net_bh_worker, NULL);
-  if (!err)
-    pthread_detach (thread);
-  else
-    {
-      errno = err;
-      perror ("pthread_create");
-    }
+  net_rx_initialize ();
 
   pthread_mutex_lock (&global_lock);
 
@@ -75,7 +75,7 @@ struct sock_user *make_sock_user (struct socket *, int, int, int);
 error_t make_sockaddr_port (struct socket *, int,
 			    mach_port_t *, mach_msg_type_name_t *);
 void init_devices (void);
-void *net_bh_worker (void *);
+void net_rx_initialize (void);
 void init_time (void);
 void ip_rt_add (short, u_long, u_long, u_long, struct device *,
 		u_short, u_long);
@@ -22,11 +22,17 @@
 #include <asm/system.h>
 #include <linux/sched.h>
 #include <linux/interrupt.h>
+#include <net/ip.h>
+#include <linux/udp.h>
+#include <net/checksum.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t net_bh_lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t net_bh_wakeup = PTHREAD_COND_INITIALIZER;
-int net_bh_raised = 0;
 
 struct task_struct current_contents; /* zeros are right default values */
 
@@ -43,34 +49,229 @@ sock_wake_async (struct socket *sock, int how)
 }
 
 
-/* This function is the "net_bh worker thread".
-   The packet receiver thread calls net/core/dev.c::netif_rx with a packet;
-   netif_rx either drops the packet, or enqueues it and wakes us up
-   via mark_bh which is really condition_broadcast on net_bh_wakeup.
-   The packet receiver thread holds net_bh_lock while calling netif_rx.
-   We wake up and take global_lock, which locks out RPC service threads.
-   We then also take net_bh_lock running net_bh.
-   Thus, only this thread running net_bh locks out the packet receiver
-   thread (which takes only net_bh_lock while calling netif_rx), so packets
-   are quickly moved from the Mach port's message queue to the `backlog'
-   queue, or dropped, without synchronizing with RPC service threads.
-   (The RPC service threads lock out the running of net_bh, but not
-   the queuing/dropping of packets in netif_rx.)  */
-void *
+/* Parallel receive checksumming.
+
+   The TCP and UDP checksums of received packets are computed by several
+   "net_bh worker threads" at once, one for each processor.  Everything
+   else on the receive path, like all the socket RPCs, still runs under
+   global_lock, one thread at a time: the Linux 2.2 protocol code relies on
+   that for all its shared state, its spinlocks and atomic operations being
+   compiled out, so there is no per-socket locking.  Checksumming is the
+   only work proportional to the size of the data done on the receive path,
+   so it is the part worth running in parallel when several flows are
+   active.
+
+   The packet receiver thread calls net/core/dev.c::netif_rx with a packet,
+   which calls net_rx_enqueue.  That either drops the packet, or puts it in
+   one of the receive queues, chosen by a hash of its flow, and wakes up the
+   worker of that queue.  The packets of one TCP connection thus always go
+   through the same queue and stay in order.  Only the lock of the queue is
+   taken, so the receiver is never held up by the RPC service threads or by
+   protocol processing.
+
+   A worker takes all the packets of its queue at once, checksums them
+   without any other lock held, and then takes global_lock to run them
+   through the protocol code with net_bh_queue.  */
+
+struct net_rx_queue
+{
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;
+  struct sk_buff_head backlog;
+  int dropping;
+};
+
+static struct net_rx_queue *net_rx_queues;
+static int net_rx_nqueues;
+
+/* Maximum number of receive queues.  */
+#define NET_RX_MAX_QUEUES 8
+
+/* Return the queue of SKB, whose data starts at the network header.  */
+static struct net_rx_queue *
+net_rx_queue (struct sk_buff *skb)
+{
+  struct iphdr *iph = (struct iphdr *) skb->data;
+  unsigned int hash;
+
+  if (net_rx_nqueues == 1
+      || skb->protocol != htons (ETH_P_IP)
+      || skb->len < sizeof *iph)
+    return &net_rx_queues[0];
+
+  hash = iph->saddr ^ iph->daddr ^ iph->protocol;
+  if ((iph->protocol == IPPROTO_TCP || iph->protocol == IPPROTO_UDP)
+      && (iph->frag_off & htons (IP_MF | IP_OFFSET)) == 0
+      && skb->len >= iph->ihl * 4 + 4)
+    hash ^= *(u32 *) (skb->data + iph->ihl * 4);
+  hash ^= hash >> 16;
+  hash ^= hash >> 8;
+  return &net_rx_queues[hash % net_rx_nqueues];
+}
+
+void
+net_rx_enqueue (struct sk_buff *skb)
+{
+  struct net_rx_queue *q = net_rx_queue (skb);
+
+  pthread_mutex_lock (&q->lock);
+  if (q->backlog.qlen > netdev_max_backlog
+      || (q->dropping && q->backlog.qlen > 0))
+    {
+      q->dropping = 1;
+      pthread_mutex_unlock (&q->lock);
+      __atomic_add_fetch (&netdev_rx_dropped.counter, 1, __ATOMIC_RELAXED);
+      kfree_skb (skb);
+      return;
+    }
+  q->dropping = 0;
+  __skb_queue_tail (&q->backlog, skb);
+  pthread_cond_signal (&q->wakeup);
+  pthread_mutex_unlock (&q->lock);
+}
+
+/* Drop the queued packets received on DEV, which is being closed.
+   global_lock is held.  */
+void
+net_rx_clear (struct device *dev)
+{
+  struct sk_buff *skb, *next;
+  int i;
+
+  for (i = 0; i < net_rx_nqueues; i++)
+    {
+      struct net_rx_queue *q = &net_rx_queues[i];
+
+      pthread_mutex_lock (&q->lock);
+      for (skb = q->backlog.next; skb != (struct sk_buff *) &q->backlog;
+	   skb = next)
+	{
+	  next = skb->next;
+	  if (skb->dev == dev)
+	    {
+	      __skb_unlink (skb, &q->backlog);
+	      kfree_skb (skb);
+	    }
+	}
+      pthread_mutex_unlock (&q->lock);
+    }
+}
+
+/* Check the TCP or UDP checksum of SKB the way a network card would, so
+   that the protocol code only has to fold the result.  Fragments and
+   packets with IP options are left for the protocol code to check.  */
+static void
+net_rx_checksum (struct sk_buff *skb)
+{
+  struct iphdr *iph = (struct iphdr *) skb->data;
+  unsigned int len;
+
+  if (skb->protocol != htons (ETH_P_IP)
+      || skb->ip_summed != CHECKSUM_NONE
+      || skb->len < sizeof *iph
+      || iph->version != 4 || iph->ihl != 5
+      || (iph->frag_off & htons (IP_MF | IP_OFFSET)) != 0)
+    return;
+
+  len = ntohs (iph->tot_len);
+  if (len > skb->len || len < sizeof *iph)
+    return;
+  len -= sizeof *iph;
+
+  switch (iph->protocol)
+    {
+    case IPPROTO_UDP:
+      /* The UDP code checksums the datagram only up to its own length
+	 field.  */
+      if (len < sizeof (struct udphdr)
+	  || ntohs (((struct udphdr *) (iph + 1))->len) != len)
+	return;
+      /* Fall through.  */
+    case IPPROTO_TCP:
+      skb->csum = csum_partial ((unsigned char *) (iph + 1), len, 0);
+      skb->ip_summed = CHECKSUM_HW;
+      break;
+    }
+}
+
+static void *
 net_bh_worker (void *arg)
 {
-  pthread_mutex_lock (&net_bh_lock);
+  struct net_rx_queue *q = arg;
+  struct sk_buff_head batch;
+  struct sk_buff *skb;
+
+  skb_queue_head_init (&batch);
   while (1)
     {
-      while (!net_bh_raised)
-        pthread_cond_wait (&net_bh_wakeup, &net_bh_lock);
+      pthread_mutex_lock (&q->lock);
+      while (skb_queue_empty (&q->backlog))
+	pthread_cond_wait (&q->wakeup, &q->lock);
+      while ((skb = __skb_dequeue (&q->backlog)) != NULL)
+	__skb_queue_tail (&batch, skb);
+      q->dropping = 0;
+      pthread_mutex_unlock (&q->lock);
 
-      net_bh_raised = 0;
+      for (skb = batch.next; skb != (struct sk_buff *) &batch;
+	   skb = skb->next)
+	net_rx_checksum (skb);
 
       pthread_mutex_lock (&global_lock);
-      net_bh ();
+      /* The device may have been closed while we were checksumming.  */
+      for (skb = batch.next; skb != (struct sk_buff *) &batch; )
+	{
+	  struct sk_buff *next = skb->next;
+	  if (! (skb->dev->flags & IFF_UP))
+	    {
+	      __skb_unlink (skb, &batch);
+	      kfree_skb (skb);
+	    }
+	  skb = next;
+	}
+      net_bh_queue (&batch);
       pthread_mutex_unlock (&global_lock);
     }
   /*NOTREACHED*/
   return 0;
 }
+
+/* Create the receive queues and the worker threads that checksum their
+   packets, one for each processor.  */
+void
+net_rx_initialize (void)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+  int i;
+
+  if (n < 1)
+    n = 1;
+  if (n > NET_RX_MAX_QUEUES)
+    n = NET_RX_MAX_QUEUES;
+
+  net_rx_queues = calloc (n, sizeof *net_rx_queues);
+  assert_backtrace (net_rx_queues);
+
+  for (i = 0; i < n; i++)
+    {
+      struct net_rx_queue *q = &net_rx_queues[i];
+      pthread_t thread;
+      error_t err;
+
+      pthread_mutex_init (&q->lock, NULL);
+      pthread_cond_init (&q->wakeup, NULL);
+      skb_queue_head_init (&q->backlog);
+
+      err = pthread_create (&thread, NULL, net_bh_worker, q);
+      if (err)
+	{
+	  errno = err;
+	  perror ("pthread_create");
+	  break;
+	}
+      pthread_detach (thread);
+    }
+
+  /* At least the first queue must be served.  */
+  assert_backtrace (i > 0);
+  net_rx_nqueues = i;
+}
@@ -799,6 +799,96 @@ S_proc_getprocinfo (struct proc *callerp,
   return err;
 }
 
+/* Implement proc_getprocinfos as described in <hurd/process.defs>. */
+kern_return_t
+S_proc_getprocinfos (struct proc *callerp,
+		     const pid_t *pids,
+		     size_t npids,
+		     int flags,
+		     int **piarray,
+		     size_t *piarraylen,
+		     int **piflags,
+		     size_t *piflagslen)
+{
+  const int details = flags & (PI_FETCH_THREAD_BASIC | PI_FETCH_THREAD_SCHED);
+  char *buf = (char *) *piarray;
+  size_t bufsize = *piarraylen * sizeof (int);
+  size_t used = 0;
+  int *pifl;
+  size_t i;
+
+  /* No need to check CALLERP here; we don't use it. */
+
+  flags &= ~PI_FETCH_THREAD_WAITS;
+
+  if (npids > *piflagslen)
+    {
+      pifl = mmap (0, npids * sizeof (int), PROT_READ|PROT_WRITE,
+		   MAP_ANON, 0, 0);
+      if (pifl == MAP_FAILED)
+	return ENOMEM;
+    }
+  else
+    pifl = *piflags;
+
+  for (i = 0; i < npids; i++)
+    {
+      int *pi = NULL;
+      size_t pilen = 0;
+      char *waits = NULL;
+      mach_msg_type_number_t waits_len = 0;
+      size_t reclen;
+      error_t err;
+
+      pifl[i] = flags;
+      err = S_proc_getprocinfo (callerp, pids[i], &pifl[i],
+				&pi, &pilen, &waits, &waits_len);
+      if (waits_len > 0)
+	munmap (waits, waits_len);
+      if (err)
+	{
+	  pifl[i] = -1;
+	  continue;
+	}
+
+      /* The length the caller will expect, whatever actually came back
+	 from a relayed request.  */
+      reclen = sizeof (struct procinfo);
+      if (details && pilen * sizeof (int) >= sizeof (struct procinfo))
+	reclen += ((struct procinfo *) pi)->nthreads
+		  * sizeof (((struct procinfo *) pi)->threadinfos[0]);
+
+      if (used + reclen > bufsize)
+	{
+	  size_t newsize = round_page (2 * (used + reclen));
+	  char *new = mmap (0, newsize, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+	  if (new == MAP_FAILED)
+	    {
+	      munmap (pi, pilen * sizeof (int));
+	      pifl[i] = -1;
+	      continue;
+	    }
+	  memcpy (new, buf, used);
+	  if (buf != (char *) *piarray)
+	    munmap (buf, bufsize);
+	  buf = new;
+	  bufsize = newsize;
+	}
+
+      memset (buf + used, 0, reclen);
+      memcpy (buf + used, pi,
+	      pilen * sizeof (int) < reclen ? pilen * sizeof (int) : reclen);
+      used += reclen;
+      munmap (pi, pilen * sizeof (int));
+    }
+
+  *piarray = (int *) buf;
+  *piarraylen = used / sizeof (int);
+  *piflags = pifl;
+  *piflagslen = npids;
+  return 0;
+}
+
 /* Implement proc_make_login_coll as described in <hurd/process.defs>. */
 kern_return_t
 S_proc_make_login_coll (struct proc *p)
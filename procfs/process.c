@@ -215,8 +215,9 @@ process_file_gc_maps (struct proc_stat *ps, char **contents)
   return contents_len;
 }
 
-static ssize_t
-process_file_gc_stat (struct proc_stat *ps, char **contents)
+static error_t
+process_file_gc_stat (struct proc_stat *ps, char **contents,
+		      ssize_t *contents_len)
 {
   struct procinfo *pi = proc_stat_proc_info (ps);
   task_basic_info_t tbi = proc_stat_task_basic_info (ps);
@@ -255,7 +256,7 @@ process_file_gc_stat (struct proc_stat *ps, char **contents)
 
   /* See proc(5) for more information about the contents of each field for the
      Linux procfs.  */
-  return asprintf (contents,
+  return procfs_printf (contents, contents_len,
       "%d (%.*s) %c "		/* pid, command, state */
       "%d %d %d "		/* ppid, pgid, session */
       "%d %d "			/* controlling tty stuff */
@@ -301,24 +302,26 @@ process_file_gc_stat (struct proc_stat *ps, char **contents)
       0LL);
 }
 
-static ssize_t
-process_file_gc_statm (struct proc_stat *ps, char **contents)
+static error_t
+process_file_gc_statm (struct proc_stat *ps, char **contents,
+		       ssize_t *contents_len)
 {
   task_basic_info_t tbi = proc_stat_task_basic_info (ps);
 
-  return asprintf (contents,
+  return procfs_printf (contents, contents_len,
       "%lu %lu 0 0 0 0 0\n",
       tbi->virtual_size  / sysconf(_SC_PAGE_SIZE),
       tbi->resident_size / sysconf(_SC_PAGE_SIZE));
 }
 
-static ssize_t
-process_file_gc_status (struct proc_stat *ps, char **contents)
+static error_t
+process_file_gc_status (struct proc_stat *ps, char **contents,
+			ssize_t *contents_len)
 {
   task_basic_info_t tbi = proc_stat_task_basic_info (ps);
   const char *fn = args_filename (proc_stat_args (ps));
 
-  return asprintf (contents,
+  return procfs_printf (contents, contents_len,
       "Name:\t%.*s\n"
       "State:\t%s\n"
       "Tgid:\t%u\n"
@@ -362,6 +365,13 @@ struct process_file_desc
      hence this simplified signature.  */
   ssize_t (*get_contents) (struct proc_stat *ps, char **contents);
 
+  /* Alternatively, a content generator which formats into the reusable
+     buffer of the node, as procfs_printf() does.  The contents of these
+     files are shared between the nodes of the same process, see
+     procfs_node_cache().  */
+  error_t (*format) (struct proc_stat *ps, char **contents,
+		     ssize_t *contents_len);
+
   /* The cmdline and environ contents don't need any cleaning since they
      point directly into the proc_stat structure.  */
   int no_cleanup;
@@ -391,6 +401,9 @@ process_file_get_contents (void *hook, char **contents, ssize_t *contents_len)
     return EIO;
 
   /* Call the actual content generator (see the definitions below).  */
+  if (file->desc->format)
+    return file->desc->format (file->ps, contents, contents_len);
+
   *contents_len = file->desc->get_contents (file->ps, contents);
   return 0;
 }
@@ -412,6 +425,11 @@ process_file_make_node (void *dir_hook, const void *entry_hook)
     .cleanup_contents = process_file_cleanup_contents,
     .cleanup = free,
   };
+  static const struct procfs_node_ops format_ops = {
+    .get_contents = process_file_get_contents,
+    .cleanup = free,
+    .needed_length = 512,
+  };
   struct process_file_node *f;
   struct node *np;
 
@@ -422,10 +440,13 @@ process_file_make_node (void *dir_hook, const void *entry_hook)
   f->desc = entry_hook;
   f->ps = dir_hook;
 
-  np = procfs_make_node (&ops, f);
+  np = procfs_make_node (f->desc->format ? &format_ops : &ops, f);
   if (! np)
     return NULL;
 
+  if (f->desc->format)
+    procfs_node_cache (np, f->desc, proc_stat_pid (f->ps));
+
   procfs_node_chown (np, proc_stat_owner_uid (f->ps));
   if (f->desc->mode)
     procfs_node_chmod (np, f->desc->mode);
@@ -494,7 +515,7 @@ static struct procfs_dir_entry entries[] = {
   {
     .name = "stat",
     .hook = & (struct process_file_desc) {
-      .get_contents = process_file_gc_stat,
+      .format = process_file_gc_stat,
       .needs = PSTAT_PID | PSTAT_ARGS | PSTAT_STATE | PSTAT_PROC_INFO
 	| PSTAT_TASK | PSTAT_TASK_BASIC | PSTAT_THREAD_BASIC
 	| PSTAT_THREAD_SCHED | PSTAT_THREAD_WAIT,
@@ -506,14 +527,14 @@ static struct procfs_dir_entry entries[] = {
   {
     .name = "statm",
     .hook = & (struct process_file_desc) {
-      .get_contents = process_file_gc_statm,
+      .format = process_file_gc_statm,
       .needs = PSTAT_TASK_BASIC,
     },
   },
   {
     .name = "status",
     .hook = & (struct process_file_desc) {
-      .get_contents = process_file_gc_status,
+      .format = process_file_gc_status,
       .needs = PSTAT_PID | PSTAT_ARGS | PSTAT_STATE | PSTAT_PROC_INFO
         | PSTAT_TASK_BASIC | PSTAT_OWNER_UID | PSTAT_NUM_THREADS,
     },
@@ -17,14 +17,27 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include <mach.h>
 #include <hurd/netfs.h>
 #include <hurd/fshelp.h>
+#include <hurd/ihash.h>
 #include "procfs.h"
+#include "main.h"
+
+struct cache_key
+{
+  const void *key;
+  unsigned long id;
+};
 
 struct netnode
 {
@@ -35,10 +48,169 @@ struct netnode
   char *contents;
   ssize_t contents_len;
 
+  /* reusable buffer, for nodes with a needed_length */
+  char *buf;
+  size_t buf_size;
+
+  /* key of the shared contents, see procfs_node_cache() */
+  struct cache_key cache_key;
+
   /* parent directory, if applicable */
   struct node *parent;
 };
 
+
+/* Shared contents.  The contents of the nodes given a key with
+   procfs_node_cache() are copied here once generated, and copied back
+   into the buffer of any node with the same key which is read within
+   opt_cache_ttl milliseconds, without calling its get_contents
+   callback.  Expired entries are only reclaimed when the table grows,
+   so that it stays proportional to the number of nodes in use.  */
+
+struct cache_entry
+{
+  hurd_ihash_locp_t locp;
+  struct cache_key key;
+  long long stamp;		/* milliseconds */
+  char *contents;
+  ssize_t contents_len;
+};
+
+static hurd_ihash_key_t
+cache_hash (const void *key)
+{
+  return hurd_ihash_hash32 (key, sizeof (struct cache_key), 0);
+}
+
+static int
+cache_compare (const void *a, const void *b)
+{
+  const struct cache_key *x = a, *y = b;
+  return x->key == y->key && x->id == y->id;
+}
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hurd_ihash cache
+  = HURD_IHASH_INITIALIZER_GKI (offsetof (struct cache_entry, locp),
+				NULL, NULL, cache_hash, cache_compare);
+
+/* Expired entries are reclaimed when the table reaches this size.  */
+static size_t cache_prune_mark = 64;
+
+static long long
+cache_now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+static int
+cache_fresh (struct cache_entry *e, long long now)
+{
+  return now >= e->stamp && now - e->stamp < opt_cache_ttl;
+}
+
+static void
+cache_free (struct cache_entry *e)
+{
+  free (e->contents);
+  free (e);
+}
+
+/* Copy the shared contents of NN into its buffer, if they are recent
+   enough.  Return their length, or -1.  */
+static ssize_t
+cache_lookup (struct netnode *nn)
+{
+  struct cache_entry *e;
+  ssize_t len = -1;
+
+  pthread_mutex_lock (&cache_lock);
+  e = hurd_ihash_find (&cache, (hurd_ihash_key_t) &nn->cache_key);
+  if (e && cache_fresh (e, cache_now ()))
+    {
+      if (nn->buf_size < e->contents_len + 1)
+	{
+	  char *buf = realloc (nn->buf, e->contents_len + 1);
+	  if (buf)
+	    {
+	      nn->buf = buf;
+	      nn->buf_size = e->contents_len + 1;
+	    }
+	}
+      if (nn->buf_size >= e->contents_len + 1)
+	{
+	  memcpy (nn->buf, e->contents, e->contents_len);
+	  len = e->contents_len;
+	}
+    }
+  pthread_mutex_unlock (&cache_lock);
+
+  return len;
+}
+
+/* Share the CONTENTS_LEN bytes at CONTENTS under the key of NN.  This
+   is only an optimization, so errors are ignored.  */
+static void
+cache_store (struct netnode *nn, const char *contents, ssize_t contents_len)
+{
+  struct cache_entry *e;
+  long long now = cache_now ();
+  char *copy;
+
+  copy = malloc (contents_len ?: 1);
+  if (! copy)
+    return;
+  memcpy (copy, contents, contents_len);
+
+  pthread_mutex_lock (&cache_lock);
+  e = hurd_ihash_find (&cache, (hurd_ihash_key_t) &nn->cache_key);
+  if (e)
+    free (e->contents);
+  else
+    {
+      if (cache.nr_items >= cache_prune_mark)
+	{
+	  HURD_IHASH_ITERATE (&cache, value)
+	    {
+	      struct cache_entry *old = value;
+	      if (! cache_fresh (old, now))
+		{
+		  hurd_ihash_locp_remove (&cache, old->locp);
+		  cache_free (old);
+		}
+	    }
+	  cache_prune_mark = 2 * cache.nr_items;
+	  if (cache_prune_mark < 64)
+	    cache_prune_mark = 64;
+	}
+
+      e = malloc (sizeof *e);
+      if (e)
+	{
+	  e->key = nn->cache_key;
+	  if (hurd_ihash_add (&cache, (hurd_ihash_key_t) &e->key, e))
+	    {
+	      free (e);
+	      e = NULL;
+	    }
+	}
+      if (! e)
+	{
+	  pthread_mutex_unlock (&cache_lock);
+	  free (copy);
+	  return;
+	}
+    }
+
+  e->stamp = now;
+  e->contents = copy;
+  e->contents_len = contents_len;
+  pthread_mutex_unlock (&cache_lock);
+}
+
 void
 procfs_cleanup_contents_with_free (void *hook, char *cont, ssize_t len)
 {
@@ -109,6 +281,43 @@ void procfs_node_chtype (struct node *np, mode_t type)
     procfs_node_chmod (np, 0777);
 }
 
+void procfs_node_cache (struct node *np, const void *key, unsigned long id)
+{
+  assert_backtrace (np->nn->ops->needed_length);
+  np->nn->cache_key.key = key;
+  np->nn->cache_key.id = id;
+}
+
+error_t
+procfs_printf (char **contents, ssize_t *contents_len, const char *fmt, ...)
+{
+  va_list ap;
+  size_t size = *contents_len;
+  char *buf;
+  int n;
+
+  va_start (ap, fmt);
+  n = vsnprintf (*contents, size, fmt, ap);
+  va_end (ap);
+  if (n < 0)
+    return errno;
+
+  if (n >= size)
+    {
+      buf = realloc (*contents, n + 1);
+      if (! buf)
+	return ENOMEM;
+      *contents = buf;
+
+      va_start (ap, fmt);
+      vsnprintf (buf, n + 1, fmt, ap);
+      va_end (ap);
+    }
+
+  *contents_len = n;
+  return 0;
+}
+
 /* FIXME: possibly not the fastest hash function... */
 ino64_t
 procfs_make_ino (struct node *np, const char *filename)
@@ -132,9 +341,66 @@ procfs_make_ino (struct node *np, const char *filename)
   return (unsigned long) jrand48 (x);
 }
 
+/* Generate the contents of a node with a needed_length into its
+   buffer, or copy them from the shared contents.  */
+static error_t
+get_buffered_contents (struct netnode *nn)
+{
+  char *contents;
+  ssize_t contents_len;
+  error_t err;
+
+  if (nn->buf_size < nn->ops->needed_length)
+    {
+      contents = realloc (nn->buf, nn->ops->needed_length);
+      if (! contents)
+	return ENOMEM;
+      nn->buf = contents;
+      nn->buf_size = nn->ops->needed_length;
+    }
+
+  if (nn->cache_key.key && opt_cache_ttl > 0)
+    {
+      contents_len = cache_lookup (nn);
+      if (contents_len >= 0)
+	{
+	  nn->contents = nn->buf;
+	  nn->contents_len = contents_len;
+	  return 0;
+	}
+    }
+
+  contents = nn->buf;
+  contents_len = nn->buf_size;
+  err = nn->ops->get_contents (nn->hook, &contents, &contents_len);
+
+  /* The buffer may have been reallocated, even on failure.  */
+  nn->buf = contents;
+  if (err)
+    return err;
+  if (contents_len < 0)
+    return ENOMEM;
+  if (nn->buf_size < contents_len + 1)
+    nn->buf_size = contents_len + 1;
+
+  if (nn->cache_key.key && opt_cache_ttl > 0)
+    cache_store (nn, contents, contents_len);
+
+  nn->contents = contents;
+  nn->contents_len = contents_len;
+  return 0;
+}
+
 error_t procfs_get_contents (struct node *np, char **data, ssize_t *data_len)
 {
-  if (! np->nn->contents && np->nn->ops->get_contents)
+  if (! np->nn->contents && np->nn->ops->get_contents
+      && np->nn->ops->needed_length)
+    {
+      error_t err = get_buffered_contents (np->nn);
+      if (err)
+	return err;
+    }
+  else if (! np->nn->contents && np->nn->ops->get_contents)
     {
       char *contents;
       ssize_t contents_len;
@@ -158,7 +424,8 @@ error_t procfs_get_contents (struct node *np, char **data, ssize_t *data_len)
 
 void procfs_refresh (struct node *np)
 {
-  if (np->nn->contents && np->nn->ops->cleanup_contents)
+  if (np->nn->contents && np->nn->ops->cleanup_contents
+      && ! np->nn->ops->needed_length)
     np->nn->ops->cleanup_contents (np->nn->hook, np->nn->contents, np->nn->contents_len);
 
   np->nn->contents = NULL;
@@ -203,6 +470,7 @@ void procfs_cleanup (struct node *np)
   if (np->nn->parent)
     netfs_nrele (np->nn->parent);
 
+  free (np->nn->buf);
   free (np->nn);
 }
 
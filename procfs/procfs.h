@@ -41,6 +41,17 @@ struct procfs_node_ops
   error_t (*get_contents) (void *hook, char **contents, ssize_t *contents_len);
   void (*cleanup_contents) (void *hook, char *contents, ssize_t contents_len);
 
+  /* If nonzero, the contents are generated into a buffer which is kept
+     with the node and reused each time they are refreshed.  On entry to
+     get_contents, *CONTENTS then points to that malloced buffer and
+     *CONTENTS_LEN is its size, at least NEEDED_LENGTH bytes.  The
+     callback should fill it in place, or realloc() it to at least
+     *CONTENTS_LEN + 1 bytes if the contents do not fit (see
+     procfs_printf), and return their length in *CONTENTS_LEN.  Even on
+     failure, *CONTENTS must be left pointing to a valid buffer.
+     cleanup_contents is not used for such nodes.  */
+  size_t needed_length;
+
   /* Lookup NAME in this directory, and store the result in *np.  The
      returned node should be created by lookup() using procfs_make_node() 
      or a derived function.  Note that the parent will be kept alive as
@@ -60,6 +71,13 @@ struct procfs_node_ops
 void procfs_cleanup_contents_with_free (void *, char *, ssize_t);
 void procfs_cleanup_contents_with_vm_deallocate (void *, char *, ssize_t);
 
+/* Helper for the get_contents callback of nodes with a needed_length:
+   format FMT into the buffer *CONTENTS of *CONTENTS_LEN bytes, growing
+   it if needed, and set *CONTENTS_LEN to the length of the result.  */
+error_t procfs_printf (char **contents, ssize_t *contents_len,
+		       const char *fmt, ...)
+  __attribute__ ((format (printf, 3, 4)));
+
 /* Create a new node and return it.  Returns NULL if it fails to allocate
    enough memory.  In this case, ops->cleanup will be invoked.  */
 struct node *procfs_make_node (const struct procfs_node_ops *ops, void *hook);
@@ -77,6 +95,12 @@ void procfs_node_chmod (struct node *np, mode_t mode);
    node has been created.  */
 void procfs_node_chtype (struct node *np, mode_t type);
 
+/* Share the contents of the node NP, which must have a needed_length,
+   with the other nodes given the same KEY and ID: once generated, they
+   are reused for opt_cache_ttl milliseconds.  Must be called right
+   after the node has been created.  */
+void procfs_node_cache (struct node *np, const void *key, unsigned long id);
+
 
 /* Interface for the libnetfs side. */
 
@@ -160,11 +160,9 @@ rootdir_gc_version (void *hook, char **contents, ssize_t *contents_len)
   if (r < 0)
     return errno;
 
-  *contents_len = asprintf (contents,
+  return procfs_printf (contents, contents_len,
       "Linux version 2.6.1 (%s %s %s %s)\n",
       uts.sysname, uts.release, uts.version, uts.machine);
-
-  return 0;
 }
 
 static error_t
@@ -195,9 +193,8 @@ rootdir_gc_uptime (void *hook, char **contents, ssize_t *contents_len)
      proc(5) specifies that it should be equal to USER_HZ times the idle value
      in ticks from /proc/stat.  So we assume a completely idle system both here
      and there to make that work.  */
-  *contents_len = asprintf (contents, "%.2lf %.2lf\n", up_secs, idle_secs);
-
-  return 0;
+  return procfs_printf (contents, contents_len,
+			"%.2lf %.2lf\n", up_secs, idle_secs);
 }
 
 static error_t
@@ -228,7 +225,7 @@ rootdir_gc_stat (void *hook, char **contents, ssize_t *contents_len)
   up_ticks = opt_clk_tck * (time.tv_sec * 1000000. + time.tv_usec) / 1000000.;
   idle_ticks = opt_clk_tck * (idletime.tv_sec * 1000000. + idletime.tv_usec) / 1000000.;
 
-  *contents_len = asprintf (contents,
+  return procfs_printf (contents, contents_len,
       "cpu  %lu 0 0 %lu 0 0 0 0 0\n"
       "cpu0 %lu 0 0 %lu 0 0 0 0 0\n"
       "intr 0\n"
@@ -238,8 +235,6 @@ rootdir_gc_stat (void *hook, char **contents, ssize_t *contents_len)
       up_ticks - idle_ticks, idle_ticks,
       vmstats.pageins, vmstats.pageouts,
       boottime.tv_sec);
-
-  return 0;
 }
 
 static error_t
@@ -255,13 +250,11 @@ rootdir_gc_loadavg (void *hook, char **contents, ssize_t *contents_len)
     return err;
 
   assert_backtrace (cnt == HOST_LOAD_INFO_COUNT);
-  *contents_len = asprintf (contents,
+  return procfs_printf (contents, contents_len,
       "%.2f %.2f %.2f 1/0 0\n",
       hli.avenrun[0] / (double) LOAD_SCALE,
       hli.avenrun[1] / (double) LOAD_SCALE,
       hli.avenrun[2] / (double) LOAD_SCALE);
-
-  return 0;
 }
 
 static error_t
@@ -272,37 +265,37 @@ rootdir_gc_meminfo (void *hook, char **contents, ssize_t *contents_len)
   struct vm_statistics vmstats;
   struct vm_cache_statistics cache_stats;
   default_pager_info_t swap;
-  FILE *m;
+  char swapinfo[64];
   error_t err;
 
-  m = open_memstream (contents, (size_t *) contents_len);
-  if (m == NULL)
-    {
-      err = ENOMEM;
-      goto out;
-    }
-
   err = vm_statistics (mach_task_self (), &vmstats);
   if (err)
-    {
-      err = EIO;
-      goto out;
-    }
+    return EIO;
 
   err = vm_cache_statistics (mach_task_self (), &cache_stats);
   if (err)
-    {
-      err = EIO;
-      goto out;
-    }
+    return EIO;
 
   cnt = HOST_BASIC_INFO_COUNT;
   err = host_info (mach_host_self (), HOST_BASIC_INFO, (host_info_t) &hbi, &cnt);
   if (err)
-    goto out;
+    return err;
 
   assert_backtrace (cnt == HOST_BASIC_INFO_COUNT);
-  fprintf (m,
+
+  err = get_swapinfo (&swap);
+  if (err)
+    /* This is not fatal, we just omit the information.  */
+    swapinfo[0] = '\0';
+  else
+    snprintf (swapinfo, sizeof swapinfo,
+      "SwapTotal:%14lu kB\n"
+      "SwapFree: %14lu kB\n"
+      ,
+      (long unsigned) swap.dpi_total_space / 1024,
+      (long unsigned) swap.dpi_free_space / 1024);
+
+  return procfs_printf (contents, contents_len,
       "MemTotal: %14lu kB\n"
       "MemFree:  %14lu kB\n"
       "Buffers:  %14lu kB\n"
@@ -310,6 +303,7 @@ rootdir_gc_meminfo (void *hook, char **contents, ssize_t *contents_len)
       "Active:   %14lu kB\n"
       "Inactive: %14lu kB\n"
       "Mlocked:  %14lu kB\n"
+      "%s"
       ,
       (long unsigned) hbi.memory_size / 1024,
       (long unsigned) vmstats.free_count * PAGE_SIZE / 1024,
@@ -317,23 +311,8 @@ rootdir_gc_meminfo (void *hook, char **contents, ssize_t *contents_len)
       (long unsigned) cache_stats.cache_count * PAGE_SIZE / 1024,
       (long unsigned) vmstats.active_count * PAGE_SIZE / 1024,
       (long unsigned) vmstats.inactive_count * PAGE_SIZE / 1024,
-      (long unsigned) vmstats.wire_count * PAGE_SIZE / 1024);
-
-  err = get_swapinfo (&swap);
-  if (err)
-    /* This is not fatal, we just omit the information.  */
-    err = 0;
-  else
-    fprintf (m,
-      "SwapTotal:%14lu kB\n"
-      "SwapFree: %14lu kB\n"
-      ,
-      (long unsigned) swap.dpi_total_space / 1024,
-      (long unsigned) swap.dpi_free_space / 1024);
-
- out:
-  fclose (m);
-  return err;
+      (long unsigned) vmstats.wire_count * PAGE_SIZE / 1024,
+      swapinfo);
 }
 
 static error_t
@@ -346,7 +325,7 @@ rootdir_gc_vmstat (void *hook, char **contents, ssize_t *contents_len)
   if (err)
     return EIO;
 
-  *contents_len = asprintf (contents,
+  return procfs_printf (contents, contents_len,
       "nr_free_pages %lu\n"
       "nr_inactive_anon %lu\n"
       "nr_active_anon %lu\n"
@@ -369,8 +348,6 @@ rootdir_gc_vmstat (void *hook, char **contents, ssize_t *contents_len)
       (long unsigned) vmstats.pageins,
       (long unsigned) vmstats.pageouts,
       (long unsigned) vmstats.faults);
-
-  return 0;
 }
 
 static error_t
@@ -632,8 +609,14 @@ rootdir_file_make_node (void *dir_hook, const void *entry_hook)
   /* The entry hook we use is actually a procfs_node_ops for the file to be
      created.  The hook associated to these newly created files (and passed
      to the generators above as a consequence) is always the same global
-     ps_context, which we get from rootdir_make_node as the directory hook. */
-  return procfs_make_node (entry_hook, dir_hook);
+     ps_context, which we get from rootdir_make_node as the directory hook.
+     The contents of the files generated into a reusable buffer are
+     shared between their nodes.  */
+  const struct procfs_node_ops *ops = entry_hook;
+  struct node *np = procfs_make_node (ops, dir_hook);
+  if (np && ops->needed_length)
+    procfs_node_cache (np, ops, 0);
+  return np;
 }
 
 static struct node *
@@ -735,42 +718,42 @@ static const struct procfs_dir_entry rootdir_entries[] = {
     .name = "version",
     .hook = & (struct procfs_node_ops) {
       .get_contents = rootdir_gc_version,
-      .cleanup_contents = procfs_cleanup_contents_with_free,
+      .needed_length = 128,
     },
   },
   {
     .name = "uptime",
     .hook = & (struct procfs_node_ops) {
       .get_contents = rootdir_gc_uptime,
-      .cleanup_contents = procfs_cleanup_contents_with_free,
+      .needed_length = 64,
     },
   },
   {
     .name = "stat",
     .hook = & (struct procfs_node_ops) {
       .get_contents = rootdir_gc_stat,
-      .cleanup_contents = procfs_cleanup_contents_with_free,
+      .needed_length = 256,
     },
   },
   {
     .name = "loadavg",
     .hook = & (struct procfs_node_ops) {
       .get_contents = rootdir_gc_loadavg,
-      .cleanup_contents = procfs_cleanup_contents_with_free,
+      .needed_length = 64,
     },
   },
   {
     .name = "meminfo",
     .hook = & (struct procfs_node_ops) {
       .get_contents = rootdir_gc_meminfo,
-      .cleanup_contents = procfs_cleanup_contents_with_free,
+      .needed_length = 512,
     },
   },
   {
     .name = "vmstat",
     .hook = & (struct procfs_node_ops) {
       .get_contents = rootdir_gc_vmstat,
-      .cleanup_contents = procfs_cleanup_contents_with_free,
+      .needed_length = 512,
     },
   },
   {
@@ -111,6 +111,80 @@ write_character (int c)
   echo_pstart = output_psize;
 }
 
+/* Return the length of the run of characters between ' ' and '~' at
+   the start of the LEN characters at P.  These are the characters that
+   output_character passes through unchanged, unless OLCASE is set, and
+   that move the cursor one column each.  */
+static size_t
+printable_run (const char *p, size_t len)
+{
+  const unsigned long ones = (unsigned long) -1 / 0xff;
+  const unsigned long highs = ones << 7;
+  size_t i = 0;
+
+  /* Look at a word at a time for a byte below ' ', a byte with the high
+     bit set, or a DEL, and find which byte it is below.  */
+  while (i + sizeof (unsigned long) <= len)
+    {
+      unsigned long w, del;
+
+      memcpy (&w, p + i, sizeof w);
+      del = w ^ (ones * '\177');
+      if (((w - ones * ' ') & ~w & highs)
+	  | (w & highs)
+	  | ((del - ones) & ~del & highs))
+	break;
+      i += sizeof (unsigned long);
+    }
+
+  while (i < len && (unsigned char) p[i] >= ' '
+	 && (unsigned char) p[i] < '\177')
+    i++;
+
+  return i;
+}
+
+/* Place characters from the LEN at DATA on the output queue, doing
+   normal processing, as calling write_character for each would while
+   the output queue is available.  Return the number of characters
+   consumed; this is less than LEN only if the queue filled up.  */
+size_t
+write_characters (const char *data, size_t len)
+{
+  int oflag = termstate.c_oflag;
+  size_t i = 0;
+
+  if (((oflag & OPOST) && (oflag & OLCASE)) || (termflags & FLUSH_OUTPUT))
+    /* Every character needs a look.  */
+    while (i < len && qavail (outputq))
+      output_character (data[i++]);
+  else
+    while (i < len && qavail (outputq))
+      {
+	size_t n = printable_run (data + i, len - i);
+
+	if (n)
+	  {
+	    /* The queue suspends once it holds more than HIWAT
+	       characters; stop there, as single characters would.  */
+	    size_t room = (qsize (outputq) > outputq->hiwat
+			   ? 1 : outputq->hiwat + 1 - qsize (outputq));
+
+	    if (n > room)
+	      n = room;
+	    enqueue_chars (&outputq, data + i, n);
+	    output_psize += n;
+	    i += n;
+	  }
+	else
+	  output_character (data[i++]);
+      }
+
+  echo_qsize = 0;
+  echo_pstart = output_psize;
+  return i;
+}
+
 /* Report the width of character C as printed by output_character,
    if output_psize were at LOC. . */
 int
@@ -730,6 +804,44 @@ create_queue (int size, int lowat, int hiwat)
   return q;
 }
 
+/* Add the N characters at P to *QP, as enqueue would one at a time. */
+void
+enqueue_chars (struct queue **qp, const char *p, size_t n)
+{
+  struct queue *q = *qp;
+  int was_empty = !qsize (q);
+
+  while (n)
+    {
+      quoted_char *end;
+
+      if (q->ce - q->array == q->arraylen)
+	q = *qp = reallocate_queue (q);
+
+      end = q->array + q->arraylen;
+      if ((size_t) (end - q->ce) > n)
+	end = q->ce + n;
+      n -= end - q->ce;
+      while (q->ce < end)
+	*q->ce++ = *p++;
+    }
+
+  if (was_empty && qsize (q))
+    {
+      pthread_cond_broadcast (q->wait);
+      pthread_cond_broadcast (&select_alert);
+      if (q == inputq)
+	{
+	  if (pty_select_alert != NULL)
+	    pthread_cond_broadcast (pty_select_alert);
+	  call_asyncs (O_READ);
+	}
+    }
+
+  if (!q->susp && (qsize (q) > q->hiwat))
+    q->susp = 1;
+}
+
 /* Make Q able to have more characters added to it. */
 struct queue *
 reallocate_queue (struct queue *q)
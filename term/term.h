@@ -276,6 +276,7 @@ dequeue (struct queue *q)
 #endif /* Use extern inlines.  */
 
 struct queue *reallocate_queue (struct queue *);
+void enqueue_chars (struct queue **qp, const char *p, size_t n);
 
 #if defined(__USE_EXTERN_INLINES) || defined(TERM_DEFINE_EI)
 /* Add C to *QP. */
@@ -377,6 +378,7 @@ void output_character (int);
 void copy_rawq (void);
 void rescan_inputq (void);
 void write_character (int);
+size_t write_characters (const char *, size_t);
 void init_users (void);
 
 extern char *tty_arg;
@@ -566,7 +566,7 @@ trivfs_S_io_write (struct trivfs_protid *cred,
 		   loff_t offset,
 		   size_t *amt)
 {
-  int i;
+  size_t i;
   int cancel;
   error_t err = 0;
 
@@ -600,7 +600,8 @@ trivfs_S_io_write (struct trivfs_protid *cred,
     }
 
   cancel = 0;
-  for (i = 0; i < datalen; i++)
+  i = 0;
+  while (i < datalen)
     {
       while (!qavail (outputq) && !cancel)
 	{
@@ -617,7 +618,7 @@ trivfs_S_io_write (struct trivfs_protid *cred,
       if (cancel)
 	break;
 
-      write_character (data[i]);
+      i += write_characters (data + i, datalen - i);
     }
 
   *amt = i;
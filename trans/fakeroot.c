@@ -22,11 +22,14 @@
 #include <argp.h>
 #include <error.h>
 #include <string.h>
+#include <argz.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <pthread.h>
 #include <sys/sysmacros.h>
+#include <sys/time.h>
+#include <limits.h>
 #include <hurd/ihash.h>
 #include <hurd/paths.h>
 
@@ -37,6 +40,7 @@
 #include "libnetfs/fsys_S.h"
 #include "libports/notify_S.h"
 #include "libports/interrupt_S.h"
+#include "fs_notify_S.h"
 
 const char *argp_program_version = STANDARD_HURD_VERSION (fakeroot);
 
@@ -46,6 +50,13 @@ int netfs_maxsymlinks = 16;	/* arbitrary */
 
 static auth_t fakeroot_auth_port;
 
+/* How long the stat information of the underlying files is reused, in
+   milliseconds, and how many lookup results are remembered.  */
+#define DEFAULT_STAT_CACHE	100
+#define DEFAULT_LOOKUP_CACHE	4096
+static int stat_cache_ttl = DEFAULT_STAT_CACHE;
+static int lookup_cache_max = DEFAULT_LOOKUP_CACHE;
+
 struct netnode
 {
   hurd_ihash_locp_t idport_locp;/* easy removal pointer in idport ihash */
@@ -54,6 +65,15 @@ struct netnode
   file_t file;			/* port on real file */
 
   unsigned int faked;
+  struct fake_attrs *attrs;	/* stored faked attributes, if any */
+
+  long long stat_stamp;		/* when nn_stat was fetched, in ms */
+  int stat_fresh;		/* nn_stat may be reused until the TTL */
+  mode_t trans_bits;		/* S_IPTRANS and S_IATRANS of the file */
+
+  /* If this is a directory, the state of its lookup cache.  */
+  struct dir_watch *watch;
+  int no_watch;			/* the directory cannot be watched */
 };
 
 #define FAKE_UID	(1 << 0)
@@ -68,6 +88,38 @@ struct hurd_ihash idport_ihash
 			  + offsetof (struct netnode, idport_locp));
 
 
+/* The faked attributes of a file.  Nodes are dropped when they are no
+   longer used, but the attributes faked for their file have to stay,
+   so they are kept here, under the identity port of the file, until
+   the translator exits.  The record holds a send right to the port,
+   so that its name stays the same.  */
+struct fake_attrs
+{
+  hurd_ihash_locp_t locp;
+  mach_port_t idport;
+  unsigned int faked;
+  uid_t uid;
+  gid_t gid;
+  uid_t author;
+  mode_t mode;
+};
+
+pthread_mutex_t fake_attrs_lock = PTHREAD_MUTEX_INITIALIZER;
+struct hurd_ihash fake_attrs_ihash
+= HURD_IHASH_INITIALIZER (offsetof (struct fake_attrs, locp));
+
+/* Copy the attributes faked in ATTRS into NP.  */
+static void
+load_faked_attributes (struct node *np, struct fake_attrs *attrs)
+{
+  netfs_node_netnode (np)->faked = attrs->faked;
+  np->nn_stat.st_uid = attrs->uid;
+  np->nn_stat.st_gid = attrs->gid;
+  np->nn_stat.st_author = attrs->author;
+  np->nn_stat.st_mode = attrs->mode;
+}
+
+
 /* Make a new virtual node.  Always consumes the ports.  If
    successful, NP will be locked.  */
 static error_t
@@ -108,6 +160,16 @@ new_node (file_t file, mach_port_t idport, int locked, int openmodes,
 	}
     }
   nn->faked = FAKE_DEFAULT;
+  nn->attrs = NULL;
+  nn->stat_fresh = 0;
+  nn->watch = NULL;
+  nn->no_watch = 0;
+
+  pthread_mutex_lock (&fake_attrs_lock);
+  nn->attrs = hurd_ihash_find (&fake_attrs_ihash, nn->idport);
+  if (nn->attrs)
+    load_faked_attributes (*np, nn->attrs);
+  pthread_mutex_unlock (&fake_attrs_lock);
 
   /* The light reference allows us to safely keep the node in the
      hash table.  */
@@ -134,29 +196,543 @@ new_node (file_t file, mach_port_t idport, int locked, int openmodes,
 static void
 set_default_attributes (struct node *np)
 {
+  if (netfs_node_netnode (np)->attrs)
+    /* The attributes of the file were faked through an earlier node.  */
+    return;
+
   netfs_node_netnode (np)->faked = FAKE_UID | FAKE_GID | FAKE_DEFAULT;
   np->nn_stat.st_uid = 0;
   np->nn_stat.st_gid = 0;
 }
 
+/* Record that the attributes FAKED of NP, already set in its nn_stat,
+   are faked.  */
 static void
 set_faked_attribute (struct node *np, unsigned int faked)
 {
-  netfs_node_netnode (np)->faked |= faked;
+  struct netnode *nn = netfs_node_netnode (np);
+  struct fake_attrs *attrs;
 
-  if (netfs_node_netnode (np)->faked & FAKE_DEFAULT)
+  nn->faked |= faked;
+
+  pthread_mutex_lock (&fake_attrs_lock);
+  attrs = nn->attrs;
+  if (! attrs)
     {
       /* Now that the node has non-default faked attributes, they have to be
-	 retained for future accesses.  Account for the hash table reference.
+	 retained for future accesses.  If we cannot, they only last as
+	 long as the node.  */
+      attrs = malloc (sizeof *attrs);
+      if (attrs && hurd_ihash_add (&fake_attrs_ihash, nn->idport, attrs))
+	{
+	  free (attrs);
+	  attrs = NULL;
+	}
+      if (attrs)
+	{
+	  mach_port_mod_refs (mach_task_self (), nn->idport,
+			      MACH_PORT_RIGHT_SEND, 1);
+	  attrs->idport = nn->idport;
+	  nn->attrs = attrs;
+	  nn->faked &= ~FAKE_DEFAULT;
+	}
+    }
+  if (attrs)
+    {
+      attrs->faked = nn->faked;
+      attrs->uid = np->nn_stat.st_uid;
+      attrs->gid = np->nn_stat.st_gid;
+      attrs->author = np->nn_stat.st_author;
+      attrs->mode = np->nn_stat.st_mode;
+    }
+  pthread_mutex_unlock (&fake_attrs_lock);
+}
 
-	 XXX This means such nodes are currently leaked.  Hopefully, there
-	 won't be too many of them until the translator is shut down, and
-	 the data structures should make implementing garbage collection
-	 easy enough if it's ever needed, although scalability could be
-	 improved.  */
-      netfs_nref (np);
-      netfs_node_netnode (np)->faked &= ~FAKE_DEFAULT;
+/* Note that the stat information of the file of NP may have changed.  */
+static void
+stat_changed (struct node *np)
+{
+  netfs_node_netnode (np)->stat_fresh = 0;
+}
+
+static long long
+now_ms (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+
+/* The lookup cache.  The result of looking up a single name in a
+   directory, the node found or the absence of the name, is remembered
+   so that the same lookup need not go to the underlying filesystem
+   again.  A positive entry holds a reference on its node.  The entries
+   of a directory are forgotten as the underlying filesystem reports
+   changes to it through dir_notice_changes, and as we change it
+   ourselves.  At most lookup_cache_max entries are kept, and the least
+   recently used ones go first.
+
+   Entries are often forgotten with a node locked: libnetfs calls
+   netfs_attempt_unlink and the like with the directory locked, and
+   netfs_try_dropping_softrefs with the node locked.  Releasing the
+   last reference on the node of an entry then takes idport_ihash_lock,
+   which netfs_S_dir_lookup takes before node locks.  So forgotten
+   entries are put on LOOKUP_DEAD, and only released by
+   lookup_cache_reap, which is called where no node is locked.  */
+
+/* The lookup flags which may change what a name refers to.  */
+#define LOOKUP_KEY_FLAGS	(O_NOTRANS | O_NOLINK)
+
+static const int lookup_key_flags[] =
+  { 0, O_NOTRANS, O_NOLINK, O_NOTRANS | O_NOLINK };
+
+struct lookup_key
+{
+  struct node *dir;
+  int flags;
+  const char *name;
+};
+
+struct lookup_entry
+{
+  hurd_ihash_locp_t locp;
+  struct lookup_key key;
+  struct node *np;		/* NULL if the name does not exist */
+  unsigned int epoch;		/* lookup_epoch when it was added */
+  struct lookup_entry *dir_next, **dir_prevp;
+  struct lookup_entry *lru_next, *lru_prev;
+  char name[0];
+};
+
+/* The lookup cache of a directory.  The underlying filesystem sends
+   the changes to the directory to this port.  */
+struct dir_watch
+{
+  struct port_info pi;
+  struct node *dir;		/* NULL once the directory is dropped */
+  mach_port_t fsidport;		/* the filesystem of the directory */
+  natural_t tick;		/* of the last change notification */
+  unsigned int gen;		/* incremented on every change */
+  struct lookup_entry *entries;
+};
+
+static struct port_class *dir_watch_class;
+
+static hurd_ihash_key_t
+lookup_hash (const void *key)
+{
+  const struct lookup_key *k = key;
+
+  return hurd_ihash_hash32 (k->name, strlen (k->name),
+			    (uint32_t) (uintptr_t) k->dir ^ k->flags);
+}
+
+static int
+lookup_compare (const void *a, const void *b)
+{
+  const struct lookup_key *x = a, *y = b;
+
+  return x->dir == y->dir && x->flags == y->flags
+    && strcmp (x->name, y->name) == 0;
+}
+
+/* This lock is taken after node locks, and no other lock is taken
+   while it is held.  */
+pthread_mutex_t lookup_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+struct hurd_ihash lookup_cache
+= HURD_IHASH_INITIALIZER_GKI (offsetof (struct lookup_entry, locp),
+			      NULL, NULL, lookup_hash, lookup_compare);
+static struct lookup_entry *lookup_lru, *lookup_lru_tail;
+static int lookup_cache_size;
+
+/* Entries taken out of the cache, chained through LRU_NEXT.  */
+static struct lookup_entry *lookup_dead;
+
+/* Incremented when a file may have been created in a directory we
+   cannot tell; negative entries from before are not trusted.  */
+static unsigned int lookup_epoch;
+
+/* Take E out of the cache, and put it on LOOKUP_DEAD.  */
+static void
+unlink_lookup_entry (struct lookup_entry *e)
+{
+  hurd_ihash_locp_remove (&lookup_cache, e->locp);
+
+  *e->dir_prevp = e->dir_next;
+  if (e->dir_next)
+    e->dir_next->dir_prevp = e->dir_prevp;
+
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    lookup_lru = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    lookup_lru_tail = e->lru_prev;
+  lookup_cache_size--;
+
+  e->lru_next = lookup_dead;
+  lookup_dead = e;
+}
+
+/* Free the entries taken out of the cache, and release their nodes.
+   No node may be locked.  */
+static void
+lookup_cache_reap (void)
+{
+  struct lookup_entry *dead;
+
+  /* Dropping the last reference on a directory forgets its entries, so
+     go on until none are left.  */
+  for (;;)
+    {
+      pthread_mutex_lock (&lookup_cache_lock);
+      dead = lookup_dead;
+      lookup_dead = NULL;
+      pthread_mutex_unlock (&lookup_cache_lock);
+
+      if (! dead)
+	break;
+
+      while (dead)
+	{
+	  struct lookup_entry *e = dead;
+
+	  dead = e->lru_next;
+	  if (e->np)
+	    netfs_nrele (e->np);
+	  free (e);
+	}
+    }
+}
+
+/* Forget the entries of W for NAME.  */
+static void
+forget_name (struct dir_watch *w, const char *name)
+{
+  struct lookup_key key = { w->dir, 0, name };
+  struct lookup_entry *e;
+  int i;
+
+  for (i = 0; i < sizeof lookup_key_flags / sizeof lookup_key_flags[0]; i++)
+    {
+      key.flags = lookup_key_flags[i];
+      e = hurd_ihash_find (&lookup_cache, (hurd_ihash_key_t) &key);
+      if (e)
+	unlink_lookup_entry (e);
+    }
+}
+
+static void
+forget_all (struct dir_watch *w)
+{
+  while (w->entries)
+    unlink_lookup_entry (w->entries);
+}
+
+/* Make sure that the changes to the directory DIR are reported to its
+   lookup cache.  If they are, return nonzero, and set *GEN to the
+   generation of the cache, for lookup_cache_add, and *FSIDPORT to the
+   identity port of the filesystem of DIR.  */
+static int
+lookup_cache_start (struct node *dir, unsigned int *gen,
+		    mach_port_t *fsidport)
+{
+  struct netnode *nn = netfs_node_netnode (dir);
+  struct dir_watch *w;
+
+  pthread_mutex_lock (&dir->lock);
+  if (! nn->watch && ! nn->no_watch)
+    {
+      error_t err;
+
+      err = ports_create_port (dir_watch_class, netfs_port_bucket,
+			       sizeof *w, &w);
+      if (! err)
+	{
+	  mach_port_t idport, notify;
+	  ino_t fileno;
+
+	  w->dir = dir;
+	  w->tick = 0;
+	  w->gen = 0;
+	  w->entries = NULL;
+	  err = io_identity (nn->file, &idport, &w->fsidport, &fileno);
+	  if (! err)
+	    {
+	      mach_port_deallocate (mach_task_self (), idport);
+
+	      /* Notifications are dropped when the queue is full.  */
+	      notify = ports_get_right (w);
+	      mach_port_set_qlimit (mach_task_self (), notify,
+				    MACH_PORT_QLIMIT_MAX);
+	      err = dir_notice_changes (nn->file, notify,
+					MACH_MSG_TYPE_MAKE_SEND);
+	      if (err)
+		mach_port_deallocate (mach_task_self (), w->fsidport);
+	    }
+	  if (err)
+	    {
+	      w->dir = NULL;
+	      ports_destroy_right (w);
+	      ports_port_deref (w);
+	    }
+	  else
+	    {
+	      pthread_mutex_lock (&lookup_cache_lock);
+	      nn->watch = w;
+	      pthread_mutex_unlock (&lookup_cache_lock);
+	    }
+	}
+      if (err)
+	nn->no_watch = 1;
     }
+
+  pthread_mutex_lock (&lookup_cache_lock);
+  w = nn->watch;
+  if (w)
+    {
+      *gen = w->gen;
+      *fsidport = w->fsidport;
+    }
+  pthread_mutex_unlock (&lookup_cache_lock);
+  pthread_mutex_unlock (&dir->lock);
+
+  return w != NULL;
+}
+
+/* Look NAME up in the cache of the directory DIR, for a lookup with
+   FLAGS.  Return a reference to the node found, or NULL; set *NEGATIVE
+   if the name is known not to exist.  */
+static struct node *
+lookup_cache_find (struct node *dir, const char *name, int flags,
+		   int *negative)
+{
+  struct lookup_key key = { dir, flags & LOOKUP_KEY_FLAGS, name };
+  struct lookup_entry *e;
+  struct node *np = NULL;
+
+  *negative = 0;
+
+  pthread_mutex_lock (&lookup_cache_lock);
+  e = hurd_ihash_find (&lookup_cache, (hurd_ihash_key_t) &key);
+  if (e && ! e->np && e->epoch != lookup_epoch)
+    {
+      unlink_lookup_entry (e);
+      e = NULL;
+    }
+  if (e)
+    {
+      if (e->lru_prev)
+	{
+	  /* Move E to the front of the LRU list.  */
+	  e->lru_prev->lru_next = e->lru_next;
+	  if (e->lru_next)
+	    e->lru_next->lru_prev = e->lru_prev;
+	  else
+	    lookup_lru_tail = e->lru_prev;
+	  e->lru_prev = NULL;
+	  e->lru_next = lookup_lru;
+	  lookup_lru->lru_prev = e;
+	  lookup_lru = e;
+	}
+
+      np = e->np;
+      if (np)
+	netfs_nref (np);
+      else
+	*negative = 1;
+    }
+  pthread_mutex_unlock (&lookup_cache_lock);
+
+  return np;
+}
+
+/* Remember that looking NAME up in the directory DIR with FLAGS found
+   NP, or nothing if NP is NULL, unless DIR changed since its cache had
+   the generation GEN.  */
+static void
+lookup_cache_add (struct node *dir, const char *name, int flags,
+		  struct node *np, unsigned int gen)
+{
+  struct netnode *nn = netfs_node_netnode (dir);
+  size_t len = strlen (name) + 1;
+  struct lookup_entry *e;
+  struct dir_watch *w;
+
+  e = malloc (sizeof *e + len);
+  if (! e)
+    return;
+  memcpy (e->name, name, len);
+  e->key.dir = dir;
+  e->key.flags = flags & LOOKUP_KEY_FLAGS;
+  e->key.name = e->name;
+  e->np = np;
+
+  pthread_mutex_lock (&lookup_cache_lock);
+  w = nn->watch;
+  if (! w || w->gen != gen
+      || hurd_ihash_find (&lookup_cache, (hurd_ihash_key_t) &e->key)
+      || hurd_ihash_add (&lookup_cache, (hurd_ihash_key_t) &e->key, e))
+    {
+      pthread_mutex_unlock (&lookup_cache_lock);
+      free (e);
+      return;
+    }
+
+  if (np)
+    netfs_nref (np);
+  e->epoch = lookup_epoch;
+
+  e->dir_next = w->entries;
+  if (e->dir_next)
+    e->dir_next->dir_prevp = &e->dir_next;
+  e->dir_prevp = &w->entries;
+  w->entries = e;
+
+  e->lru_prev = NULL;
+  e->lru_next = lookup_lru;
+  if (lookup_lru)
+    lookup_lru->lru_prev = e;
+  else
+    lookup_lru_tail = e;
+  lookup_lru = e;
+
+  lookup_cache_size++;
+  while (lookup_cache_size > lookup_cache_max)
+    unlink_lookup_entry (lookup_lru_tail);
+  pthread_mutex_unlock (&lookup_cache_lock);
+}
+
+/* Forget what the lookup cache of the directory DIR knows about NAME,
+   which we are changing.  DIR may be locked.  */
+static void
+lookup_cache_forget (struct node *dir, const char *name)
+{
+  struct dir_watch *w;
+
+  pthread_mutex_lock (&lookup_cache_lock);
+  w = netfs_node_netnode (dir)->watch;
+  if (w)
+    {
+      w->gen++;
+      forget_name (w, name);
+    }
+  pthread_mutex_unlock (&lookup_cache_lock);
+}
+
+/* Note that a lookup may have created a file in some directory.  */
+static void
+lookup_cache_created (void)
+{
+  pthread_mutex_lock (&lookup_cache_lock);
+  lookup_epoch++;
+  pthread_mutex_unlock (&lookup_cache_lock);
+}
+
+/* Note that we changed NAME in the directory DIR.  */
+static void
+dir_changed (struct node *dir, const char *name)
+{
+  lookup_cache_forget (dir, name);
+  stat_changed (dir);
+}
+
+/* Drop the lookup cache of the directory NP, which may be locked.  */
+static void
+lookup_cache_drop (struct node *np)
+{
+  struct netnode *nn = netfs_node_netnode (np);
+  struct dir_watch *w;
+
+  pthread_mutex_lock (&lookup_cache_lock);
+  w = nn->watch;
+  nn->watch = NULL;
+  if (w)
+    {
+      w->dir = NULL;
+      forget_all (w);
+    }
+  pthread_mutex_unlock (&lookup_cache_lock);
+
+  if (w)
+    {
+      mach_port_deallocate (mach_task_self (), w->fsidport);
+      ports_destroy_right (w);
+      ports_port_deref (w);
+    }
+}
+
+/* The underlying filesystem reports a change to a directory.  */
+kern_return_t
+S_dir_changed (fs_notify_t notify, natural_t tickno,
+	       dir_changed_type_t change, const_string_t name)
+{
+  struct dir_watch *w;
+
+  w = ports_lookup_port (netfs_port_bucket, notify, dir_watch_class);
+  if (! w)
+    return EOPNOTSUPP;
+
+  pthread_mutex_lock (&lookup_cache_lock);
+  if (w->dir)
+    {
+      w->gen++;
+      if ((change == DIR_CHANGED_NEW || change == DIR_CHANGED_UNLINK)
+	  && tickno == w->tick + 1)
+	forget_name (w, name);
+      else
+	/* This is the first notification, the directory was renumbered,
+	   or some notifications were lost.  */
+	forget_all (w);
+      w->tick = tickno;
+    }
+  pthread_mutex_unlock (&lookup_cache_lock);
+
+  lookup_cache_reap ();
+  ports_port_deref (w);
+  return 0;
+}
+
+kern_return_t
+S_file_changed (fs_notify_t notify, natural_t tickno,
+		file_changed_type_t change, loff_t start, loff_t end)
+{
+  return EOPNOTSUPP;
+}
+
+/* Check that NP, found in the lookup cache for a lookup with FLAGS, is
+   still what the lookup would find: without O_NOTRANS, a translator
+   set on its file since would be found instead.  NP is locked.  */
+static error_t
+lookup_cache_check (struct node *np, int flags, struct iouser *user)
+{
+  error_t err;
+
+  if (flags & O_NOTRANS)
+    return 0;
+
+  err = netfs_validate_stat (np, user);
+  if (! err && netfs_node_netnode (np)->trans_bits)
+    err = EAGAIN;
+  return err;
+}
+
+/* Return nonzero if the result of looking up FILENAME with FLAGS can be
+   cached: it is a single name, the lookup creates nothing, and the
+   result is not checked as for O_NOFOLLOW.  */
+static int
+lookup_cacheable (const char *filename, int flags)
+{
+  return lookup_cache_max > 0
+    && ! (flags & (O_CREAT | O_NOFOLLOW))
+    && filename[0] != '\0'
+    && strcmp (filename, ".") != 0
+    && strcmp (filename, "..") != 0
+    && strchr (filename, '/') == NULL;
 }
 
 void
@@ -169,6 +745,8 @@ netfs_try_dropping_softrefs (struct node *np)
   hurd_ihash_locp_remove (&idport_ihash, netfs_node_netnode (np)->idport_locp);
   pthread_mutex_unlock (&idport_ihash_lock);
 
+  lookup_cache_drop (np);
+
   netfs_nrele_light (np);
 }
 
@@ -297,26 +875,75 @@ netfs_S_dir_lookup (struct protid *diruser,
   mach_port_t file;
   mach_port_t idport, fsidport;
   ino_t fileno;
+  int lookup_flags, cache_flags, cacheable, one_step, add_entry = 0;
+  unsigned int gen;
+  mach_port_t dir_fsidport;
 
   if (!diruser)
     return EOPNOTSUPP;
 
   dnp = diruser->po->np;
 
+  /* Release what the cache forgot since, with no node locked.  */
+  lookup_cache_reap ();
+
   /* See glibc's lookup-retry.c about O_NOFOLLOW.  */
   if (flags & O_NOFOLLOW)
     flags |= O_NOTRANS;
+  cache_flags = flags;
+
+  cacheable = (lookup_cacheable (filename, flags)
+	       && lookup_cache_start (dnp, &gen, &dir_fsidport));
+  if (cacheable)
+    {
+      int negative;
+
+      np = lookup_cache_find (dnp, filename, flags, &negative);
+      if (negative)
+	return ENOENT;
+      if (np)
+	{
+	  pthread_mutex_lock (&np->lock);
+	  err = lookup_cache_check (np, flags, diruser->user);
+	  if (! err)
+	    err = check_openmodes (netfs_node_netnode (np),
+				   (flags & (O_RDWR|O_EXEC)), MACH_PORT_NULL);
+	  if (! err)
+	    {
+	      *do_retry = FS_RETRY_NORMAL;
+	      retry_name[0] = '\0';
+	      goto found;
+	    }
+
+	  /* Ask the underlying filesystem, which may know better.  */
+	  netfs_nput (np);
+	  lookup_cache_forget (dnp, filename);
+	  cacheable = 0;
+	}
+    }
+
+  lookup_flags = flags & (O_NOFOLLOW|O_NOTRANS|O_NOLINK
+			  |O_RDWR|O_EXEC|O_CREAT|O_EXCL|O_NONBLOCK);
+  one_step = 1;
 
   mach_port_t dir = netfs_node_netnode (dnp)->file;
  redo_lookup:
+  /* When the result is to be cached, a symlink is not followed, so that
+     a name found to be one can be looked up again below, uncached.  */
   err = dir_lookup (dir, filename,
-		    flags & (O_NOFOLLOW|O_NOTRANS|O_NOLINK
-			     |O_RDWR|O_EXEC|O_CREAT|O_EXCL|O_NONBLOCK),
+		    lookup_flags | (cacheable && one_step ? O_NOLINK : 0),
 		    real_from_fake_mode (mode), do_retry, retry_name, &file);
+  if (flags & O_CREAT)
+    /* We cannot tell in which directory a file may have been created.  */
+    lookup_cache_created ();
   if (dir != netfs_node_netnode (dnp)->file)
     mach_port_deallocate (mach_task_self (), dir);
   if (err)
-    return err;
+    {
+      if (err == ENOENT && cacheable && one_step)
+	lookup_cache_add (dnp, filename, cache_flags, NULL, gen);
+      return err;
+    }
 
   /* See glibc's lookup-retry.c about O_NOFOLLOW.  */
   if (flags & O_NOFOLLOW
@@ -389,6 +1016,7 @@ netfs_S_dir_lookup (struct protid *diruser,
 	  return err;
       }
       filename = retry_name;
+      one_step = 0;
       goto redo_lookup;
 
     case FS_RETRY_NORMAL:
@@ -396,6 +1024,7 @@ netfs_S_dir_lookup (struct protid *diruser,
 	{
 	  dir = file;
 	  filename = retry_name;
+	  one_step = 0;
 	  goto redo_lookup;
 	}
       break;
@@ -429,6 +1058,9 @@ netfs_S_dir_lookup (struct protid *diruser,
       return err;
     }
 
+  /* Only a file of the filesystem of the directory is cached: other
+     filesystems do not report their changes to the directory.  */
+  add_entry = cacheable && one_step && fsidport == dir_fsidport;
   mach_port_deallocate (mach_task_self (), fsidport);
 
  redo_hash_lookup:
@@ -485,6 +1117,17 @@ netfs_S_dir_lookup (struct protid *diruser,
   if (err)
     goto lose;
 
+  if (cacheable && one_step
+      && S_ISLNK (np->nn_stat.st_mode) && ! (flags & O_NOLINK))
+    {
+      /* The name is a symlink, which the user wants followed.  */
+      netfs_nput (np);
+      cacheable = add_entry = 0;
+      dir = netfs_node_netnode (dnp)->file;
+      goto redo_lookup;
+    }
+
+ found:
   assert_backtrace (retry_name[0] == '\0' && *do_retry == FS_RETRY_NORMAL);
   flags &= ~(O_CREAT|O_EXCL|O_NOLINK|O_NOTRANS|O_NONBLOCK);
 
@@ -508,7 +1151,16 @@ netfs_S_dir_lookup (struct protid *diruser,
 
  lose:
   if (np != NULL)
-    netfs_nput (np);
+    {
+      if (! err && add_entry && np != dnp)
+	{
+	  pthread_mutex_unlock (&np->lock);
+	  lookup_cache_add (dnp, filename, cache_flags, np, gen);
+	  netfs_nrele (np);
+	}
+      else
+	netfs_nput (np);
+    }
   return err;
 }
 
@@ -519,6 +1171,7 @@ error_t
 netfs_set_translator (struct iouser *cred, struct node *np,
 		      const char *argz, size_t argzlen)
 {
+  stat_changed (np);
   return file_set_translator (netfs_node_netnode (np)->file,
 			      FS_TRANS_EXCL|FS_TRANS_SET,
 			      FS_TRANS_EXCL|FS_TRANS_SET, 0,
@@ -549,18 +1202,31 @@ netfs_attempt_create_file (struct iouser *user, struct node *dir,
 error_t
 netfs_validate_stat (struct node *np, struct iouser *cred)
 {
+  struct netnode *nn = netfs_node_netnode (np);
   struct stat st;
-  error_t err = io_stat (netfs_node_netnode (np)->file, &st);
+  long long now = now_ms ();
+  error_t err;
+
+  /* The underlying file is not asked again until the information is
+     STAT_CACHE_TTL old, unless we changed it ourselves.  */
+  if (nn->stat_fresh
+      && now >= nn->stat_stamp && now - nn->stat_stamp < stat_cache_ttl)
+    return 0;
+
+  err = io_stat (nn->file, &st);
   if (err)
     return err;
+  nn->stat_stamp = now;
+  nn->stat_fresh = 1;
+  nn->trans_bits = st.st_mode & (S_IPTRANS | S_IATRANS);
 
-  if (netfs_node_netnode (np)->faked & FAKE_UID)
+  if (nn->faked & FAKE_UID)
     st.st_uid = np->nn_stat.st_uid;
-  if (netfs_node_netnode (np)->faked & FAKE_GID)
+  if (nn->faked & FAKE_GID)
     st.st_gid = np->nn_stat.st_gid;
-  if (netfs_node_netnode (np)->faked & FAKE_AUTHOR)
+  if (nn->faked & FAKE_AUTHOR)
     st.st_author = np->nn_stat.st_author;
-  if (netfs_node_netnode (np)->faked & FAKE_MODE)
+  if (nn->faked & FAKE_MODE)
     st.st_mode = (st.st_mode & S_IFMT) | (np->nn_stat.st_mode & ~S_IFMT);
 
   np->nn_stat = st;
@@ -585,13 +1251,13 @@ netfs_attempt_chown (struct iouser *cred, struct node *np,
 {
   if (uid != ~0U)
     {
-      set_faked_attribute (np, FAKE_UID);
       np->nn_stat.st_uid = uid;
+      set_faked_attribute (np, FAKE_UID);
     }
   if (gid != ~0U)
     {
-      set_faked_attribute (np, FAKE_GID);
       np->nn_stat.st_gid = gid;
+      set_faked_attribute (np, FAKE_GID);
     }
   return 0;
 }
@@ -599,8 +1265,8 @@ netfs_attempt_chown (struct iouser *cred, struct node *np,
 error_t
 netfs_attempt_chauthor (struct iouser *cred, struct node *np, uid_t author)
 {
-  set_faked_attribute (np, FAKE_AUTHOR);
   np->nn_stat.st_author = author;
+  set_faked_attribute (np, FAKE_AUTHOR);
   return 0;
 }
 
@@ -632,8 +1298,9 @@ netfs_attempt_chmod (struct iouser *cred, struct node *np, mode_t mode)
   /* We don't bother with error checking since the fake mode change should
      always succeed--worst case a later open will get EACCES.  */
   (void) file_chmod (nn->file, real_mode);
-  set_faked_attribute (np, FAKE_MODE);
+  stat_changed (np);
   np->nn_stat.st_mode = mode;
+  set_faked_attribute (np, FAKE_MODE);
   return 0;
 }
 
@@ -646,6 +1313,7 @@ netfs_attempt_mksymlink (struct iouser *cred, struct node *np, const char *name)
   char trans[sizeof _HURD_SYMLINK + namelen];
   memcpy (trans, _HURD_SYMLINK, sizeof _HURD_SYMLINK);
   memcpy (&trans[sizeof _HURD_SYMLINK], name, namelen);
+  stat_changed (np);
   return file_set_translator (netfs_node_netnode (np)->file,
 			      FS_TRANS_EXCL|FS_TRANS_SET,
 			      FS_TRANS_EXCL|FS_TRANS_SET, 0,
@@ -672,6 +1340,7 @@ netfs_attempt_mkdev (struct iouser *cred, struct node *np,
 					 MACH_PORT_NULL,
 					 MACH_MSG_TYPE_COPY_SEND);
       free (trans);
+      stat_changed (np);
       return err;
     }
 }
@@ -679,6 +1348,7 @@ netfs_attempt_mkdev (struct iouser *cred, struct node *np,
 error_t
 netfs_attempt_chflags (struct iouser *cred, struct node *np, int flags)
 {
+  stat_changed (np);
   return file_chflags (netfs_node_netnode (np)->file, flags);
 }
 
@@ -726,12 +1396,14 @@ netfs_attempt_utimes (struct iouser *cred, struct node *np,
       err = file_utimes (netfs_node_netnode (np)->file, atim, mtim);
     }
 
+  stat_changed (np);
   return err;
 }
 
 error_t
 netfs_attempt_set_size (struct iouser *cred, struct node *np, off_t size)
 {
+  stat_changed (np);
   return file_set_size (netfs_node_netnode (np)->file, size);
 }
 
@@ -757,7 +1429,10 @@ error_t
 netfs_attempt_mkdir (struct iouser *user, struct node *dir,
 		     const char *name, mode_t mode)
 {
-  return dir_mkdir (netfs_node_netnode (dir)->file, name, mode | S_IRWXU);
+  error_t err = dir_mkdir (netfs_node_netnode (dir)->file, name,
+			   mode | S_IRWXU);
+  dir_changed (dir, name);
+  return err;
 }
 
 
@@ -769,7 +1444,9 @@ netfs_attempt_mkdir (struct iouser *user, struct node *dir,
 error_t
 netfs_attempt_unlink (struct iouser *user, struct node *dir, const char *name)
 {
-  return dir_unlink (netfs_node_netnode (dir)->file, name);
+  error_t err = dir_unlink (netfs_node_netnode (dir)->file, name);
+  dir_changed (dir, name);
+  return err;
 }
 
 error_t
@@ -777,22 +1454,31 @@ netfs_attempt_rename (struct iouser *user, struct node *fromdir,
 		      const char *fromname, struct node *todir,
 		      const char *toname, int excl)
 {
-  return dir_rename (netfs_node_netnode (fromdir)->file, fromname,
-		     netfs_node_netnode (todir)->file, toname, excl);
+  error_t err = dir_rename (netfs_node_netnode (fromdir)->file, fromname,
+			    netfs_node_netnode (todir)->file, toname, excl);
+  dir_changed (fromdir, fromname);
+  dir_changed (todir, toname);
+  return err;
 }
 
 error_t
 netfs_attempt_rmdir (struct iouser *user,
 		     struct node *dir, const char *name)
 {
-  return dir_rmdir (netfs_node_netnode (dir)->file, name);
+  error_t err = dir_rmdir (netfs_node_netnode (dir)->file, name);
+  dir_changed (dir, name);
+  return err;
 }
 
 error_t
 netfs_attempt_link (struct iouser *user, struct node *dir,
 		    struct node *file, const char *name, int excl)
 {
-  return dir_link (netfs_node_netnode (dir)->file, netfs_node_netnode (file)->file, name, excl);
+  error_t err = dir_link (netfs_node_netnode (dir)->file,
+			  netfs_node_netnode (file)->file, name, excl);
+  dir_changed (dir, name);
+  stat_changed (file);
+  return err;
 }
 
 error_t
@@ -812,8 +1498,8 @@ netfs_attempt_mkfile (struct iouser *user, struct node *dir,
       set_default_attributes (*np);
       if (real_mode != mode)
 	{
-	  set_faked_attribute (*np, FAKE_MODE);
 	  (*np)->nn_stat.st_mode = mode;
+	  set_faked_attribute (*np, FAKE_MODE);
 	}
     }
   return err;
@@ -863,6 +1549,7 @@ error_t
 netfs_attempt_write (struct iouser *cred, struct node *np,
 		     off_t offset, size_t *len, const void *data)
 {
+  stat_changed (np);
   return io_write (netfs_node_netnode (np)->file, data, *len, offset, len);
 }
 
@@ -1131,6 +1818,7 @@ netfs_demuxer (mach_msg_header_t *inp,
       (routine = netfs_fs_server_routine (inp)) ||
       (routine = ports_notify_server_routine (inp)) ||
       (routine = netfs_fsys_server_routine (inp)) ||
+      (routine = fs_notify_server_routine (inp)) ||
       /* XXX we should intercept interrupt_operation and do
 	 the ports_S_interrupt_operation work as well as
 	 sending an interrupt_operation to the underlying file.
@@ -1184,13 +1872,86 @@ netfs_demuxer (mach_msg_header_t *inp,
 }
 
 
+#define STAT_CACHE_KEY -1 /* <= 0, so no short option. */
+#define LOOKUP_CACHE_KEY -2 /* Likewise. */
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  char *endp;
+  long v;
+
+  switch (key)
+    {
+    case STAT_CACHE_KEY:
+      v = strtol (arg, &endp, 0);
+      if (*endp || ! *arg || v < 0 || v > INT_MAX)
+	argp_error (state, "--stat-cache: MSEC should be a non-negative integer");
+      else
+	stat_cache_ttl = v;
+      break;
+
+    case LOOKUP_CACHE_KEY:
+      v = strtol (arg, &endp, 0);
+      if (*endp || ! *arg || v < 0 || v > INT_MAX)
+	argp_error (state, "--lookup-cache: N should be a non-negative integer");
+      else
+	lookup_cache_max = v;
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+
+  return 0;
+}
+
+static const struct argp_option options[] = {
+#define STR(X)	XSTR (X)
+#define XSTR(X)	#X
+  { "stat-cache", STAT_CACHE_KEY, "MSEC", 0,
+      "Reuse the status of an underlying file fetched less than MSEC "
+      "milliseconds ago, unless it was changed through this translator.  "
+      "(default: " STR (DEFAULT_STAT_CACHE) ")" },
+  { "lookup-cache", LOOKUP_CACHE_KEY, "N", 0,
+      "Remember the results of up to N lookups in the underlying "
+      "directories which report their changes.  "
+      "(default: " STR (DEFAULT_LOOKUP_CACHE) ", 0 to disable)" },
+  {}
+#undef XSTR
+#undef STR
+};
+
+error_t
+netfs_append_args (char **argz, size_t *argz_len)
+{
+  char buf[80];
+  error_t err = 0;
+
+#define FOPT(fmt, arg) \
+  do { \
+    if (! err) \
+      { \
+	snprintf (buf, sizeof buf, fmt, arg); \
+	err = argz_add (argz, argz_len, buf); \
+      } \
+  } while (0)
+
+  if (stat_cache_ttl != DEFAULT_STAT_CACHE)
+    FOPT ("--stat-cache=%d", stat_cache_ttl);
+  if (lookup_cache_max != DEFAULT_LOOKUP_CACHE)
+    FOPT ("--lookup-cache=%d", lookup_cache_max);
+
+  return err;
+}
+
 int
 main (int argc, char **argv)
 {
   error_t err;
   mach_port_t bootstrap;
 
-  struct argp argp = { .doc = "\
+  struct argp argp = { .options = options, .parser = parse_opt, .doc = "\
 A translator for faking privileged access to an underlying filesystem.\v\
 This translator appears to give transparent access to the underlying \
 directory node.  However, all accesses are made using the credentials \
@@ -1199,7 +1960,7 @@ success for chown and chmod operations that only root could actually do, \
 reporting the faked IDs and modes in later stat calls, and allows \
 any user to open nodes regardless of permissions as is done for root." };
 
-  /* Parse our command line arguments (all none of them).  */
+  /* Parse our command line arguments.  */
   argp_parse (&argp, argc, argv, ARGP_IN_ORDER, 0, 0);
 
   fakeroot_auth_port = getauth ();
@@ -1210,6 +1971,8 @@ any user to open nodes regardless of permissions as is done for root." };
   /* Install our own clean routine.  */
   netfs_protid_class->clean_routine = fakeroot_netfs_release_protid;
 
+  dir_watch_class = ports_create_class (0, 0);
+
   /* Get our underlying node (we presume it's a directory) and use
      that to make the root node of the filesystem.  */
   err = new_node (netfs_startup (bootstrap, O_READ), MACH_PORT_NULL, 0, O_READ,
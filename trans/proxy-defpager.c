@@ -63,6 +63,14 @@ S_default_pager_info (mach_port_t default_pager, default_pager_info_t *info)
     ?: default_pager_info (real_defpager, info);
 }
 
+kern_return_t
+S_default_pager_compressed_info (mach_port_t default_pager,
+				 default_pager_compressed_info_t *info)
+{
+  return allowed (default_pager, O_READ)
+    ?: default_pager_compressed_info (real_defpager, info);
+}
+
 kern_return_t
 S_default_pager_storage_info (mach_port_t default_pager,
 			      vm_size_array_t *size,
@@ -0,0 +1,293 @@
+/* Format the binary traces written by rpctrace --binary.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <mach.h>
+#include <hurd/ihash.h>
+#include <argp.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <version.h>
+
+#include "msgids.h"
+#include "rpctrace-binary.h"
+
+const char *argp_program_version = STANDARD_HURD_VERSION (rpcdecode);
+
+static const struct argp_option options[] =
+{
+  {"summary", 's', 0, 0,
+   "Instead of the messages, print the number of requests and their "
+   "latencies for each message id."},
+  {0}
+};
+
+static const char args_doc[] = "FILE";
+static const char doc[] = "Format a binary trace written by rpctrace.";
+
+static int summary;
+
+/* Print the name of MSGID if it is known, else the number.  */
+static void
+print_msgid (mach_msg_id_t msgid)
+{
+  const struct msgid_info *info = msgid_info (msgid);
+
+  if (info)
+    printf ("%s", info->name);
+  else
+    printf ("%d", (int) msgid);
+}
+
+static void
+print_record (const struct rpctrace_record *rec)
+{
+  printf ("%12.6f ", rec->time / 1e9);
+
+  switch (rec->kind)
+    {
+    case RPCTRACE_REQUEST:
+    case RPCTRACE_SIMPLE:
+    case RPCTRACE_NOTIFY:
+      printf ("%4u->", rec->port);
+      print_msgid (rec->msgid);
+      printf (" (%u bytes", rec->size);
+      if (rec->ool_size)
+	printf (" + %u out-of-line", rec->ool_size);
+      if (rec->kind == RPCTRACE_REQUEST)
+	printf (") ...%u\n", rec->reply_port);
+      else
+	printf (");\n");
+      break;
+
+    case RPCTRACE_REPLY:
+      printf ("%u... ", rec->port);
+      print_msgid (rec->msgid - 100);
+      if (rec->retcode == 0)
+	printf (" = 0");
+      else
+	printf (" = %#x (%s)", rec->retcode, strerror (rec->retcode));
+      printf (" (%u bytes", rec->size);
+      if (rec->ool_size)
+	printf (" + %u out-of-line", rec->ool_size);
+      printf (") in %.1fus\n", rec->latency / 1e3);
+      break;
+
+    default:
+      printf ("bad record kind %u\n", rec->kind);
+      break;
+    }
+}
+
+/* Statistics for one message id.  */
+struct msgid_stats
+{
+  mach_msg_id_t msgid;
+  unsigned long requests;	/* Requests and simple messages.  */
+  unsigned long replies;
+  unsigned long errors;		/* Replies with a nonzero return code.  */
+  uint64_t total_latency;
+  uint64_t max_latency;
+};
+
+static struct hurd_ihash stats_ihash
+  = HURD_IHASH_INITIALIZER (HURD_IHASH_NO_LOCP);
+
+static struct msgid_stats *
+stats_for (mach_msg_id_t msgid)
+{
+  struct msgid_stats *stats = hurd_ihash_find (&stats_ihash, msgid);
+
+  if (stats == NULL)
+    {
+      stats = calloc (1, sizeof *stats);
+      if (stats == NULL)
+	error (1, errno, "calloc");
+      stats->msgid = msgid;
+      if (hurd_ihash_add (&stats_ihash, msgid, stats))
+	error (1, errno, "hurd_ihash_add");
+    }
+  return stats;
+}
+
+static void
+account_record (const struct rpctrace_record *rec)
+{
+  struct msgid_stats *stats;
+
+  if (rec->kind == RPCTRACE_REPLY)
+    {
+      stats = stats_for (rec->msgid - 100);
+      stats->replies++;
+      if (rec->retcode)
+	stats->errors++;
+      stats->total_latency += rec->latency;
+      if (rec->latency > stats->max_latency)
+	stats->max_latency = rec->latency;
+    }
+  else
+    stats_for (rec->msgid)->requests++;
+}
+
+/* Sort by decreasing total latency, then by message id.  */
+static int
+compare_stats (const void *a, const void *b)
+{
+  const struct msgid_stats *x = *(struct msgid_stats *const *) a;
+  const struct msgid_stats *y = *(struct msgid_stats *const *) b;
+
+  if (x->total_latency != y->total_latency)
+    return x->total_latency < y->total_latency ? 1 : -1;
+  return x->msgid < y->msgid ? -1 : x->msgid > y->msgid;
+}
+
+static void
+print_summary (void)
+{
+  struct msgid_stats **all;
+  size_t n = 0, i;
+
+  all = malloc (stats_ihash.nr_items * sizeof *all);
+  if (all == NULL && stats_ihash.nr_items > 0)
+    error (1, errno, "malloc");
+  HURD_IHASH_ITERATE (&stats_ihash, value)
+    all[n++] = value;
+  qsort (all, n, sizeof *all, compare_stats);
+
+  printf ("%-32s %9s %9s %7s %12s %10s %10s\n", "MSGID", "REQUESTS",
+	  "REPLIES", "ERRORS", "TOTAL(us)", "AVG(us)", "MAX(us)");
+  for (i = 0; i < n; i++)
+    {
+      const struct msgid_info *info = msgid_info (all[i]->msgid);
+
+      if (info)
+	printf ("%-32s", info->name);
+      else
+	printf ("%-32d", (int) all[i]->msgid);
+      printf (" %9lu %9lu %7lu %12.1f %10.1f %10.1f\n",
+	      all[i]->requests, all[i]->replies, all[i]->errors,
+	      all[i]->total_latency / 1e3,
+	      all[i]->replies
+	      ? all[i]->total_latency / 1e3 / all[i]->replies : 0.0,
+	      all[i]->max_latency / 1e3);
+    }
+  free (all);
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *file = 0;
+  const struct rpctrace_header *hdr;
+  const struct rpctrace_record *records;
+  uint64_t head, first, i;
+  struct stat st;
+  void *addr;
+  int fd;
+
+  error_t parse_opt (int key, char *arg, struct argp_state *state)
+    {
+      switch (key)
+	{
+	case 's':
+	  summary = 1;
+	  break;
+
+	case ARGP_KEY_ARG:
+	  if (file)
+	    argp_usage (state);
+	  file = arg;
+	  break;
+
+	case ARGP_KEY_NO_ARGS:
+	  argp_usage (state);
+	  return EINVAL;
+
+	default:
+	  return ARGP_ERR_UNKNOWN;
+	}
+      return 0;
+    }
+  const struct argp_child children[] =
+    {
+      { .argp=&msgid_argp, },
+      { 0 }
+    };
+  const struct argp argp = { options, parse_opt, args_doc, doc, children };
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0)
+    error (1, errno, "%s", file);
+  if (fstat (fd, &st) < 0)
+    error (1, errno, "%s", file);
+  if (st.st_size < RPCTRACE_RECORDS_OFFSET)
+    error (1, 0, "%s: Not an rpctrace binary trace", file);
+  addr = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+    error (1, errno, "%s", file);
+  close (fd);
+
+  hdr = addr;
+  if (hdr->magic != RPCTRACE_MAGIC)
+    error (1, 0, "%s: Not an rpctrace binary trace", file);
+  if (hdr->version != RPCTRACE_VERSION
+      || hdr->record_size != sizeof (struct rpctrace_record))
+    error (1, 0, "%s: Unsupported trace version %u", file, hdr->version);
+  if (hdr->nrecords == 0
+      || st.st_size < (RPCTRACE_RECORDS_OFFSET
+		       + (off_t) hdr->nrecords * hdr->record_size))
+    error (1, 0, "%s: Truncated trace", file);
+  records = addr + RPCTRACE_RECORDS_OFFSET;
+
+  /* The trace may still be running; take the records written so far.  */
+  head = __atomic_load_n (&hdr->head, __ATOMIC_ACQUIRE);
+  first = head > hdr->nrecords ? head - hdr->nrecords : 0;
+
+  if (! summary)
+    {
+      time_t start = hdr->start_sec;
+      printf ("Trace started %s", ctime (&start));
+      if (first > 0)
+	printf ("(%llu older records were overwritten)\n",
+		(unsigned long long) first);
+    }
+
+  for (i = first; i < head; i++)
+    {
+      const struct rpctrace_record *rec = &records[i % hdr->nrecords];
+
+      if (summary)
+	account_record (rec);
+      else
+	print_record (rec);
+    }
+
+  if (summary)
+    print_summary ();
+
+  return 0;
+}
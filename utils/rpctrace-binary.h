@@ -0,0 +1,73 @@
+/* Format of the binary traces written by rpctrace --binary.
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _HURD_RPCTRACE_BINARY_H_
+#define _HURD_RPCTRACE_BINARY_H_
+
+#include <stdint.h>
+
+/* A binary trace is a file holding a header followed by a ring of
+   NRECORDS fixed-size records.  rpctrace maps the file and writes
+   record number N into slot N % NRECORDS, so the file always holds the
+   last NRECORDS messages.  HEAD is only advanced once the record is
+   complete, so the file can be read while the trace is running.  */
+
+#define RPCTRACE_MAGIC		0x54435052	/* "RPCT" */
+#define RPCTRACE_VERSION	1
+
+struct rpctrace_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;		/* sizeof (struct rpctrace_record) */
+  uint32_t nrecords;		/* Slots in the ring.  */
+  uint64_t head;		/* Number of records written so far.  */
+  uint64_t start_sec;		/* Wall-clock time the trace started.  */
+  uint64_t start_nsec;
+  uint8_t pad[24];
+};
+
+/* Offset of the first record in the file.  */
+#define RPCTRACE_RECORDS_OFFSET	sizeof (struct rpctrace_header)
+
+/* Kinds of records.  */
+#define RPCTRACE_REQUEST	1	/* A request waiting for a reply.  */
+#define RPCTRACE_SIMPLE		2	/* A message without a reply port.  */
+#define RPCTRACE_NOTIFY		3	/* A kernel notification.  */
+#define RPCTRACE_REPLY		4	/* The reply to a request.  */
+
+struct rpctrace_record
+{
+  uint64_t time;		/* Nanoseconds since the trace started.  */
+  uint64_t latency;		/* For a reply, nanoseconds since the
+				   request; otherwise zero.  */
+  int32_t msgid;
+  uint32_t kind;		/* RPCTRACE_* */
+  uint32_t port;		/* rpctrace's name for the port the message
+				   was sent to: the traced port for a
+				   request, the reply port for a reply.  */
+  uint32_t reply_port;		/* For a request, the reply port, which is
+				   the PORT of the matching reply.  */
+  uint32_t size;		/* Size of the message itself.  */
+  uint32_t ool_size;		/* Bytes of out-of-line data it carries.  */
+  int32_t retcode;		/* For a reply, the return code.  */
+  uint32_t pad;
+};
+
+#endif	/* _HURD_RPCTRACE_BINARY_H_ */
@@ -26,7 +26,9 @@
 #include <mach/message.h>
 #include <assert-backtrace.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <argp.h>
 #include <error.h>
@@ -40,6 +42,7 @@
 #include <envz.h>
 
 #include "msgids.h"
+#include "rpctrace-binary.h"
 
 const char *argp_program_version = STANDARD_HURD_VERSION (rpctrace);
 
@@ -52,6 +55,14 @@ static const struct argp_option options[] =
   {0, 'E', "var[=value]", 0,
    "Set/change (var=value) or remove (var) an environment variable among the "
    "ones inherited by the executed process."},
+  {"binary", 'b', "FILE", 0,
+   "Write a fixed-size binary record for each message to FILE instead of "
+   "printing it; use rpcdecode to format the records."},
+  {"records", 'r', "N", 0,
+   "Keep the last N records in the binary trace (the default is 65536)."},
+  {"msgid", 'm', "ID[-ID]", 0,
+   "Only show or record the messages with the message id ID, or in the "
+   "given range, and their replies.  May be given several times."},
   {0}
 };
 
@@ -102,13 +113,43 @@ msgid_name (mach_msg_id_t msgid)
   return info ? info->name : 0;
 }
 
-/* Return true if this message's data should be printed out.
-   For a request message, that means the in parameters.
-   For a reply messages, that means the return code and out parameters.  */
+/* The message ids given with --msgid; when there are none, all
+   messages are shown.  */
+struct msgid_range
+{
+  mach_msg_id_t first, last;
+};
+
+static struct msgid_range *msgid_ranges;
+static size_t msgid_nranges;
+
+static void
+add_msgid_range (mach_msg_id_t first, mach_msg_id_t last)
+{
+  msgid_ranges = realloc (msgid_ranges,
+			  (msgid_nranges + 1) * sizeof *msgid_ranges);
+  if (msgid_ranges == NULL)
+    error (1, 0, "Fail to allocate memory.");
+  msgid_ranges[msgid_nranges].first = first;
+  msgid_ranges[msgid_nranges].last = last;
+  msgid_nranges++;
+}
+
+/* Return true if the request MSGID should be printed out (or recorded
+   in a binary trace), together with its reply.  Messages that are not
+   shown are still forwarded, and the port rights they carry are still
+   interposed on, so that the RPCs made on those later can be traced.  */
 static int
-msgid_display (const struct msgid_info *info)
+msgid_display (mach_msg_id_t msgid)
 {
-  return 1;
+  size_t i;
+
+  if (msgid_nranges == 0)
+    return 1;
+  for (i = 0; i < msgid_nranges; i++)
+    if (msgid >= msgid_ranges[i].first && msgid <= msgid_ranges[i].last)
+      return 1;
+  return 0;
 }
 
 /* Return true if we should interpose on this RPC's reply port.  If this
@@ -120,6 +161,57 @@ msgid_trace_replies (const struct msgid_info *info)
   return 1;
 }
 
+/* The binary trace given with --binary, mapped in memory, or null when
+   the trace is printed out as text.  */
+static struct rpctrace_header *trace_ring;
+static struct rpctrace_record *trace_records;
+static size_t trace_nrecords = 65536;
+static uint64_t trace_start;
+
+/* Return the time in nanoseconds since some unspecified point.  */
+static uint64_t
+trace_clock (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Create the binary trace FILE, holding TRACE_NRECORDS records, and
+   map it.  */
+static void
+open_binary_trace (const char *file)
+{
+  size_t size = (RPCTRACE_RECORDS_OFFSET
+		 + trace_nrecords * sizeof (struct rpctrace_record));
+  struct timespec now;
+  void *addr;
+  int fd;
+
+  fd = open (file, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    error (1, errno, "%s", file);
+  if (ftruncate (fd, size) < 0)
+    error (1, errno, "%s", file);
+  addr = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+    error (1, errno, "%s", file);
+  close (fd);
+
+  trace_ring = addr;
+  trace_records = addr + RPCTRACE_RECORDS_OFFSET;
+  clock_gettime (CLOCK_REALTIME, &now);
+  trace_start = trace_clock ();
+  trace_ring->magic = RPCTRACE_MAGIC;
+  trace_ring->version = RPCTRACE_VERSION;
+  trace_ring->record_size = sizeof (struct rpctrace_record);
+  trace_ring->nrecords = trace_nrecords;
+  trace_ring->head = 0;
+  trace_ring->start_sec = now.tv_sec;
+  trace_ring->start_nsec = now.tv_nsec;
+}
+
 
 /* A common structure between sender_info and send_once_info */
 struct traced_info
@@ -179,6 +271,9 @@ struct req_info
   mach_port_t reply_port;
   task_t from;
   task_t to;
+  boolean_t display;		/* Show the reply (see msgid_display).  */
+  uint64_t time;		/* When the request was sent, if
+				   recording a binary trace.  */
   struct req_info *next;
 };
 
@@ -186,7 +281,7 @@ static struct req_info *req_head = NULL;
 
 static struct req_info *
 add_request (mach_msg_id_t req_id, mach_port_t reply_port,
-	     task_t from, task_t to)
+	     task_t from, task_t to, boolean_t display)
 {
   struct req_info *req = malloc (sizeof (*req));
   if (!req)
@@ -196,6 +291,8 @@ add_request (mach_msg_id_t req_id, mach_port_t reply_port,
   req->to = to;
   req->reply_port = reply_port;
   req->is_req = TRUE;
+  req->display = display;
+  req->time = display && trace_ring ? trace_clock () : 0;
 
   req->next = req_head;
   req_head = req;
@@ -798,15 +895,17 @@ rewrite_right (mach_port_t *right, mach_msg_type_name_t *type,
   return 0;
 }
 
-static void
+/* Process the message data, wrapping ports and, if PRINT, printing
+   data.  Return the number of bytes of out-of-line data.  */
+static size_t
 print_contents (mach_msg_header_t *inp,
-		void *msg_buf_ptr, struct req_info *req)
+		void *msg_buf_ptr, struct req_info *req, int print)
 {
   error_t err;
+  size_t ool_size = 0;
 
   int first = 1;
 
-  /* Process the message data, wrapping ports and printing data.  */
   while (msg_buf_ptr < (void *) inp + inp->msgh_size)
     {
       mach_msg_type_t *const type = msg_buf_ptr;
@@ -837,6 +936,7 @@ print_contents (mach_msg_header_t *inp,
 	     contains a pointer to a vm_allocate'd region of data.  */
 	  data = *(void **) data;
 	  msg_buf_ptr += sizeof (void *);
+	  ool_size += nelt * eltsize;
 	}
       else
 	msg_buf_ptr += ((nelt * eltsize + sizeof(natural_t) - 1)
@@ -844,7 +944,7 @@ print_contents (mach_msg_header_t *inp,
 
       if (first)
 	first = 0;
-      else
+      else if (print)
 	putc (' ', ostream);
 
       /* Note that MACH_MSG_TYPE_PORT_NAME does not indicate a port right.
@@ -872,6 +972,12 @@ print_contents (mach_msg_header_t *inp,
 
 	      str = rewrite_right (&portnames[i], &newtypes[i], req);
 
+	      if (i > 0 && newtypes[i] != newtypes[0])
+		poly = 1;
+
+	      if (!print)
+		continue;
+
 	      putc ((i == 0 && nelt > 1) ? '{' : ' ', ostream);
 
 	      if (portnames[i] == MACH_PORT_NULL)
@@ -885,10 +991,8 @@ print_contents (mach_msg_header_t *inp,
 		  else
 		    fprintf (ostream, "%3u", (unsigned int) portnames[i]);
 		}
-	      if (i > 0 && newtypes[i] != newtypes[0])
-		poly = 1;
 	    }
-	  if (nelt > 1)
+	  if (print && nelt > 1)
 	    putc ('}', ostream);
 
 	  if (poly)
@@ -947,9 +1051,11 @@ print_contents (mach_msg_header_t *inp,
 		type->msgt_name = newtypes[0];
 	    }
 	}
-      else
+      else if (print)
 	print_data (name, data, nelt, eltsize);
     }
+
+  return ool_size;
 }
 
 /* Wrap all thread ports in the task */
@@ -1086,6 +1192,43 @@ wrap_new_task (mach_msg_header_t *inp, struct req_info *req)
   ports_port_deref (task_wrapper1);
 }
 
+/* Append a record of KIND for the message INP, sent to the port
+   wrapped by INFO, to the binary trace.  REQ is the request a reply
+   answers.  */
+static void
+record_message (uint32_t kind, const mach_msg_header_t *inp,
+		struct traced_info *info, size_t ool_size,
+		const struct req_info *req)
+{
+  uint64_t head = trace_ring->head;
+  struct rpctrace_record *rec = &trace_records[head % trace_nrecords];
+
+  rec->time = trace_clock ();
+  rec->msgid = inp->msgh_id;
+  rec->kind = kind;
+  rec->port = info->pi.port_right;
+  rec->size = inp->msgh_size;
+  rec->ool_size = ool_size;
+  rec->pad = 0;
+  if (kind == RPCTRACE_REPLY)
+    {
+      rec->latency = rec->time - req->time;
+      rec->reply_port = MACH_PORT_NULL;
+      rec->retcode = ((const mig_reply_header_t *) inp)->RetCode;
+    }
+  else
+    {
+      rec->latency = 0;
+      rec->reply_port = inp->msgh_local_port;
+      rec->retcode = 0;
+    }
+  rec->time -= trace_start;
+
+  /* Make the record visible to readers of the file only once it is
+     complete.  */
+  __atomic_store_n (&trace_ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
 /* Returns true if the given message is a Mach notification.  */
 static inline int
 is_notification (const mach_msg_header_t *InHeadP)
@@ -1270,86 +1413,107 @@ trace_and_forward (mach_msg_header_t *inp, mach_msg_header_t *outp)
   /* The message now appears as it would if we were the sender.
      It is ready to be resent.  */
 
-  if (msgid_display (msgid))
+  if (inp->msgh_local_port == MACH_PORT_NULL
+      && info->type == MACH_MSG_TYPE_MOVE_SEND_ONCE
+      && inp->msgh_size >= sizeof (mig_reply_header_t)
+      /* The notification message is considered as a request. */
+      && (inp->msgh_id > 72 || inp->msgh_id < 64)
+      && !memcmp(&((mig_reply_header_t *) inp)->RetCodeType,
+		 &RetCodeType, sizeof (RetCodeType)))
     {
-      if (inp->msgh_local_port == MACH_PORT_NULL
-	  && info->type == MACH_MSG_TYPE_MOVE_SEND_ONCE
-	  && inp->msgh_size >= sizeof (mig_reply_header_t)
-	  /* The notification message is considered as a request. */
-	  && (inp->msgh_id > 72 || inp->msgh_id < 64)
-          && !memcmp(&((mig_reply_header_t *) inp)->RetCodeType,
-                     &RetCodeType, sizeof (RetCodeType)))
+      struct req_info *req = remove_request (inp->msgh_id - 100,
+					     inp->msgh_remote_port);
+      assert_backtrace (req);
+      req->is_req = FALSE;
+      /* This sure looks like an RPC reply message.  */
+      mig_reply_header_t *rh = (void *) inp;
+      int print = req->display && !trace_ring;
+      size_t ool_size = 0;
+
+      if (print)
 	{
-	  struct req_info *req = remove_request (inp->msgh_id - 100,
-						 inp->msgh_remote_port);
-	  assert_backtrace (req);
-	  req->is_req = FALSE;
-	  /* This sure looks like an RPC reply message.  */
-	  mig_reply_header_t *rh = (void *) inp;
 	  print_reply_header ((struct send_once_info *) info, rh, req);
 	  putc (' ', ostream);
 	  fflush (ostream);
-	  print_contents (&rh->Head, rh + 1, req);
-	  putc ('\n', ostream);
-
-	  if (inp->msgh_id == 2161)/* the reply message for thread_create */
-	    wrap_new_thread (inp, req);
-	  else if (inp->msgh_id == 2107) /* for task_create */
-	    wrap_new_task (inp, req);
+	}
+      /* Only complex messages have port rights to interpose on.  */
+      if (print || complex)
+	ool_size = print_contents (&rh->Head, rh + 1, req, print);
+      if (print)
+	putc ('\n', ostream);
+      else if (req->display)
+	record_message (RPCTRACE_REPLY, inp, info, ool_size, req);
+
+      if (inp->msgh_id == 2161)/* the reply message for thread_create */
+	wrap_new_thread (inp, req);
+      else if (inp->msgh_id == 2107) /* for task_create */
+	wrap_new_task (inp, req);
+
+      free (req);
+    }
+  else
+    {
+      struct task_info *task_info;
+      task_t to = 0;
+      struct req_info *req = NULL;
+      int display = msgid_display (inp->msgh_id);
+      int print = display && !trace_ring;
+      size_t ool_size = 0;
+
+      /* Print something about the message header.  */
+      if (print)
+	print_request_header ((struct sender_info *) info, inp);
+      /* It's a notification message. */
+      if (inp->msgh_id <= 72 && inp->msgh_id >= 64)
+	{
+	  assert_backtrace (info->type == MACH_MSG_TYPE_MOVE_SEND_ONCE);
+	  /* mach_notify_port_destroyed message has a port,
+	   * TODO how do I handle it? */
+	  assert_backtrace (inp->msgh_id != 69);
+	}
 
+      /* If it's mach_port RPC,
+       * the port rights in the message will be moved to the target task. */
+      else if (inp->msgh_id >= 3200 && inp->msgh_id <= 3218)
+	to = SEND_INFO (info)->receive_right->forward;
+      else
+	to = SEND_INFO (info)->receive_right->task;
+      if (info->type == MACH_MSG_TYPE_MOVE_SEND)
+	req = add_request (inp->msgh_id, reply_port,
+			   SEND_INFO (info)->task, to, display);
+
+      /* If it's the notification message, req is NULL.
+       * TODO again, it's difficult to handle mach_notify_port_destroyed */
+      if (print || complex)
+	ool_size = print_contents (inp, inp + 1, req, print);
+      if (display && trace_ring)
+	record_message (inp->msgh_id <= 72 && inp->msgh_id >= 64
+			? RPCTRACE_NOTIFY
+			: inp->msgh_local_port == MACH_PORT_NULL
+			? RPCTRACE_SIMPLE : RPCTRACE_REQUEST,
+			inp, info, ool_size, NULL);
+      if (inp->msgh_local_port == MACH_PORT_NULL) /* simpleroutine */
+	{
+	  /* If it's a simpleroutine,
+	   * we don't need the request information any more. */
+	  req = remove_request (inp->msgh_id, reply_port);
 	  free (req);
+	  if (print)
+	    fprintf (ostream, ");\n");
 	}
-      else
+      else if (print)
+	/* Leave a partial line that will be finished later.  */
+	fprintf (ostream, ")");
+      if (print)
+	fflush (ostream);
+
+      /* If it's the first request from the traced task,
+       * wrap the all threads in the task. */
+      task_info = hurd_ihash_find (&task_ihash, SEND_INFO (info)->task);
+      if (task_info && !task_info->threads_wrapped)
 	{
-	  struct task_info *task_info;
-	  task_t to = 0;
-	  struct req_info *req = NULL;
-
-	  /* Print something about the message header.  */
-	  print_request_header ((struct sender_info *) info, inp);
-	  /* It's a notification message. */
-	  if (inp->msgh_id <= 72 && inp->msgh_id >= 64)
-	    {
-	      assert_backtrace (info->type == MACH_MSG_TYPE_MOVE_SEND_ONCE);
-	      /* mach_notify_port_destroyed message has a port,
-	       * TODO how do I handle it? */
-	      assert_backtrace (inp->msgh_id != 69);
-	    }
-
-	  /* If it's mach_port RPC,
-	   * the port rights in the message will be moved to the target task. */
-	  else if (inp->msgh_id >= 3200 && inp->msgh_id <= 3218)
-	    to = SEND_INFO (info)->receive_right->forward;
-	  else
-	    to = SEND_INFO (info)->receive_right->task;
-	  if (info->type == MACH_MSG_TYPE_MOVE_SEND)
-	    req = add_request (inp->msgh_id, reply_port,
-			       SEND_INFO (info)->task, to);
-
-	  /* If it's the notification message, req is NULL.
-	   * TODO again, it's difficult to handle mach_notify_port_destroyed */
-	  print_contents (inp, inp + 1, req);
-	  if (inp->msgh_local_port == MACH_PORT_NULL) /* simpleroutine */
-	    {
-	      /* If it's a simpleroutine,
-	       * we don't need the request information any more. */
-	      req = remove_request (inp->msgh_id, reply_port);
-	      free (req);
-	      fprintf (ostream, ");\n");
-	    }
-	  else
-	    /* Leave a partial line that will be finished later.  */
-	    fprintf (ostream, ")");
-	  fflush (ostream);
-
-	  /* If it's the first request from the traced task,
-	   * wrap the all threads in the task. */
-	  task_info = hurd_ihash_find (&task_ihash, SEND_INFO (info)->task);
-	  if (task_info && !task_info->threads_wrapped)
-	    {
-	      wrap_all_threads (SEND_INFO (info)->task);
-	      task_info->threads_wrapped = TRUE;
-	    }
+	  wrap_all_threads (SEND_INFO (info)->task);
+	  task_info->threads_wrapped = TRUE;
 	}
     }
 
@@ -1683,6 +1847,7 @@ int
 main (int argc, char **argv, char **envp)
 {
   const char *outfile = 0;
+  const char *binfile = 0;
   char **cmd_argv = 0;
   pthread_t thread;
   error_t err;
@@ -1703,6 +1868,40 @@ main (int argc, char **argv, char **envp)
 	  strsize = atoi (arg);
 	  break;
 
+	case 'b':
+	  binfile = arg;
+	  break;
+
+	case 'r':
+	  {
+	    char *end;
+	    unsigned long n;
+
+	    errno = 0;
+	    n = strtoul (arg, &end, 0);
+	    if (strchr (arg, '-') || *end != '\0' || end == arg || errno
+		|| n == 0
+		|| n > ((SIZE_MAX - RPCTRACE_RECORDS_OFFSET)
+			/ sizeof (struct rpctrace_record)))
+	      argp_error (state, "Invalid number of records: %s", arg);
+	    trace_nrecords = n;
+	  }
+	  break;
+
+	case 'm':
+	  {
+	    char *end;
+	    long first, last;
+
+	    first = last = strtol (arg, &end, 0);
+	    if (*end == '-')
+	      last = strtol (end + 1, &end, 0);
+	    if (end == arg || *end != '\0' || last < first)
+	      argp_error (state, "Invalid message id range: %s", arg);
+	    add_msgid_range (first, last);
+	  }
+	  break;
+
 	case 'E':
 	  if (envz == NULL)
 	    {
@@ -1769,6 +1968,9 @@ main (int argc, char **argv, char **envp)
     ostream = stderr;
   setlinebuf (ostream);
 
+  if (binfile)
+    open_binary_trace (binfile);
+
   traced_bucket = ports_create_bucket ();
   traced_class = ports_create_class (&traced_clean, NULL);
   other_class = ports_create_class (0, 0);